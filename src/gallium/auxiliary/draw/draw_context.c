@@ -1122,6 +1122,29 @@ draw_set_sampler_views(struct draw_context *draw,
    draw->num_sampler_views[shader_stage] = num;
 }
 
+/**
+ * Tell which of the sampler views sample textures stored in the tiled
+ * layout, for drivers which use it.
+ */
+void
+draw_set_tiled_sampler_views(struct draw_context *draw,
+                             enum pipe_shader_type shader_stage,
+                             const boolean *tiled,
+                             unsigned num)
+{
+   unsigned i;
+
+   debug_assert(shader_stage < PIPE_SHADER_TYPES);
+   debug_assert(num <= PIPE_MAX_SHADER_SAMPLER_VIEWS);
+
+   draw_do_flush( draw, DRAW_FLUSH_STATE_CHANGE );
+
+   for (i = 0; i < num; ++i)
+      draw->sampler_views_tiled[shader_stage][i] = tiled[i];
+   for (; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; ++i)
+      draw->sampler_views_tiled[shader_stage][i] = FALSE;
+}
+
 void
 draw_set_samplers(struct draw_context *draw,
                   enum pipe_shader_type shader_stage,
@@ -2428,6 +2428,8 @@ draw_llvm_make_variant_key(struct draw_llvm *llvm, char *store)
    for (i = 0 ; i < key->nr_sampler_views; i++) {
       lp_sampler_static_texture_state(&draw_sampler[i].texture_state,
                                       llvm->draw->sampler_views[PIPE_SHADER_VERTEX][i]);
+      draw_sampler[i].texture_state.tiled =
+         llvm->draw->sampler_views_tiled[PIPE_SHADER_VERTEX][i];
    }
 
    draw_image = draw_llvm_variant_key_images(key);
@@ -3020,6 +3022,8 @@ draw_gs_llvm_make_variant_key(struct draw_llvm *llvm, char *store)
    for (i = 0 ; i < key->nr_sampler_views; i++) {
       lp_sampler_static_texture_state(&draw_sampler[i].texture_state,
                                       llvm->draw->sampler_views[PIPE_SHADER_GEOMETRY][i]);
+      draw_sampler[i].texture_state.tiled =
+         llvm->draw->sampler_views_tiled[PIPE_SHADER_GEOMETRY][i];
    }
 
    draw_image = draw_gs_llvm_variant_key_images(key);
@@ -3676,6 +3680,8 @@ draw_tcs_llvm_make_variant_key(struct draw_llvm *llvm, char *store)
    for (i = 0 ; i < key->nr_sampler_views; i++) {
       lp_sampler_static_texture_state(&draw_sampler[i].texture_state,
                                       llvm->draw->sampler_views[PIPE_SHADER_TESS_CTRL][i]);
+      draw_sampler[i].texture_state.tiled =
+         llvm->draw->sampler_views_tiled[PIPE_SHADER_TESS_CTRL][i];
    }
 
    draw_image = draw_tcs_llvm_variant_key_images(key);
@@ -4187,6 +4193,8 @@ draw_tes_llvm_make_variant_key(struct draw_llvm *llvm, char *store)
    for (i = 0 ; i < key->nr_sampler_views; i++) {
       lp_sampler_static_texture_state(&draw_sampler[i].texture_state,
                                       llvm->draw->sampler_views[PIPE_SHADER_TESS_EVAL][i]);
+      draw_sampler[i].texture_state.tiled =
+         llvm->draw->sampler_views_tiled[PIPE_SHADER_TESS_EVAL][i];
    }
 
    draw_image = draw_tes_llvm_variant_key_images(key);
@@ -146,7 +146,7 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddCoroElidePass(gallivm->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0 && !gallivm->no_opt) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -265,7 +265,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if ((gallivm_perf & GALLIVM_PERF_NO_OPT) || gallivm->no_opt) {
          optlevel = None;
       }
       else {
@@ -525,6 +525,31 @@ gallivm_create(const char *name, LLVMContextRef context,
 }
 
 
+/**
+ * Create a new gallivm_state object whose code is generated without the
+ * optimization passes and at codegen level None, as with GALLIVM_PERF=nopt.
+ * This is much quicker to build, for code which is replaced by an
+ * optimized version later.  There is no on-disk caching of such code.
+ */
+struct gallivm_state *
+gallivm_create_unoptimized(const char *name, LLVMContextRef context)
+{
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      gallivm->no_opt = TRUE;
+      if (!init_gallivm_state(gallivm, name, context, NULL)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   assert(gallivm != NULL);
+   return gallivm;
+}
+
+
 /**
  * Destroy a gallivm_state object.
  */
@@ -725,6 +750,18 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    return jit_func;
 }
 
+
+/**
+ * Return the number of bytes of machine code and data the JIT allocated
+ * for this gallivm, once its functions have been jitted.  This stays
+ * valid after gallivm_free_ir().
+ */
+size_t
+gallivm_get_code_size(const struct gallivm_state *gallivm)
+{
+   return gallivm->code ? lp_get_generated_code_size(gallivm->code) : 0;
+}
+
 unsigned gallivm_get_perf_flags(void)
 {
    return gallivm_perf;
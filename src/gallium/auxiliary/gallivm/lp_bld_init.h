@@ -54,6 +54,7 @@ struct gallivm_state
    struct lp_generated_code *code;
    struct lp_cached_code *cache;
    unsigned compiled;
+   boolean no_opt;    /**< skip the optimizations, see gallivm_create_unoptimized() */
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
    LLVMValueRef debug_printf_hook;
@@ -68,6 +69,9 @@ struct gallivm_state *
 gallivm_create(const char *name, LLVMContextRef context,
                struct lp_cached_code *cache);
 
+struct gallivm_state *
+gallivm_create_unoptimized(const char *name, LLVMContextRef context);
+
 void
 gallivm_destroy(struct gallivm_state *gallivm);
 
@@ -85,6 +89,9 @@ func_pointer
 gallivm_jit_function(struct gallivm_state *gallivm,
                      LLVMValueRef func);
 
+size_t
+gallivm_get_code_size(const struct gallivm_state *gallivm);
+
 unsigned gallivm_get_perf_flags(void);
 
 #ifdef __cplusplus
@@ -246,9 +246,11 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
       typedef std::vector<void *> Vec;
       Vec FunctionBody, ExceptionTable;
       BaseMemoryManager *TheMM;
+      size_t Size; // bytes of code and data sections allocated
 
       GeneratedCode(BaseMemoryManager *MM) {
          TheMM = MM;
+         Size = 0;
       }
 
       ~GeneratedCode() {
@@ -283,6 +285,32 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
          delete (GeneratedCode *) code;
       }
 
+      static size_t getGeneratedCodeSize(const struct lp_generated_code *code) {
+         return ((const GeneratedCode *) code)->Size;
+      }
+
+      virtual uint8_t *allocateCodeSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName) {
+         code->Size += Size;
+         return DelegatingJITMemoryManager::allocateCodeSection(Size, Alignment,
+                                                                SectionID,
+                                                                SectionName);
+      }
+
+      virtual uint8_t *allocateDataSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName,
+                                           bool IsReadOnly) {
+         code->Size += Size;
+         return DelegatingJITMemoryManager::allocateDataSection(Size, Alignment,
+                                                                SectionID,
+                                                                SectionName,
+                                                                IsReadOnly);
+      }
+
       virtual void deallocateFunctionBody(void *Body) {
          // remember for later deallocation
          code->FunctionBody.push_back(Body);
@@ -562,6 +590,13 @@ lp_free_generated_code(struct lp_generated_code *code)
    ShaderMemoryManager::freeGeneratedCode(code);
 }
 
+extern "C"
+size_t
+lp_get_generated_code_size(const struct lp_generated_code *code)
+{
+   return ShaderMemoryManager::getGeneratedCodeSize(code);
+}
+
 extern "C"
 LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager()
@@ -77,6 +77,9 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
 extern void
 lp_free_generated_code(struct lp_generated_code *code);
 
+extern size_t
+lp_get_generated_code_size(const struct lp_generated_code *code);
+
 extern LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager();
 
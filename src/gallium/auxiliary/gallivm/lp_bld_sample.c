@@ -2060,6 +2060,49 @@ lp_build_sample_partial_offset(struct lp_build_context *bld,
 }
 
 
+/**
+ * Partial offset of a texel of a tiled texture along the x or y axis,
+ * see lp_tiled_texel_offset().  The x and y partial offsets of a texel
+ * simply add up, as they occupy different bits of the Morton index.
+ *
+ * @param axis          0 for x, 1 for y
+ * @param texel_size    texel size in bytes
+ * @param coord         texel coordinate along the axis
+ * @param stride        distance between two tiles along the axis, in bytes
+ * @param out_offset    resulting relative offset of the texel in bytes
+ */
+void
+lp_build_sample_tiled_partial_offset(struct lp_build_context *bld,
+                                     unsigned axis,
+                                     unsigned texel_size,
+                                     LLVMValueRef coord,
+                                     LLVMValueRef stride,
+                                     LLVMValueRef *out_offset)
+{
+   LLVMBuilderRef builder = bld->gallivm->builder;
+   LLVMValueRef one = lp_build_const_int_vec(bld->gallivm, bld->type, 1);
+   LLVMValueRef two = lp_build_const_int_vec(bld->gallivm, bld->type, 2);
+   LLVMValueRef tile, lo, hi, morton;
+
+   assert(axis < 2);
+   assert(LP_TEXTURE_TILE_SIZE == 4);
+
+   tile = LLVMBuildLShr(builder, coord, two, "");
+
+   /* Spread the two low coordinate bits to the even (x) or odd (y) bits */
+   lo = LLVMBuildAnd(builder, coord, one, "");
+   hi = LLVMBuildAnd(builder, coord, two, "");
+   hi = LLVMBuildShl(builder, hi, one, "");
+   morton = LLVMBuildOr(builder, lo, hi, "");
+   if (axis)
+      morton = LLVMBuildShl(builder, morton, one, "");
+
+   *out_offset = lp_build_add(bld,
+                              lp_build_mul(bld, tile, stride),
+                              lp_build_mul_imm(bld, morton, texel_size));
+}
+
+
 /**
  * Compute the offset of a pixel block.
  *
@@ -2070,6 +2113,7 @@ lp_build_sample_partial_offset(struct lp_build_context *bld,
 void
 lp_build_sample_offset(struct lp_build_context *bld,
                        const struct util_format_description *format_desc,
+                       boolean tiled,
                        LLVMValueRef x,
                        LLVMValueRef y,
                        LLVMValueRef z,
@@ -2079,27 +2123,48 @@ lp_build_sample_offset(struct lp_build_context *bld,
                        LLVMValueRef *out_i,
                        LLVMValueRef *out_j)
 {
+   const unsigned texel_size = format_desc->block.bits/8;
    LLVMValueRef x_stride;
    LLVMValueRef offset;
 
-   x_stride = lp_build_const_vec(bld->gallivm, bld->type,
-                                 format_desc->block.bits/8);
-
-   lp_build_sample_partial_offset(bld,
-                                  format_desc->block.width,
-                                  x, x_stride,
-                                  &offset, out_i);
-
-   if (y && y_stride) {
+   if (tiled) {
       LLVMValueRef y_offset;
-      lp_build_sample_partial_offset(bld,
-                                     format_desc->block.height,
-                                     y, y_stride,
-                                     &y_offset, out_j);
+
+      /* Only formats with 1x1 pixel blocks use the tiled layout */
+      assert(format_desc->block.width == 1);
+      assert(format_desc->block.height == 1);
+      assert(y && y_stride);
+
+      x_stride = lp_build_const_int_vec(bld->gallivm, bld->type,
+                                        texel_size * LP_TEXTURE_TILE_SIZE *
+                                        LP_TEXTURE_TILE_SIZE);
+      lp_build_sample_tiled_partial_offset(bld, 0, texel_size,
+                                           x, x_stride, &offset);
+      lp_build_sample_tiled_partial_offset(bld, 1, texel_size,
+                                           y, y_stride, &y_offset);
       offset = lp_build_add(bld, offset, y_offset);
+      *out_i = bld->zero;
+      *out_j = bld->zero;
    }
    else {
-      *out_j = bld->zero;
+      x_stride = lp_build_const_vec(bld->gallivm, bld->type, texel_size);
+
+      lp_build_sample_partial_offset(bld,
+                                     format_desc->block.width,
+                                     x, x_stride,
+                                     &offset, out_i);
+
+      if (y && y_stride) {
+         LLVMValueRef y_offset;
+         lp_build_sample_partial_offset(bld,
+                                        format_desc->block.height,
+                                        y, y_stride,
+                                        &y_offset, out_j);
+         offset = lp_build_add(bld, offset, y_offset);
+      }
+      else {
+         *out_j = bld->zero;
+      }
    }
 
    if (z && z_stride) {
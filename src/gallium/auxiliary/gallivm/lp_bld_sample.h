@@ -174,6 +174,7 @@ struct lp_static_texture_state
    unsigned pot_height:1;
    unsigned pot_depth:1;
    unsigned level_zero_only:1;
+   unsigned tiled:1;         /**< texels in tiles, see lp_tiled_texel_offset() */
 };
 
 
@@ -501,6 +502,34 @@ apply_sampler_swizzle(struct lp_build_sample_context *bld,
    lp_build_swizzle_soa_inplace(&bld->texel_bld, texel, swizzles);
 }
 
+/**
+ * Tiled texture layout.
+ *
+ * The images of a tiled texture are stored as tiles of LP_TEXTURE_TILE_SIZE
+ * x LP_TEXTURE_TILE_SIZE texels, one after the other in row major order,
+ * with the texels of a tile in Morton order.  The row stride of a tiled
+ * image is the distance between two rows of tiles.
+ */
+#define LP_TEXTURE_TILE_SIZE 4
+
+
+/**
+ * Byte offset of texel (x, y) in a tiled image.
+ */
+static inline unsigned
+lp_tiled_texel_offset(unsigned x, unsigned y,
+                      unsigned row_stride, unsigned texel_size)
+{
+   unsigned morton = (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2;
+   unsigned tile_x = x / LP_TEXTURE_TILE_SIZE;
+   unsigned tile_y = y / LP_TEXTURE_TILE_SIZE;
+
+   return tile_y * row_stride +
+          (tile_x * LP_TEXTURE_TILE_SIZE * LP_TEXTURE_TILE_SIZE + morton) *
+          texel_size;
+}
+
+
 /*
  * not really dimension as such, this indicates the amount of
  * "normal" texture coords subject to minification, wrapping etc.
@@ -664,9 +693,19 @@ lp_build_sample_partial_offset(struct lp_build_context *bld,
                                LLVMValueRef *out_i);
 
 
+void
+lp_build_sample_tiled_partial_offset(struct lp_build_context *bld,
+                                     unsigned axis,
+                                     unsigned texel_size,
+                                     LLVMValueRef coord,
+                                     LLVMValueRef stride,
+                                     LLVMValueRef *out_offset);
+
+
 void
 lp_build_sample_offset(struct lp_build_context *bld,
                        const struct util_format_description *format_desc,
+                       boolean tiled,
                        LLVMValueRef x,
                        LLVMValueRef y,
                        LLVMValueRef z,
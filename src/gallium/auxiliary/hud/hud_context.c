@@ -1384,13 +1384,27 @@ hud_parse_env_var(struct hud_context *hud, struct pipe_screen *screen,
             }
          }
 
-         /* driver queries */
+         /* driver queries, then counters of the state tracker */
          if (!processed) {
             if (!hud_driver_query_install(&hud->batch_query, pane,
                                           screen, name)) {
-               fprintf(stderr, "gallium_hud: unknown driver query '%s'\n", name);
-               fflush(stderr);
-               added = false;
+               const struct hud_frontend_counter *counter = NULL;
+
+               for (i = 0; i < hud->num_frontend_counters; i++) {
+                  if (strcmp(hud->frontend_counters[i].name, name) == 0) {
+                     counter = &hud->frontend_counters[i];
+                     break;
+                  }
+               }
+
+               if (counter) {
+                  hud_frontend_counter_install(pane, counter);
+               }
+               else {
+                  fprintf(stderr, "gallium_hud: unknown driver query '%s'\n", name);
+                  fflush(stderr);
+                  added = false;
+               }
             }
          }
       }
@@ -1513,7 +1527,9 @@ hud_parse_env_var(struct hud_context *hud, struct pipe_screen *screen,
 }
 
 static void
-print_help(struct pipe_screen *screen)
+print_help(struct pipe_screen *screen,
+           const struct hud_frontend_counter *frontend_counters,
+           unsigned num_frontend_counters)
 {
    int i, num_queries, num_cpus = hud_get_num_cpus();
 
@@ -1617,6 +1633,9 @@ print_help(struct pipe_screen *screen)
       }
    }
 
+   for (i = 0; i < num_frontend_counters; i++)
+      printf("    %s\n", frontend_counters[i].name);
+
    puts("");
    fflush(stdout);
 }
@@ -1781,10 +1800,16 @@ hud_set_record_context(struct hud_context *hud, struct pipe_context *pipe)
  * according to the environment variable, and return "share".
  * This allows sharing the HUD instance within a multi-context share group,
  * record queries in one context and draw them in another.
+ *
+ * "frontend_counters" are the counters of the state tracker GALLIUM_HUD can
+ * select, they must stay valid as long as the HUD is used.  A shared HUD
+ * keeps those of the context which created it.
  */
 struct hud_context *
 hud_create(struct cso_context *cso, struct st_context_iface *st,
-           struct hud_context *share)
+           struct hud_context *share,
+           const struct hud_frontend_counter *frontend_counters,
+           unsigned num_frontend_counters)
 {
    const char *share_env = debug_get_option("GALLIUM_HUD_SHARE", NULL);
    unsigned record_ctx = 0, draw_ctx = 0;
@@ -1832,7 +1857,7 @@ hud_create(struct cso_context *cso, struct st_context_iface *st,
       return NULL;
 
    if (strcmp(env, "help") == 0) {
-      print_help(screen);
+      print_help(screen, frontend_counters, num_frontend_counters);
       return NULL;
    }
 
@@ -1848,6 +1873,8 @@ hud_create(struct cso_context *cso, struct st_context_iface *st,
    }
 
    hud->refcount = 1;
+   hud->frontend_counters = frontend_counters;
+   hud->num_frontend_counters = num_frontend_counters;
    hud->has_srgb = screen->is_format_supported(screen,
                                                PIPE_FORMAT_B8G8R8A8_SRGB,
                                                PIPE_TEXTURE_2D, 0, 0,
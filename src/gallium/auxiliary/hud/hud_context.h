@@ -28,6 +28,8 @@
 #ifndef HUD_CONTEXT_H
 #define HUD_CONTEXT_H
 
+#include "pipe/p_defines.h"
+
 struct hud_context;
 struct cso_context;
 struct pipe_context;
@@ -35,9 +37,13 @@ struct pipe_resource;
 struct util_queue_monitoring;
 struct st_context_iface;
 
+struct hud_frontend_counter;
+
 struct hud_context *
 hud_create(struct cso_context *cso, struct st_context_iface *st,
-           struct hud_context *share);
+           struct hud_context *share,
+           const struct hud_frontend_counter *frontend_counters,
+           unsigned num_frontend_counters);
 
 void
 hud_destroy(struct hud_context *hud, struct cso_context *cso);
@@ -53,4 +59,18 @@ void
 hud_add_queue_for_monitoring(struct hud_context *hud,
                              struct util_queue_monitoring *queue_info);
 
+/**
+ * A CPU side counter of the state tracker, which can be selected by name
+ * in GALLIUM_HUD when passed to hud_create. The graph shows the average
+ * value per frame.
+ */
+struct hud_frontend_counter {
+   const char *name;
+   enum pipe_driver_query_type type;
+   /* If true, value is a total since the start and the graph shows its
+    * increase, otherwise the graph shows value itself. */
+   bool cumulative;
+   uint64_t value; /* updated by the state tracker */
+};
+
 #endif
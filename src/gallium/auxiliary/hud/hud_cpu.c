@@ -28,6 +28,7 @@
 /* This file contains code for reading CPU load for displaying on the HUD.
  */
 
+#include "hud/hud_context.h"
 #include "hud/hud_private.h"
 #include "util/os_time.h"
 #include "os/os_thread.h"
@@ -466,3 +467,69 @@ void hud_thread_counter_install(struct hud_pane *pane, const char *name,
    hud_pane_add_graph(pane, gr);
    hud_pane_set_max_value(pane, 100);
 }
+
+struct frontend_counter_info {
+   bool initialized;
+   const struct hud_frontend_counter *counter;
+   uint64_t last_value;
+   double results_cumulative;
+   unsigned num_results;
+   int64_t last_time;
+};
+
+static void
+query_frontend_counter(struct hud_graph *gr, struct pipe_context *pipe)
+{
+   struct frontend_counter_info *info = gr->query_data;
+   int64_t now = os_time_get_nano();
+   uint64_t value = info->counter->value;
+
+   if (!info->initialized) {
+      info->last_value = value;
+      info->last_time = now;
+      info->initialized = true;
+      return;
+   }
+
+   if (info->counter->cumulative)
+      info->results_cumulative += value - info->last_value;
+   else
+      info->results_cumulative += value;
+   info->last_value = value;
+   info->num_results++;
+
+   if (info->last_time + gr->pane->period*1000 <= now) {
+      hud_graph_add_value(gr, info->results_cumulative / info->num_results);
+      info->results_cumulative = 0;
+      info->num_results = 0;
+      info->last_time = now;
+   }
+}
+
+void
+hud_frontend_counter_install(struct hud_pane *pane,
+                             const struct hud_frontend_counter *counter)
+{
+   struct hud_graph *gr = CALLOC_STRUCT(hud_graph);
+   struct frontend_counter_info *info;
+
+   if (!gr)
+      return;
+
+   strncpy(gr->name, counter->name, sizeof(gr->name));
+   gr->name[sizeof(gr->name) - 1] = '\0';
+
+   info = CALLOC_STRUCT(frontend_counter_info);
+   if (!info) {
+      FREE(gr);
+      return;
+   }
+   info->counter = counter;
+
+   gr->query_data = info;
+   gr->query_new_value = query_frontend_counter;
+   gr->free_query_data = free_query_data;
+
+   hud_pane_add_graph(pane, gr);
+   pane->type = counter->type;
+}
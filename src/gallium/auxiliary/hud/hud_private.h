@@ -57,6 +57,9 @@ struct hud_context {
 
    struct util_queue_monitoring *monitored_queue;
 
+   const struct hud_frontend_counter *frontend_counters;
+   unsigned num_frontend_counters;
+
    /* states */
    struct pipe_blend_state no_blend, alpha_blend;
    struct pipe_depth_stencil_alpha_state dsa;
@@ -164,6 +167,8 @@ void hud_cpu_graph_install(struct hud_pane *pane, unsigned cpu_index);
 void hud_thread_busy_install(struct hud_pane *pane, const char *name, bool main);
 void hud_thread_counter_install(struct hud_pane *pane, const char *name,
                                 enum hud_counter counter);
+void hud_frontend_counter_install(struct hud_pane *pane,
+                                  const struct hud_frontend_counter *counter);
 void hud_pipe_query_install(struct hud_batch_query_context **pbq,
                             struct hud_pane *pane,
                             const char *name,
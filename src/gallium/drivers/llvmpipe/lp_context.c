@@ -60,6 +60,8 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
 
    lp_print_counters();
 
+   llvmpipe_remove_variants(llvmpipe);
+
    if (llvmpipe->csctx) {
       lp_csctx_destroy(llvmpipe->csctx);
    }
@@ -107,6 +109,8 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
 #endif
    llvmpipe->context = NULL;
 
+   p_atomic_dec(&llvmpipe_screen(pipe->screen)->num_contexts);
+
    align_free( llvmpipe );
 }
 
@@ -196,6 +200,10 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe->pipe.screen = screen;
    llvmpipe->pipe.priv = priv;
 
+   p_atomic_inc(&llvmpipe_screen(screen)->num_contexts);
+   llvmpipe->texture_layouts =
+      p_atomic_read(&llvmpipe_screen(screen)->texture_layouts);
+
    /* Init the pipe context methods */
    llvmpipe->pipe.destroy = llvmpipe_destroy;
    llvmpipe->pipe.set_framebuffer_state = llvmpipe_set_framebuffer_state;
@@ -150,6 +150,7 @@ struct llvmpipe_context {
    struct blitter_context *blitter;
 
    unsigned tex_timestamp;
+   unsigned texture_layouts;
 
    /** List of all fragment shader variants */
    struct lp_fs_variant_list_item fs_variants_list;
@@ -163,6 +164,12 @@ struct llvmpipe_context {
    struct lp_cs_variant_list_item cs_variants_list;
    unsigned nr_cs_variants;
    unsigned nr_cs_instrs;
+
+   /** Bytes of JIT code and data of all the variants above */
+   uint64_t variant_code_size;
+
+   /** Bumped whenever a variant is bound, orders them for LRU eviction */
+   uint64_t variant_timestamp;
    struct lp_cs_context *csctx;
 
    /** Conditional query object and mode */
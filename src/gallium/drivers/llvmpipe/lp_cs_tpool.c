@@ -77,6 +77,14 @@ lp_cs_tpool_create(unsigned num_threads)
    if (!pool)
       return NULL;
 
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(thrd_t));
+      if (!pool->threads) {
+         FREE(pool);
+         return NULL;
+      }
+   }
+
    (void) mtx_init(&pool->m, mtx_plain);
    cnd_init(&pool->new_work);
 
@@ -105,6 +113,7 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -39,6 +39,7 @@
 #include "lp_context.h"
 #include "lp_state.h"
 #include "lp_query.h"
+#include "lp_setup.h"
 
 #include "draw/draw_context.h"
 
@@ -72,6 +73,8 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
       return;
    }
 
+   llvmpipe_check_texture_layouts(lp);
+
    if (lp->dirty)
       llvmpipe_update_derived( lp );
 
@@ -171,6 +174,9 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
     * internally when this condition is seen?)
     */
    draw_flush(draw);
+
+   /* Set up the triangles batched by this draw, with its state */
+   lp_setup_flush_batch(lp->setup);
 }
 
 
@@ -66,28 +66,34 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 16
+/**
+ * Upper bound for the number of rasterizer and compute threads.  The
+ * per-thread state is allocated at runtime for the actual thread count,
+ * this only bounds LP_NUM_THREADS.
+ */
+#define LP_MAX_THREADS 256
 
 
 /**
- * Max bytes per scene.  This may be replaced by a runtime parameter.
+ * Upper bound for the per-scene memory budget (LP_SCENE_SIZE).
  */
 #define LP_MAX_SCENE_SIZE (512 * 1024 * 1024)
 
 /**
- * Max number of shader variants (for all shaders combined,
- * per context) that will be kept around.
+ * Upper bound for the number of scenes per context (LP_NUM_SCENES).
  */
-#define LP_MAX_SHADER_VARIANTS 1024
+#define LP_MAX_SCENES 16
 
 /**
- * Max number of instructions (for all fragment shaders combined per context)
- * that will be kept around (counted in terms of llvm ir).
+ * Default budget, in bytes of JIT code and data, for the fragment, compute
+ * and setup variants kept around per context (LP_VARIANT_CACHE_SIZE).
+ * The least recently used variants are evicted beyond it.
  */
-#define LP_MAX_SHADER_INSTRUCTIONS (2048 * LP_MAX_SHADER_VARIANTS)
+#define LP_DEFAULT_VARIANT_CACHE_SIZE (64 * 1024 * 1024)
 
 /**
- * Max number of setup variants that will be kept around.
+ * Max number of setup variants that will be kept around, as they are
+ * looked up linearly.  They also count against the variant cache budget.
  *
  * These are determined by the combination of the fragment shader
  * input signature and a small amount of rasterization state (eg
@@ -33,6 +33,7 @@
 #include "draw/draw_context.h"
 #include "pipe/p_defines.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
 #include "util/os_time.h"
 #include "lp_context.h"
 #include "lp_flush.h"
@@ -53,15 +54,22 @@ llvmpipe_create_query(struct pipe_context *pipe,
                       unsigned type,
                       unsigned index)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   unsigned num_threads = MAX2(1, screen->num_threads);
    struct llvmpipe_query *pq;
 
-   assert(type < PIPE_QUERY_TYPES);
+   assert(type < PIPE_QUERY_TYPES || type >= PIPE_QUERY_DRIVER_SPECIFIC);
 
-   pq = CALLOC_STRUCT( llvmpipe_query );
+   /* The per-thread counters are allocated along with the query */
+   pq = CALLOC(1, sizeof(struct llvmpipe_query) +
+                  2 * num_threads * sizeof(uint64_t));
 
    if (pq) {
       pq->type = type;
       pq->index = index;
+      pq->num_threads = num_threads;
+      pq->start = (uint64_t *)(pq + 1);
+      pq->end = pq->start + num_threads;
    }
 
    return (struct pipe_query *) pq;
@@ -182,6 +190,10 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
       *stats = pq->stats;
    }
       break;
+   case LP_QUERY_VARIANT_CODE_SIZE:
+   case LP_QUERY_NUM_VARIANTS:
+      *result = pq->end[0];
+      break;
    default:
       assert(0);
       break;
@@ -366,6 +378,10 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   /* Driver queries only sample context state at end_query */
+   if (pq->type >= PIPE_QUERY_DRIVER_SPECIFIC)
+      return true;
+
    /* Check if the query is already in the scene.  If so, we need to
     * flush the scene now.  Real apps shouldn't re-use a query in a
     * frame of rendering.
@@ -375,8 +391,8 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    }
 
 
-   memset(pq->start, 0, sizeof(pq->start));
-   memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->start, 0, pq->num_threads * sizeof(pq->start[0]));
+   memset(pq->end, 0, pq->num_threads * sizeof(pq->end[0]));
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -429,6 +445,18 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   switch (pq->type) {
+   case LP_QUERY_VARIANT_CODE_SIZE:
+      pq->end[0] = p_atomic_read(&llvmpipe->variant_code_size);
+      return true;
+   case LP_QUERY_NUM_VARIANTS:
+      pq->end[0] = llvmpipe->nr_fs_variants + llvmpipe->nr_cs_variants +
+                   llvmpipe->nr_setup_variants;
+      return true;
+   default:
+      break;
+   }
+
    lp_setup_end_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -536,6 +564,30 @@ llvmpipe_set_active_query_state(struct pipe_context *pipe, bool enable)
    llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
 }
 
+int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+   static const struct pipe_driver_query_info queries[] = {
+      {"variant-code-size", LP_QUERY_VARIANT_CODE_SIZE, {0},
+       PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE,
+       0, 0},
+      {"num-variants", LP_QUERY_NUM_VARIANTS, {0},
+       PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE,
+       0, 0},
+   };
+
+   if (!info)
+      return ARRAY_SIZE(queries);
+
+   if (index >= ARRAY_SIZE(queries))
+      return 0;
+
+   *info = queries[index];
+   return 1;
+}
+
 void llvmpipe_init_query_funcs(struct llvmpipe_context *llvmpipe )
 {
    llvmpipe->pipe.create_query = llvmpipe_create_query;
@@ -39,11 +39,19 @@
 
 
 struct llvmpipe_context;
+struct pipe_screen;
+struct pipe_driver_query_info;
+
+
+/** Driver specific queries, reporting the state at end_query time */
+#define LP_QUERY_VARIANT_CODE_SIZE   (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define LP_QUERY_NUM_VARIANTS        (PIPE_QUERY_DRIVER_SPECIFIC + 1)
 
 
 struct llvmpipe_query {
-   uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
-   uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   uint64_t *start;                 /* start count value for each thread */
+   uint64_t *end;                   /* end count value for each thread */
+   unsigned num_threads;            /* size of start[] and end[] */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    unsigned type;                   /* PIPE_QUERY_* */
    unsigned index;
@@ -56,6 +64,11 @@ struct llvmpipe_query {
 
 extern void llvmpipe_init_query_funcs(struct llvmpipe_context * );
 
+extern int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info);
+
 extern boolean llvmpipe_check_render_cond(struct llvmpipe_context *);
 
 #endif /* LP_QUERY_H */
@@ -78,10 +78,15 @@ lp_rast_begin( struct lp_rasterizer *rast,
 }
 
 
+/**
+ * Unmap the framebuffer, before the scene fence is signalled.  The scene
+ * itself is released by the setup code once its fence is signalled, see
+ * lp_setup_retire_scene().
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   lp_scene_unmap_framebuffer( rast->curr_scene );
 
    rast->curr_scene = NULL;
 }
@@ -325,6 +330,9 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    }
    variant = state->variant;
 
+   if (variant->linear && lp_rast_linear_shade_tile(task, inputs))
+      return;
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (y = 0; y < task->height; y += 4){
       for (x = 0; x < task->width; x += 4) {
@@ -443,6 +451,12 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    assert((x % 4) == 0);
    assert((y % 4) == 0);
 
+   /* The linear rasterizer only runs single sample variants */
+   if (variant->linear &&
+       (x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height &&
+       lp_rast_linear_shade_quads(task, inputs, x, y, mask & 0xffff))
+      return;
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
@@ -729,11 +743,13 @@ rasterize_scene(struct lp_rasterizer_task *task,
    if (!task->rast->no_rast) {
       /* loop over scene bins, rasterize each */
       {
+         struct lp_scene_bin_iter iter;
          struct cmd_bin *bin;
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
+         lp_scene_bin_iter_init(scene, &iter, task->thread_index);
+         while ((bin = lp_scene_bin_iter_next(scene, &iter, &i, &j))) {
             if (!is_empty_bin( bin ))
                rasterize_bin(task, bin, i, j);
          }
@@ -755,10 +771,7 @@ rasterize_scene(struct lp_rasterizer_task *task,
    }
 #endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
-
+   /* The fence is signalled after lp_rast_end() */
    task->scene = NULL;
 }
 
@@ -787,6 +800,9 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 
       lp_rast_end( rast );
 
+      if (scene->fence)
+         lp_fence_signal(scene->fence);
+
       util_fpstate_set(fpstate);
 
       rast->curr_scene = NULL;
@@ -807,29 +823,12 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
-{
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   }
-   else {
-      int i;
-
-      /* wait for work to complete */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
-}
-
-
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
  *   1. wait for work
  *   2. do work
- *   3. signal that we're done
+ *   3. signal that we're done (through the scene fence)
  */
 static int
 thread_function(void *init_data)
@@ -839,6 +838,7 @@ thread_function(void *init_data)
    boolean debug = false;
    char thread_name[16];
    unsigned fpstate;
+   struct lp_scene *scene;
 
    snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
@@ -871,28 +871,29 @@ thread_function(void *init_data)
        * get a null rast->curr_scene pointer.
        */
       util_barrier_wait( &rast->barrier );
+      scene = rast->curr_scene;
 
       /* do work */
       if (debug)
          debug_printf("thread %d doing work\n", task->thread_index);
 
-      rasterize_scene(task,
-                      rast->curr_scene);
+      rasterize_scene(task, scene);
       
       /* wait for all threads to finish with this scene */
       util_barrier_wait( &rast->barrier );
 
-      /* XXX: shouldn't be necessary:
-       */
       if (task->thread_index == 0) {
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
+      /* The fence is complete once every thread signalled it, thread 0
+       * only does so after unmapping the framebuffer.
+       */
+      if (scene->fence)
+         lp_fence_signal(scene->fence);
+
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
 #ifdef _WIN32
@@ -947,6 +948,12 @@ lp_rast_create( unsigned num_threads )
       goto no_full_scenes;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(struct lp_rasterizer_task));
+   rast->threads = CALLOC(MAX2(1, num_threads), sizeof(thrd_t));
+   if (!rast->tasks || !rast->threads) {
+      goto no_tasks;
+   }
+
    for (i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
@@ -974,11 +981,14 @@ lp_rast_create( unsigned num_threads )
    return rast;
 
 no_thread_data_cache:
-   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
+no_tasks:
+   FREE(rast->tasks);
+   FREE(rast->threads);
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
@@ -1030,6 +1040,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->tasks);
+   FREE(rast->threads);
    FREE(rast);
 }
 
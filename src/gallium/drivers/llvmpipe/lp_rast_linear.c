@@ -0,0 +1,427 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Linear rasterizer.
+ *
+ * Runs the fragment shader variants lp_state_fs_linear.c found eligible
+ * (a single texture lookup written to an 8-bit BGRA/BGRX color buffer)
+ * without the JIT code.  Instead of 4x4 blocks of SoA floats, whole rows
+ * of a tile are sampled and blended as packed 8-bit AoS pixels.  Texture
+ * coordinates are stepped in 16.16 fixed point along the rows, and the
+ * channels are filtered and blended two at a time in the 0x00ff00ff lanes
+ * of a 32-bit word.
+ *
+ * The results may differ from the JIT code by one unit of rounding.
+ */
+
+#include <math.h>
+#include "util/u_math.h"
+#include "lp_debug.h"
+#include "lp_rast.h"
+#include "lp_rast_priv.h"
+#include "lp_state_fs.h"
+
+
+struct linear_sampler
+{
+   const uint8_t *data;
+   unsigned stride;
+   int width, height;
+
+   boolean filter_linear;
+   boolean repeat_s, repeat_t;
+
+   /* Conversion of the texels to BGRA */
+   boolean swap_rb;
+   uint32_t alpha_one;
+
+   /* Texel coordinates at the window origin and their derivatives */
+   float u0, dudx, dudy;
+   float v0, dvdx, dvdy;
+};
+
+
+/* The 16.16 fixed point texel coordinates must not overflow */
+#define LINEAR_MAX_COORD 16384.0f
+
+
+static inline boolean
+coord_in_range(float u0, float dudx, float dudy,
+               int x, int y, unsigned width, unsigned height)
+{
+   /* The coordinates are affine, so the extremes are at the corners */
+   float u = u0 + dudx * x + dudy * y;
+   float du = dudx * (width - 1);
+   float dv = dudy * (height - 1);
+
+   return fabsf(u) < LINEAR_MAX_COORD &&
+          fabsf(u + du) < LINEAR_MAX_COORD &&
+          fabsf(u + dv) < LINEAR_MAX_COORD &&
+          fabsf(u + du + dv) < LINEAR_MAX_COORD;
+}
+
+
+/**
+ * Set up the sampling of the texture coordinates of these inputs in a
+ * width x height rectangle.  Fails when the JIT code must be used.
+ */
+static boolean
+linear_sampler_init(struct linear_sampler *samp,
+                    const struct lp_rasterizer_task *task,
+                    const struct lp_rast_shader_inputs *inputs,
+                    int x, int y, unsigned width, unsigned height)
+{
+   const struct lp_rast_state *state = task->state;
+   const struct lp_fragment_shader_variant *variant = state->variant;
+   const struct lp_fragment_shader *shader = variant->shader;
+   const struct lp_jit_texture *tex = &state->jit_context.textures[0];
+   const struct lp_static_texture_state *texture =
+      &variant->key.samplers[0].texture_state;
+   const struct lp_static_sampler_state *sampler =
+      &variant->key.samplers[0].sampler_state;
+   const struct lp_shader_input *input = &shader->inputs[shader->linear.input];
+   const unsigned slot = input->src_index;
+   const unsigned chan_s = shader->linear.chan[0];
+   const unsigned chan_t = shader->linear.chan[1];
+   float (*a0)[4] = GET_A0(inputs);
+   float (*dadx)[4] = GET_DADX(inputs);
+   float (*dady)[4] = GET_DADY(inputs);
+   const unsigned level = tex->first_level;
+   float scale_s, scale_t, offset;
+   float oow = 1.0f;
+
+   if (!tex->base ||
+       task->scene->fb.nr_cbufs != 1 ||
+       !task->scene->fb.cbufs[0])
+      return FALSE;
+
+   /* The interpolation is affine when w is constant over the primitive */
+   if (input->interp == LP_INTERP_PERSPECTIVE) {
+      if (dadx[0][3] != 0.0f || dady[0][3] != 0.0f || a0[0][3] == 0.0f)
+         return FALSE;
+      oow = 1.0f / a0[0][3];
+   }
+
+   samp->data = (const uint8_t *)tex->base + tex->mip_offsets[level];
+   samp->stride = tex->row_stride[level];
+   samp->width = u_minify(tex->width, level);
+   samp->height = u_minify(tex->height, level);
+
+   samp->filter_linear = sampler->min_img_filter == PIPE_TEX_FILTER_LINEAR;
+   samp->repeat_s = sampler->wrap_s == PIPE_TEX_WRAP_REPEAT;
+   samp->repeat_t = sampler->wrap_t == PIPE_TEX_WRAP_REPEAT;
+
+   samp->swap_rb = texture->format == PIPE_FORMAT_R8G8B8A8_UNORM ||
+                   texture->format == PIPE_FORMAT_R8G8B8X8_UNORM;
+   samp->alpha_one = (!util_format_has_alpha(texture->format) ||
+                      texture->swizzle_a == PIPE_SWIZZLE_1) ? 0xff000000 : 0;
+
+   scale_s = oow;
+   scale_t = oow;
+   if (sampler->normalized_coords) {
+      scale_s *= samp->width;
+      scale_t *= samp->height;
+   }
+
+   /* Bilinear filtering is centered between the texels */
+   offset = samp->filter_linear ? -0.5f : 0.0f;
+
+   samp->u0 = a0[slot][chan_s] * scale_s + offset;
+   samp->dudx = dadx[slot][chan_s] * scale_s;
+   samp->dudy = dady[slot][chan_s] * scale_s;
+   samp->v0 = a0[slot][chan_t] * scale_t + offset;
+   samp->dvdx = dadx[slot][chan_t] * scale_t;
+   samp->dvdy = dady[slot][chan_t] * scale_t;
+
+   return coord_in_range(samp->u0, samp->dudx, samp->dudy,
+                         x, y, width, height) &&
+          coord_in_range(samp->v0, samp->dvdx, samp->dvdy,
+                         x, y, width, height);
+}
+
+
+static inline int
+wrap_coord(int i, int size, boolean repeat)
+{
+   if (repeat) {
+      i %= size;
+      return i < 0 ? i + size : i;
+   }
+   return CLAMP(i, 0, size - 1);
+}
+
+
+static inline uint32_t
+fetch_texel(const struct linear_sampler *samp, int i, int j)
+{
+   return *(const uint32_t *)(samp->data + j * samp->stride + i * 4);
+}
+
+
+/**
+ * Interpolate the four channels of a and b, with a weight from 0 to 256.
+ */
+static inline uint32_t
+lerp_texel(uint32_t a, uint32_t b, unsigned w)
+{
+   uint32_t rb = (a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w;
+   uint32_t ga = ((a >> 8) & 0x00ff00ff) * (256 - w) +
+                 ((b >> 8) & 0x00ff00ff) * w;
+
+   return ((rb >> 8) & 0x00ff00ff) | (ga & 0xff00ff00);
+}
+
+
+/**
+ * Sample the texture for a row of width pixels starting at x, y.
+ */
+static void
+linear_sample_row(const struct linear_sampler *samp,
+                  int x, int y, unsigned width,
+                  uint32_t *texels)
+{
+   const int tex_width = samp->width, tex_height = samp->height;
+   int32_t fu = (int32_t)((samp->u0 + samp->dudx * x + samp->dudy * y) * 65536.0f);
+   int32_t fv = (int32_t)((samp->v0 + samp->dvdx * x + samp->dvdy * y) * 65536.0f);
+   const int32_t dfu = (int32_t)(samp->dudx * 65536.0f);
+   const int32_t dfv = (int32_t)(samp->dvdx * 65536.0f);
+   const int i0 = fu >> 16, j0 = fv >> 16;
+   unsigned k;
+
+   if (dfu == 0x10000 && dfv == 0 &&
+       (!samp->filter_linear || ((fu | fv) & 0xffff) == 0) &&
+       i0 >= 0 && i0 + (int)width <= tex_width &&
+       j0 >= 0 && j0 < tex_height) {
+      /* Unscaled blit, the texels are on the pixel centers */
+      memcpy(texels, samp->data + j0 * samp->stride + i0 * 4, width * 4);
+   }
+   else if (!samp->filter_linear) {
+      for (k = 0; k < width; k++) {
+         int i = wrap_coord(fu >> 16, tex_width, samp->repeat_s);
+         int j = wrap_coord(fv >> 16, tex_height, samp->repeat_t);
+
+         texels[k] = fetch_texel(samp, i, j);
+         fu += dfu;
+         fv += dfv;
+      }
+   }
+   else {
+      for (k = 0; k < width; k++) {
+         int i = fu >> 16, j = fv >> 16;
+         unsigned wu = (fu >> 8) & 0xff, wv = (fv >> 8) & 0xff;
+         int i1 = wrap_coord(i + 1, tex_width, samp->repeat_s);
+         int j1 = wrap_coord(j + 1, tex_height, samp->repeat_t);
+         uint32_t top, bottom;
+
+         i = wrap_coord(i, tex_width, samp->repeat_s);
+         j = wrap_coord(j, tex_height, samp->repeat_t);
+
+         top = lerp_texel(fetch_texel(samp, i, j),
+                          fetch_texel(samp, i1, j), wu);
+         bottom = lerp_texel(fetch_texel(samp, i, j1),
+                             fetch_texel(samp, i1, j1), wu);
+         texels[k] = lerp_texel(top, bottom, wv);
+         fu += dfu;
+         fv += dfv;
+      }
+   }
+
+   if (samp->swap_rb) {
+      for (k = 0; k < width; k++) {
+         uint32_t t = texels[k];
+         texels[k] = (t & 0xff00ff00) |
+                     ((t & 0x00ff0000) >> 16) |
+                     ((t & 0x000000ff) << 16);
+      }
+   }
+
+   if (samp->alpha_one) {
+      for (k = 0; k < width; k++)
+         texels[k] |= samp->alpha_one;
+   }
+}
+
+
+/**
+ * x * f / 255, rounded, for the two channels in the 0x00ff00ff lanes.
+ */
+static inline uint32_t
+mul_lanes(uint32_t x, unsigned f)
+{
+   uint32_t t = x * f + 0x00800080;
+   return ((t + ((t >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+
+/**
+ * Saturated a + b, for the two channels in the 0x00ff00ff lanes.
+ */
+static inline uint32_t
+add_lanes(uint32_t a, uint32_t b)
+{
+   uint32_t sum = a + b;
+   uint32_t overflow = sum & 0x01000100;
+   return (sum | (overflow - (overflow >> 8))) & 0x00ff00ff;
+}
+
+
+static inline uint32_t
+blend_pixel(enum lp_linear_blend blend, uint32_t src, uint32_t dst)
+{
+   const unsigned src_alpha = src >> 24;
+   const unsigned inv_alpha = 255 - src_alpha;
+   uint32_t src_rb = src & 0x00ff00ff;
+   uint32_t src_ga = (src >> 8) & 0x00ff00ff;
+   uint32_t rb, ga;
+
+   switch (blend) {
+   case LP_LINEAR_BLEND_ALPHA:
+      src_rb = mul_lanes(src_rb, src_alpha);
+      src_ga = mul_lanes(src_ga, src_alpha);
+      break;
+   case LP_LINEAR_BLEND_SEPARATE:
+      src_rb = mul_lanes(src_rb, src_alpha);
+      src_ga = (mul_lanes(src_ga, src_alpha) & 0xff) | (src_alpha << 16);
+      break;
+   default:
+      break;
+   }
+
+   rb = add_lanes(src_rb, mul_lanes(dst & 0x00ff00ff, inv_alpha));
+   ga = add_lanes(src_ga, mul_lanes((dst >> 8) & 0x00ff00ff, inv_alpha));
+
+   return rb | (ga << 8);
+}
+
+
+/**
+ * Shade a row of width pixels starting at x, y.  Bit n of mask enables
+ * pixel n.
+ */
+static void
+linear_shade_row(const struct linear_sampler *samp,
+                 enum lp_linear_blend blend,
+                 int x, int y, unsigned width, uint64_t mask,
+                 uint32_t *dst)
+{
+   const uint64_t full_mask = width < 64 ? (1ULL << width) - 1 : ~0ULL;
+   uint32_t texels[TILE_SIZE];
+   unsigned k;
+
+   assert(width <= TILE_SIZE);
+
+   if (blend == LP_LINEAR_BLEND_NONE && (mask & full_mask) == full_mask) {
+      linear_sample_row(samp, x, y, width, dst);
+      return;
+   }
+
+   linear_sample_row(samp, x, y, width, texels);
+
+   for (k = 0; k < width; k++) {
+      uint32_t src = texels[k];
+      unsigned src_alpha = src >> 24;
+
+      if (!(mask & (1ULL << k)))
+         continue;
+
+      /* Opaque texels replace the pixel, transparent ones keep it */
+      if (blend == LP_LINEAR_BLEND_NONE || src_alpha == 0xff)
+         dst[k] = src;
+      else if (src_alpha != 0 ||
+               (blend == LP_LINEAR_BLEND_PREMUL && src != 0))
+         dst[k] = blend_pixel(blend, src, dst[k]);
+   }
+}
+
+
+/**
+ * Shade a whole tile, in rows.
+ */
+boolean
+lp_rast_linear_shade_tile(struct lp_rasterizer_task *task,
+                          const struct lp_rast_shader_inputs *inputs)
+{
+   const struct lp_scene *scene = task->scene;
+   const struct lp_fragment_shader_variant *variant = task->state->variant;
+   struct linear_sampler samp;
+   uint8_t *color;
+   unsigned y;
+
+   if (!linear_sampler_init(&samp, task, inputs,
+                            task->x, task->y, task->width, task->height))
+      return FALSE;
+
+   color = lp_rast_get_color_block_pointer(task, 0, task->x, task->y,
+                                           inputs->layer + inputs->view_index);
+
+   for (y = 0; y < task->height; y++) {
+      linear_shade_row(&samp, variant->linear_blend,
+                       task->x, task->y + y, task->width, ~0ULL,
+                       (uint32_t *)(color + y * scene->cbufs[0].stride));
+   }
+
+   /* The JIT code counts one invocation per 4x4 block */
+   task->thread_data.ps_invocations +=
+      DIV_ROUND_UP(task->width, 4) * DIV_ROUND_UP(task->height, 4);
+
+   return TRUE;
+}
+
+
+/**
+ * Shade a 4x4 block partially covered by a primitive.
+ */
+boolean
+lp_rast_linear_shade_quads(struct lp_rasterizer_task *task,
+                           const struct lp_rast_shader_inputs *inputs,
+                           unsigned x, unsigned y,
+                           unsigned mask)
+{
+   const struct lp_scene *scene = task->scene;
+   const struct lp_fragment_shader_variant *variant = task->state->variant;
+   struct linear_sampler samp;
+   uint8_t *color;
+   unsigned row;
+
+   if (!linear_sampler_init(&samp, task, inputs, x, y, 4, 4))
+      return FALSE;
+
+   color = lp_rast_get_color_block_pointer(task, 0, x, y,
+                                           inputs->layer + inputs->view_index);
+
+   for (row = 0; row < 4; row++) {
+      unsigned row_mask = (mask >> (row * 4)) & 0xf;
+
+      if (row_mask) {
+         linear_shade_row(&samp, variant->linear_blend,
+                          x, y + row, 4, row_mask,
+                          (uint32_t *)(color + row * scene->cbufs[0].stride));
+      }
+   }
+
+   task->thread_data.ps_invocations++;
+
+   return TRUE;
+}
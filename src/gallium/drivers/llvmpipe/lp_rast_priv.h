@@ -121,11 +121,11 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread (at least one) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -142,6 +142,16 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          unsigned x, unsigned y,
                          unsigned mask);
 
+boolean
+lp_rast_linear_shade_tile(struct lp_rasterizer_task *task,
+                          const struct lp_rast_shader_inputs *inputs);
+
+boolean
+lp_rast_linear_shade_quads(struct lp_rasterizer_task *task,
+                           const struct lp_rast_shader_inputs *inputs,
+                           unsigned x, unsigned y,
+                           unsigned mask);
+
 
 /**
  * Get the pointer to a 4x4 color block (within a 64x64 tile).
@@ -240,6 +250,11 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    unsigned depth_sample_stride = 0;
    unsigned i;
 
+   if (variant->linear &&
+       (x % TILE_SIZE) < task->width && (y % TILE_SIZE) < task->height &&
+       lp_rast_linear_shade_quads(task, inputs, x, y, 0xffff))
+      return;
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
@@ -28,6 +28,7 @@
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
 #include "util/u_inlines.h"
 #include "util/simple_list.h"
 #include "util/format/u_format.h"
@@ -58,21 +59,32 @@ struct shader_ref {
 
 /**
  * Create a new scene object.
- * \param queue  the queue to put newly rendered/emptied scenes into
+ * \param num_threads  number of rasterizer threads which will consume it
+ * \param max_size  memory budget of the scene, in bytes
  */
 struct lp_scene *
-lp_scene_create( struct pipe_context *pipe )
+lp_scene_create( struct pipe_context *pipe, unsigned num_threads,
+                 unsigned max_size )
 {
    struct lp_scene *scene = CALLOC_STRUCT(lp_scene);
    if (!scene)
       return NULL;
 
    scene->pipe = pipe;
+   scene->max_size = max_size;
 
    scene->data.head =
       CALLOC_STRUCT(data_block);
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
+   scene->num_bin_queues = MAX2(1, num_threads);
+   scene->bin_queues = align_malloc(scene->num_bin_queues *
+                                    sizeof(struct lp_scene_bin_queue), 64);
+   if (!scene->data.head || !scene->bin_queues) {
+      FREE(scene->data.head);
+      align_free(scene->bin_queues);
+      FREE(scene);
+      return NULL;
+   }
 
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
@@ -83,9 +95,9 @@ lp_scene_create( struct pipe_context *pipe )
       /* We'll need at least one command block per bin.  Make sure that's
        * less than the max allowed scene size.
        */
-      assert(maxCommandBytes < LP_SCENE_MAX_SIZE);
+      assert(maxCommandBytes < scene->max_size);
       /* We'll also need space for at least one other data block */
-      assert(maxCommandPlusData <= LP_SCENE_MAX_SIZE);
+      assert(maxCommandPlusData <= scene->max_size);
    }
 #endif
 
@@ -100,9 +112,9 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_fence_reference(&scene->fence, NULL);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head->next == NULL);
    FREE(scene->data.head);
+   align_free(scene->bin_queues);
    FREE(scene);
 }
 
@@ -215,18 +227,32 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
                                                LP_TEX_USAGE_READ_WRITE);
       scene->zsbuf.format_bytes = util_format_get_blocksize(zsbuf->format);
    }
+
+   /* Wait for the code of the fragment shaders built in the background
+    * (LP_ASYNC_JIT).
+    */
+   {
+      struct shader_ref *ref;
+
+      for (ref = scene->frag_shaders; ref; ref = ref->next) {
+         for (i = 0; i < ref->count; i++)
+            util_queue_fence_wait(&ref->variant[i]->build_fence);
+      }
+   }
 }
 
 
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer surfaces mapped by lp_scene_begin_rasterization().
+ * Called by the rasterizer before the scene fence is signalled, so that
+ * the surfaces are unmapped as soon as the rendering is done.
  */
 void
-lp_scene_end_rasterization(struct lp_scene *scene )
+lp_scene_unmap_framebuffer(struct lp_scene *scene)
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -249,6 +275,19 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene.
+ */
+void
+lp_scene_end_rasterization(struct lp_scene *scene )
+{
+   int i, j;
+
+   /* Normally already done by the rasterizer */
+   lp_scene_unmap_framebuffer(scene);
 
    /* Reset all command lists:
     */
@@ -269,20 +308,24 @@ lp_scene_end_rasterization(struct lp_scene *scene )
    /* Decrement texture ref counts
     */
    {
+      struct resource_ref *lists[2] = { scene->resources,
+                                        scene->writeable_resources };
       struct resource_ref *ref;
-      int i, j = 0;
-
-      for (ref = scene->resources; ref; ref = ref->next) {
-         for (i = 0; i < ref->count; i++) {
-            if (LP_DEBUG & DEBUG_SETUP)
-               debug_printf("resource %d: %p %dx%d sz %d\n",
-                            j,
-                            (void *) ref->resource[i],
-                            ref->resource[i]->width0,
-                            ref->resource[i]->height0,
-                            llvmpipe_resource_size(ref->resource[i]));
-            j++;
-            pipe_resource_reference(&ref->resource[i], NULL);
+      int i, j = 0, l;
+
+      for (l = 0; l < ARRAY_SIZE(lists); l++) {
+         for (ref = lists[l]; ref; ref = ref->next) {
+            for (i = 0; i < ref->count; i++) {
+               if (LP_DEBUG & DEBUG_SETUP)
+                  debug_printf("resource %d: %p %dx%d sz %d\n",
+                               j,
+                               (void *) ref->resource[i],
+                               ref->resource[i]->width0,
+                               ref->resource[i]->height0,
+                               llvmpipe_resource_size(ref->resource[i]));
+               j++;
+               pipe_resource_reference(&ref->resource[i], NULL);
+            }
          }
       }
 
@@ -325,6 +368,7 @@ lp_scene_end_rasterization(struct lp_scene *scene )
    lp_fence_reference(&scene->fence, NULL);
 
    scene->resources = NULL;
+   scene->writeable_resources = NULL;
    scene->frag_shaders = NULL;
    scene->scene_size = 0;
    scene->resource_reference_size = 0;
@@ -364,7 +408,7 @@ lp_scene_new_cmd_block( struct lp_scene *scene,
 struct data_block *
 lp_scene_new_data_block( struct lp_scene *scene )
 {
-   if (scene->scene_size + DATA_BLOCK_SIZE > LP_SCENE_MAX_SIZE) {
+   if (scene->scene_size + DATA_BLOCK_SIZE > scene->max_size) {
       if (0) debug_printf("%s: failed\n", __FUNCTION__);
       scene->alloc_failed = TRUE;
       return NULL;
@@ -385,6 +429,28 @@ lp_scene_new_data_block( struct lp_scene *scene )
 }
 
 
+/**
+ * Hand data blocks allocated outside of the scene over to it, they are
+ * freed along with the scene's own blocks.  The caller is responsible
+ * for checking the scene size limit.
+ */
+void
+lp_scene_add_data_blocks( struct lp_scene *scene,
+                          struct data_block *blocks )
+{
+   struct data_block *block, *next;
+
+   for (block = blocks; block; block = next) {
+      next = block->next;
+
+      /* Keep the current block in front, allocations are made from it */
+      block->next = scene->data.head->next;
+      scene->data.head->next = block;
+      scene->scene_size += sizeof *block;
+   }
+}
+
+
 /**
  * Return number of bytes used for all bin data within a scene.
  * This does not include resources (textures) referenced by the scene.
@@ -404,18 +470,22 @@ lp_scene_data_size( const struct lp_scene *scene )
 
 /**
  * Add a reference to a resource by the scene.
+ * \param writeable  the scene commands may write to the resource
  */
 boolean
 lp_scene_add_resource_reference(struct lp_scene *scene,
                                 struct pipe_resource *resource,
-                                boolean initializing_scene)
+                                boolean initializing_scene,
+                                boolean writeable)
 {
-   struct resource_ref *ref, **last = &scene->resources;
+   struct resource_ref **list = writeable ? &scene->writeable_resources
+                                          : &scene->resources;
+   struct resource_ref *ref, **last = list;
    int i;
 
    /* Look at existing resource blocks:
     */
-   for (ref = scene->resources; ref; ref = ref->next) {
+   for (ref = *list; ref; ref = ref->next) {
       last = &ref->next;
 
       /* Search for this resource:
@@ -510,81 +580,102 @@ lp_scene_add_frag_shader_reference(struct lp_scene *scene,
 
 /**
  * Does this scene have a reference to the given resource?
+ * \return mask of LP_REFERENCED_FOR_READ/WRITE bits
  */
-boolean
+unsigned
 lp_scene_is_resource_referenced(const struct lp_scene *scene,
                                 const struct pipe_resource *resource)
 {
    const struct resource_ref *ref;
    int i;
 
+   /* The framebuffer is only set while the scene is binned or rendered */
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (scene->fb.cbufs[i] && scene->fb.cbufs[i]->texture == resource)
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+   if (scene->fb.zsbuf && scene->fb.zsbuf->texture == resource)
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+
+   for (ref = scene->writeable_resources; ref; ref = ref->next) {
+      for (i = 0; i < ref->count; i++)
+         if (ref->resource[i] == resource)
+            return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+
    for (ref = scene->resources; ref; ref = ref->next) {
       for (i = 0; i < ref->count; i++)
          if (ref->resource[i] == resource)
-            return TRUE;
+            return LP_REFERENCED_FOR_READ;
    }
 
-   return FALSE;
+   return 0;
 }
 
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Split the bins in one range per rasterizer thread.
+ * Called once per scene, before the threads start iterating.
+ */
+void
+lp_scene_bin_iter_begin( struct lp_scene *scene )
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
+   unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned n = scene->num_bin_queues;
+   unsigned i;
+
+   for (i = 0; i < n; i++) {
+      scene->bin_queues[i].next = num_bins * i / n;
+      scene->bin_queues[i].end = num_bins * (i + 1) / n;
    }
-   return TRUE;
 }
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
+lp_scene_bin_iter_init( struct lp_scene *scene,
+                        struct lp_scene_bin_iter *iter,
+                        unsigned thread_index )
 {
-   scene->curr_x = scene->curr_y = -1;
+   iter->queue = thread_index % scene->num_bin_queues;
+   iter->visited = 0;
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Each thread first drains its own range,
+ * which keeps neighbouring tiles on the same thread, then moves on to
+ * the ranges of the other threads.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene,
+                        struct lp_scene_bin_iter *iter,
+                        int *x, int *y)
 {
-   struct cmd_bin *bin = NULL;
+   while (iter->visited < scene->num_bin_queues) {
+      struct lp_scene_bin_queue *queue = &scene->bin_queues[iter->queue];
+      int index;
 
-   mtx_lock(&scene->mutex);
+      /* A queue is only incremented past its end once per thread, as
+       * the thread moves to the next queue right after.
+       */
+      if (p_atomic_read(&queue->next) < queue->end) {
+         index = p_atomic_inc_return(&queue->next) - 1;
+         if (index < queue->end) {
+            *x = index % scene->tiles_x;
+            *y = index / scene->tiles_x;
+            return lp_scene_get_bin(scene, *x, *y);
+         }
+      }
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
+      iter->queue = (iter->queue + 1) % scene->num_bin_queues;
+      iter->visited++;
    }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
-
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return NULL;
 }
 
 
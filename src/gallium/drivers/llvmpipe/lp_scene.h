@@ -58,9 +58,15 @@ struct lp_rast_state;
  */
 #define DATA_BLOCK_SIZE (64 * 1024)
 
-/* Scene temporary storage is clamped to this size:
+/* Default budget for the scene temporary storage, see LP_SCENE_SIZE:
  */
-#define LP_SCENE_MAX_SIZE (36*1024*1024)
+#define LP_SCENE_DEFAULT_SIZE (36*1024*1024)
+
+/* Smallest budget which holds one command block per bin plus one data
+ * block:
+ */
+#define LP_SCENE_MIN_SIZE \
+   (TILES_X * TILES_Y * sizeof(struct cmd_block) + DATA_BLOCK_SIZE)
 
 /* The maximum amount of texture storage referenced by a scene is
  * clamped to this size:
@@ -164,6 +170,9 @@ struct lp_scene {
    /** list of resources referenced by the scene commands */
    struct resource_ref *resources;
 
+   /** list of resources the scene commands may write to (ssbos, images) */
+   struct resource_ref *writeable_resources;
+
    /** list of frag shaders referenced by the scene commands */
    struct shader_ref *frag_shaders;
 
@@ -173,6 +182,9 @@ struct lp_scene {
     */
    unsigned scene_size;
 
+   /** Memory budget of the scene, scene_size is kept below it */
+   unsigned max_size;
+
    /** Sum of sizes of all resources referenced by the scene.  Sums
     * all the textures read by the scene:
     */
@@ -185,8 +197,13 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /**
+    * For iterating over bins.  The bins are split in one contiguous
+    * range per rasterizer thread, a thread which ran out of bins in its
+    * own range steals the remaining ones of the others.
+    */
+   struct lp_scene_bin_queue *bin_queues;
+   unsigned num_bin_queues;
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -194,7 +211,23 @@ struct lp_scene {
 
 
 
-struct lp_scene *lp_scene_create(struct pipe_context *pipe);
+/** A range of bins, in row-major order, handed out to the rasterizer threads */
+struct lp_scene_bin_queue {
+   int next;            /**< atomically incremented */
+   int end;
+   char pad[64 - 2 * sizeof(int)];   /**< keep the queues on their own cache line */
+};
+
+/** Per-thread state of the bin iteration */
+struct lp_scene_bin_iter {
+   unsigned queue;      /**< queue currently drained */
+   unsigned visited;    /**< number of queues found empty */
+};
+
+
+struct lp_scene *lp_scene_create(struct pipe_context *pipe,
+                                 unsigned num_threads,
+                                 unsigned max_size);
 
 void lp_scene_destroy(struct lp_scene *scene);
 
@@ -204,15 +237,19 @@ boolean lp_scene_is_oom(struct lp_scene *scene );
 
 struct data_block *lp_scene_new_data_block( struct lp_scene *scene );
 
+void lp_scene_add_data_blocks( struct lp_scene *scene,
+                               struct data_block *blocks );
+
 struct cmd_block *lp_scene_new_cmd_block( struct lp_scene *scene,
                                           struct cmd_bin *bin );
 
 boolean lp_scene_add_resource_reference(struct lp_scene *scene,
                                         struct pipe_resource *resource,
-                                        boolean initializing_scene);
+                                        boolean initializing_scene,
+                                        boolean writeable);
 
-boolean lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                        const struct pipe_resource *resource );
+unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                         const struct pipe_resource *resource );
 
 boolean lp_scene_add_frag_shader_reference(struct lp_scene *scene,
                                            struct lp_fragment_shader_variant *variant);
@@ -235,7 +272,7 @@ lp_scene_alloc( struct lp_scene *scene, unsigned size)
    if (LP_DEBUG & DEBUG_MEM)
       debug_printf("alloc %u block %u/%u tot %u/%u\n",
 		   size, block->used, DATA_BLOCK_SIZE,
-		   scene->scene_size, LP_SCENE_MAX_SIZE);
+		   scene->scene_size, scene->max_size);
 
    if (block->used + size > DATA_BLOCK_SIZE) {
       block = lp_scene_new_data_block( scene );
@@ -269,7 +306,7 @@ lp_scene_alloc_aligned( struct lp_scene *scene, unsigned size,
       debug_printf("alloc %u block %u/%u tot %u/%u\n",
 		   size + alignment - 1,
 		   block->used, DATA_BLOCK_SIZE,
-		   scene->scene_size, LP_SCENE_MAX_SIZE);
+		   scene->scene_size, scene->max_size);
        
    if (block->used + size + alignment - 1 > DATA_BLOCK_SIZE) {
       block = lp_scene_new_data_block( scene );
@@ -397,8 +434,15 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 void
 lp_scene_bin_iter_begin( struct lp_scene *scene );
 
+void
+lp_scene_bin_iter_init( struct lp_scene *scene,
+                        struct lp_scene_bin_iter *iter,
+                        unsigned thread_index );
+
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene,
+                        struct lp_scene_bin_iter *iter,
+                        int *x, int *y );
 
 
 
@@ -417,6 +461,9 @@ lp_scene_end_binning(struct lp_scene *scene);
 void
 lp_scene_begin_rasterization(struct lp_scene *scene);
 
+void
+lp_scene_unmap_framebuffer(struct lp_scene *scene);
+
 void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
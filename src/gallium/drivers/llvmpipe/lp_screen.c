@@ -50,7 +50,10 @@
 #include "lp_public.h"
 #include "lp_limits.h"
 #include "lp_rast.h"
+#include "lp_scene.h"
+#include "lp_flush.h"
 #include "lp_cs_tpool.h"
+#include "lp_query.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -739,8 +742,26 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    struct llvmpipe_resource *texture = llvmpipe_resource(resource);
 
    assert(texture->dt);
-   if (texture->dt)
+   if (texture->dt) {
+      /* The scenes rendering to it may still be in flight */
+      if (_pipe) {
+         llvmpipe_flush_resource(_pipe, resource, 0, TRUE, TRUE, FALSE,
+                                 __FUNCTION__);
+      } else {
+         /* The caller flushed its context already */
+         struct lp_fence *fence = NULL;
+
+         mtx_lock(&screen->rast_mutex);
+         lp_fence_reference(&fence, texture->dt_fence);
+         mtx_unlock(&screen->rast_mutex);
+
+         if (fence) {
+            lp_fence_wait(fence);
+            lp_fence_reference(&fence, NULL);
+         }
+      }
       winsys->displaytarget_display(winsys, texture->dt, context_private, sub_box);
+   }
 }
 
 static void
@@ -752,6 +773,12 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
+   if (screen->async_jit)
+      util_queue_destroy(&screen->build_queue);
+
+   if (screen->tiered_jit)
+      util_queue_destroy(&screen->jit_queue);
+
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
@@ -877,6 +904,139 @@ void lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
    disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key, 20, sha1);
    disk_cache_put(screen->disk_shader_cache, sha1, cache->data, cache->data_size, NULL);
 }
+
+
+static void
+lp_optimize_variant_cleanup(void *data, int thread_index);
+
+
+static void
+lp_optimize_variant_job(void *data, int thread_index)
+{
+   struct lp_variant_opt_job *job = data;
+   struct lp_cached_code cached = { 0 };
+   struct gallivm_state *gallivm;
+   LLVMContextRef context;
+   bool built = false;
+
+   /* LLVM contexts aren't thread safe, build in one of our own */
+   context = LLVMContextCreate();
+   if (!context)
+      goto next;
+
+   if (job->unoptimized)
+      gallivm = gallivm_create_unoptimized(job->module_name, context);
+   else
+      gallivm = gallivm_create(job->module_name, context, &cached);
+   if (!gallivm) {
+      LLVMContextDispose(context);
+      goto next;
+   }
+
+   if (!job->generate(job, gallivm)) {
+      gallivm_destroy(gallivm);
+      LLVMContextDispose(context);
+      goto next;
+   }
+
+   gallivm_compile_module(gallivm);
+   job->publish(job, gallivm);
+   built = true;
+
+   if (job->needs_caching)
+      lp_disk_cache_insert_shader(job->screen, &cached, job->ir_sha1_cache_key);
+
+   gallivm_free_ir(gallivm);
+   LLVMContextDispose(context);
+
+next:
+   if (job->next) {
+      /* Without a first build, whoever waits on this job needs the next */
+      if (built)
+         lp_queue_variant_job(&job->screen->jit_queue, job->next,
+                              job->next_fence);
+      else {
+         lp_optimize_variant_job(job->next, thread_index);
+         lp_optimize_variant_cleanup(job->next, thread_index);
+      }
+      job->next = NULL;
+   }
+}
+
+
+static void
+lp_optimize_variant_cleanup(void *data, int thread_index)
+{
+   struct lp_variant_opt_job *job = data;
+
+   if (job->next)
+      lp_optimize_variant_cleanup(job->next, thread_index);
+
+   ralloc_free(job->nir);
+   FREE(job);
+}
+
+
+/**
+ * Set up a job before it's queued, the job is freed on failure.
+ * \param nir  the shader NIR, copied for the job (or NULL for TGSI)
+ * \param ir_sha1_cache_key  key to store the code in the disk cache with,
+ *                           or NULL
+ */
+bool
+lp_prepare_variant_job(struct llvmpipe_screen *screen,
+                       struct lp_variant_opt_job *job,
+                       const struct nir_shader *nir,
+                       const unsigned char *ir_sha1_cache_key)
+{
+   job->screen = screen;
+   if (nir) {
+      job->nir = nir_shader_clone(NULL, nir);
+      if (!job->nir) {
+         FREE(job);
+         return false;
+      }
+   }
+   if (ir_sha1_cache_key) {
+      job->needs_caching = true;
+      memcpy(job->ir_sha1_cache_key, ir_sha1_cache_key,
+             sizeof(job->ir_sha1_cache_key));
+   }
+   return true;
+}
+
+
+/**
+ * Queue a job set up by lp_prepare_variant_job(), it's freed once done.
+ */
+void
+lp_queue_variant_job(struct util_queue *queue,
+                     struct lp_variant_opt_job *job,
+                     struct util_queue_fence *fence)
+{
+   util_queue_add_job(queue, job, fence,
+                      lp_optimize_variant_job, lp_optimize_variant_cleanup, 0);
+}
+
+
+/**
+ * Queue the build of the optimized code of a variant whose first code
+ * was built without optimizations.  The job is freed once done, or right
+ * away on failure.
+ */
+bool
+lp_queue_optimized_variant(struct llvmpipe_screen *screen,
+                           struct lp_variant_opt_job *job,
+                           struct util_queue_fence *fence,
+                           const struct nir_shader *nir,
+                           const unsigned char *ir_sha1_cache_key)
+{
+   if (!lp_prepare_variant_job(screen, job, nir, ir_sha1_cache_key))
+      return false;
+
+   lp_queue_variant_job(&screen->jit_queue, job, fence);
+   return true;
+}
 /**
  * Create a new pipe_screen object
  * Note: we're not presently subclassing pipe_screen (no llvmpipe_screen).
@@ -885,6 +1045,7 @@ struct pipe_screen *
 llvmpipe_create_screen(struct sw_winsys *winsys)
 {
    struct llvmpipe_screen *screen;
+   long scene_size_mb;
 
    util_cpu_detect();
 
@@ -925,6 +1086,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.fence_finish = llvmpipe_fence_finish;
 
    screen->base.get_timestamp = llvmpipe_get_timestamp;
+   screen->base.get_driver_query_info = llvmpipe_get_driver_query_info;
 
    screen->base.finalize_nir = llvmpipe_finalize_nir;
 
@@ -940,6 +1102,23 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS", screen->num_threads);
    screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
 
+   /* One scene can be binned while the previous ones are rasterized */
+   screen->num_scenes = debug_get_num_option("LP_NUM_SCENES", 2);
+   screen->num_scenes = CLAMP(screen->num_scenes, 1, LP_MAX_SCENES);
+   /* Bound the size in megabytes, so that large values can't wrap around
+    * when converted to bytes.
+    */
+   scene_size_mb = debug_get_num_option("LP_SCENE_SIZE",
+                                        LP_SCENE_DEFAULT_SIZE >> 20);
+   scene_size_mb = CLAMP(scene_size_mb, 0, LP_MAX_SCENE_SIZE >> 20);
+   screen->scene_size = CLAMP((unsigned)scene_size_mb << 20,
+                              LP_SCENE_MIN_SIZE, LP_MAX_SCENE_SIZE);
+
+   screen->variant_cache_size =
+      (uint64_t)MAX2(debug_get_num_option("LP_VARIANT_CACHE_SIZE",
+                                          LP_DEFAULT_VARIANT_CACHE_SIZE >> 20),
+                     1) << 20;
+
    screen->rast = lp_rast_create(screen->num_threads);
    if (!screen->rast) {
       lp_jit_screen_cleanup(screen);
@@ -957,6 +1136,28 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    }
    (void) mtx_init(&screen->cs_mutex, mtx_plain);
 
+   screen->linear_rast = debug_get_bool_option("LP_LINEAR_RAST", TRUE);
+   screen->tiled_textures = debug_get_bool_option("LP_TILED_TEXTURES", FALSE);
+
+   screen->tiered_jit = debug_get_bool_option("LP_TIERED_JIT", FALSE);
+   screen->num_jit_threads = debug_get_num_option("LP_JIT_THREADS", 1);
+   screen->num_jit_threads = CLAMP(screen->num_jit_threads, 1, LP_MAX_THREADS);
+   if (screen->tiered_jit &&
+       !util_queue_init(&screen->jit_queue, "lpjit", 64,
+                        screen->num_jit_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY))
+      screen->tiered_jit = false;
+
+   /* The rasterizer waits for these, keep the default priority */
+   screen->async_jit = screen->tiered_jit &&
+                       debug_get_bool_option("LP_ASYNC_JIT", FALSE);
+   if (screen->async_jit &&
+       !util_queue_init(&screen->build_queue, "lpbuild", 64,
+                        screen->num_jit_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+      screen->async_jit = false;
+
    lp_disk_cache_create(screen);
    return &screen->base;
 }
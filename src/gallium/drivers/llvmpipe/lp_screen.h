@@ -37,6 +37,7 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
 
@@ -51,16 +52,52 @@ struct llvmpipe_screen
 
    unsigned num_threads;
 
+   /* Scenes per context and memory budget of each scene, in bytes */
+   unsigned num_scenes;
+   unsigned scene_size;
+
+   /* Budget of each context for the JIT code of its variants, in bytes */
+   uint64_t variant_cache_size;
+
    /* Increments whenever textures are modified.  Contexts can track this.
     */
    unsigned timestamp;
 
+   /* Increments whenever a texture changes layout, see
+    * llvmpipe_resource_untile().  Contexts track this.
+    */
+   unsigned texture_layouts;
+
+   unsigned num_contexts;
+
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
 
    struct lp_cs_tpool *cs_tpool;
    mtx_t cs_mutex;
 
+   /* Background builds of the optimized shader variants (LP_TIERED_JIT),
+    * on LP_JIT_THREADS threads
+    */
+   bool tiered_jit;
+   unsigned num_jit_threads;
+   struct util_queue jit_queue;
+
+   /* Background builds of the first, unoptimized code of the fragment
+    * shader variants (LP_ASYNC_JIT).  A queue of their own, so that the
+    * rasterizer waiting on them isn't held up by the optimized builds.
+    */
+   bool async_jit;
+   struct util_queue build_queue;
+
+   /* Run the eligible fragment shaders with the linear rasterizer
+    * (LP_LINEAR_RAST)
+    */
+   bool linear_rast;
+
+   /* Store sampled textures in 4x4 texel tiles (LP_TILED_TEXTURES) */
+   bool tiled_textures;
+
    bool use_tgsi;
    bool allow_cl;
 
@@ -77,6 +114,58 @@ void lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                                  unsigned char ir_sha1_cache_key[20]);
 
 
+struct nir_shader;
+
+/**
+ * Background build of the optimized code of a shader variant, see
+ * LP_TIERED_JIT, or of its first code with LP_ASYNC_JIT.  Embedded at the
+ * start of the stage specific job, which provides the callbacks.
+ */
+struct lp_variant_opt_job
+{
+   struct llvmpipe_screen *screen;
+   char module_name[64];
+
+   /* Build without optimizations */
+   bool unoptimized;
+
+   /* Job queued on the jit_queue once this one is done, with its fence.
+    * Freed with this job if it never gets there.
+    */
+   struct lp_variant_opt_job *next;
+   struct util_queue_fence *next_fence;
+
+   /* Private copy of the shader NIR, which lp_build_nir_soa() modifies */
+   struct nir_shader *nir;
+
+   bool needs_caching;
+   unsigned char ir_sha1_cache_key[20];
+
+   /* Generate the code of the variant in gallivm */
+   bool (*generate)(struct lp_variant_opt_job *job,
+                    struct gallivm_state *gallivm);
+
+   /* Swap the compiled code into the variant, which takes over gallivm */
+   void (*publish)(struct lp_variant_opt_job *job,
+                   struct gallivm_state *gallivm);
+};
+
+bool lp_prepare_variant_job(struct llvmpipe_screen *screen,
+                            struct lp_variant_opt_job *job,
+                            const struct nir_shader *nir,
+                            const unsigned char *ir_sha1_cache_key);
+
+void lp_queue_variant_job(struct util_queue *queue,
+                          struct lp_variant_opt_job *job,
+                          struct util_queue_fence *fence);
+
+bool lp_queue_optimized_variant(struct llvmpipe_screen *screen,
+                                struct lp_variant_opt_job *job,
+                                struct util_queue_fence *fence,
+                                const struct nir_shader *nir,
+                                const unsigned char *ir_sha1_cache_key);
+
+
 static inline struct llvmpipe_screen *
 llvmpipe_screen( struct pipe_screen *pipe )
 {
@@ -48,6 +48,7 @@
 #include "lp_texture.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
+#include "lp_perf.h"
 #include "lp_query.h"
 #include "lp_rast.h"
 #include "lp_setup_context.h"
@@ -64,24 +65,70 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
 
+/**
+ * Release what a scene handed to the rasterizer references, once it has
+ * been rendered.  The scenes are retired here rather than by the
+ * rasterizer so that the references are only ever dropped by the thread
+ * owning the context.
+ */
 static void
-lp_setup_get_empty_scene(struct lp_setup_context *setup)
+lp_setup_retire_scene(struct lp_setup_context *setup,
+                      struct lp_scene *scene)
 {
-   assert(setup->scene == NULL);
+   assert(scene != setup->scene);
 
-   setup->scene_idx++;
-   setup->scene_idx %= ARRAY_SIZE(setup->scenes);
+   if (!scene->fence)
+      return;
 
-   setup->scene = setup->scenes[setup->scene_idx];
+   if (lp_fence_issued(scene->fence) && !lp_fence_signalled(scene->fence)) {
+      int64_t start = os_time_get_nano();
 
-   if (setup->scene->fence) {
       if (LP_DEBUG & DEBUG_SETUP)
          debug_printf("%s: wait for scene %d\n",
-                      __FUNCTION__, setup->scene->fence->id);
+                      __FUNCTION__, scene->fence->id);
 
-      lp_fence_wait(setup->scene->fence);
+      lp_fence_wait(scene->fence);
+
+      LP_COUNT(nr_scene_waits);
+      LP_COUNT_ADD(scene_wait_time, (os_time_get_nano() - start) / 1000);
    }
 
+   lp_scene_end_rasterization(scene);
+}
+
+
+/**
+ * Retire the scenes which have been rendered already, so that they stop
+ * holding references to their resources.
+ */
+static void
+lp_setup_retire_signalled_scenes(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+
+      if (scene != setup->scene && scene->fence &&
+          lp_fence_signalled(scene->fence))
+         lp_setup_retire_scene(setup, scene);
+   }
+}
+
+
+static void
+lp_setup_get_empty_scene(struct lp_setup_context *setup)
+{
+   assert(setup->scene == NULL);
+
+   setup->scene_idx++;
+   setup->scene_idx %= setup->num_scenes;
+
+   /* The scenes are rasterized in order, this is the oldest one */
+   lp_setup_retire_scene(setup, setup->scenes[setup->scene_idx]);
+
+   setup->scene = setup->scenes[setup->scene_idx];
+
    lp_scene_begin_binning(setup->scene, &setup->fb);
 
 }
@@ -154,6 +201,7 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
 {
    struct lp_scene *scene = setup->scene;
    struct llvmpipe_screen *screen = llvmpipe_screen(scene->pipe->screen);
+   unsigned i;
 
    scene->num_active_queries = setup->active_binned_queries;
    memcpy(scene->active_queries, setup->active_queries,
@@ -166,23 +214,28 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
    if (setup->last_fence)
       setup->last_fence->issued = TRUE;
 
+   /* Don't wait for the rasterizer, the next scene is binned while this
+    * one is rendered.  The scene is retired when it's reused, anything
+    * needing its results waits on the fence (see
+    * lp_setup_is_resource_referenced()).
+    */
    mtx_lock(&screen->rast_mutex);
+   lp_rast_queue_scene(screen->rast, scene);
 
-   /* FIXME: We enqueue the scene then wait on the rasterizer to finish.
-    * This means we never actually run any vertex stuff in parallel to
-    * rasterization (not in the same context at least) which is what the
-    * multiple scenes per setup is about - when we get a new empty scene
-    * any old one is already empty again because we waited here for
-    * raster tasks to be finished. Ideally, we shouldn't need to wait here
-    * and rely on fences elsewhere when waiting is necessary.
-    * Certainly, lp_scene_end_rasterization() would need to be deferred too
-    * and there's probably other bits why this doesn't actually work.
+   /* A display target may be presented without a context, see
+    * llvmpipe_flush_frontbuffer().
     */
-   lp_rast_queue_scene(screen->rast, scene);
-   lp_rast_finish(screen->rast);
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      struct pipe_surface *cbuf = scene->fb.cbufs[i];
+
+      if (cbuf && llvmpipe_resource(cbuf->texture)->dt)
+         lp_fence_reference(&llvmpipe_resource(cbuf->texture)->dt_fence,
+                            scene->fence);
+   }
    mtx_unlock(&screen->rast_mutex);
 
-   lp_scene_end_rasterization(setup->scene);
+   LP_COUNT(nr_scenes);
+
    lp_setup_reset( setup );
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
@@ -297,6 +350,8 @@ set_scene_state( struct lp_setup_context *setup,
 
    if (old_state == new_state)
       return TRUE;
+
+   lp_setup_flush_batch(setup);
    
    if (LP_DEBUG & DEBUG_SCENE) {
       debug_printf("%s old %s new %s%s%s\n",
@@ -360,6 +415,8 @@ lp_setup_flush( struct lp_setup_context *setup,
 {
    set_scene_state( setup, SETUP_FLUSHED, reason );
 
+   lp_setup_retire_signalled_scenes(setup);
+
    if (fence) {
       lp_fence_reference((struct lp_fence **)fence, setup->last_fence);
       if (!*fence)
@@ -619,6 +676,18 @@ lp_setup_set_setup_variant( struct lp_setup_context *setup,
    setup->setup.variant = variant;
 }
 
+/**
+ * Whether the fragment shader or setup variant is the one currently set,
+ * which must not be freed.
+ */
+boolean
+lp_setup_is_variant_bound(const struct lp_setup_context *setup,
+                          const void *variant)
+{
+   return variant == (const void *)setup->fs.current.variant ||
+          variant == (const void *)setup->setup.variant;
+}
+
 void
 lp_setup_set_fs_variant( struct lp_setup_context *setup,
                          struct lp_fragment_shader_variant *variant)
@@ -1070,6 +1139,7 @@ unsigned
 lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
                                 const struct pipe_resource *texture )
 {
+   unsigned referenced = LP_UNREFERENCED;
    unsigned i;
 
    /* check the render targets */
@@ -1081,11 +1151,17 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   /* check textures referenced by the scene */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
-      if (lp_scene_is_resource_referenced(setup->scenes[i], texture)) {
-         return LP_REFERENCED_FOR_READ;
-      }
+   /* check resources referenced by the scenes, including the ones which
+    * are still being rasterized, but not the ones already rendered
+    */
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+
+      if (scene != setup->scene && scene->fence &&
+          lp_fence_signalled(scene->fence))
+         continue;
+
+      referenced |= lp_scene_is_resource_referenced(scene, texture);
    }
 
    for (i = 0; i < ARRAY_SIZE(setup->ssbos); i++) {
@@ -1098,7 +1174,7 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
          return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   return LP_UNREFERENCED;
+   return referenced;
 }
 
 
@@ -1303,7 +1379,31 @@ try_update_scene_state( struct lp_setup_context *setup )
             if (setup->fs.current_tex[i]) {
                if (!lp_scene_add_resource_reference(scene,
                                                     setup->fs.current_tex[i],
-                                                    new_scene)) {
+                                                    new_scene, FALSE)) {
+                  assert(!new_scene);
+                  return FALSE;
+               }
+            }
+         }
+
+         /* Keep the buffers and images the shader writes to alive while
+          * the scene is in flight.
+          */
+         for (i = 0; i < ARRAY_SIZE(setup->ssbos); i++) {
+            if (setup->ssbos[i].current.buffer) {
+               if (!lp_scene_add_resource_reference(scene,
+                                                    setup->ssbos[i].current.buffer,
+                                                    new_scene, TRUE)) {
+                  assert(!new_scene);
+                  return FALSE;
+               }
+            }
+         }
+         for (i = 0; i < ARRAY_SIZE(setup->images); i++) {
+            if (setup->images[i].current.resource) {
+               if (!lp_scene_add_resource_reference(scene,
+                                                    setup->images[i].current.resource,
+                                                    new_scene, TRUE)) {
                   assert(!new_scene);
                   return FALSE;
                }
@@ -1341,6 +1441,11 @@ lp_setup_update_state( struct lp_setup_context *setup,
     */
    {
       struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
+
+      /* The batched triangles use the state they were submitted with */
+      if (lp->dirty || setup->dirty)
+         lp_setup_flush_batch(setup);
+
       if (lp->dirty) {
          llvmpipe_update_derived(lp);
       }
@@ -1414,6 +1519,8 @@ lp_setup_destroy( struct lp_setup_context *setup )
 
    lp_setup_reset( setup );
 
+   lp_setup_batch_destroy( setup );
+
    util_unreference_framebuffer_state(&setup->fb);
 
    for (i = 0; i < ARRAY_SIZE(setup->fs.current_tex); i++) {
@@ -1428,13 +1535,11 @@ lp_setup_destroy( struct lp_setup_context *setup )
       pipe_resource_reference(&setup->ssbos[i].current.buffer, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
+   /* free the scenes, waiting for the ones still being rasterized */
+   for (i = 0; i < setup->num_scenes; i++) {
       struct lp_scene *scene = setup->scenes[i];
 
-      if (scene->fence)
-         lp_fence_wait(scene->fence);
-
+      lp_setup_retire_scene(setup, scene);
       lp_scene_destroy(scene);
    }
 
@@ -1470,6 +1575,8 @@ lp_setup_create( struct pipe_context *pipe,
 
 
    setup->num_threads = screen->num_threads;
+   setup->num_scenes = screen->num_scenes;
+   lp_setup_batch_init(setup);
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1479,8 +1586,9 @@ lp_setup_create( struct pipe_context *pipe,
    draw_set_render(draw, &setup->base);
 
    /* create some empty scenes */
-   for (i = 0; i < MAX_SCENES; i++) {
-      setup->scenes[i] = lp_scene_create( pipe );
+   for (i = 0; i < setup->num_scenes; i++) {
+      setup->scenes[i] = lp_scene_create( pipe, setup->num_threads,
+                                          screen->scene_size );
       if (!setup->scenes[i]) {
          goto no_scenes;
       }
@@ -1499,7 +1607,7 @@ lp_setup_create( struct pipe_context *pipe,
    return setup;
 
 no_scenes:
-   for (i = 0; i < MAX_SCENES; i++) {
+   for (i = 0; i < setup->num_scenes; i++) {
       if (setup->scenes[i]) {
          lp_scene_destroy(setup->scenes[i]);
       }
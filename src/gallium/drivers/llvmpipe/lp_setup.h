@@ -62,6 +62,9 @@ lp_setup_clear(struct lp_setup_context *setup,
 
 
 
+void
+lp_setup_flush_batch( struct lp_setup_context *setup );
+
 void
 lp_setup_flush( struct lp_setup_context *setup,
                 struct pipe_fence_handle **fence,
@@ -96,6 +99,10 @@ void
 lp_setup_set_setup_variant( struct lp_setup_context *setup,
 			    const struct lp_setup_variant *variant );
 
+boolean
+lp_setup_is_variant_bound(const struct lp_setup_context *setup,
+                          const void *variant);
+
 void
 lp_setup_set_fs_variant( struct lp_setup_context *setup,
                          struct lp_fragment_shader_variant *variant );
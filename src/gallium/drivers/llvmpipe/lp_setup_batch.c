@@ -0,0 +1,346 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Parallel triangle setup.
+ *
+ * With LP_PARALLEL_SETUP set, the triangle lists coming out of the draw
+ * module are copied in a batch instead of being set up one at a time.
+ * When the batch is flushed (at the end of the draw call, before the
+ * state changes or when it is full) it is split in chunks, which the
+ * threads of the compute thread pool set up into their own data blocks
+ * and command records.  The chunks are then merged in the scene bins in
+ * submission order, so each tile sees the commands in the same order as
+ * with the serial setup.
+ */
+
+#include "util/u_debug.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "lp_context.h"
+#include "lp_cs_tpool.h"
+#include "lp_screen.h"
+#include "lp_setup_context.h"
+
+
+void
+lp_setup_batch_init(struct lp_setup_context *setup)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+
+   setup->batch.enabled = screen->num_threads > 1 &&
+                          debug_get_bool_option("LP_PARALLEL_SETUP", FALSE);
+}
+
+
+static void
+free_chunk_data(struct lp_setup_bin_chunk *chunk)
+{
+   struct data_block *block, *next;
+
+   for (block = chunk->data; block; block = next) {
+      next = block->next;
+      FREE(block);
+   }
+   chunk->data = NULL;
+   chunk->data_size = 0;
+}
+
+
+void
+lp_setup_batch_destroy(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   for (i = 0; i < setup->batch.num_chunks; i++) {
+      free_chunk_data(&setup->batch.chunks[i]);
+      util_dynarray_fini(&setup->batch.chunks[i].records);
+   }
+   FREE(setup->batch.chunks);
+   align_free(setup->batch.verts);
+}
+
+
+/**
+ * Allocate triangle data for a chunk.  Like lp_scene_alloc_aligned(),
+ * but the blocks only get to the scene when the chunk is merged.
+ */
+void *
+lp_setup_chunk_alloc_aligned(struct lp_setup_bin_chunk *chunk,
+                             unsigned size,
+                             unsigned alignment)
+{
+   struct data_block *block = chunk->data;
+
+   assert(size + alignment - 1 <= DATA_BLOCK_SIZE);
+
+   if (!block || block->used + size + alignment - 1 > DATA_BLOCK_SIZE) {
+      if (chunk->data_size + sizeof *block > chunk->max_size)
+         return NULL;
+
+      block = MALLOC_STRUCT(data_block);
+      if (!block)
+         return NULL;
+
+      block->used = 0;
+      block->next = chunk->data;
+      chunk->data = block;
+      chunk->data_size += sizeof *block;
+   }
+
+   {
+      ubyte *data = block->data + block->used;
+      unsigned offset = (((uintptr_t)data + alignment - 1) & ~(alignment - 1)) - (uintptr_t)data;
+      block->used += offset + size;
+      return data + offset;
+   }
+}
+
+
+/**
+ * Worker thread entrypoint, set up the triangles of one chunk.
+ */
+static void
+setup_chunk(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct lp_setup_context *setup = (struct lp_setup_context *)data;
+   struct lp_setup_bin_chunk *chunk = &setup->batch.chunks[iter_idx];
+   const unsigned stride = setup->batch.stride;
+   const uint8_t *verts = setup->batch.verts +
+                          iter_idx * LP_SETUP_CHUNK_TRIS * 3 * stride;
+   unsigned i;
+
+   for (i = 0; i < chunk->num_tris; i++, verts += 3 * stride) {
+      unsigned num_records =
+         util_dynarray_num_elements(&chunk->records, struct lp_setup_bin_record);
+
+      if (!lp_setup_chunk_triangle(setup, chunk,
+                                   (const float (*)[4])verts,
+                                   (const float (*)[4])(verts + stride),
+                                   (const float (*)[4])(verts + 2 * stride)) ||
+          chunk->data_size +
+          util_dynarray_num_elements(&chunk->records, struct lp_setup_bin_record) *
+          sizeof(struct cmd_block) > chunk->max_size) {
+         /* Drop what was recorded for this triangle, it is set up again
+          * serially along with the rest of the chunk.
+          */
+         chunk->records.size = num_records * sizeof(struct lp_setup_bin_record);
+         break;
+      }
+   }
+
+   chunk->num_done = i;
+}
+
+
+/**
+ * Move the data blocks of a chunk to the scene and replay its commands
+ * in the bins.
+ */
+static void
+merge_chunk(struct lp_setup_context *setup,
+            struct lp_setup_bin_chunk *chunk)
+{
+   const unsigned num_records =
+      util_dynarray_num_elements(&chunk->records, struct lp_setup_bin_record);
+   const unsigned cmd_blocks_per_data_block =
+      DATA_BLOCK_SIZE / sizeof(struct cmd_block);
+   struct lp_scene *scene;
+   unsigned size;
+
+   /* Each record adds at most one command block to its bin, make sure
+    * the scene can hold all of them before touching the bins.
+    */
+   size = chunk->data_size +
+          (DIV_ROUND_UP(num_records, cmd_blocks_per_data_block) + 1) * DATA_BLOCK_SIZE;
+
+   if (setup->scene->scene_size + size > setup->scene->max_size) {
+      if (!lp_setup_flush_and_restart(setup)) {
+         free_chunk_data(chunk);
+         util_dynarray_clear(&chunk->records);
+         chunk->num_done = chunk->num_tris;
+         return;
+      }
+   }
+
+   scene = setup->scene;
+   lp_scene_add_data_blocks(scene, chunk->data);
+   chunk->data = NULL;
+   chunk->data_size = 0;
+
+   util_dynarray_foreach(&chunk->records, struct lp_setup_bin_record, rec) {
+      if (rec->cmd == LP_SETUP_BIN_RESET) {
+         if (lp_setup_may_reset_bin(scene))
+            lp_scene_bin_reset(scene, rec->x, rec->y);
+      }
+      else if (!lp_scene_bin_cmd_with_state(scene, rec->x, rec->y,
+                                            setup->fs.stored,
+                                            rec->cmd, rec->arg)) {
+         assert(0);
+         break;
+      }
+   }
+
+   util_dynarray_clear(&chunk->records);
+}
+
+
+void
+lp_setup_flush_batch(struct lp_setup_context *setup)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   const unsigned num_tris = setup->batch.num_tris;
+   const unsigned tri_size = 3 * setup->batch.stride;
+   struct lp_cs_tpool_task *task;
+   unsigned num_chunks, dirty, i, j;
+
+   if (!num_tris)
+      return;
+
+   /* Restarting the scene below gets back here */
+   setup->batch.num_tris = 0;
+
+   /* State changes pending in the context are for the triangles which
+    * come after the batch, keep lp_setup_update_state() away from them.
+    */
+   dirty = lp->dirty;
+   lp->dirty = 0;
+
+   num_chunks = DIV_ROUND_UP(num_tris, LP_SETUP_CHUNK_TRIS);
+   if (num_chunks > setup->batch.num_chunks) {
+      struct lp_setup_bin_chunk *chunks =
+         REALLOC(setup->batch.chunks,
+                 setup->batch.num_chunks * sizeof(*chunks),
+                 num_chunks * sizeof(*chunks));
+      if (chunks) {
+         for (i = setup->batch.num_chunks; i < num_chunks; i++) {
+            memset(&chunks[i], 0, sizeof(chunks[i]));
+            util_dynarray_init(&chunks[i].records, NULL);
+         }
+         setup->batch.chunks = chunks;
+         setup->batch.num_chunks = num_chunks;
+      }
+   }
+
+   if (num_chunks <= setup->batch.num_chunks) {
+      for (i = 0; i < num_chunks; i++) {
+         setup->batch.chunks[i].num_tris =
+            MIN2(LP_SETUP_CHUNK_TRIS, num_tris - i * LP_SETUP_CHUNK_TRIS);
+         setup->batch.chunks[i].num_done = 0;
+         /* What doesn't fit is set up serially */
+         setup->batch.chunks[i].max_size = screen->scene_size / 8;
+      }
+
+      task = lp_cs_tpool_queue_task(screen->cs_tpool, setup_chunk,
+                                    setup, num_chunks);
+      lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+
+      for (i = 0; i < num_chunks; i++) {
+         struct lp_setup_bin_chunk *chunk = &setup->batch.chunks[i];
+         const uint8_t *verts = setup->batch.verts +
+                                i * LP_SETUP_CHUNK_TRIS * tri_size;
+
+         merge_chunk(setup, chunk);
+
+         /* What the worker couldn't fit in the chunk */
+         for (j = chunk->num_done; j < chunk->num_tris; j++) {
+            const uint8_t *v = verts + j * tri_size;
+            setup->triangle(setup,
+                            (const float (*)[4])v,
+                            (const float (*)[4])(v + setup->batch.stride),
+                            (const float (*)[4])(v + 2 * setup->batch.stride));
+         }
+      }
+   }
+   else {
+      for (i = 0; i < num_tris; i++) {
+         const uint8_t *v = setup->batch.verts + i * tri_size;
+         setup->triangle(setup,
+                         (const float (*)[4])v,
+                         (const float (*)[4])(v + setup->batch.stride),
+                         (const float (*)[4])(v + 2 * setup->batch.stride));
+      }
+   }
+
+   lp->dirty |= dirty;
+}
+
+
+/**
+ * Add the triangles of a PIPE_PRIM_TRIANGLES vbuf to the batch.
+ * \param indices  NULL for non-indexed draws
+ */
+void
+lp_setup_batch_triangles(struct lp_setup_context *setup,
+                         const void *vertex_buffer,
+                         const ushort *indices,
+                         unsigned nr)
+{
+   const unsigned stride = setup->vertex_info->size * sizeof(float);
+   const unsigned tri_size = 3 * stride;
+   unsigned i;
+
+   if (!setup->batch.verts) {
+      setup->batch.verts = align_malloc(LP_SETUP_BATCH_SIZE, 16);
+      setup->batch.size = setup->batch.verts ? LP_SETUP_BATCH_SIZE : 0;
+   }
+
+   if (setup->batch.num_tris && setup->batch.stride != stride)
+      lp_setup_flush_batch(setup);
+   setup->batch.stride = stride;
+
+   for (i = 2; i < nr; i += 3) {
+      uint8_t *dst;
+
+      if ((setup->batch.num_tris + 1) * tri_size > setup->batch.size) {
+         lp_setup_flush_batch(setup);
+         if (tri_size > setup->batch.size) {
+            /* No memory for the batch, set up serially */
+            setup->batch.enabled = FALSE;
+            for (; i < nr; i += 3) {
+               unsigned i0 = indices ? indices[i-2] : i-2;
+               unsigned i1 = indices ? indices[i-1] : i-1;
+               unsigned i2 = indices ? indices[i-0] : i-0;
+               setup->triangle(setup,
+                               (const float (*)[4])((const uint8_t *)vertex_buffer + i0 * stride),
+                               (const float (*)[4])((const uint8_t *)vertex_buffer + i1 * stride),
+                               (const float (*)[4])((const uint8_t *)vertex_buffer + i2 * stride));
+            }
+            return;
+         }
+      }
+
+      dst = setup->batch.verts + setup->batch.num_tris * tri_size;
+      if (indices) {
+         memcpy(dst, (const uint8_t *)vertex_buffer + indices[i-2] * stride, stride);
+         memcpy(dst + stride, (const uint8_t *)vertex_buffer + indices[i-1] * stride, stride);
+         memcpy(dst + 2 * stride, (const uint8_t *)vertex_buffer + indices[i-0] * stride, stride);
+      }
+      else {
+         memcpy(dst, (const uint8_t *)vertex_buffer + (i-2) * stride, tri_size);
+      }
+      setup->batch.num_tris++;
+   }
+}
@@ -41,6 +41,7 @@
 #include "lp_bld_interp.h"	/* for struct lp_shader_input */
 
 #include "draw/draw_vbuf.h"
+#include "util/u_dynarray.h"
 #include "util/u_rect.h"
 #include "util/u_pack_color.h"
 
@@ -54,10 +55,41 @@
 struct lp_setup_variant;
 
 
-/** Max number of scenes */
-/* XXX: make multiple scenes per context work, see lp_setup_rasterize_scene */
-#define MAX_SCENES 1
+/** Triangles per chunk of a parallel setup batch */
+#define LP_SETUP_CHUNK_TRIS 256
 
+/** Vertex data accumulated by a parallel setup batch before it's flushed */
+#define LP_SETUP_BATCH_SIZE (4 * 1024 * 1024)
+
+/** Pseudo command recording an opaque tile, see lp_setup_whole_tile() */
+#define LP_SETUP_BIN_RESET 0xff
+
+
+/**
+ * A command binned by a setup worker, replayed in the scene bins when
+ * the chunk is merged.
+ */
+struct lp_setup_bin_record {
+   uint16_t x, y;
+   uint8_t cmd;
+   union lp_rast_cmd_arg arg;
+};
+
+
+/**
+ * The triangles of a parallel setup batch are split in chunks, which are
+ * set up by the worker threads into their own data blocks and command
+ * records.  The chunks are then merged in the scene in submission order,
+ * which keeps the per-tile command order of the serial setup.
+ */
+struct lp_setup_bin_chunk {
+   struct data_block *data;        /**< triangle data, handed to the scene */
+   unsigned data_size;
+   unsigned max_size;              /**< scene memory the chunk may use */
+   struct util_dynarray records;   /**< struct lp_setup_bin_record */
+   unsigned num_tris;
+   unsigned num_done;              /**< triangles fully recorded */
+};
 
 
 /**
@@ -89,7 +121,8 @@ struct lp_setup_context
    struct draw_stage *vbuf;
    unsigned num_threads;
    unsigned scene_idx;
-   struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
+   unsigned num_scenes;                     /**< LP_NUM_SCENES */
+   struct lp_scene *scenes[LP_MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
    struct lp_fence *last_fence;
@@ -177,6 +210,17 @@ struct lp_setup_context
                      const float (*v0)[4],
                      const float (*v1)[4],
                      const float (*v2)[4]);
+
+   /** Triangles waiting for the parallel setup (LP_PARALLEL_SETUP) */
+   struct {
+      boolean enabled;
+      uint8_t *verts;         /**< three vertices per triangle */
+      unsigned size;          /**< allocated size of verts */
+      unsigned stride;        /**< vertex size */
+      unsigned num_tris;
+      struct lp_setup_bin_chunk *chunks;
+      unsigned num_chunks;    /**< allocated chunks */
+   } batch;
 };
 
 static inline void
@@ -227,10 +271,85 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
 
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_setup_bin_chunk *chunk,
                       struct lp_rast_triangle *tri,
                       const struct u_rect *bboxorig,
                       const struct u_rect *bbox,
                       int nr_planes,
                       unsigned scissor_index);
 
+boolean
+lp_setup_chunk_triangle(struct lp_setup_context *setup,
+                        struct lp_setup_bin_chunk *chunk,
+                        const float (*v0)[4],
+                        const float (*v1)[4],
+                        const float (*v2)[4]);
+
+void *
+lp_setup_chunk_alloc_aligned(struct lp_setup_bin_chunk *chunk,
+                             unsigned size,
+                             unsigned alignment);
+
+void
+lp_setup_batch_init(struct lp_setup_context *setup);
+
+void
+lp_setup_batch_destroy(struct lp_setup_context *setup);
+
+void
+lp_setup_batch_triangles(struct lp_setup_context *setup,
+                         const void *vertex_buffer,
+                         const ushort *indices,
+                         unsigned nr);
+
+
+/**
+ * Whether an opaque whole tile command may drop the previous commands
+ * of its bin.  See lp_setup_whole_tile().
+ */
+static inline boolean
+lp_setup_may_reset_bin(const struct lp_scene *scene)
+{
+   return !scene->fb.zsbuf && scene->fb_max_layer == 0 && !scene->had_queries;
+}
+
+
+static inline boolean
+lp_setup_chunk_record(struct lp_setup_bin_chunk *chunk,
+                      unsigned x, unsigned y,
+                      unsigned cmd,
+                      union lp_rast_cmd_arg arg)
+{
+   struct lp_setup_bin_record *rec =
+      util_dynarray_grow(&chunk->records, struct lp_setup_bin_record, 1);
+
+   if (!rec)
+      return FALSE;
+
+   rec->x = x;
+   rec->y = y;
+   rec->cmd = cmd;
+   rec->arg = arg;
+   return TRUE;
+}
+
+
+/**
+ * Add a command with the current state to bin[x][y] of the scene, or
+ * record it in the chunk when the triangle is set up by a worker.
+ */
+static inline boolean
+lp_setup_bin_cmd(struct lp_setup_context *setup,
+                 struct lp_setup_bin_chunk *chunk,
+                 unsigned x, unsigned y,
+                 unsigned cmd,
+                 union lp_rast_cmd_arg arg)
+{
+   if (chunk)
+      return lp_setup_chunk_record(chunk, x, y, cmd, arg);
+
+   return lp_scene_bin_cmd_with_state(setup->scene, x, y,
+                                      setup->fs.stored, cmd, arg);
+}
+
 #endif
@@ -76,16 +76,18 @@ struct fixed_position {
 /**
  * Alloc space for a new triangle plus the input.a0/dadx/dady arrays
  * immediately after it.
- * The memory is allocated from the per-scene pool, not per-tile.
+ * The memory is allocated from the per-scene pool, not per-tile, or
+ * from the chunk when it is set up by a worker thread.
  * \param tri_size  returns number of bytes allocated
  * \param num_inputs  number of fragment shader inputs
  * \return pointer to triangle space
  */
-struct lp_rast_triangle *
-lp_setup_alloc_triangle(struct lp_scene *scene,
-                        unsigned nr_inputs,
-                        unsigned nr_planes,
-                        unsigned *tri_size)
+static inline struct lp_rast_triangle *
+alloc_triangle(struct lp_scene *scene,
+               struct lp_setup_bin_chunk *chunk,
+               unsigned nr_inputs,
+               unsigned nr_planes,
+               unsigned *tri_size)
 {
    unsigned input_array_sz = NUM_CHANNELS * (nr_inputs + 1) * sizeof(float);
    unsigned plane_sz = nr_planes * sizeof(struct lp_rast_plane);
@@ -97,7 +99,10 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
                 3 * input_array_sz +
                 plane_sz);
 
-   tri = lp_scene_alloc_aligned( scene, *tri_size, 16 );
+   if (chunk)
+      tri = lp_setup_chunk_alloc_aligned( chunk, *tri_size, 16 );
+   else
+      tri = lp_scene_alloc_aligned( scene, *tri_size, 16 );
    if (!tri)
       return NULL;
 
@@ -113,6 +118,16 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
    return tri;
 }
 
+
+struct lp_rast_triangle *
+lp_setup_alloc_triangle(struct lp_scene *scene,
+                        unsigned nr_inputs,
+                        unsigned nr_planes,
+                        unsigned *tri_size)
+{
+   return alloc_triangle(scene, NULL, nr_inputs, nr_planes, tri_size);
+}
+
 void
 lp_setup_print_vertex(struct lp_setup_context *setup,
                       const char *name,
@@ -225,11 +240,10 @@ lp_rast_ms_tri_tab[MAX_PLANES+1] = {
  */
 static boolean
 lp_setup_whole_tile(struct lp_setup_context *setup,
+                    struct lp_setup_bin_chunk *chunk,
                     const struct lp_rast_shader_inputs *inputs,
                     int tx, int ty)
 {
-   struct lp_scene *scene = setup->scene;
-
    LP_COUNT(nr_fully_covered_64);
 
    /* if variant is opaque and scissor doesn't effect the tile */
@@ -246,24 +260,28 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
        * accurate query results we unfortunately need to execute the rendering
        * commands.
        */
-      if (!scene->fb.zsbuf && scene->fb_max_layer == 0 && !scene->had_queries) {
+      if (chunk) {
+         /* The scene is only known when the chunk gets merged */
+         if (!lp_setup_chunk_record( chunk, tx, ty, LP_SETUP_BIN_RESET,
+                                     lp_rast_arg_null() ))
+            return FALSE;
+      }
+      else if (lp_setup_may_reset_bin(setup->scene)) {
          /*
           * All previous rendering will be overwritten so reset the bin.
           */
-         lp_scene_bin_reset( scene, tx, ty );
+         lp_scene_bin_reset( setup->scene, tx, ty );
       }
 
       LP_COUNT(nr_shade_opaque_64);
-      return lp_scene_bin_cmd_with_state( scene, tx, ty,
-                                          setup->fs.stored,
-                                          LP_RAST_OP_SHADE_TILE_OPAQUE,
-                                          lp_rast_arg_inputs(inputs) );
+      return lp_setup_bin_cmd( setup, chunk, tx, ty,
+                               LP_RAST_OP_SHADE_TILE_OPAQUE,
+                               lp_rast_arg_inputs(inputs) );
    } else {
       LP_COUNT(nr_shade_64);
-      return lp_scene_bin_cmd_with_state( scene, tx, ty,
-                                          setup->fs.stored,
-                                          LP_RAST_OP_SHADE_TILE,
-                                          lp_rast_arg_inputs(inputs) );
+      return lp_setup_bin_cmd( setup, chunk, tx, ty,
+                               LP_RAST_OP_SHADE_TILE,
+                               lp_rast_arg_inputs(inputs) );
    }
 }
 
@@ -275,6 +293,7 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
  */
 static boolean
 do_triangle_ccw(struct lp_setup_context *setup,
+                struct lp_setup_bin_chunk *chunk,
                 struct fixed_position* position,
                 const float (*v0)[4],
                 const float (*v1)[4],
@@ -364,10 +383,10 @@ do_triangle_ccw(struct lp_setup_context *setup,
    scissor_planes_needed(s_planes, &bboxpos, scissor);
    nr_planes += s_planes[0] + s_planes[1] + s_planes[2] + s_planes[3];
 
-   tri = lp_setup_alloc_triangle(scene,
-                                 key->num_inputs,
-                                 nr_planes,
-                                 &tri_bytes);
+   tri = alloc_triangle(scene, chunk,
+                        key->num_inputs,
+                        nr_planes,
+                        &tri_bytes);
    if (!tri)
       return FALSE;
 
@@ -727,7 +746,8 @@ do_triangle_ccw(struct lp_setup_context *setup,
       assert(plane_s == &plane[nr_planes]);
    }
 
-   return lp_setup_bin_triangle(setup, tri, &bbox, &bboxpos, nr_planes, viewport_index);
+   return lp_setup_bin_triangle(setup, chunk, tri, &bbox, &bboxpos,
+                                nr_planes, viewport_index);
 }
 
 /*
@@ -760,13 +780,13 @@ floor_pot(uint32_t n)
 
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
+                      struct lp_setup_bin_chunk *chunk,
                       struct lp_rast_triangle *tri,
                       const struct u_rect *bboxorig,
                       const struct u_rect *bbox,
                       int nr_planes,
                       unsigned viewport_index)
 {
-   struct lp_scene *scene = setup->scene;
    struct u_rect trimmed_box = *bbox;   
    int i;
    unsigned cmd;
@@ -824,9 +844,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                cmd = LP_RAST_OP_MS_TRIANGLE_3_4;
             else
                cmd = use_32bits ? LP_RAST_OP_TRIANGLE_32_3_4 : LP_RAST_OP_TRIANGLE_3_4;
-            return lp_scene_bin_cmd_with_state( scene, ix0, iy0,
-                                                setup->fs.stored, cmd,
-                                                lp_rast_arg_triangle_contained(tri, px, py) );
+            return lp_setup_bin_cmd( setup, chunk, ix0, iy0, cmd,
+                                     lp_rast_arg_triangle_contained(tri, px, py) );
          }
 
          if (sz < 16)
@@ -849,9 +868,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                cmd = LP_RAST_OP_MS_TRIANGLE_3_16;
             else
                cmd = use_32bits ? LP_RAST_OP_TRIANGLE_32_3_16 : LP_RAST_OP_TRIANGLE_3_16;
-            return lp_scene_bin_cmd_with_state( scene, ix0, iy0,
-                                                setup->fs.stored, cmd,
-                                                lp_rast_arg_triangle_contained(tri, px, py) );
+            return lp_setup_bin_cmd( setup, chunk, ix0, iy0, cmd,
+                                     lp_rast_arg_triangle_contained(tri, px, py) );
          }
       }
       else if (nr_planes == 4 && sz < 16) 
@@ -866,9 +884,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
             cmd = LP_RAST_OP_MS_TRIANGLE_4_16;
          else
             cmd = use_32bits ? LP_RAST_OP_TRIANGLE_32_4_16 : LP_RAST_OP_TRIANGLE_4_16;
-         return lp_scene_bin_cmd_with_state(scene, ix0, iy0,
-                                            setup->fs.stored, cmd,
-                                            lp_rast_arg_triangle_contained(tri, px, py));
+         return lp_setup_bin_cmd(setup, chunk, ix0, iy0, cmd,
+                                 lp_rast_arg_triangle_contained(tri, px, py));
       }
 
 
@@ -878,8 +895,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
          cmd = lp_rast_ms_tri_tab[nr_planes];
       else
          cmd = use_32bits ? lp_rast_32_tri_tab[nr_planes] : lp_rast_tri_tab[nr_planes];
-      return lp_scene_bin_cmd_with_state(
-         scene, ix0, iy0, setup->fs.stored, cmd,
+      return lp_setup_bin_cmd(
+         setup, chunk, ix0, iy0, cmd,
          lp_rast_arg_triangle(tri, (1<<nr_planes)-1));
    }
    else
@@ -956,9 +973,8 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                   cmd = lp_rast_ms_tri_tab[count];
                else
                   cmd = use_32bits ? lp_rast_32_tri_tab[count] : lp_rast_tri_tab[count];
-               if (!lp_scene_bin_cmd_with_state( scene, x, y,
-                                                 setup->fs.stored, cmd,
-                                                 lp_rast_arg_triangle(tri, partial) ))
+               if (!lp_setup_bin_cmd( setup, chunk, x, y, cmd,
+                                      lp_rast_arg_triangle(tri, partial) ))
                   goto fail;
 
                LP_COUNT(nr_partially_covered_64);
@@ -967,7 +983,7 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                /* triangle covers the whole tile- shade whole tile */
                LP_COUNT(nr_fully_covered_64);
                in = TRUE;
-               if (!lp_setup_whole_tile(setup, &tri->inputs, x, y))
+               if (!lp_setup_whole_tile(setup, chunk, &tri->inputs, x, y))
                   goto fail;
             }
 
@@ -1004,12 +1020,12 @@ static void retry_triangle_ccw( struct lp_setup_context *setup,
                                 const float (*v2)[4],
                                 boolean front)
 {
-   if (!do_triangle_ccw( setup, position, v0, v1, v2, front ))
+   if (!do_triangle_ccw( setup, NULL, position, v0, v1, v2, front ))
    {
       if (!lp_setup_flush_and_restart(setup))
          return;
 
-      if (!do_triangle_ccw( setup, position, v0, v1, v2, front ))
+      if (!do_triangle_ccw( setup, NULL, position, v0, v1, v2, front ))
          return;
    }
 }
@@ -1226,6 +1242,60 @@ static void triangle_both(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Cull and set up a triangle of a parallel setup batch, recording its
+ * commands in the chunk.  Called by the worker threads.
+ * \return FALSE if the chunk ran out of memory
+ */
+boolean
+lp_setup_chunk_triangle(struct lp_setup_context *setup,
+                        struct lp_setup_bin_chunk *chunk,
+                        const float (*v0)[4],
+                        const float (*v1)[4],
+                        const float (*v2)[4])
+{
+   PIPE_ALIGN_VAR(16) struct fixed_position position;
+   boolean draw_ccw, draw_cw;
+
+   switch (setup->cullmode) {
+   case PIPE_FACE_NONE:
+      draw_ccw = draw_cw = TRUE;
+      break;
+   case PIPE_FACE_BACK:
+      draw_ccw = setup->ccw_is_frontface;
+      draw_cw = !setup->ccw_is_frontface;
+      break;
+   case PIPE_FACE_FRONT:
+      draw_ccw = !setup->ccw_is_frontface;
+      draw_cw = setup->ccw_is_frontface;
+      break;
+   default:
+      return TRUE;
+   }
+
+   calc_fixed_position(setup, &position, v0, v1, v2);
+
+   if (position.area > 0) {
+      if (draw_ccw)
+         return do_triangle_ccw( setup, chunk, &position, v0, v1, v2,
+                                 setup->ccw_is_frontface );
+   }
+   else if (position.area < 0 && draw_cw) {
+      if (setup->flatshade_first) {
+         rotate_fixed_position_12( &position );
+         return do_triangle_ccw( setup, chunk, &position, v0, v2, v1,
+                                 !setup->ccw_is_frontface );
+      } else {
+         rotate_fixed_position_01( &position );
+         return do_triangle_ccw( setup, chunk, &position, v1, v0, v2,
+                                 !setup->ccw_is_frontface );
+      }
+   }
+
+   return TRUE;
+}
+
+
 static void triangle_noop(struct lp_setup_context *setup,
                           const float (*v0)[4],
                           const float (*v1)[4],
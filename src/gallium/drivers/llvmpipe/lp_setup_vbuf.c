@@ -126,6 +126,19 @@ lp_setup_set_view_index(struct vbuf_render *vbr, unsigned view_index)
    lp_setup_context(vbr)->view_index = view_index;
 }
 
+/**
+ * Whether the triangles of the current primitive go to the parallel
+ * setup batch, see lp_setup_batch.c.
+ */
+static inline boolean
+lp_setup_use_batch(struct lp_setup_context *setup)
+{
+   return setup->batch.enabled &&
+          setup->prim == PIPE_PRIM_TRIANGLES &&
+          !setup->rasterizer_discard &&
+          !llvmpipe_context(setup->pipe)->active_statistics_queries;
+}
+
 typedef const float (*const_float4_ptr)[4];
 
 static inline const_float4_ptr get_vert( const void *vertex_buffer,
@@ -152,6 +165,14 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_use_batch(setup)) {
+      lp_setup_batch_triangles(setup, vertex_buffer, indices, nr);
+      return;
+   }
+
+   /* Keep the primitives in order */
+   lp_setup_flush_batch(setup);
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -350,6 +371,14 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_use_batch(setup)) {
+      lp_setup_batch_triangles(setup, vertex_buffer, NULL, nr);
+      return;
+   }
+
+   /* Keep the primitives in order */
+   lp_setup_flush_batch(setup);
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -116,12 +116,25 @@ llvmpipe_update_fs(struct llvmpipe_context *lp);
 void 
 llvmpipe_update_setup(struct llvmpipe_context *lp);
 
+void
+llvmpipe_evict_variants(struct llvmpipe_context *lp);
+
+void
+llvmpipe_remove_variants(struct llvmpipe_context *lp);
+
 void
 llvmpipe_update_derived(struct llvmpipe_context *llvmpipe);
 
 void
 llvmpipe_init_sampler_funcs(struct llvmpipe_context *llvmpipe);
 
+void
+llvmpipe_sampler_static_texture_state(struct lp_static_texture_state *state,
+                                      const struct pipe_sampler_view *view);
+
+void
+llvmpipe_check_texture_layouts(struct llvmpipe_context *llvmpipe);
+
 void
 llvmpipe_init_blend_funcs(struct llvmpipe_context *llvmpipe);
 
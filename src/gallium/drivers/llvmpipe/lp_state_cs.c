@@ -45,6 +45,7 @@
 #include "lp_memory.h"
 #include "lp_query.h"
 #include "lp_cs_tpool.h"
+#include "lp_flush.h"
 #include "frontend/sw_winsys.h"
 #include "nir/nir_to_tgsi_info.h"
 #include "util/mesa-sha1.h"
@@ -144,7 +145,7 @@ generate_compute(struct llvmpipe_context *lp,
 
    lp_build_coro_declare_malloc_hooks(gallivm);
 
-   if (variant->gallivm->cache->data_size)
+   if (variant->gallivm->cache && variant->gallivm->cache->data_size)
       return;
 
    context_ptr  = LLVMGetParam(function, 0);
@@ -498,7 +499,7 @@ llvmpipe_bind_compute_state(struct pipe_context *pipe,
  * Remove shader variant from two lists: the shader's variant list
  * and the context's variant list.
  */
-static void
+void
 llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
                                   struct lp_compute_shader_variant *variant)
 {
@@ -511,7 +512,17 @@ llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
                    lp->nr_cs_variants, variant->nr_instrs, lp->nr_cs_instrs);
    }
 
+   /* Cancel the optimized build, or wait for it if it's running */
+   if (!util_queue_fence_is_signalled(&variant->opt_fence))
+      util_queue_drop_job(&llvmpipe_screen(lp->pipe.screen)->jit_queue,
+                          &variant->opt_fence);
+   util_queue_fence_destroy(&variant->opt_fence);
+
    gallivm_destroy(variant->gallivm);
+   if (variant->opt_gallivm)
+      gallivm_destroy(variant->opt_gallivm);
+   p_atomic_add(&lp->variant_code_size,
+                -(int64_t)(variant->code_size + variant->opt_code_size));
 
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
@@ -590,8 +601,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&cs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+            llvmpipe_sampler_static_texture_state(&cs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
          }
       }
    }
@@ -599,8 +610,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&cs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+            llvmpipe_sampler_static_texture_state(&cs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
          }
       }
    }
@@ -710,6 +721,107 @@ lp_cs_get_ir_cache_key(struct lp_compute_shader_variant *variant,
    blob_finish(&blob);
 }
 
+/**
+ * Background build of the optimized code of a compute shader variant.
+ */
+struct lp_cs_variant_opt_job
+{
+   struct lp_variant_opt_job base;
+
+   struct llvmpipe_context *lp;
+   struct lp_compute_shader_variant *variant;
+
+   /* Snapshot of the shader, using the job's copy of the NIR */
+   struct lp_compute_shader shader;
+
+   /* The variant the optimized code is generated for */
+   struct lp_compute_shader_variant *opt;
+};
+
+static bool
+optimize_variant_generate(struct lp_variant_opt_job *base,
+                          struct gallivm_state *gallivm)
+{
+   struct lp_cs_variant_opt_job *job = (struct lp_cs_variant_opt_job *)base;
+   struct lp_compute_shader *shader = &job->shader;
+   struct lp_compute_shader_variant *variant = job->variant;
+   struct lp_compute_shader_variant *opt;
+
+   opt = CALLOC(1, sizeof *opt + shader->variant_key_size - sizeof opt->key);
+   if (!opt)
+      return false;
+
+   opt->gallivm = gallivm;
+   opt->shader = variant->shader;
+   opt->no = variant->no;
+   memcpy(&opt->key, &variant->key, shader->variant_key_size);
+
+   shader->base.ir.nir = base->nir;
+
+   lp_jit_init_cs_types(opt);
+
+   generate_compute(job->lp, shader, opt);
+
+   job->opt = opt;
+   return true;
+}
+
+static void
+optimize_variant_publish(struct lp_variant_opt_job *base,
+                         struct gallivm_state *gallivm)
+{
+   struct lp_cs_variant_opt_job *job = (struct lp_cs_variant_opt_job *)base;
+   struct lp_compute_shader_variant *variant = job->variant;
+   lp_jit_cs_func jit_function;
+
+   lp_build_coro_add_malloc_hooks(gallivm);
+   jit_function = (lp_jit_cs_func)gallivm_jit_function(gallivm,
+                                                       job->opt->function);
+
+   /* The compute threads pick up the new code on their next block */
+   variant->opt_gallivm = gallivm;
+   variant->opt_code_size = gallivm_get_code_size(gallivm);
+   p_atomic_add(&job->lp->variant_code_size, variant->opt_code_size);
+   p_atomic_set(&variant->jit_function, jit_function);
+
+   if (LP_DEBUG & DEBUG_CS)
+      debug_printf("llvmpipe: optimized cs #%u variant %u\n",
+                   job->shader.no, variant->no);
+
+   FREE(job->opt);
+}
+
+/**
+ * Queue the build of the optimized code of a variant whose first code
+ * was built without optimizations.
+ * \param ir_sha1_cache_key  key to store the code in the disk cache with,
+ *                           or NULL
+ */
+static void
+queue_optimized_variant(struct llvmpipe_context *lp,
+                        struct lp_compute_shader_variant *variant,
+                        const unsigned char *ir_sha1_cache_key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_compute_shader *shader = variant->shader;
+   struct lp_cs_variant_opt_job *job;
+
+   job = CALLOC_STRUCT(lp_cs_variant_opt_job);
+   if (!job)
+      return;
+
+   snprintf(job->base.module_name, sizeof(job->base.module_name),
+            "cs%u_variant%u_opt", shader->no, variant->no);
+   job->base.generate = optimize_variant_generate;
+   job->base.publish = optimize_variant_publish;
+   job->lp = lp;
+   job->variant = variant;
+   job->shader = *shader;
+
+   lp_queue_optimized_variant(screen, &job->base, &variant->opt_fence,
+                              shader->base.ir.nir, ir_sha1_cache_key);
+}
+
 static struct lp_compute_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
                  struct lp_compute_shader *shader,
@@ -721,11 +833,13 @@ generate_variant(struct llvmpipe_context *lp,
    unsigned char ir_sha1_cache_key[20];
    struct lp_cached_code cached = { 0 };
    bool needs_caching = false;
+   bool tiered = false;
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
 
    memset(variant, 0, sizeof(*variant));
+   util_queue_fence_init(&variant->opt_fence);
    snprintf(module_name, sizeof(module_name), "cs%u_variant%u",
             shader->no, shader->variants_created);
 
@@ -739,8 +853,19 @@ generate_variant(struct llvmpipe_context *lp,
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+
+   /* As for fragment shaders, a variant missing from the disk cache is
+    * first built without optimizations when LP_TIERED_JIT is set.
+    */
+   if (screen->tiered_jit && !cached.data_size) {
+      tiered = true;
+      variant->gallivm = gallivm_create_unoptimized(module_name, lp->context);
+   }
+   else {
+      variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+   }
    if (!variant->gallivm) {
+      util_queue_fence_destroy(&variant->opt_fence);
       FREE(variant);
       return NULL;
    }
@@ -766,10 +891,16 @@ generate_variant(struct llvmpipe_context *lp,
 
    variant->jit_function = (lp_jit_cs_func)gallivm_jit_function(variant->gallivm, variant->function);
 
-   if (needs_caching) {
+   if (needs_caching && !tiered) {
       lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    }
    gallivm_free_ir(variant->gallivm);
+
+   variant->code_size = gallivm_get_code_size(variant->gallivm);
+
+   if (tiered)
+      queue_optimized_variant(lp, variant,
+                              needs_caching ? ir_sha1_cache_key : NULL);
    return variant;
 }
 
@@ -811,8 +942,6 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
    else {
       /* variant not found, create it now */
       int64_t t0, t1, dt;
-      unsigned i;
-      unsigned variants_to_cull;
 
       if (LP_DEBUG & DEBUG_CS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
@@ -821,38 +950,9 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
                       lp->nr_cs_variants ? lp->nr_cs_instrs / lp->nr_cs_variants : 0);
       }
 
-      /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 6.25% of them (the least recently used ones).
-       */
-      variants_to_cull = lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
-
-      if (variants_to_cull ||
-          lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
-         if (gallivm_debug & GALLIVM_DEBUG_PERF) {
-            debug_printf("Evicting CS: %u cs variants,\t%u total variants,"
-                         "\t%u instrs,\t%u instrs/variant\n",
-                         shader->variants_cached,
-                         lp->nr_cs_variants, lp->nr_cs_instrs,
-                         lp->nr_cs_instrs / lp->nr_cs_variants);
-         }
+      /* Make room for the new variant in the variant cache budget */
+      llvmpipe_evict_variants(lp);
 
-         /*
-          * We need to re-check lp->nr_cs_variants because an arbitrarily large
-          * number of shader variants (potentially all of them) could be
-          * pending for destruction on flush.
-          */
-
-         for (i = 0; i < variants_to_cull || lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
-            struct lp_cs_variant_list_item *item;
-            if (is_empty_list(&lp->cs_variants_list)) {
-               break;
-            }
-            item = last_elem(&lp->cs_variants_list);
-            assert(item);
-            assert(item->base);
-            llvmpipe_remove_cs_shader_variant(lp, item->base);
-         }
-      }
       /*
        * Generate the new variant.
        */
@@ -869,9 +969,14 @@ llvmpipe_update_cs(struct llvmpipe_context *lp)
          insert_at_head(&lp->cs_variants_list, &variant->list_item_global);
          lp->nr_cs_variants++;
          lp->nr_cs_instrs += variant->nr_instrs;
+         p_atomic_add(&lp->variant_code_size, variant->code_size);
          shader->variants_cached++;
       }
    }
+
+   if (variant)
+      variant->last_use = ++lp->variant_timestamp;
+
    /* Bind this variant */
    lp_cs_ctx_set_cs_variant(lp->csctx, variant);
 }
@@ -1326,6 +1431,44 @@ fill_grid_size(struct pipe_context *pipe,
    pipe_buffer_unmap(pipe, transfer);
 }
 
+/**
+ * Compute jobs run right away on the thread pool, not after the scenes in
+ * flight, so wait for the scenes which use the resources of the shader.
+ */
+static void
+llvmpipe_cs_wait_for_scenes(struct llvmpipe_context *llvmpipe)
+{
+   struct pipe_context *pipe = &llvmpipe->pipe;
+   unsigned i;
+
+   for (i = 0; i < llvmpipe->num_sampler_views[PIPE_SHADER_COMPUTE]; i++) {
+      struct pipe_sampler_view *view =
+         llvmpipe->sampler_views[PIPE_SHADER_COMPUTE][i];
+
+      if (view)
+         llvmpipe_flush_resource(pipe, view->texture, 0, TRUE, TRUE, FALSE,
+                                 "compute sampling");
+   }
+
+   for (i = 0; i < llvmpipe->num_images[PIPE_SHADER_COMPUTE]; i++) {
+      struct pipe_resource *img =
+         llvmpipe->images[PIPE_SHADER_COMPUTE][i].resource;
+
+      if (img)
+         llvmpipe_flush_resource(pipe, img, 0, FALSE, TRUE, FALSE,
+                                 "compute images");
+   }
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->ssbos[PIPE_SHADER_COMPUTE]); i++) {
+      struct pipe_resource *buffer =
+         llvmpipe->ssbos[PIPE_SHADER_COMPUTE][i].buffer;
+
+      if (buffer)
+         llvmpipe_flush_resource(pipe, buffer, 0, FALSE, TRUE, FALSE,
+                                 "compute ssbos");
+   }
+}
+
 static void llvmpipe_launch_grid(struct pipe_context *pipe,
                                  const struct pipe_grid_info *info)
 {
@@ -1338,6 +1481,8 @@ static void llvmpipe_launch_grid(struct pipe_context *pipe,
 
    memset(&job_info, 0, sizeof(job_info));
 
+   llvmpipe_check_texture_layouts(llvmpipe);
+   llvmpipe_cs_wait_for_scenes(llvmpipe);
    llvmpipe_cs_update_derived(llvmpipe, info->input);
 
    fill_grid_size(pipe, info, job_info.grid_size);
@@ -28,6 +28,7 @@
 
 #include "os/os_thread.h"
 #include "util/u_thread.h"
+#include "util/u_queue.h"
 #include "pipe/p_state.h"
 
 #include "gallivm/lp_bld.h"
@@ -77,6 +78,10 @@ struct lp_compute_shader_variant
 {
    struct gallivm_state *gallivm;
 
+   /* With LP_TIERED_JIT, the optimized code built in the background */
+   struct gallivm_state *opt_gallivm;
+   struct util_queue_fence opt_fence;
+
    LLVMTypeRef jit_cs_context_ptr_type;
    LLVMTypeRef jit_cs_thread_data_ptr_type;
 
@@ -86,6 +91,13 @@ struct lp_compute_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /* Bytes of JIT code and data of gallivm and opt_gallivm */
+   uint64_t code_size;
+   uint64_t opt_code_size;
+
+   /* lp->variant_timestamp when last bound, for LRU eviction */
+   uint64_t last_use;
+
    struct lp_cs_variant_list_item list_item_global, list_item_local;
 
    struct lp_compute_shader *shader;
@@ -152,4 +164,8 @@ struct lp_cs_context {
 struct lp_cs_context *lp_csctx_create(struct pipe_context *pipe);
 void lp_csctx_destroy(struct lp_cs_context *csctx);
 
+void
+llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
+                                  struct lp_compute_shader_variant *variant);
+
 #endif
@@ -27,14 +27,21 @@
 
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/simple_list.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "draw/draw_vertex.h"
 #include "draw/draw_private.h"
+#include "gallivm/lp_bld_debug.h"
 #include "lp_context.h"
+#include "lp_flush.h"
 #include "lp_screen.h"
 #include "lp_setup.h"
 #include "lp_state.h"
+#include "lp_state_cs.h"
+#include "lp_state_fs.h"
+#include "lp_state_setup.h"
 
 
 
@@ -296,3 +303,96 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
    llvmpipe->dirty = 0;
 }
 
+
+/**
+ * Evict the least recently bound fragment shader, compute shader and setup
+ * variants, whichever kind they are, until the JIT code of the variants
+ * left fits within the screen's budget (LP_VARIANT_CACHE_SIZE).  Called
+ * before a new variant is added.  The variants currently bound are kept.
+ */
+void
+llvmpipe_evict_variants(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   boolean finished = FALSE;
+
+   if ((gallivm_debug & GALLIVM_DEBUG_PERF) &&
+       p_atomic_read(&lp->variant_code_size) >= screen->variant_cache_size) {
+      debug_printf("Evicting variants: %"PRIu64" bytes of code,"
+                   "\t%u fs,\t%u cs,\t%u setup variants\n",
+                   p_atomic_read(&lp->variant_code_size), lp->nr_fs_variants,
+                   lp->nr_cs_variants, lp->nr_setup_variants);
+   }
+
+   while (p_atomic_read(&lp->variant_code_size) >= screen->variant_cache_size) {
+      struct lp_fs_variant_list_item *fs_item;
+      struct lp_cs_variant_list_item *cs_item;
+      struct lp_setup_variant_list_item *setup_item;
+      uint64_t oldest = UINT64_MAX;
+
+      /* Each list is in LRU order, so only the tails need comparing */
+      fs_item = last_elem(&lp->fs_variants_list);
+      while (!at_end(&lp->fs_variants_list, fs_item) &&
+             lp_setup_is_variant_bound(lp->setup, fs_item->base))
+         fs_item = prev_elem(fs_item);
+      cs_item = last_elem(&lp->cs_variants_list);
+      while (!at_end(&lp->cs_variants_list, cs_item) &&
+             cs_item->base == lp->csctx->cs.current.variant)
+         cs_item = prev_elem(cs_item);
+      setup_item = last_elem(&lp->setup_variants_list);
+      while (!at_end(&lp->setup_variants_list, setup_item) &&
+             lp_setup_is_variant_bound(lp->setup, setup_item->base))
+         setup_item = prev_elem(setup_item);
+
+      if (!at_end(&lp->fs_variants_list, fs_item))
+         oldest = MIN2(oldest, fs_item->base->last_use);
+      if (!at_end(&lp->cs_variants_list, cs_item))
+         oldest = MIN2(oldest, cs_item->base->last_use);
+      if (!at_end(&lp->setup_variants_list, setup_item))
+         oldest = MIN2(oldest, setup_item->base->last_use);
+
+      if (!at_end(&lp->fs_variants_list, fs_item) &&
+          fs_item->base->last_use == oldest) {
+         struct lp_fragment_shader_variant *variant = fs_item->base;
+         llvmpipe_remove_shader_variant(lp, variant);
+         lp_fs_variant_reference(lp, &variant, NULL);
+      }
+      else if (!at_end(&lp->cs_variants_list, cs_item) &&
+               cs_item->base->last_use == oldest) {
+         llvmpipe_remove_cs_shader_variant(lp, cs_item->base);
+      }
+      else if (!at_end(&lp->setup_variants_list, setup_item)) {
+         /* Setup variants aren't referenced by the scenes, wait for them */
+         if (!finished) {
+            llvmpipe_finish(&lp->pipe, __FUNCTION__);
+            finished = TRUE;
+         }
+         lp_remove_setup_variant(lp, setup_item->base);
+      }
+      else {
+         /* Only bound variants left */
+         break;
+      }
+   }
+}
+
+
+/**
+ * Remove the fragment and compute shader variants still cached when the
+ * context is destroyed, cancelling or waiting for their background builds,
+ * which would otherwise publish their code into a freed context.
+ */
+void
+llvmpipe_remove_variants(struct llvmpipe_context *lp)
+{
+   while (!is_empty_list(&lp->fs_variants_list)) {
+      struct lp_fragment_shader_variant *variant =
+         last_elem(&lp->fs_variants_list)->base;
+      llvmpipe_remove_shader_variant(lp, variant);
+      lp_fs_variant_reference(lp, &variant, NULL);
+   }
+
+   while (!is_empty_list(&lp->cs_variants_list))
+      llvmpipe_remove_cs_shader_variant(lp,
+                                        last_elem(&lp->cs_variants_list)->base);
+}
@@ -3050,7 +3050,7 @@ generate_fragment(struct llvmpipe_context *lp,
       if(LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
          lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
 
-   if (variant->gallivm->cache->data_size)
+   if (variant->gallivm->cache && variant->gallivm->cache->data_size)
       return;
 
    context_ptr  = LLVMGetParam(function, 0);
@@ -3451,6 +3451,7 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
       nir_print_shader(variant->shader->base.ir.nir, stderr);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
+   debug_printf("variant->linear = %u\n", variant->linear);
    debug_printf("\n");
 }
 
@@ -3476,6 +3477,178 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
    blob_finish(&blob);
 }
 
+/**
+ * Background build of the optimized code of a fragment shader variant, or
+ * of its first code with LP_ASYNC_JIT.
+ */
+struct lp_fs_variant_opt_job
+{
+   struct lp_variant_opt_job base;
+
+   struct llvmpipe_context *lp;
+   struct lp_fragment_shader_variant *variant;
+
+   /* Snapshot of the shader, using the job's copy of the NIR */
+   struct lp_fragment_shader shader;
+
+   /* The variant the optimized code is generated for */
+   struct lp_fragment_shader_variant *opt;
+};
+
+
+static bool
+optimize_variant_generate(struct lp_variant_opt_job *base,
+                          struct gallivm_state *gallivm)
+{
+   struct lp_fs_variant_opt_job *job = (struct lp_fs_variant_opt_job *)base;
+   struct lp_fragment_shader *shader = &job->shader;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   struct lp_fragment_shader_variant *opt;
+
+   opt = CALLOC(1, sizeof *opt + shader->variant_key_size - sizeof opt->key);
+   if (!opt)
+      return false;
+
+   opt->gallivm = gallivm;
+   opt->opaque = variant->opaque;
+   opt->shader = variant->shader;
+   opt->no = variant->no;
+   memcpy(&opt->key, &variant->key, shader->variant_key_size);
+
+   shader->base.ir.nir = base->nir;
+
+   lp_jit_init_types(opt);
+
+   generate_fragment(job->lp, shader, opt, RAST_EDGE_TEST);
+   if (opt->opaque)
+      generate_fragment(job->lp, shader, opt, RAST_WHOLE);
+
+   job->opt = opt;
+   return true;
+}
+
+
+static void
+optimize_variant_publish(struct lp_variant_opt_job *base,
+                         struct gallivm_state *gallivm)
+{
+   struct lp_fs_variant_opt_job *job = (struct lp_fs_variant_opt_job *)base;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   struct lp_fragment_shader_variant *opt = job->opt;
+   lp_jit_frag_func edge_test, whole;
+
+   edge_test = (lp_jit_frag_func)
+         gallivm_jit_function(gallivm, opt->function[RAST_EDGE_TEST]);
+   whole = opt->function[RAST_WHOLE] ?
+         (lp_jit_frag_func)gallivm_jit_function(gallivm,
+                                                opt->function[RAST_WHOLE]) :
+         edge_test;
+
+   if (base->unoptimized) {
+      /* Nothing runs the variant before build_fence is signalled */
+      variant->gallivm = gallivm;
+      variant->code_size = gallivm_get_code_size(gallivm);
+      p_atomic_add(&job->lp->variant_code_size, variant->code_size);
+   }
+   else {
+      /* The rasterizer threads pick up the new code on their next call */
+      variant->opt_gallivm = gallivm;
+      variant->opt_code_size = gallivm_get_code_size(gallivm);
+      p_atomic_add(&job->lp->variant_code_size, variant->opt_code_size);
+   }
+   p_atomic_set(&variant->jit_function[RAST_EDGE_TEST], edge_test);
+   p_atomic_set(&variant->jit_function[RAST_WHOLE], whole);
+
+   if (LP_DEBUG & DEBUG_FS)
+      debug_printf("llvmpipe: %s fs #%u variant %u\n",
+                   base->unoptimized ? "built" : "optimized",
+                   job->shader.no, variant->no);
+
+   FREE(opt);
+}
+
+
+static struct lp_fs_variant_opt_job *
+create_variant_job(struct llvmpipe_context *lp,
+                   struct lp_fragment_shader_variant *variant,
+                   bool unoptimized)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   struct lp_fs_variant_opt_job *job;
+
+   job = CALLOC_STRUCT(lp_fs_variant_opt_job);
+   if (!job)
+      return NULL;
+
+   snprintf(job->base.module_name, sizeof(job->base.module_name),
+            "fs%u_variant%u%s", shader->no, variant->no,
+            unoptimized ? "" : "_opt");
+   job->base.unoptimized = unoptimized;
+   job->base.generate = optimize_variant_generate;
+   job->base.publish = optimize_variant_publish;
+   job->lp = lp;
+   job->variant = variant;
+   job->shader = *shader;
+   return job;
+}
+
+
+/**
+ * Queue the build of the optimized code of a variant whose first code
+ * was built without optimizations.
+ * \param ir_sha1_cache_key  key to store the code in the disk cache with,
+ *                           or NULL
+ */
+static void
+queue_optimized_variant(struct llvmpipe_context *lp,
+                        struct lp_fragment_shader_variant *variant,
+                        const unsigned char *ir_sha1_cache_key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fs_variant_opt_job *job;
+
+   job = create_variant_job(lp, variant, false);
+   if (!job)
+      return;
+
+   lp_queue_optimized_variant(screen, &job->base, &variant->opt_fence,
+                              variant->shader->base.ir.nir, ir_sha1_cache_key);
+}
+
+
+/**
+ * With LP_ASYNC_JIT, queue the build of the first, unoptimized code of a
+ * variant, followed by the build of its optimized code.  The variant can
+ * be bound and binned right away, the rasterizer waits for build_fence
+ * before running the scenes using it.
+ * \return FALSE if the first build couldn't be queued
+ */
+static boolean
+queue_variant_build(struct llvmpipe_context *lp,
+                    struct lp_fragment_shader_variant *variant,
+                    const unsigned char *ir_sha1_cache_key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   const struct nir_shader *nir = variant->shader->base.ir.nir;
+   struct lp_fs_variant_opt_job *build, *opt;
+
+   build = create_variant_job(lp, variant, true);
+   if (!build || !lp_prepare_variant_job(screen, &build->base, nir, NULL))
+      return FALSE;
+
+   opt = create_variant_job(lp, variant, false);
+   if (opt && lp_prepare_variant_job(screen, &opt->base, nir,
+                                     ir_sha1_cache_key)) {
+      build->base.next = &opt->base;
+      build->base.next_fence = &variant->opt_fence;
+   }
+
+   lp_queue_variant_job(&screen->build_queue, &build->base,
+                        &variant->build_fence);
+   return TRUE;
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
@@ -3493,11 +3666,15 @@ generate_variant(struct llvmpipe_context *lp,
    unsigned char ir_sha1_cache_key[20];
    struct lp_cached_code cached = { 0 };
    bool needs_caching = false;
+   bool tiered = false;
+   bool async = false;
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
 
    memset(variant, 0, sizeof(*variant));
+   util_queue_fence_init(&variant->build_fence);
+   util_queue_fence_init(&variant->opt_fence);
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
 
@@ -3513,8 +3690,22 @@ generate_variant(struct llvmpipe_context *lp,
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
-   if (!variant->gallivm) {
+
+   /* With LP_TIERED_JIT, a variant which isn't in the disk cache is first
+    * built without optimizations so it can be used right away.  The
+    * optimized code is built in the background and replaces it.  With
+    * LP_ASYNC_JIT, the first code is built in the background as well.
+    */
+   if (screen->tiered_jit && !cached.data_size) {
+      tiered = true;
+      async = screen->async_jit;
+      if (!async)
+         variant->gallivm = gallivm_create_unoptimized(module_name, lp->context);
+   }
+   else {
+      variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+   }
+   if (!async && !variant->gallivm) {
       FREE(variant);
       return NULL;
    }
@@ -3547,10 +3738,27 @@ generate_variant(struct llvmpipe_context *lp,
          !shader->info.base.writes_samplemask
       ? TRUE : FALSE;
 
+   if (screen->linear_rast)
+      llvmpipe_fs_variant_linear(variant);
+
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       lp_debug_fs_variant(variant);
    }
 
+   if (async) {
+      if (queue_variant_build(lp, variant,
+                              needs_caching ? ir_sha1_cache_key : NULL))
+         return variant;
+
+      /* Build it here then */
+      variant->gallivm = gallivm_create_unoptimized(module_name, lp->context);
+      if (!variant->gallivm) {
+         lp_fs_reference(lp, &variant->shader, NULL);
+         FREE(variant);
+         return NULL;
+      }
+   }
+
    lp_jit_init_types(variant);
    
    if (variant->jit_function[RAST_EDGE_TEST] == NULL)
@@ -3585,12 +3793,19 @@ generate_variant(struct llvmpipe_context *lp,
       variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
    }
 
-   if (needs_caching) {
+   if (needs_caching && !tiered) {
       lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    }
 
    gallivm_free_ir(variant->gallivm);
 
+   variant->code_size = gallivm_get_code_size(variant->gallivm);
+   p_atomic_add(&lp->variant_code_size, variant->code_size);
+
+   if (tiered)
+      queue_optimized_variant(lp, variant,
+                              needs_caching ? ir_sha1_cache_key : NULL);
+
    return variant;
 }
 
@@ -3677,6 +3892,8 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
       shader->inputs[i].src_index = i+1;
    }
 
+   llvmpipe_fs_analyse_linear(shader);
+
    if (LP_DEBUG & DEBUG_TGSI) {
       unsigned attrib;
       debug_printf("llvmpipe: Create fragment shader #%u %p:\n",
@@ -3722,11 +3939,12 @@ llvmpipe_bind_fs_state(struct pipe_context *pipe, void *fs)
  * Remove shader variant from two lists: the shader's variant list
  * and the context's variant list.
  */
-
-static
-void llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
-                                    struct lp_fragment_shader_variant *variant)
+void
+llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
+                               struct lp_fragment_shader_variant *variant)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       debug_printf("llvmpipe: del fs #%u var %u v created %u v cached %u "
                    "v total cached %u inst %u total inst %u\n",
@@ -3744,13 +3962,37 @@ void llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
    remove_from_list(&variant->list_item_global);
    lp->nr_fs_variants--;
    lp->nr_fs_instrs -= variant->nr_instrs;
+
+   /* The variant may live on in a scene, which needs its first build.
+    * Its optimized build would no longer be accounted for.
+    */
+   util_queue_fence_wait(&variant->build_fence);
+   if (!util_queue_fence_is_signalled(&variant->opt_fence))
+      util_queue_drop_job(&screen->jit_queue, &variant->opt_fence);
+   p_atomic_add(&lp->variant_code_size,
+                -(int64_t)(variant->code_size + variant->opt_code_size));
 }
 
 void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant)
 {
-   gallivm_destroy(variant->gallivm);
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   /* Cancel the builds, or wait for them if they are running.  The first
+    * build queues the optimized one when done.
+    */
+   if (!util_queue_fence_is_signalled(&variant->build_fence))
+      util_queue_drop_job(&screen->build_queue, &variant->build_fence);
+   util_queue_fence_destroy(&variant->build_fence);
+   if (!util_queue_fence_is_signalled(&variant->opt_fence))
+      util_queue_drop_job(&screen->jit_queue, &variant->opt_fence);
+   util_queue_fence_destroy(&variant->opt_fence);
+
+   if (variant->gallivm)
+      gallivm_destroy(variant->gallivm);
+   if (variant->opt_gallivm)
+      gallivm_destroy(variant->opt_gallivm);
 
    lp_fs_reference(lp, &variant->shader, NULL);
 
@@ -3895,6 +4137,13 @@ llvmpipe_set_shader_images(struct pipe_context *pipe,
    for (i = start_slot, idx = 0; i < start_slot + count; i++, idx++) {
       const struct pipe_image_view *image = images ? &images[idx] : NULL;
 
+      /* Images are always addressed linearly, leave the slot unbound if
+       * the texture can't be converted.
+       */
+      if (image && image->resource &&
+          !llvmpipe_resource_untile(pipe, image->resource))
+         image = NULL;
+
       util_copy_image_view(&llvmpipe->images[shader][i], image);
    }
 
@@ -4129,8 +4378,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&fs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&fs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -4138,8 +4387,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&fs_sampler[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&fs_sampler[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -4192,8 +4441,6 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
    else {
       /* variant not found, create it now */
       int64_t t0, t1, dt;
-      unsigned i;
-      unsigned variants_to_cull;
 
       if (LP_DEBUG & DEBUG_FS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
@@ -4202,40 +4449,8 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
                       lp->nr_fs_variants ? lp->nr_fs_instrs / lp->nr_fs_variants : 0);
       }
 
-      /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 6.25% of them (the least recently used ones).
-       */
-      variants_to_cull = lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
-
-      if (variants_to_cull ||
-          lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
-         if (gallivm_debug & GALLIVM_DEBUG_PERF) {
-            debug_printf("Evicting FS: %u fs variants,\t%u total variants,"
-                         "\t%u instrs,\t%u instrs/variant\n",
-                         shader->variants_cached,
-                         lp->nr_fs_variants, lp->nr_fs_instrs,
-                         lp->nr_fs_instrs / lp->nr_fs_variants);
-         }
-
-         /*
-          * We need to re-check lp->nr_fs_variants because an arbitrarliy large
-          * number of shader variants (potentially all of them) could be
-          * pending for destruction on flush.
-          */
-
-         for (i = 0; i < variants_to_cull || lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
-            struct lp_fs_variant_list_item *item;
-            if (is_empty_list(&lp->fs_variants_list)) {
-               break;
-            }
-            item = last_elem(&lp->fs_variants_list);
-            assert(item);
-            assert(item->base);
-            llvmpipe_remove_shader_variant(lp, item->base);
-            struct lp_fragment_shader_variant *variant = item->base;
-            lp_fs_variant_reference(lp, &variant, NULL);
-         }
-      }
+      /* Make room for the new variant in the variant cache budget */
+      llvmpipe_evict_variants(lp);
 
       /*
        * Generate the new variant.
@@ -4257,6 +4472,9 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
    }
 
+   if (variant)
+      variant->last_use = ++lp->variant_timestamp;
+
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
 }
@@ -37,6 +37,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct tgsi_token;
@@ -127,6 +128,31 @@ lp_fs_variant_key_images(struct lp_fragment_shader_variant_key *key)
       &key->samplers[key->nr_samplers];
 }
 
+/**
+ * How the linear rasterizer (lp_rast_linear.c) combines the texels with
+ * the color buffer.
+ */
+enum lp_linear_blend
+{
+   LP_LINEAR_BLEND_NONE,     /**< src */
+   LP_LINEAR_BLEND_PREMUL,   /**< src + dst * (1 - src.a) */
+   LP_LINEAR_BLEND_ALPHA,    /**< src * src.a + dst * (1 - src.a) */
+   LP_LINEAR_BLEND_SEPARATE, /**< rgb like _ALPHA, alpha like _PREMUL */
+};
+
+
+/**
+ * Fragment shaders the linear rasterizer can run: they output a single
+ * 2D texture lookup at an interpolated input.
+ */
+struct lp_linear_shader_info
+{
+   boolean eligible;
+   unsigned input;     /**< shader input with the texture coordinates */
+   unsigned chan[2];   /**< its s and t channels */
+};
+
+
 /** doubly-linked list item */
 struct lp_fs_variant_list_item
 {
@@ -140,8 +166,25 @@ struct lp_fragment_shader_variant
    struct pipe_reference reference;
    boolean opaque;
 
+   /* Whether the linear rasterizer runs this variant instead of the JIT
+    * code, and how it blends.
+    */
+   boolean linear;
+   enum lp_linear_blend linear_blend;
+
    struct gallivm_state *gallivm;
 
+   /* With LP_TIERED_JIT, the optimized code built in the background.  The
+    * first code isn't freed before the variant, it may still be running.
+    */
+   struct gallivm_state *opt_gallivm;
+   struct util_queue_fence opt_fence;
+
+   /* With LP_ASYNC_JIT, signalled once the first code is built, gallivm
+    * and jit_function[] are only set then.
+    */
+   struct util_queue_fence build_fence;
+
    LLVMTypeRef jit_context_ptr_type;
    LLVMTypeRef jit_thread_data_ptr_type;
    LLVMTypeRef jit_linear_context_ptr_type;
@@ -153,6 +196,13 @@ struct lp_fragment_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /* Bytes of JIT code and data of gallivm and opt_gallivm */
+   uint64_t code_size;
+   uint64_t opt_code_size;
+
+   /* lp->variant_timestamp when last bound, for LRU eviction */
+   uint64_t last_use;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
@@ -184,12 +234,20 @@ struct lp_fragment_shader
 
    /** Fragment shader input interpolation info */
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
+
+   struct lp_linear_shader_info linear;
 };
 
 
 void
 lp_debug_fs_variant(struct lp_fragment_shader_variant *variant);
 
+void
+llvmpipe_fs_analyse_linear(struct lp_fragment_shader *shader);
+
+void
+llvmpipe_fs_variant_linear(struct lp_fragment_shader_variant *variant);
+
 void
 llvmpipe_destroy_fs(struct llvmpipe_context *llvmpipe,
                     struct lp_fragment_shader *shader);
@@ -206,6 +264,10 @@ lp_fs_reference(struct llvmpipe_context *llvmpipe,
    *ptr = shader;
 }
 
+void
+llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
+                               struct lp_fragment_shader_variant *variant);
+
 void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant);
@@ -0,0 +1,510 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Decides which fragment shader variants the linear rasterizer
+ * (lp_rast_linear.c) can run.
+ *
+ * The shader must write a single 2D texture lookup, at an input
+ * interpolated without perspective or with a constant w, to the only color
+ * output.  The variant must have no depth, stencil or alpha test, a single
+ * 8-bit BGRA/BGRX color buffer and a texture sampled with one filter and
+ * without mipmaps.  This is what blits, compositors and most UI toolkits
+ * draw.
+ */
+
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_parse.h"
+#include "util/format/u_format.h"
+#include "util/u_endian.h"
+#include "nir.h"
+#include "lp_debug.h"
+#include "lp_state_fs.h"
+
+
+/*
+ * Match TEX OUT[color], IN[n], SAMP[0], 2D (possibly through a temporary
+ * moved to the output).
+ */
+static boolean
+analyse_tgsi(const struct tgsi_token *tokens,
+             unsigned color_output,
+             struct lp_linear_shader_info *linear)
+{
+   struct tgsi_parse_context parse;
+   boolean has_tex = FALSE, has_output = FALSE, ok = TRUE;
+   int tex_temp = -1;
+
+   tgsi_parse_init(&parse, tokens);
+
+   while (ok && !tgsi_parse_end_of_tokens(&parse)) {
+      const struct tgsi_full_instruction *inst;
+      const struct tgsi_full_dst_register *dst;
+      const struct tgsi_full_src_register *src;
+
+      tgsi_parse_token(&parse);
+      if (parse.FullToken.Token.Type != TGSI_TOKEN_TYPE_INSTRUCTION)
+         continue;
+
+      inst = &parse.FullToken.FullInstruction;
+      dst = &inst->Dst[0];
+      src = &inst->Src[0];
+
+      switch (inst->Instruction.Opcode) {
+      case TGSI_OPCODE_TEX:
+         if (has_tex ||
+             (inst->Texture.Texture != TGSI_TEXTURE_2D &&
+              inst->Texture.Texture != TGSI_TEXTURE_RECT) ||
+             src->Register.File != TGSI_FILE_INPUT ||
+             src->Register.Indirect ||
+             src->Register.Absolute ||
+             src->Register.Negate ||
+             inst->Src[1].Register.File != TGSI_FILE_SAMPLER ||
+             inst->Src[1].Register.Index != 0 ||
+             inst->Instruction.Saturate ||
+             dst->Register.WriteMask != TGSI_WRITEMASK_XYZW ||
+             dst->Register.Indirect) {
+            ok = FALSE;
+            break;
+         }
+
+         linear->input = src->Register.Index;
+         linear->chan[0] = src->Register.SwizzleX;
+         linear->chan[1] = src->Register.SwizzleY;
+         has_tex = TRUE;
+
+         if (dst->Register.File == TGSI_FILE_OUTPUT &&
+             dst->Register.Index == color_output) {
+            has_output = TRUE;
+         } else if (dst->Register.File == TGSI_FILE_TEMPORARY) {
+            tex_temp = dst->Register.Index;
+         } else {
+            ok = FALSE;
+         }
+         break;
+
+      case TGSI_OPCODE_MOV:
+         if (has_output ||
+             tex_temp < 0 ||
+             src->Register.File != TGSI_FILE_TEMPORARY ||
+             src->Register.Index != tex_temp ||
+             src->Register.Indirect ||
+             src->Register.Absolute ||
+             src->Register.Negate ||
+             src->Register.SwizzleX != TGSI_SWIZZLE_X ||
+             src->Register.SwizzleY != TGSI_SWIZZLE_Y ||
+             src->Register.SwizzleZ != TGSI_SWIZZLE_Z ||
+             src->Register.SwizzleW != TGSI_SWIZZLE_W ||
+             dst->Register.File != TGSI_FILE_OUTPUT ||
+             dst->Register.Index != color_output ||
+             dst->Register.Indirect ||
+             dst->Register.WriteMask != TGSI_WRITEMASK_XYZW) {
+            ok = FALSE;
+            break;
+         }
+         /* The texels are unorm, saturating them is a no-op */
+         has_output = TRUE;
+         break;
+
+      case TGSI_OPCODE_END:
+         break;
+
+      default:
+         ok = FALSE;
+         break;
+      }
+   }
+
+   tgsi_parse_free(&parse);
+
+   return ok && has_tex && has_output;
+}
+
+
+/** An SSA value made of channels of a shader input */
+struct nir_input_value
+{
+   const nir_ssa_def *def;
+   const nir_variable *var;
+   unsigned chan[4];
+};
+
+
+static const struct nir_input_value *
+find_input_value(const struct nir_input_value *values, unsigned num_values,
+                 const nir_ssa_def *def)
+{
+   unsigned i;
+
+   for (i = 0; i < num_values; i++) {
+      if (values[i].def == def)
+         return &values[i];
+   }
+   return NULL;
+}
+
+
+/*
+ * Match the NIR equivalent of the TGSI above: a tex of an input load,
+ * possibly swizzled by a mov or vec2, stored to the color output.
+ */
+static boolean
+analyse_nir(nir_shader *nir,
+            struct lp_linear_shader_info *linear)
+{
+   nir_function_impl *impl = nir_shader_get_entrypoint(nir);
+   struct nir_input_value values[8];
+   unsigned num_values = 0;
+   const nir_ssa_def *texel = NULL;
+   boolean has_output = FALSE;
+
+   /* No control flow */
+   if (exec_list_length(&impl->body) != 1)
+      return FALSE;
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         switch (instr->type) {
+         case nir_instr_type_deref:
+            if (nir_instr_as_deref(instr)->deref_type != nir_deref_type_var)
+               return FALSE;
+            break;
+
+         case nir_instr_type_load_const:
+            break;
+
+         case nir_instr_type_intrinsic: {
+            nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+            nir_variable *var;
+
+            if (intr->intrinsic == nir_intrinsic_load_deref) {
+               struct nir_input_value *value;
+               unsigned i;
+
+               var = nir_intrinsic_get_var(intr, 0);
+               if (var->data.mode != nir_var_shader_in ||
+                   num_values == ARRAY_SIZE(values))
+                  return FALSE;
+
+               value = &values[num_values++];
+               value->def = &intr->dest.ssa;
+               value->var = var;
+               for (i = 0; i < 4; i++)
+                  value->chan[i] = var->data.location_frac + i;
+            } else if (intr->intrinsic == nir_intrinsic_store_deref) {
+               var = nir_intrinsic_get_var(intr, 0);
+               if (has_output ||
+                   var->data.mode != nir_var_shader_out ||
+                   (var->data.location != FRAG_RESULT_COLOR &&
+                    var->data.location != FRAG_RESULT_DATA0) ||
+                   nir_intrinsic_write_mask(intr) != 0xf ||
+                   !texel ||
+                   intr->src[1].ssa != texel)
+                  return FALSE;
+               has_output = TRUE;
+            } else {
+               return FALSE;
+            }
+            break;
+         }
+
+         case nir_instr_type_alu: {
+            nir_alu_instr *alu = nir_instr_as_alu(instr);
+            const struct nir_input_value *src;
+            struct nir_input_value *value;
+            unsigned i;
+
+            if ((alu->op != nir_op_mov && alu->op != nir_op_vec2) ||
+                alu->dest.saturate ||
+                num_values == ARRAY_SIZE(values))
+               return FALSE;
+
+            value = &values[num_values++];
+            memset(value, 0, sizeof *value);
+            value->def = &alu->dest.dest.ssa;
+            for (i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+               if (alu->src[i].abs || alu->src[i].negate)
+                  return FALSE;
+               src = find_input_value(values, num_values - 1,
+                                      alu->src[i].src.ssa);
+               if (!src || (value->var && value->var != src->var))
+                  return FALSE;
+               value->var = src->var;
+               if (alu->op == nir_op_mov) {
+                  value->chan[0] = src->chan[alu->src[i].swizzle[0]];
+                  value->chan[1] = src->chan[alu->src[i].swizzle[1]];
+               } else {
+                  value->chan[i] = src->chan[alu->src[i].swizzle[0]];
+               }
+            }
+            break;
+         }
+
+         case nir_instr_type_tex: {
+            nir_tex_instr *tex = nir_instr_as_tex(instr);
+            const struct nir_input_value *coord = NULL;
+            unsigned i;
+
+            if (texel ||
+                tex->op != nir_texop_tex ||
+                (tex->sampler_dim != GLSL_SAMPLER_DIM_2D &&
+                 tex->sampler_dim != GLSL_SAMPLER_DIM_RECT) ||
+                tex->is_array ||
+                tex->is_shadow ||
+                tex->is_sparse ||
+                tex->dest.ssa.num_components != 4)
+               return FALSE;
+
+            for (i = 0; i < tex->num_srcs; i++) {
+               switch (tex->src[i].src_type) {
+               case nir_tex_src_coord:
+                  coord = find_input_value(values, num_values,
+                                           tex->src[i].src.ssa);
+                  break;
+               case nir_tex_src_texture_deref:
+               case nir_tex_src_sampler_deref:
+                  break;
+               default:
+                  return FALSE;
+               }
+            }
+
+            if (!coord)
+               return FALSE;
+
+            linear->input = coord->var->data.driver_location;
+            linear->chan[0] = coord->chan[0];
+            linear->chan[1] = coord->chan[1];
+            texel = &tex->dest.ssa;
+            break;
+         }
+
+         default:
+            return FALSE;
+         }
+      }
+   }
+
+   return has_output;
+}
+
+
+/**
+ * Check whether the linear rasterizer can run this shader, regardless of
+ * the state it's used with.
+ */
+void
+llvmpipe_fs_analyse_linear(struct lp_fragment_shader *shader)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   struct lp_linear_shader_info *linear = &shader->linear;
+   const struct lp_shader_input *input;
+
+   memset(linear, 0, sizeof *linear);
+
+   /* The texels and pixels are handled as packed 32-bit words */
+   if (UTIL_ARCH_BIG_ENDIAN)
+      return;
+
+   if (info->num_outputs != 1 ||
+       info->output_semantic_name[0] != TGSI_SEMANTIC_COLOR ||
+       info->output_semantic_index[0] != 0 ||
+       info->uses_kill ||
+       info->uses_fbfetch ||
+       info->writes_z ||
+       info->writes_stencil ||
+       info->writes_samplemask ||
+       info->writes_memory ||
+       info->file_max[TGSI_FILE_SAMPLER] != 0 ||
+       info->file_max[TGSI_FILE_SAMPLER_VIEW] > 0 ||
+       info->file_max[TGSI_FILE_IMAGE] >= 0 ||
+       info->file_max[TGSI_FILE_BUFFER] >= 0)
+      return;
+
+   if (shader->base.type == PIPE_SHADER_IR_TGSI) {
+      if (!analyse_tgsi(shader->base.tokens, 0, linear))
+         return;
+   } else {
+      if (!analyse_nir(shader->base.ir.nir, linear))
+         return;
+   }
+
+   if (linear->input >= info->num_inputs ||
+       linear->chan[0] > 3 || linear->chan[1] > 3)
+      return;
+
+   input = &shader->inputs[linear->input];
+   if ((input->interp != LP_INTERP_LINEAR &&
+        input->interp != LP_INTERP_PERSPECTIVE) ||
+       input->location != TGSI_INTERPOLATE_LOC_CENTER ||
+       input->cyl_wrap)
+      return;
+
+   linear->eligible = TRUE;
+}
+
+
+static boolean
+linear_texture_format(enum pipe_format format)
+{
+   return format == PIPE_FORMAT_B8G8R8A8_UNORM ||
+          format == PIPE_FORMAT_B8G8R8X8_UNORM ||
+          format == PIPE_FORMAT_R8G8B8A8_UNORM ||
+          format == PIPE_FORMAT_R8G8B8X8_UNORM;
+}
+
+
+static boolean
+linear_wrap(unsigned wrap)
+{
+   return wrap == PIPE_TEX_WRAP_CLAMP_TO_EDGE ||
+          wrap == PIPE_TEX_WRAP_REPEAT;
+}
+
+
+/*
+ * Map the blend state to one of the modes of the linear rasterizer.
+ */
+static boolean
+linear_blend(const struct pipe_rt_blend_state *rt,
+             boolean dst_has_alpha,
+             enum lp_linear_blend *blend)
+{
+   boolean rgb_premul, alpha_premul;
+
+   if (!rt->blend_enable) {
+      *blend = LP_LINEAR_BLEND_NONE;
+      return TRUE;
+   }
+
+   if (rt->rgb_func != PIPE_BLEND_ADD ||
+       rt->rgb_dst_factor != PIPE_BLENDFACTOR_INV_SRC_ALPHA)
+      return FALSE;
+
+   if (rt->rgb_src_factor == PIPE_BLENDFACTOR_ONE)
+      rgb_premul = TRUE;
+   else if (rt->rgb_src_factor == PIPE_BLENDFACTOR_SRC_ALPHA)
+      rgb_premul = FALSE;
+   else
+      return FALSE;
+
+   /* Without alpha in the color buffer only the rgb blend matters */
+   alpha_premul = rgb_premul;
+   if (dst_has_alpha) {
+      if (rt->alpha_func != PIPE_BLEND_ADD ||
+          rt->alpha_dst_factor != PIPE_BLENDFACTOR_INV_SRC_ALPHA)
+         return FALSE;
+
+      if (rt->alpha_src_factor == PIPE_BLENDFACTOR_ONE)
+         alpha_premul = TRUE;
+      else if (rt->alpha_src_factor == PIPE_BLENDFACTOR_SRC_ALPHA)
+         alpha_premul = FALSE;
+      else
+         return FALSE;
+   }
+
+   if (rgb_premul && alpha_premul)
+      *blend = LP_LINEAR_BLEND_PREMUL;
+   else if (!rgb_premul && !alpha_premul)
+      *blend = LP_LINEAR_BLEND_ALPHA;
+   else if (!rgb_premul)
+      *blend = LP_LINEAR_BLEND_SEPARATE;
+   else
+      return FALSE;
+
+   return TRUE;
+}
+
+
+/**
+ * Check whether the linear rasterizer can run this variant, and set
+ * variant->linear accordingly.
+ */
+void
+llvmpipe_fs_variant_linear(struct lp_fragment_shader_variant *variant)
+{
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
+   const struct lp_static_sampler_state *sampler;
+   const struct lp_static_texture_state *texture;
+   const struct util_format_description *cbuf_desc;
+   enum lp_linear_blend blend;
+
+   variant->linear = FALSE;
+
+   if (!variant->shader->linear.eligible)
+      return;
+
+   if (LP_PERF & (PERF_TEX_MEM | PERF_NO_TEX | PERF_NO_BLEND))
+      return;
+
+   if (key->nr_cbufs != 1 ||
+       (key->cbuf_format[0] != PIPE_FORMAT_B8G8R8A8_UNORM &&
+        key->cbuf_format[0] != PIPE_FORMAT_B8G8R8X8_UNORM) ||
+       key->cbuf_nr_samples[0] > 1 ||
+       key->depth.enabled ||
+       key->stencil[0].enabled ||
+       key->alpha.enabled ||
+       key->occlusion_count ||
+       key->multisample ||
+       key->blend.logicop_enable ||
+       key->blend.alpha_to_coverage ||
+       key->blend.alpha_to_one ||
+       key->nr_samplers < 1 ||
+       key->nr_sampler_views < 1)
+      return;
+
+   cbuf_desc = util_format_description(key->cbuf_format[0]);
+   if (!util_format_colormask_full(cbuf_desc, key->blend.rt[0].colormask) ||
+       !linear_blend(&key->blend.rt[0], util_format_has_alpha(key->cbuf_format[0]),
+                     &blend))
+      return;
+
+   texture = &key->samplers[0].texture_state;
+   if (!linear_texture_format(texture->format) ||
+       texture->tiled ||
+       (texture->target != PIPE_TEXTURE_2D &&
+        texture->target != PIPE_TEXTURE_RECT) ||
+       texture->swizzle_r != PIPE_SWIZZLE_X ||
+       texture->swizzle_g != PIPE_SWIZZLE_Y ||
+       texture->swizzle_b != PIPE_SWIZZLE_Z ||
+       (texture->swizzle_a != PIPE_SWIZZLE_W &&
+        texture->swizzle_a != PIPE_SWIZZLE_1))
+      return;
+
+   /* A single filter and no mipmapping, so no LOD is needed */
+   sampler = &key->samplers[0].sampler_state;
+   if (sampler->compare_mode != PIPE_TEX_COMPARE_NONE ||
+       sampler->min_img_filter != sampler->mag_img_filter ||
+       (sampler->min_mip_filter != PIPE_TEX_MIPFILTER_NONE &&
+        !texture->level_zero_only) ||
+       !linear_wrap(sampler->wrap_s) ||
+       !linear_wrap(sampler->wrap_t) ||
+       sampler->force_nearest_s ||
+       sampler->force_nearest_t ||
+       sampler->reduction_mode != PIPE_TEX_REDUCTION_WEIGHTED_AVERAGE)
+      return;
+
+   variant->linear = TRUE;
+   variant->linear_blend = blend;
+}
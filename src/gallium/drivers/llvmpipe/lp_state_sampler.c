@@ -31,12 +31,14 @@
 
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
+#include "util/format/u_format.h"
 
 #include "draw/draw_context.h"
 
 #include "lp_context.h"
 #include "lp_screen.h"
 #include "lp_state.h"
+#include "lp_texture.h"
 #include "lp_debug.h"
 #include "frontend/sw_winsys.h"
 #include "lp_flush.h"
@@ -114,6 +116,69 @@ llvmpipe_bind_sampler_states(struct pipe_context *pipe,
 }
 
 
+static boolean
+llvmpipe_sampler_view_is_tiled(const struct pipe_sampler_view *view)
+{
+   return view && view->texture && view->target != PIPE_BUFFER &&
+          llvmpipe_resource(view->texture)->tiled;
+}
+
+
+/**
+ * Tell draw which vertex stage sampler views sample tiled textures, as it
+ * builds the shader keys from the bound views itself.
+ */
+static void
+llvmpipe_set_draw_sampler_layouts(struct llvmpipe_context *llvmpipe,
+                                  enum pipe_shader_type shader)
+{
+   boolean tiled[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   unsigned i;
+
+   for (i = 0; i < llvmpipe->num_sampler_views[shader]; i++)
+      tiled[i] = llvmpipe_sampler_view_is_tiled(llvmpipe->sampler_views[shader][i]);
+
+   draw_set_tiled_sampler_views(llvmpipe->draw, shader, tiled,
+                                llvmpipe->num_sampler_views[shader]);
+}
+
+
+/**
+ * Revalidate the sampler views if a texture changed layout since the last
+ * check, in any context.  Called before drawing and dispatching.
+ */
+void
+llvmpipe_check_texture_layouts(struct llvmpipe_context *llvmpipe)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(llvmpipe->pipe.screen);
+   unsigned texture_layouts = p_atomic_read(&screen->texture_layouts);
+
+   if (llvmpipe->texture_layouts == texture_layouts)
+      return;
+
+   llvmpipe->texture_layouts = texture_layouts;
+   llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW;
+   llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW;
+
+   llvmpipe_set_draw_sampler_layouts(llvmpipe, PIPE_SHADER_VERTEX);
+   llvmpipe_set_draw_sampler_layouts(llvmpipe, PIPE_SHADER_GEOMETRY);
+   llvmpipe_set_draw_sampler_layouts(llvmpipe, PIPE_SHADER_TESS_CTRL);
+   llvmpipe_set_draw_sampler_layouts(llvmpipe, PIPE_SHADER_TESS_EVAL);
+}
+
+
+/**
+ * lp_sampler_static_texture_state() plus the llvmpipe texture layout.
+ */
+void
+llvmpipe_sampler_static_texture_state(struct lp_static_texture_state *state,
+                                      const struct pipe_sampler_view *view)
+{
+   lp_sampler_static_texture_state(state, view);
+   state->tiled = llvmpipe_sampler_view_is_tiled(view);
+}
+
+
 static void
 llvmpipe_set_sampler_views(struct pipe_context *pipe,
                            enum pipe_shader_type shader,
@@ -175,6 +240,7 @@ llvmpipe_set_sampler_views(struct pipe_context *pipe,
                              shader,
                              llvmpipe->sampler_views[shader],
                              llvmpipe->num_sampler_views[shader]);
+      llvmpipe_set_draw_sampler_layouts(llvmpipe, shader);
    }
    else if (shader == PIPE_SHADER_COMPUTE) {
       llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW;
@@ -199,6 +265,16 @@ llvmpipe_create_sampler_view(struct pipe_context *pipe,
       texture->bind |= PIPE_BIND_SAMPLER_VIEW;
    }
 
+   /* Tiles are laid out in units of the texture's texels. */
+   if (llvmpipe_resource(texture)->tiled &&
+       (util_format_get_blocksize(templ->format) !=
+        util_format_get_blocksize(texture->format) ||
+        util_format_is_compressed(templ->format)) &&
+       !llvmpipe_resource_untile(pipe, texture)) {
+      FREE(view);
+      return NULL;
+   }
+
    if (view) {
       *view = *templ;
       view->reference.count = 1;
@@ -283,6 +359,12 @@ prepare_shader_sampling(
          struct pipe_resource *tex = view->texture;
          struct llvmpipe_resource *lp_tex = llvmpipe_resource(tex);
          unsigned width0 = tex->width0;
+
+         /* Vertex processing runs on this thread, not after the scenes
+          * rendering to the texture, so wait for them.
+          */
+         llvmpipe_flush_resource(&lp->pipe, tex, 0, TRUE, TRUE, FALSE,
+                                 "vertex sampling");
          unsigned num_layers = tex->depth0;
          unsigned first_level = 0;
          unsigned last_level = 0;
@@ -438,6 +520,10 @@ prepare_shader_images(
          if (!img)
             continue;
 
+         /* As for sampling, wait for the scenes using the image */
+         llvmpipe_flush_resource(&lp->pipe, img, 0, FALSE, TRUE, FALSE,
+                                 "vertex images");
+
          unsigned width = u_minify(img->width0, view->u.tex.level);
          unsigned height = u_minify(img->height0, view->u.tex.level);
          unsigned num_layers = img->depth0;
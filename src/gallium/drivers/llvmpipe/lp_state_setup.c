@@ -807,6 +807,8 @@ generate_setup_variant(struct lp_setup_variant_key *key,
 
    gallivm_free_ir(variant->gallivm);
 
+   variant->code_size = gallivm_get_code_size(variant->gallivm);
+
    /*
     * Update timing information:
     */
@@ -883,9 +885,12 @@ lp_make_setup_variant_key(struct llvmpipe_context *lp,
 }
 
 
-static void
-remove_setup_variant(struct llvmpipe_context *lp,
-                     struct lp_setup_variant *variant)
+/**
+ * Remove and free a setup variant.  It must not be in use by any scene.
+ */
+void
+lp_remove_setup_variant(struct llvmpipe_context *lp,
+                        struct lp_setup_variant *variant)
 {
    if (gallivm_debug & GALLIVM_DEBUG_IR) {
       debug_printf("llvmpipe: del setup_variant #%u total %u\n",
@@ -898,6 +903,7 @@ remove_setup_variant(struct llvmpipe_context *lp,
 
    remove_from_list(&variant->list_item_global);
    lp->nr_setup_variants--;
+   p_atomic_add(&lp->variant_code_size, -(int64_t)variant->code_size);
    FREE(variant);
 }
 
@@ -927,7 +933,7 @@ cull_setup_variants(struct llvmpipe_context *lp)
       item = last_elem(&lp->setup_variants_list);
       assert(item);
       assert(item->base);
-      remove_setup_variant(lp, item->base);
+      lp_remove_setup_variant(lp, item->base);
    }
 }
 
@@ -962,13 +968,19 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
          cull_setup_variants(lp);
       }
 
+      llvmpipe_evict_variants(lp);
+
       variant = generate_setup_variant(key, lp);
       if (variant) {
          insert_at_head(&lp->setup_variants_list, &variant->list_item_global);
          lp->nr_setup_variants++;
+         p_atomic_add(&lp->variant_code_size, variant->code_size);
       }
    }
 
+   if (variant)
+      variant->last_use = ++lp->variant_timestamp;
+
    lp_setup_set_setup_variant(lp->setup, variant);
 }
 
@@ -979,7 +991,7 @@ lp_delete_setup_variants(struct llvmpipe_context *lp)
    li = first_elem(&lp->setup_variants_list);
    while(!at_end(&lp->setup_variants_list, li)) {
       struct lp_setup_variant_list_item *next = next_elem(li);
-      remove_setup_variant(lp, li->base);
+      lp_remove_setup_variant(lp, li->base);
       li = next;
    }
 }
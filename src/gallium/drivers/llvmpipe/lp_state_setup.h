@@ -71,9 +71,18 @@ struct lp_setup_variant {
     */
    lp_jit_setup_triangle jit_function;
 
+   /* Bytes of JIT code and data */
+   uint64_t code_size;
+
+   /* lp->variant_timestamp when last bound, for LRU eviction */
+   uint64_t last_use;
+
    unsigned no;
 };
 
+void lp_remove_setup_variant(struct llvmpipe_context *lp,
+                             struct lp_setup_variant *variant);
+
 void lp_delete_setup_variants(struct llvmpipe_context *lp);
 
 void
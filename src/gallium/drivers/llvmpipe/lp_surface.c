@@ -196,6 +196,11 @@ llvmpipe_create_surface(struct pipe_context *pipe,
       }
    }
 
+   /* Rendering is always done to linear textures. */
+   if (llvmpipe_resource_is_texture(pt) &&
+       !llvmpipe_resource_untile(pipe, pt))
+      return NULL;
+
    ps = CALLOC_STRUCT(pipe_surface);
    if (ps) {
       pipe_reference_init(&ps->reference, 1);
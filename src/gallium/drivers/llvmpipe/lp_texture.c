@@ -42,8 +42,10 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/u_transfer.h"
+#include "util/u_box.h"
 
 #include "lp_context.h"
+#include "lp_fence.h"
 #include "lp_flush.h"
 #include "lp_screen.h"
 #include "lp_texture.h"
@@ -52,6 +54,7 @@
 #include "lp_rast.h"
 
 #include "frontend/sw_winsys.h"
+#include "gallivm/lp_bld_sample.h"
 
 
 #ifdef DEBUG
@@ -134,6 +137,12 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
 
       lpr->img_stride[level] = lpr->row_stride[level] * nblocksy;
 
+      /* A row of tiles spans LP_TEXTURE_TILE_SIZE rows of texels, the
+       * image itself keeps the same size.
+       */
+      if (lpr->tiled)
+         lpr->row_stride[level] *= LP_TEXTURE_TILE_SIZE;
+
       /* Number of 3D image slices, cube faces or texture array layers */
       if (lpr->base.target == PIPE_TEXTURE_CUBE) {
          assert(layers == 6);
@@ -190,6 +199,40 @@ fail:
 }
 
 
+/**
+ * Can the texture be stored in the tiled layout?  Only textures which are
+ * sampled from qualify.  Everything else (rendering, images, sharing,
+ * persistent mappings) expects the linear layout, though render targets are
+ * tiled until first rendered to, see llvmpipe_resource_untile().
+ */
+static boolean
+llvmpipe_texture_can_tile(const struct llvmpipe_screen *screen,
+                          const struct pipe_resource *pt)
+{
+   const struct util_format_description *desc =
+      util_format_description(pt->format);
+
+   if (!screen->tiled_textures)
+      return FALSE;
+
+   if (!(pt->bind & PIPE_BIND_SAMPLER_VIEW) ||
+       (pt->bind & ~(PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_RENDER_TARGET)) ||
+       (pt->flags & (PIPE_RESOURCE_FLAG_MAP_PERSISTENT |
+                     PIPE_RESOURCE_FLAG_MAP_COHERENT)))
+      return FALSE;
+
+   if (llvmpipe_resource_is_1d(pt) || pt->nr_samples > 1)
+      return FALSE;
+
+   /* plain texels of power of two size only (no compressed or subsampled) */
+   if (desc->block.width != 1 || desc->block.height != 1 ||
+       !util_is_power_of_two_nonzero(desc->block.bits / 8))
+      return FALSE;
+
+   return TRUE;
+}
+
+
 /**
  * Check the size of the texture specified by 'res'.
  * \return TRUE if OK, FALSE if too large.
@@ -269,6 +312,7 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
       }
       else {
          /* texture map */
+         lpr->tiled = alloc_backing && llvmpipe_texture_can_tile(screen, templat);
          if (!llvmpipe_texture_layout(screen, lpr, alloc_backing))
             goto fail;
       }
@@ -362,6 +406,7 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
       if (lpr->dt) {
          /* display target */
          struct sw_winsys *winsys = screen->winsys;
+         lp_fence_reference(&lpr->dt_fence, NULL);
          winsys->displaytarget_destroy(winsys, lpr->dt);
       }
       else if (llvmpipe_resource_is_texture(pt)) {
@@ -370,6 +415,8 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
             align_free(lpr->tex_data);
             lpr->tex_data = NULL;
          }
+         if (lpr->tiled_data)
+            align_free(lpr->tiled_data);
       }
       else if (!lpr->userBuffer) {
          if (lpr->data)
@@ -547,6 +594,108 @@ llvmpipe_resource_get_handle(struct pipe_screen *screen,
 }
 
 
+/**
+ * Copy a box of texels between a tiled texture level and a linear buffer
+ * (in either direction).
+ */
+static void
+llvmpipe_copy_tiled_box(struct llvmpipe_resource *lpr,
+                        unsigned level,
+                        const struct pipe_box *box,
+                        uint8_t *linear,
+                        unsigned stride,
+                        unsigned layer_stride,
+                        boolean to_tiled)
+{
+   const unsigned texel_size = util_format_get_blocksize(lpr->base.format);
+   const unsigned tiled_stride = lpr->row_stride[level];
+   int x, y, z;
+
+   assert(lpr->tiled);
+
+   for (z = 0; z < box->depth; z++) {
+      uint8_t *tiled = llvmpipe_get_texture_image_address(lpr, box->z + z,
+                                                          level);
+      for (y = 0; y < box->height; y++) {
+         uint8_t *row = linear + z * layer_stride + y * stride;
+         for (x = 0; x < box->width; x++) {
+            unsigned offset = lp_tiled_texel_offset(box->x + x, box->y + y,
+                                                    tiled_stride, texel_size);
+            if (to_tiled)
+               memcpy(tiled + offset, row + x * texel_size, texel_size);
+            else
+               memcpy(row + x * texel_size, tiled + offset, texel_size);
+         }
+      }
+   }
+}
+
+
+/**
+ * Convert a tiled texture to the linear layout for good.  This is for
+ * textures created for sampling only which end up being rendered to or
+ * bound as shader images anyway (bind flags are merely hints to some
+ * frontends).  Every context revalidates its sampler views on its next
+ * draw or dispatch, see llvmpipe_check_texture_layouts().
+ * \return FALSE if out of memory, the texture is still tiled then
+ */
+boolean
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   unsigned mip_align = MAX2(64, util_get_cpu_caps()->cacheline);
+   unsigned level;
+   uint8_t *data;
+
+   if (!lpr->tiled)
+      return TRUE;
+
+   llvmpipe_flush_resource(pipe, resource, 0, FALSE, TRUE, FALSE,
+                           __FUNCTION__);
+
+   data = align_malloc(lpr->size_required, mip_align);
+   if (!data)
+      return FALSE;
+
+   for (level = 0; level <= resource->last_level; level++) {
+      struct pipe_box box;
+
+      /* the whole 4x4 aligned area is stored, so copy all of it */
+      u_box_3d(0, 0, 0,
+               align(u_minify(resource->width0, level), LP_TEXTURE_TILE_SIZE),
+               align(u_minify(resource->height0, level), LP_TEXTURE_TILE_SIZE),
+               util_num_layers(resource, level), &box);
+      llvmpipe_copy_tiled_box(lpr, level, &box,
+                              data + lpr->mip_offsets[level],
+                              lpr->row_stride[level] / LP_TEXTURE_TILE_SIZE,
+                              lpr->img_stride[level], FALSE);
+   }
+
+   for (level = 0; level <= resource->last_level; level++)
+      lpr->row_stride[level] /= LP_TEXTURE_TILE_SIZE;
+
+   /* Only this context's scenes were flushed, the scenes and bound state
+    * of the other contexts may still point at the tiled texels.
+    */
+   if (p_atomic_read(&screen->num_contexts) > 1)
+      lpr->tiled_data = lpr->tex_data;
+   else
+      align_free(lpr->tex_data);
+
+   lpr->tex_data = data;
+   lpr->tiled = FALSE;
+   screen->timestamp++;
+   p_atomic_inc(&screen->texture_layouts);
+
+   /* shader variants sampling it were built for the tiled layout */
+   llvmpipe_check_texture_layouts(llvmpipe);
+   return TRUE;
+}
+
+
 void *
 llvmpipe_transfer_map_ms( struct pipe_context *pipe,
                           struct pipe_resource *resource,
@@ -569,6 +718,10 @@ llvmpipe_transfer_map_ms( struct pipe_context *pipe,
    assert(resource);
    assert(level <= resource->last_level);
 
+   /* There is no linear view of tiled texels to hand out. */
+   if (lpr->tiled && (usage & PIPE_MAP_DIRECTLY))
+      return NULL;
+
    /*
     * Transfers, like other pipe operations, must happen in order, so flush the
     * context if necessary.
@@ -655,6 +808,26 @@ llvmpipe_transfer_map_ms( struct pipe_context *pipe,
       screen->timestamp++;
    }
 
+   if (lpr->tiled) {
+      /* Map a linear copy of the box, written back on unmap. */
+      assert(sample == 0);
+      pt->stride = align(box->width * util_format_get_blocksize(format), 16);
+      pt->layer_stride = pt->stride * box->height;
+      lpt->staging = align_malloc(pt->layer_stride * box->depth, 16);
+      if (!lpt->staging) {
+         llvmpipe_resource_unmap(resource, level, box->z);
+         pipe_resource_reference(&pt->resource, NULL);
+         FREE(lpt);
+         *transfer = NULL;
+         return NULL;
+      }
+      if (!(usage & (PIPE_MAP_DISCARD_RANGE |
+                     PIPE_MAP_DISCARD_WHOLE_RESOURCE)))
+         llvmpipe_copy_tiled_box(lpr, level, box, lpt->staging,
+                                 pt->stride, pt->layer_stride, FALSE);
+      return lpt->staging;
+   }
+
    map +=
       box->y / util_format_get_blockheight(format) * pt->stride +
       box->x / util_format_get_blockwidth(format) * util_format_get_blocksize(format);
@@ -678,15 +851,27 @@ static void
 llvmpipe_transfer_unmap(struct pipe_context *pipe,
                         struct pipe_transfer *transfer)
 {
+   struct llvmpipe_transfer *lpt = llvmpipe_transfer(transfer);
+
    assert(transfer->resource);
 
+   if (lpt->staging) {
+      if (transfer->usage & PIPE_MAP_WRITE)
+         llvmpipe_copy_tiled_box(llvmpipe_resource(transfer->resource),
+                                 transfer->level, &transfer->box,
+                                 lpt->staging, transfer->stride,
+                                 transfer->layer_stride, TRUE);
+      align_free(lpt->staging);
+   }
+
    llvmpipe_resource_unmap(transfer->resource,
                            transfer->level,
                            transfer->box.z);
 
    /* Effectively do the texture_update work here - if texture images
     * needed post-processing to put them into hardware layout, this is
-    * where it would happen.  For llvmpipe, nothing to do.
+    * where it would happen.  For llvmpipe, only tiled textures need it
+    * (done above).
     */
    assert (transfer->resource);
    pipe_resource_reference(&transfer->resource, NULL);
@@ -47,6 +47,7 @@ struct pipe_screen;
 struct llvmpipe_context;
 
 struct sw_displaytarget;
+struct lp_fence;
 
 
 /**
@@ -75,6 +76,12 @@ struct llvmpipe_resource
     */
    struct sw_displaytarget *dt;
 
+   /**
+    * Fence of the last scene rendering to the display target, protected
+    * by the screen's rast_mutex.
+    */
+   struct lp_fence *dt_fence;
+
    /**
     * Malloc'ed data for regular textures, or a mapping to dt above.
     */
@@ -95,6 +102,20 @@ struct llvmpipe_resource
    uint64_t size_required;
    uint64_t backing_offset;
    bool backable;
+
+   /**
+    * Texels are stored in LP_TEXTURE_TILE_SIZE square tiles rather than
+    * linearly, and row_stride is the stride between rows of tiles.
+    * Only set for textures which haven't been used other than for
+    * sampling, see llvmpipe_texture_can_tile().
+    */
+   boolean tiled;
+
+   /**
+    * Texels of a texture no longer tiled, kept until the resource is
+    * destroyed when other contexts may still sample them.
+    */
+   void *tiled_data;
 #ifdef DEBUG
    /** for linked list */
    struct llvmpipe_resource *prev, *next;
@@ -107,6 +128,9 @@ struct llvmpipe_transfer
    struct pipe_transfer base;
 
    unsigned long offset;
+
+   /** Linear copy of the box handed out when mapping a tiled texture */
+   void *staging;
 };
 
 
@@ -231,6 +255,11 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
                                    unsigned face_slice, unsigned level);
 
 
+boolean
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource);
+
+
 extern void
 llvmpipe_print_resources(void);
 
@@ -195,7 +195,7 @@ dri_create_context(gl_api api, const struct gl_config * visual,
       ctx->pp = pp_init(ctx->st->pipe, screen->pp_enabled, ctx->st->cso_context,
                         ctx->st);
       ctx->hud = hud_create(ctx->st->cso_context, ctx->st,
-                            share_ctx ? share_ctx->hud : NULL);
+                            share_ctx ? share_ctx->hud : NULL, NULL, 0);
    }
 
    /* Do this last. */
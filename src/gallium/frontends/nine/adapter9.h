@@ -42,8 +42,14 @@ struct d3dadapter9_context
     BOOL discard_delayed_release;
     BOOL tearfree_discard;
     int csmt_force;
+    int csmt_queue_depth;
+    int csmt_shadow_memory;
     BOOL dynamic_texture_workaround;
     BOOL shader_inline_constants;
+    BOOL shader_precompile;
+    int ff_shader_cache_size;
+    BOOL texture_upload_thread;
+    BOOL swvp_on_cpu;
     int memfd_virtualsizelimit;
     int override_vram_size;
 
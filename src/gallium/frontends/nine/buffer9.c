@@ -215,6 +215,11 @@ NineBuffer9_dtor( struct NineBuffer9 *This )
     if (This->buf)
         nine_upload_release_buffer(This->base.base.device->buffer_upload, This->buf);
 
+    if (This->shadow.data) {
+        FREE(This->shadow.data);
+        p_atomic_add(&This->base.base.device->shadow_memory.used, -(long long)This->size);
+    }
+
     NineResource9_dtor(&This->base);
 }
 
@@ -250,6 +255,101 @@ NineBuffer9_RebindIfRequired( struct NineBuffer9 *This,
                                        offset);
 }
 
+/* Modified regions of the shadow are copied in the csmt queue by pieces
+ * of this size. */
+#define NINE_SHADOW_UPLOAD_CHUNK (64 * 1024)
+
+/* Locks the ram copy of a DEFAULT pool buffer, if there is one or if the
+ * buffer is locked often enough to deserve one. Without it, the lock
+ * would wait for the worker thread to be idle.
+ * Only the first lock needing the content of the buffer has to wait,
+ * to read the resource back. */
+static boolean
+NineBuffer9_LockShadow( struct NineBuffer9 *This,
+                        const struct pipe_box *box,
+                        DWORD Flags,
+                        void **ppbData )
+{
+    struct NineDevice9 *device = This->base.base.device;
+    struct pipe_context *pipe;
+    struct pipe_transfer *transfer;
+    struct pipe_box full_box;
+    void *data;
+
+    /* Nested locks of a shadowed lock use the shadow as well */
+    if (This->shadow.locked)
+        goto locked;
+
+    if (!device->shadow_memory.limit || This->nlocks || This->buf ||
+        (Flags & (D3DLOCK_DISCARD | D3DLOCK_NOOVERWRITE | D3DLOCK_DONOTWAIT)))
+        return FALSE;
+
+    if (!This->shadow.data) {
+        /* Buffers filled once at load time don't need one */
+        if (++This->shadow.num_sync_locks < 2)
+            return FALSE;
+        if (p_atomic_add_return(&device->shadow_memory.used, (long long)This->size) >
+            device->shadow_memory.limit) {
+            p_atomic_add(&device->shadow_memory.used, -(long long)This->size);
+            return FALSE;
+        }
+        This->shadow.data = MALLOC(This->size);
+        if (!This->shadow.data) {
+            p_atomic_add(&device->shadow_memory.used, -(long long)This->size);
+            return FALSE;
+        }
+        This->shadow.valid = FALSE;
+        DBG("Created shadow for %p (%u bytes)\n", This, This->size);
+    }
+
+    /* Do not ask for READ if writeonly, as for the resource */
+    if (!This->shadow.valid && !(This->base.usage & D3DUSAGE_WRITEONLY)) {
+        DBG("Reading back %p to its shadow\n", This);
+        u_box_1d(0, This->size, &full_box);
+        pipe = NineDevice9_GetPipe(device);
+        data = pipe->transfer_map(pipe, This->base.resource, 0,
+                                  PIPE_MAP_READ, &full_box, &transfer);
+        if (!data)
+            return FALSE;
+        memcpy(This->shadow.data, data, This->size);
+        pipe->transfer_unmap(pipe, transfer);
+        This->shadow.valid = TRUE;
+    }
+
+    This->shadow.locked = TRUE;
+    u_box_1d(0, 0, &This->shadow.dirty_box);
+
+locked:
+    if (!(Flags & D3DLOCK_READONLY)) {
+        if (This->shadow.dirty_box.width)
+            u_box_union_1d(&This->shadow.dirty_box, &This->shadow.dirty_box, box);
+        else
+            This->shadow.dirty_box = *box;
+    }
+    *ppbData = (char *)This->shadow.data + box->x;
+    return TRUE;
+}
+
+/* Uploads the modified region of the shadow in the worker thread.
+ * The data is copied in the queue, thus the next lock doesn't have
+ * to wait for the upload. */
+static void
+NineBuffer9_UnlockShadow( struct NineBuffer9 *This )
+{
+    struct NineDevice9 *device = This->base.base.device;
+    unsigned offset = This->shadow.dirty_box.x;
+    unsigned end = offset + This->shadow.dirty_box.width;
+
+    while (offset < end) {
+        unsigned size = MIN2(end - offset, NINE_SHADOW_UPLOAD_CHUNK);
+
+        nine_context_range_upload_copy(device, This->base.resource, offset,
+                                       (uint8_t *)This->shadow.data + offset, size);
+        offset += size;
+    }
+    This->shadow.locked = FALSE;
+}
+
 HRESULT NINE_WINAPI
 NineBuffer9_Lock( struct NineBuffer9 *This,
                         UINT OffsetToLock,
@@ -357,6 +457,14 @@ NineBuffer9_Lock( struct NineBuffer9 *This,
     if ((Flags & (D3DLOCK_DISCARD | D3DLOCK_NOOVERWRITE)) == (D3DLOCK_DISCARD | D3DLOCK_NOOVERWRITE))
         Flags &= ~D3DLOCK_DISCARD;
 
+    if (NineBuffer9_LockShadow(This, &box, Flags, ppbData)) {
+        DBG("returning shadow pointer %p\n", *ppbData);
+        This->nlocks++;
+        return D3D_OK;
+    }
+    /* The content of the resource is going to change behind the shadow */
+    This->shadow.valid = FALSE;
+
     if (Flags & D3DLOCK_DISCARD)
         usage = PIPE_MAP_WRITE | PIPE_MAP_DISCARD_WHOLE_RESOURCE;
     else if (Flags & D3DLOCK_NOOVERWRITE)
@@ -429,6 +537,8 @@ NineBuffer9_Lock( struct NineBuffer9 *This,
             unsigned offset;
             struct pipe_resource *res;
             This->buf = nine_upload_create_buffer(device->buffer_upload, This->base.info.width0);
+            if (This->buf)
+                p_atomic_add(&device->cpu_stats.upload_bytes, This->base.info.width0);
             res = nine_upload_buffer_resource_and_offset(This->buf, &offset);
             NineBuffer9_RebindIfRequired(This, device, res, offset);
         }
@@ -522,6 +632,8 @@ NineBuffer9_Unlock( struct NineBuffer9 *This )
         return D3D_OK; /* Pending unlocks. Wait all unlocks before unmapping */
 
     if (This->base.pool == D3DPOOL_DEFAULT) {
+        if (This->shadow.locked)
+            NineBuffer9_UnlockShadow(This);
         for (i = 0; i < This->nmaps; i++) {
             if (!This->maps[i].buf) {
                 pipe = This->maps[i].is_pipe_secondary ?
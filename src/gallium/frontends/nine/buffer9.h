@@ -62,6 +62,17 @@ struct NineBuffer9
     boolean need_sync_if_nooverwrite;
     struct nine_subbuffer *buf;
 
+    /* Ram copy of DEFAULT pool buffers, locked instead of the resource
+     * to avoid waiting for the worker thread. Modified regions are
+     * uploaded by the worker thread at unlock. */
+    struct {
+        void *data;
+        boolean valid; /* data matches the content of the resource */
+        boolean locked; /* the current lock uses data */
+        unsigned num_sync_locks; /* locks which could have waited */
+        struct pipe_box dirty_box;
+    } shadow;
+
     /* Specific to managed buffers */
     struct {
         void *data;
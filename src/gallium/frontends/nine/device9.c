@@ -39,6 +39,11 @@
 #include "nine_memory_helper.h"
 #include "nine_pipe.h"
 #include "nine_ff.h"
+#include "nine_shader_cache.h"
+#include "nine_shader_precompile.h"
+#include "nine_swvp_cpu.h"
+#include "nine_texture_upload.h"
+#include "nine_hud.h"
 #include "nine_dump.h"
 #include "nine_limits.h"
 
@@ -268,7 +273,7 @@ NineDevice9_ctor( struct NineDevice9 *This,
     if (!This->cso_sw) { return E_OUTOFMEMORY; }
 
     /* Create first, it messes up our state. */
-    This->hud = hud_create(This->context.cso, NULL, NULL); /* NULL result is fine */
+    nine_hud_init(This); /* NULL hud is fine */
 
     This->allocator = nine_allocator_create(This, pCTX->memfd_virtualsizelimit);
 
@@ -350,7 +355,7 @@ NineDevice9_ctor( struct NineDevice9 *This,
         This->csmt_active = false;
 
     if (This->csmt_active) {
-        This->csmt_ctx = nine_csmt_create(This);
+        This->csmt_ctx = nine_csmt_create(This, pCTX->csmt_queue_depth);
         if (!This->csmt_ctx)
             return E_OUTOFMEMORY;
     }
@@ -358,6 +363,10 @@ NineDevice9_ctor( struct NineDevice9 *This,
     if (This->csmt_active)
         DBG("\033[1;32mCSMT is active\033[0m\n");
 
+    /* Shadow copies only help avoiding waits for the worker thread */
+    if (This->csmt_active && pCTX->csmt_shadow_memory > 0)
+        This->shadow_memory.limit = (long long)pCTX->csmt_shadow_memory << 20;
+
     This->workarounds.dynamic_texture_workaround = pCTX->dynamic_texture_workaround;
 
     /* Due to the pb_cache, in some cases the buffer_upload path can increase GTT usage/virtual memory.
@@ -565,6 +574,11 @@ NineDevice9_ctor( struct NineDevice9 *This,
      * handle the conversion of integer constants */
     This->context.inline_constants &= This->driver_caps.vs_integer && This->driver_caps.ps_integer;
 
+    nine_shader_cache_init(This);
+    nine_shader_precompile_init(This, pCTX->shader_precompile);
+    nine_texture_upload_init(This, pCTX->texture_upload_thread);
+    nine_swvp_cpu_init(This, pCTX->swvp_on_cpu);
+    This->ff.max_shaders = pCTX->ff_shader_cache_size;
     nine_ff_init(This); /* initialize fixed function code */
 
     NineDevice9_SetDefaultState(This, FALSE);
@@ -609,7 +623,10 @@ NineDevice9_dtor( struct NineDevice9 *This )
         This->csmt_ctx = NULL;
     }
 
+    nine_shader_precompile_fini(This);
+    nine_texture_upload_fini(This);
     nine_ff_fini(This);
+    nine_shader_cache_fini(This);
     nine_state_destroy_sw(This);
     nine_device_state_clear(This);
     nine_context_clear(This);
@@ -648,6 +665,11 @@ NineDevice9_dtor( struct NineDevice9 *This )
     if (This->allocator)
         nine_allocator_destroy(This->allocator);
 
+    nine_hud_fini(This);
+
+    /* After the shaders, which destroy their variants on it */
+    nine_swvp_cpu_fini(This);
+
     /* Destroy cso first */
     if (This->context.cso) { cso_destroy_context(This->context.cso); }
     if (This->cso_sw) { cso_destroy_context(This->cso_sw); }
@@ -3216,7 +3238,6 @@ NineDevice9_ProcessVertices( struct NineDevice9 *This,
     struct NineVertexDeclaration9 *vdecl = NineVertexDeclaration9(pVertexDecl);
     struct NineVertexBuffer9 *dst = NineVertexBuffer9(pDestBuffer);
     struct NineVertexShader9 *vs;
-    struct pipe_resource *resource;
     struct pipe_transfer *transfer = NULL;
     struct pipe_stream_output_info so;
     struct pipe_stream_output_target *target;
@@ -3242,9 +3263,9 @@ NineDevice9_ProcessVertices( struct NineDevice9 *This,
     }
 
 
-    vs = programmable_vs ? This->state.vs : This->ff.vs;
+    vs = programmable_vs ? This->state.vs : NULL;
     /* Note: version is 0 for ff */
-    user_assert(vdecl || (vs->byte_code.version < 0x30 && dst->desc.FVF),
+    user_assert(vdecl || ((!vs || vs->byte_code.version < 0x30) && dst->desc.FVF),
                 D3DERR_INVALIDCALL);
     if (!vdecl) {
         DWORD FVF = dst->desc.FVF;
@@ -3267,38 +3288,22 @@ NineDevice9_ProcessVertices( struct NineDevice9 *This,
     user_assert(vdecl->position_t || programmable_vs,
                 D3DERR_INVALIDCALL);
 
-    /* TODO: Support vs < 3 and ff */
-    user_assert(vs->byte_code.version == 0x30,
-                D3DERR_INVALIDCALL);
-    /* TODO: Not hardcode the constant buffers for swvp */
-    user_assert(This->may_swvp,
-                D3DERR_INVALIDCALL);
+    if (!VertexCount)
+        return D3D_OK;
 
-    nine_state_prepare_draw_sw(This, vdecl, SrcStartIndex, VertexCount, &so);
+    /* vs 1/2 and the ff shader are translated with swvp on for
+     * the software pipe, whatever the vertex processing mode */
+    hr = nine_state_prepare_draw_sw(This, vdecl, SrcStartIndex, VertexCount, &so);
+    if (FAILED(hr)) {
+        nine_state_after_draw_sw(This);
+        return hr;
+    }
 
     buffer_size = VertexCount * so.stride[0] * 4;
-    {
-        struct pipe_resource templ;
-
-        memset(&templ, 0, sizeof(templ));
-        templ.target = PIPE_BUFFER;
-        templ.format = PIPE_FORMAT_R8_UNORM;
-        templ.width0 = buffer_size;
-        templ.flags = 0;
-        templ.bind = PIPE_BIND_STREAM_OUTPUT;
-        templ.usage = PIPE_USAGE_STREAM;
-        templ.height0 = templ.depth0 = templ.array_size = 1;
-        templ.last_level = templ.nr_samples = templ.nr_storage_samples = 0;
-
-        resource = screen_sw->resource_create(screen_sw, &templ);
-        if (!resource)
-            return E_OUTOFMEMORY;
-    }
-    target = pipe_sw->create_stream_output_target(pipe_sw, resource,
-                                                  0, buffer_size);
+    target = nine_state_get_so_target_sw(This, buffer_size);
     if (!target) {
-        pipe_resource_reference(&resource, NULL);
-        return D3DERR_DRIVERINTERNALERROR;
+        nine_state_after_draw_sw(This);
+        return E_OUTOFMEMORY;
     }
 
     draw.mode = PIPE_PRIM_POINTS;
@@ -3319,10 +3324,9 @@ NineDevice9_ProcessVertices( struct NineDevice9 *This,
     pipe_sw->draw_vbo(pipe_sw, &draw, NULL, &sc, 1);
 
     pipe_sw->set_stream_output_targets(pipe_sw, 0, NULL, 0);
-    pipe_sw->stream_output_target_destroy(pipe_sw, target);
 
-    u_box_1d(0, VertexCount * so.stride[0] * 4, &box);
-    map = pipe_sw->transfer_map(pipe_sw, resource, 0, PIPE_MAP_READ, &box,
+    u_box_1d(0, buffer_size, &box);
+    map = pipe_sw->transfer_map(pipe_sw, target->buffer, 0, PIPE_MAP_READ, &box,
                                 &transfer);
     if (!map) {
         hr = D3DERR_DRIVERINTERNALERROR;
@@ -3337,7 +3341,6 @@ NineDevice9_ProcessVertices( struct NineDevice9 *This,
 
 out:
     nine_state_after_draw_sw(This);
-    pipe_resource_reference(&resource, NULL);
     return hr;
 }
 
@@ -3445,6 +3448,8 @@ NineDevice9_CreateVertexShader( struct NineDevice9 *This,
     hr = NineVertexShader9_new(This, &vs, pFunction, NULL);
     if (FAILED(hr))
         return hr;
+    if (This->shader_precompile.active)
+        nine_context_precompile_vertex_shader(This, vs);
     *ppShader = (IDirect3DVertexShader9 *)vs;
     return D3D_OK;
 }
@@ -3879,6 +3884,8 @@ NineDevice9_CreatePixelShader( struct NineDevice9 *This,
     hr = NinePixelShader9_new(This, &ps, pFunction, NULL);
     if (FAILED(hr))
         return hr;
+    if (This->shader_precompile.active)
+        nine_context_precompile_pixel_shader(This, ps);
     *ppShader = (IDirect3DPixelShader9 *)ps;
     return D3D_OK;
 }
@@ -38,13 +38,16 @@ struct pipe_screen;
 struct pipe_context;
 struct cso_context;
 struct hud_context;
+struct hud_frontend_counter;
 struct u_upload_mgr;
+struct disk_cache;
 struct csmt_context;
 
 struct NineSwapChain9;
 struct NineStateBlock9;
 
 #include "util/list.h"
+#include "util/u_queue.h"
 
 struct NineDevice9
 {
@@ -63,6 +66,21 @@ struct NineDevice9
     /* CSMT context */
     struct csmt_context *csmt_ctx;
     BOOL csmt_active;
+    struct nine_csmt_stats csmt_stats; /* of the last frame */
+
+    /* Totals since the creation, for the HUD. See nine_hud.h */
+    struct {
+        uint64_t update_state_ns; /* only measured with the HUD */
+        unsigned shader_compiles;
+        uint64_t upload_bytes;
+    } cpu_stats;
+
+    /* CPU copies of resources, used to lock them without waiting
+     * for the worker thread. See NineBuffer9 shadow. */
+    struct {
+        long long limit; /* 0 disables them */
+        long long used;
+    } shadow_memory;
 
     /* For DISCARD/NOOVERWRITE */
     struct nine_buffer_upload *buffer_upload;
@@ -110,12 +128,59 @@ struct NineDevice9
         struct NinePixelShader9 *ps;
         unsigned num_vs;
         unsigned num_ps;
+        unsigned max_shaders; /* per type, least recently used are evicted */
+        struct list_head lru_vs; /* most recently used first */
+        struct list_head lru_ps;
+        struct {
+            unsigned vs_hits;
+            unsigned vs_misses;
+            unsigned vs_evictions;
+            unsigned ps_hits;
+            unsigned ps_misses;
+            unsigned ps_evictions;
+        } stats;
         float *vs_const;
         float *ps_const;
 
         struct hash_table *ht_fvf;
     } ff;
 
+    struct {
+        struct disk_cache *cache; /* NULL if disabled. Owned by the screen */
+        unsigned hits;
+        unsigned misses;
+    } shader_cache;
+
+    struct {
+        boolean active;
+        struct util_queue queue;
+        struct pipe_context *pipe; /* used by the queue thread only */
+        unsigned compiled;
+        unsigned used;
+        unsigned waits; /* GetVariant waited for a job */
+    } shader_precompile;
+
+    struct {
+        boolean active;
+        struct util_queue queue;
+        struct pipe_context *pipe; /* used by the queue thread only */
+        int pending_bytes; /* size of the jobs not consumed yet */
+        unsigned staged;
+        unsigned direct;
+        unsigned waits; /* nine_context waited for a job */
+    } texture_upload;
+
+    struct {
+        boolean active;
+        struct pipe_context *pipe; /* used by nine_context only */
+        struct cso_context *cso;
+        void *fs;
+        struct pipe_resource *so_buffer;
+        struct pipe_stream_output_target *so_target;
+        unsigned draws;
+        unsigned fallbacks; /* draws done with the hardware vertex shader */
+    } swvp_cpu;
+
     struct {
         struct pipe_resource *image;
         unsigned w;
@@ -148,6 +213,7 @@ struct NineDevice9
     struct nine_range_pool range_pool;
 
     struct hud_context *hud; /* NULL if hud is disabled */
+    struct hud_frontend_counter *hud_counters;
 
     struct nine_allocator *allocator;
 
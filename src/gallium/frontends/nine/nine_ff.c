@@ -16,19 +16,18 @@
 #include "nine_helpers.h"
 #include "nine_pipe.h"
 #include "nine_dump.h"
+#include "nine_shader_cache.h"
 
 #include "pipe/p_context.h"
 #include "tgsi/tgsi_ureg.h"
 #include "tgsi/tgsi_dump.h"
+#include "util/blob.h"
 #include "util/u_box.h"
 #include "util/u_hash_table.h"
 #include "util/u_upload_mgr.h"
 
 #define DBG_CHANNEL DBG_FF
 
-#define NINE_FF_NUM_VS_CONST 196
-#define NINE_FF_NUM_PS_CONST 24
-
 struct fvec4
 {
     float x, y, z, w;
@@ -295,6 +294,12 @@ struct vs_build_ctx
     struct ureg_src mtlD;
     struct ureg_src mtlS;
     struct ureg_src mtlE;
+
+    /* ProcessVertices: outputs are captured with stream output */
+    struct NineVertexDeclaration9 *vdecl_out;
+    struct pipe_stream_output_info *so;
+    struct nine_vs_output_info output_info[16];
+    unsigned num_outputs;
 };
 
 static inline unsigned
@@ -314,6 +319,22 @@ build_vs_add_input(struct vs_build_ctx *vs, uint16_t ndecl)
     return ureg_DECL_vs_input(vs->ureg, i);
 }
 
+static inline void
+build_vs_add_output(struct vs_build_ctx *vs, BYTE usage, BYTE usage_idx,
+                    int mask, struct ureg_dst dst)
+{
+    const unsigned i = vs->num_outputs;
+
+    if (!vs->vdecl_out)
+        return;
+    assert(i < ARRAY_SIZE(vs->output_info));
+    vs->output_info[i].output_semantic = usage;
+    vs->output_info[i].output_semantic_index = usage_idx;
+    vs->output_info[i].mask = mask;
+    vs->output_info[i].output_index = dst.Index;
+    vs->num_outputs++;
+}
+
 /* NOTE: dst may alias src */
 static inline void
 ureg_normalize3(struct ureg_program *ureg,
@@ -329,11 +350,11 @@ ureg_normalize3(struct ureg_program *ureg,
 }
 
 static void *
-nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
+nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs, struct blob *cache_blob)
 {
     const struct nine_ff_vs_key *key = vs->key;
     struct ureg_program *ureg = ureg_create(PIPE_SHADER_VERTEX);
-    struct ureg_dst oPos, oCol[2], oPsz, oFog;
+    struct ureg_dst oPos, oPos_out, oCol[2], oPsz, oFog;
     struct ureg_dst AR;
     unsigned i, c;
     unsigned label[32], l = 0;
@@ -342,6 +363,8 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
     boolean need_aVtx = key->lighting || key->fog_mode || key->pointscale || key->ucp;
     const unsigned texcoord_sn = get_texcoord_sn(device->screen);
 
+    p_atomic_inc(&device->cpu_stats.shader_compiles);
+
     vs->ureg = ureg;
 
     /* Check which inputs we should transform. */
@@ -421,17 +444,27 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
     oPos = ureg_DECL_output(ureg, TGSI_SEMANTIC_POSITION, 0); /* HPOS */
     oCol[0] = ureg_saturate(ureg_DECL_output(ureg, TGSI_SEMANTIC_COLOR, 0));
     oCol[1] = ureg_saturate(ureg_DECL_output(ureg, TGSI_SEMANTIC_COLOR, 1));
+    build_vs_add_output(vs, D3DDECLUSAGE_POSITION, 0, TGSI_WRITEMASK_XYZW, oPos);
+    build_vs_add_output(vs, D3DDECLUSAGE_COLOR, 0, TGSI_WRITEMASK_XYZW, oCol[0]);
+    build_vs_add_output(vs, D3DDECLUSAGE_COLOR, 1, TGSI_WRITEMASK_XYZW, oCol[1]);
     if (key->fog || key->passthrough & (1 << NINE_DECLUSAGE_FOG)) {
         oFog = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 16);
         oFog = ureg_writemask(oFog, TGSI_WRITEMASK_X);
+        build_vs_add_output(vs, D3DDECLUSAGE_FOG, 0, TGSI_WRITEMASK_X, oFog);
     }
 
     if (key->vertexpointsize || key->pointscale) {
         oPsz = ureg_DECL_output_masked(ureg, TGSI_SEMANTIC_PSIZE, 0,
                                        TGSI_WRITEMASK_X, 0, 1);
         oPsz = ureg_writemask(oPsz, TGSI_WRITEMASK_X);
+        build_vs_add_output(vs, D3DDECLUSAGE_PSIZE, 0, TGSI_WRITEMASK_X, oPsz);
     }
 
+    /* ProcessVertices outputs the position after the viewport transformation */
+    oPos_out = oPos;
+    if (vs->vdecl_out)
+        oPos = ureg_DECL_temporary(ureg);
+
     if (key->lighting || key->vertexblend)
         AR = ureg_DECL_address(ureg);
 
@@ -632,6 +665,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         if (tci == NINED3DTSS_TCI_DISABLE)
             continue;
         oTex = ureg_DECL_output(ureg, texcoord_sn, i);
+        build_vs_add_output(vs, D3DDECLUSAGE_TEXCOORD, i, TGSI_WRITEMASK_XYZW, oTex);
         tmp = ureg_DECL_temporary(ureg);
         tmp_x = ureg_writemask(tmp, TGSI_WRITEMASK_X);
         input_coord = ureg_DECL_temporary(ureg);
@@ -1003,6 +1037,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         struct ureg_dst output;
         input = vs->aWgt;
         output = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 19);
+        build_vs_add_output(vs, D3DDECLUSAGE_BLENDWEIGHT, 0, TGSI_WRITEMASK_XYZW, output);
         ureg_MOV(ureg, output, input);
     }
     if (key->passthrough & (1 << NINE_DECLUSAGE_BLENDINDICES)) {
@@ -1010,6 +1045,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         struct ureg_dst output;
         input = vs->aInd;
         output = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 20);
+        build_vs_add_output(vs, D3DDECLUSAGE_BLENDINDICES, 0, TGSI_WRITEMASK_XYZW, output);
         ureg_MOV(ureg, output, input);
     }
     if (key->passthrough & (1 << NINE_DECLUSAGE_NORMAL)) {
@@ -1017,6 +1053,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         struct ureg_dst output;
         input = vs->aNrm;
         output = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 21);
+        build_vs_add_output(vs, D3DDECLUSAGE_NORMAL, 0, TGSI_WRITEMASK_XYZW, output);
         ureg_MOV(ureg, output, input);
     }
     if (key->passthrough & (1 << NINE_DECLUSAGE_TANGENT)) {
@@ -1024,6 +1061,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         struct ureg_dst output;
         input = build_vs_add_input(vs, NINE_DECLUSAGE_TANGENT);
         output = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 22);
+        build_vs_add_output(vs, D3DDECLUSAGE_TANGENT, 0, TGSI_WRITEMASK_XYZW, output);
         ureg_MOV(ureg, output, input);
     }
     if (key->passthrough & (1 << NINE_DECLUSAGE_BINORMAL)) {
@@ -1031,6 +1069,7 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
         struct ureg_dst output;
         input = build_vs_add_input(vs, NINE_DECLUSAGE_BINORMAL);
         output = ureg_DECL_output(ureg, TGSI_SEMANTIC_GENERIC, 23);
+        build_vs_add_output(vs, D3DDECLUSAGE_BINORMAL, 0, TGSI_WRITEMASK_XYZW, output);
         ureg_MOV(ureg, output, input);
     }
     if (key->passthrough & (1 << NINE_DECLUSAGE_FOG)) {
@@ -1060,9 +1099,63 @@ nine_ff_build_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
     if (key->position_t && device->driver_caps.window_space_position_support)
         ureg_property(ureg, TGSI_PROPERTY_VS_WINDOW_SPACE_POSITION, TRUE);
 
+    if (vs->vdecl_out) {
+        if (key->position_t)
+            ureg_MOV(ureg, oPos_out, vs->aVtx);
+        else
+            nine_shader_add_vs_viewport_transform(ureg, oPos_out, ureg_src(oPos),
+                                                  vs->vdecl_out->position_t);
+    }
+
     ureg_END(ureg);
     nine_ureg_tgsi_dump(ureg, FALSE);
-    return nine_create_shader_with_so_and_destroy(ureg, device->context.pipe, NULL);
+    if (vs->vdecl_out) {
+        NineVertexDeclaration9_FillStreamOutputInfo(vs->vdecl_out, vs->output_info,
+                                                    vs->num_outputs, vs->so);
+        return nine_create_shader_with_so_and_destroy(ureg, device->pipe_sw, vs->so);
+    }
+    if (cache_blob) {
+        blob_write_uint32(cache_blob, vs->num_inputs);
+        blob_write_bytes(cache_blob, vs->input, vs->num_inputs * sizeof(vs->input[0]));
+    }
+    return nine_create_shader_with_blob_and_destroy(ureg, device->context.pipe, cache_blob);
+}
+
+static void *
+nine_ff_create_vs(struct NineDevice9 *device, struct vs_build_ctx *vs)
+{
+    cache_key cache_key;
+    struct blob blob;
+    void *data, *cso = NULL;
+    size_t size;
+
+    if (!device->shader_cache.cache)
+        return nine_ff_build_vs(device, vs, NULL);
+
+    nine_shader_cache_key_ff(device, PIPE_SHADER_VERTEX, vs->key, sizeof(*vs->key), cache_key);
+    data = nine_shader_cache_get(device, cache_key, &size);
+    if (data) {
+        struct blob_reader reader;
+
+        blob_reader_init(&reader, data, size);
+        vs->num_inputs = blob_read_uint32(&reader);
+        if (vs->num_inputs <= ARRAY_SIZE(vs->input)) {
+            blob_copy_bytes(&reader, vs->input, vs->num_inputs * sizeof(vs->input[0]));
+            if (!reader.overrun)
+                cso = nine_create_shader_from_blob(device->context.pipe, PIPE_SHADER_VERTEX, &reader);
+        }
+        FREE(data);
+        if (cso)
+            return cso;
+        vs->num_inputs = 0;
+    }
+
+    blob_init(&blob);
+    cso = nine_ff_build_vs(device, vs, &blob);
+    if (cso && !blob.out_of_memory)
+        nine_shader_cache_put(device, cache_key, &blob);
+    blob_finish(&blob);
+    return cso;
 }
 
 /* PS FF constants layout:
@@ -1316,7 +1409,7 @@ ps_do_ts_op(struct ps_build_ctx *ps, unsigned top, struct ureg_dst dst, struct u
 }
 
 static void *
-nine_ff_build_ps(struct NineDevice9 *device, struct nine_ff_ps_key *key)
+nine_ff_build_ps(struct NineDevice9 *device, struct nine_ff_ps_key *key, struct blob *cache_blob)
 {
     struct ps_build_ctx ps;
     struct ureg_program *ureg = ureg_create(PIPE_SHADER_FRAGMENT);
@@ -1324,6 +1417,8 @@ nine_ff_build_ps(struct NineDevice9 *device, struct nine_ff_ps_key *key)
     unsigned s;
     const unsigned texcoord_sn = get_texcoord_sn(device->screen);
 
+    p_atomic_inc(&device->cpu_stats.shader_compiles);
+
     memset(&ps, 0, sizeof(ps));
     ps.ureg = ureg;
     ps.stage.index_pre_mod = -1;
@@ -1561,7 +1656,38 @@ nine_ff_build_ps(struct NineDevice9 *device, struct nine_ff_ps_key *key)
 
     ureg_END(ureg);
     nine_ureg_tgsi_dump(ureg, FALSE);
-    return nine_create_shader_with_so_and_destroy(ureg, device->context.pipe, NULL);
+    return nine_create_shader_with_blob_and_destroy(ureg, device->context.pipe, cache_blob);
+}
+
+static void *
+nine_ff_create_ps(struct NineDevice9 *device, struct nine_ff_ps_key *key)
+{
+    cache_key cache_key;
+    struct blob blob;
+    void *data, *cso = NULL;
+    size_t size;
+
+    if (!device->shader_cache.cache)
+        return nine_ff_build_ps(device, key, NULL);
+
+    nine_shader_cache_key_ff(device, PIPE_SHADER_FRAGMENT, key, sizeof(*key), cache_key);
+    data = nine_shader_cache_get(device, cache_key, &size);
+    if (data) {
+        struct blob_reader reader;
+
+        blob_reader_init(&reader, data, size);
+        cso = nine_create_shader_from_blob(device->context.pipe, PIPE_SHADER_FRAGMENT, &reader);
+        FREE(data);
+        if (cso)
+            return cso;
+    }
+
+    blob_init(&blob);
+    cso = nine_ff_build_ps(device, key, &blob);
+    if (cso && !blob.out_of_memory)
+        nine_shader_cache_put(device, cache_key, &blob);
+    blob_finish(&blob);
+    return cso;
 }
 
 static struct NineVertexShader9 *
@@ -1690,18 +1816,25 @@ nine_ff_get_vs(struct NineDevice9 *device)
 
     DBG("VS ff key hash: %x\n", nine_ff_vs_key_hash(&key));
     vs = util_hash_table_get(device->ff.ht_vs, &key);
-    if (vs)
+    if (vs) {
+        /* Move to the head of the LRU list */
+        list_del(&vs->ff_link);
+        list_add(&vs->ff_link, &device->ff.lru_vs);
+        device->ff.stats.vs_hits++;
         return vs;
-    NineVertexShader9_new(device, &vs, NULL, nine_ff_build_vs(device, &bld));
+    }
+    device->ff.stats.vs_misses++;
+    NineVertexShader9_new(device, &vs, NULL, nine_ff_create_vs(device, &bld));
 
-    nine_ff_prune_vs(device);
     if (vs) {
         unsigned n;
 
         memcpy(&vs->ff_key, &key, sizeof(vs->ff_key));
 
         _mesa_hash_table_insert(device->ff.ht_vs, &vs->ff_key, vs);
+        list_add(&vs->ff_link, &device->ff.lru_vs);
         device->ff.num_vs++;
+        nine_ff_prune_vs(device);
 
         vs->num_inputs = bld.num_inputs;
         for (n = 0; n < bld.num_inputs; ++n)
@@ -1841,16 +1974,22 @@ nine_ff_get_ps(struct NineDevice9 *device)
 
     DBG("PS ff key hash: %x\n", nine_ff_ps_key_hash(&key));
     ps = util_hash_table_get(device->ff.ht_ps, &key);
-    if (ps)
+    if (ps) {
+        list_del(&ps->ff_link);
+        list_add(&ps->ff_link, &device->ff.lru_ps);
+        device->ff.stats.ps_hits++;
         return ps;
-    NinePixelShader9_new(device, &ps, NULL, nine_ff_build_ps(device, &key));
+    }
+    device->ff.stats.ps_misses++;
+    NinePixelShader9_new(device, &ps, NULL, nine_ff_create_ps(device, &key));
 
-    nine_ff_prune_ps(device);
     if (ps) {
         memcpy(&ps->ff_key, &key, sizeof(ps->ff_key));
 
         _mesa_hash_table_insert(device->ff.ht_ps, &ps->ff_key, ps);
+        list_add(&ps->ff_link, &device->ff.lru_ps);
         device->ff.num_ps++;
+        nine_ff_prune_ps(device);
 
         ps->rt_mask = 0x1;
         ps->sampler_mask = sampler_mask;
@@ -2032,6 +2171,46 @@ nine_ff_load_viewport_info(struct NineDevice9 *device)
     dst[101].z = (float)(viewport->MinZ);
 }
 
+/* ProcessVertices: variant of the ff vertex shader for the current state
+ * running on the software pipe, with the outputs matching vdecl_out
+ * captured with stream output. Also fills the ff constants.
+ * The worker thread must be idle, as the state is read from the context. */
+void *
+nine_ff_get_vs_process_vertices(struct NineDevice9 *device,
+                                struct NineVertexDeclaration9 *vdecl_out,
+                                struct pipe_stream_output_info *so)
+{
+    struct NineVertexShader9 *vs;
+    struct vs_build_ctx bld;
+    void *cso;
+
+    vs = nine_ff_get_vs(device);
+    if (!vs)
+        return NULL;
+    device->ff.vs = vs;
+
+    /* The constants are only marked clean by nine_ff_update,
+     * thus the next draw still uploads them. */
+    nine_ff_load_vs_transforms(device);
+    nine_ff_load_tex_matrices(device);
+    nine_ff_load_lights(device);
+    nine_ff_load_point_and_fog_params(device);
+    nine_ff_load_viewport_info(device);
+
+    cso = nine_shader_variant_so_get(&vs->variant_so, vdecl_out, so);
+    if (cso)
+        return cso;
+
+    memset(&bld, 0, sizeof(bld));
+    bld.key = (const struct nine_ff_vs_key *)vs->ff_key;
+    bld.vdecl_out = vdecl_out;
+    bld.so = so;
+    cso = nine_ff_build_vs(device, &bld, NULL);
+    if (cso)
+        nine_shader_variant_so_add(&vs->variant_so, vdecl_out, so, cso);
+    return cso;
+}
+
 void
 nine_ff_update(struct NineDevice9 *device)
 {
@@ -2097,6 +2276,12 @@ nine_ff_init(struct NineDevice9 *device)
     device->ff.ht_fvf = _mesa_hash_table_create(NULL, nine_ff_fvf_key_hash,
                                                 nine_ff_fvf_key_comp);
 
+    list_inithead(&device->ff.lru_vs);
+    list_inithead(&device->ff.lru_ps);
+    memset(&device->ff.stats, 0, sizeof(device->ff.stats));
+    if (!device->ff.max_shaders)
+        device->ff.max_shaders = 1024;
+
     device->ff.vs_const = CALLOC(NINE_FF_NUM_VS_CONST, 4 * sizeof(float));
     device->ff.ps_const = CALLOC(NINE_FF_NUM_PS_CONST, 4 * sizeof(float));
 
@@ -2114,6 +2299,12 @@ static enum pipe_error nine_ff_ht_delete_cb(void *key, void *value, void *data)
 void
 nine_ff_fini(struct NineDevice9 *device)
 {
+    DBG("FF cache: vs %u hits %u misses %u evictions, "
+        "ps %u hits %u misses %u evictions\n",
+        device->ff.stats.vs_hits, device->ff.stats.vs_misses,
+        device->ff.stats.vs_evictions, device->ff.stats.ps_hits,
+        device->ff.stats.ps_misses, device->ff.stats.ps_evictions);
+
     if (device->ff.ht_vs) {
         util_hash_table_foreach(device->ff.ht_vs, nine_ff_ht_delete_cb, NULL);
         _mesa_hash_table_destroy(device->ff.ht_vs, NULL);
@@ -2133,32 +2324,43 @@ nine_ff_fini(struct NineDevice9 *device)
     FREE(device->ff.ps_const);
 }
 
+/* Evict the least recently used shaders once the cache is above its
+ * capacity. The last used ones (device->ff.vs/ps) may still be bound
+ * and are never evicted. The hash table holds the only reference. */
 static void
 nine_ff_prune_vs(struct NineDevice9 *device)
 {
-    struct nine_context *context = &device->context;
+    while (device->ff.num_vs > device->ff.max_shaders) {
+        struct NineVertexShader9 *vs =
+            list_last_entry(&device->ff.lru_vs, struct NineVertexShader9, ff_link);
 
-    if (device->ff.num_vs > 1024) {
-        /* could destroy the bound one here, so unbind */
-        context->pipe->bind_vs_state(context->pipe, NULL);
-        util_hash_table_foreach(device->ff.ht_vs, nine_ff_ht_delete_cb, NULL);
-        _mesa_hash_table_clear(device->ff.ht_vs, NULL);
-        device->ff.num_vs = 0;
-        context->changed.group |= NINE_STATE_VS;
+        list_del(&vs->ff_link);
+        if (vs == device->ff.vs) {
+            list_add(&vs->ff_link, &device->ff.lru_vs);
+            continue;
+        }
+        _mesa_hash_table_remove_key(device->ff.ht_vs, &vs->ff_key);
+        device->ff.num_vs--;
+        device->ff.stats.vs_evictions++;
+        NineUnknown_Unbind(NineUnknown(vs));
     }
 }
 static void
 nine_ff_prune_ps(struct NineDevice9 *device)
 {
-    struct nine_context *context = &device->context;
+    while (device->ff.num_ps > device->ff.max_shaders) {
+        struct NinePixelShader9 *ps =
+            list_last_entry(&device->ff.lru_ps, struct NinePixelShader9, ff_link);
 
-    if (device->ff.num_ps > 1024) {
-        /* could destroy the bound one here, so unbind */
-        context->pipe->bind_fs_state(context->pipe, NULL);
-        util_hash_table_foreach(device->ff.ht_ps, nine_ff_ht_delete_cb, NULL);
-        _mesa_hash_table_clear(device->ff.ht_ps, NULL);
-        device->ff.num_ps = 0;
-        context->changed.group |= NINE_STATE_PS;
+        list_del(&ps->ff_link);
+        if (ps == device->ff.ps) {
+            list_add(&ps->ff_link, &device->ff.lru_ps);
+            continue;
+        }
+        _mesa_hash_table_remove_key(device->ff.ht_ps, &ps->ff_key);
+        device->ff.num_ps--;
+        device->ff.stats.ps_evictions++;
+        NineUnknown_Unbind(NineUnknown(ps));
     }
 }
 
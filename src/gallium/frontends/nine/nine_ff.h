@@ -5,11 +5,19 @@
 #include "device9.h"
 #include "vertexdeclaration9.h"
 
+#define NINE_FF_NUM_VS_CONST 196
+#define NINE_FF_NUM_PS_CONST 24
+
 boolean nine_ff_init(struct NineDevice9 *);
 void    nine_ff_fini(struct NineDevice9 *);
 
 void nine_ff_update(struct NineDevice9 *);
 
+void *
+nine_ff_get_vs_process_vertices(struct NineDevice9 *device,
+                                struct NineVertexDeclaration9 *vdecl_out,
+                                struct pipe_stream_output_info *so);
+
 void
 nine_d3d_matrix_matrix_mul(D3DMATRIX *, const D3DMATRIX *, const D3DMATRIX *);
 
@@ -0,0 +1,325 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "nine_format.h"
+
+#include "util/format/u_format.h"
+#include "util/format/u_format_yuv.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/u_sse.h"
+
+#if defined(PIPE_ARCH_SSE)
+#include <xmmintrin.h>
+#endif
+
+/* Converts a row of width pixels */
+typedef void (*nine_format_convert_row_func)(uint8_t *dst,
+                                             const uint8_t *src,
+                                             unsigned width);
+
+/* X8L8V8U8 (R8SG8SB8UX8U_NORM) -> R32G32B32X32_FLOAT */
+
+static void
+convert_row_x8l8v8u8_rgbx32f(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    float *d = (float *)dst;
+    unsigned x;
+
+    for (x = 0; x < width; x++) {
+        uint32_t value = util_le32_to_cpu(((const uint32_t *)src)[x]);
+        int32_t r = ((int32_t)(value << 24)) >> 24;
+        int32_t g = ((int32_t)(value << 16)) >> 24;
+        uint32_t b = (value >> 16) & 0xff;
+
+        d[0] = (float)(r * (1.0f/0x7f));
+        d[1] = (float)(g * (1.0f/0x7f));
+        d[2] = ubyte_to_float(b);
+        d[3] = 0.0f;
+        d += 4;
+    }
+}
+
+/* YUYV/UYVY -> R8G8B8X8_UNORM. The source x must be even. */
+
+static inline void
+convert_yuv_pair(uint8_t *dst, uint8_t y0, uint8_t y1, uint8_t u, uint8_t v,
+                 boolean second)
+{
+    util_format_yuv_to_rgb_8unorm(y0, u, v, &dst[0], &dst[1], &dst[2]);
+    dst[3] = 0;
+    if (second) {
+        util_format_yuv_to_rgb_8unorm(y1, u, v, &dst[4], &dst[5], &dst[6]);
+        dst[7] = 0;
+    }
+}
+
+static void
+convert_row_yuyv_rgbx8_c(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x < width; x += 2, src += 4, dst += 8)
+        convert_yuv_pair(dst, src[0], src[2], src[1], src[3], x + 1 < width);
+}
+
+static void
+convert_row_uyvy_rgbx8_c(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x < width; x += 2, src += 4, dst += 8)
+        convert_yuv_pair(dst, src[1], src[3], src[0], src[2], x + 1 < width);
+}
+
+#if defined(PIPE_ARCH_SSE)
+
+static void
+convert_row_x8l8v8u8_rgbx32f_sse2(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    const __m128 snorm_scale = _mm_set1_ps(1.0f/0x7f);
+    const __m128 unorm_scale = _mm_set1_ps(1.0f/255.0f);
+    const __m128i mask_ff = _mm_set1_epi32(0xff);
+    float *d = (float *)dst;
+    unsigned x;
+
+    for (x = 0; x + 4 <= width; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x * 4));
+        __m128i r = _mm_srai_epi32(_mm_slli_epi32(v, 24), 24);
+        __m128i g = _mm_srai_epi32(_mm_slli_epi32(v, 16), 24);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), mask_ff);
+        __m128 rf = _mm_mul_ps(_mm_cvtepi32_ps(r), snorm_scale);
+        __m128 gf = _mm_mul_ps(_mm_cvtepi32_ps(g), snorm_scale);
+        __m128 bf = _mm_mul_ps(_mm_cvtepi32_ps(b), unorm_scale);
+        __m128 xf = _mm_setzero_ps();
+
+        _MM_TRANSPOSE4_PS(rf, gf, bf, xf);
+        _mm_storeu_ps(d + 0, rf);
+        _mm_storeu_ps(d + 4, gf);
+        _mm_storeu_ps(d + 8, bf);
+        _mm_storeu_ps(d + 12, xf);
+        d += 16;
+    }
+
+    if (x < width)
+        convert_row_x8l8v8u8_rgbx32f((uint8_t *)d, src + x * 4, width - x);
+}
+
+/* 8 pixels. y: the 8 luma values, c: U0 V0 U1 V1 .. U3 V3, as int16. */
+static inline void
+convert_yuv8_sse2(uint8_t *dst, __m128i y, __m128i c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    /* int16 coefficient pairs for _mm_madd_epi16 */
+    const __m128i coef_r = _mm_set1_epi32(298 | (409 << 16));
+    const __m128i coef_g = _mm_set1_epi32(298 | (0xffff & -100) << 16);
+    const __m128i coef_gv = _mm_set1_epi32(0xffff & -208);
+    const __m128i coef_b = _mm_set1_epi32(298 | (516 << 16));
+    __m128i u, v, yu, yv, v0, r[2], g[2], b[2], r8, g8, b8, rg, bx;
+    unsigned i;
+
+    /* Duplicate the chroma for the two pixels of each pair */
+    u = _mm_and_si128(c, _mm_set1_epi32(0xffff));
+    u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+    v = _mm_srli_epi32(c, 16);
+    v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    for (i = 0; i < 2; i++) {
+        if (i == 0) {
+            yu = _mm_unpacklo_epi16(y, u);
+            yv = _mm_unpacklo_epi16(y, v);
+            v0 = _mm_unpacklo_epi16(v, zero);
+        } else {
+            yu = _mm_unpackhi_epi16(y, u);
+            yv = _mm_unpackhi_epi16(y, v);
+            v0 = _mm_unpackhi_epi16(v, zero);
+        }
+        r[i] = _mm_add_epi32(_mm_madd_epi16(yv, coef_r), round);
+        g[i] = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yu, coef_g),
+                                           _mm_madd_epi16(v0, coef_gv)), round);
+        b[i] = _mm_add_epi32(_mm_madd_epi16(yu, coef_b), round);
+        r[i] = _mm_srai_epi32(r[i], 8);
+        g[i] = _mm_srai_epi32(g[i], 8);
+        b[i] = _mm_srai_epi32(b[i], 8);
+    }
+
+    /* The saturating packs do the clamp to [0, 255] */
+    r8 = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]), zero);
+    g8 = _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), zero);
+    b8 = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), zero);
+
+    rg = _mm_unpacklo_epi8(r8, g8);
+    bx = _mm_unpacklo_epi8(b8, zero);
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg, bx));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, bx));
+}
+
+static void
+convert_row_yuyv_rgbx8_sse2(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    const __m128i mask_lo = _mm_set1_epi16(0xff);
+    unsigned x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + x * 2));
+
+        convert_yuv8_sse2(dst + x * 4, _mm_and_si128(s, mask_lo),
+                          _mm_srli_epi16(s, 8));
+    }
+
+    if (x < width)
+        convert_row_yuyv_rgbx8_c(dst + x * 4, src + x * 2, width - x);
+}
+
+static void
+convert_row_uyvy_rgbx8_sse2(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+    const __m128i mask_lo = _mm_set1_epi16(0xff);
+    unsigned x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + x * 2));
+
+        convert_yuv8_sse2(dst + x * 4, _mm_srli_epi16(s, 8),
+                          _mm_and_si128(s, mask_lo));
+    }
+
+    if (x < width)
+        convert_row_uyvy_rgbx8_c(dst + x * 4, src + x * 2, width - x);
+}
+
+#endif /* PIPE_ARCH_SSE */
+
+static nine_format_convert_row_func
+nine_format_get_convert_row(enum pipe_format dst_format,
+                            enum pipe_format src_format)
+{
+#if defined(PIPE_ARCH_SSE) && UTIL_ARCH_LITTLE_ENDIAN
+    boolean sse2 = util_get_cpu_caps()->has_sse2;
+#else
+    boolean sse2 = FALSE;
+#endif
+
+    (void) sse2;
+    switch (src_format) {
+    case PIPE_FORMAT_R8SG8SB8UX8U_NORM:
+        if (dst_format != PIPE_FORMAT_R32G32B32X32_FLOAT)
+            return NULL;
+#if defined(PIPE_ARCH_SSE)
+        if (sse2)
+            return convert_row_x8l8v8u8_rgbx32f_sse2;
+#endif
+        return convert_row_x8l8v8u8_rgbx32f;
+    case PIPE_FORMAT_YUYV:
+        if (dst_format != PIPE_FORMAT_R8G8B8X8_UNORM)
+            return NULL;
+#if defined(PIPE_ARCH_SSE)
+        if (sse2)
+            return convert_row_yuyv_rgbx8_sse2;
+#endif
+        return convert_row_yuyv_rgbx8_c;
+    case PIPE_FORMAT_UYVY:
+        if (dst_format != PIPE_FORMAT_R8G8B8X8_UNORM)
+            return NULL;
+#if defined(PIPE_ARCH_SSE)
+        if (sse2)
+            return convert_row_uyvy_rgbx8_sse2;
+#endif
+        return convert_row_uyvy_rgbx8_c;
+    default:
+        return NULL;
+    }
+}
+
+boolean
+nine_format_translate(enum pipe_format dst_format,
+                      void *dst, unsigned dst_stride,
+                      unsigned dst_x, unsigned dst_y,
+                      enum pipe_format src_format,
+                      const void *src, unsigned src_stride,
+                      unsigned src_x, unsigned src_y,
+                      unsigned width, unsigned height)
+{
+    nine_format_convert_row_func convert_row =
+        nine_format_get_convert_row(dst_format, src_format);
+    const struct util_format_description *dst_desc, *src_desc;
+    uint8_t *dst_row;
+    const uint8_t *src_row;
+    unsigned y;
+
+    if (!convert_row)
+        return util_format_translate(dst_format, dst, dst_stride, dst_x, dst_y,
+                                     src_format, src, src_stride, src_x, src_y,
+                                     width, height);
+
+    dst_desc = util_format_description(dst_format);
+    src_desc = util_format_description(src_format);
+    assert(dst_desc->block.width == 1 && dst_desc->block.height == 1);
+    assert(src_desc->block.height == 1);
+    assert(src_x % src_desc->block.width == 0);
+
+    dst_row = (uint8_t *)dst + dst_y * dst_stride +
+        dst_x * (dst_desc->block.bits / 8);
+    src_row = (const uint8_t *)src + src_y * src_stride +
+        (src_x / src_desc->block.width) * (src_desc->block.bits / 8);
+
+    for (y = 0; y < height; y++) {
+        convert_row(dst_row, src_row, width);
+        dst_row += dst_stride;
+        src_row += src_stride;
+    }
+    return TRUE;
+}
+
+boolean
+nine_format_translate_3d(enum pipe_format dst_format,
+                         void *dst, unsigned dst_stride,
+                         unsigned dst_slice_stride,
+                         unsigned dst_x, unsigned dst_y,
+                         unsigned dst_z,
+                         enum pipe_format src_format,
+                         const void *src, unsigned src_stride,
+                         unsigned src_slice_stride,
+                         unsigned src_x, unsigned src_y,
+                         unsigned src_z, unsigned width,
+                         unsigned height, unsigned depth)
+{
+    uint8_t *dst_layer = (uint8_t *)dst + dst_z * dst_slice_stride;
+    const uint8_t *src_layer = (const uint8_t *)src + src_z * src_slice_stride;
+    unsigned z;
+
+    for (z = 0; z < depth; ++z) {
+        if (!nine_format_translate(dst_format, dst_layer, dst_stride,
+                                   dst_x, dst_y,
+                                   src_format, src_layer, src_stride,
+                                   src_x, src_y,
+                                   width, height))
+            return FALSE;
+
+        dst_layer += dst_slice_stride;
+        src_layer += src_slice_stride;
+    }
+    return TRUE;
+}
@@ -0,0 +1,113 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "device9.h"
+#include "nine_debug.h"
+#include "nine_hud.h"
+#include "nine_memory_helper.h"
+
+#include "hud/hud_context.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+
+#define DBG_CHANNEL DBG_DEVICE
+
+enum nine_hud_counter {
+    NINE_HUD_CSMT_QUEUE_DEPTH,
+    NINE_HUD_CSMT_WAIT,
+    NINE_HUD_UPDATE_STATE,
+    NINE_HUD_SHADER_COMPILES,
+    NINE_HUD_UPLOAD_BYTES,
+    NINE_HUD_MEMFD_MAPS,
+    NINE_HUD_MEMFD_UNMAPS,
+    NINE_HUD_NUM_COUNTERS
+};
+
+static const struct {
+    const char *name;
+    enum pipe_driver_query_type type;
+    bool cumulative;
+} nine_hud_counter_info[NINE_HUD_NUM_COUNTERS] = {
+    [NINE_HUD_CSMT_QUEUE_DEPTH] = { "nine-csmt-queue-depth", PIPE_DRIVER_QUERY_TYPE_UINT, false },
+    [NINE_HUD_CSMT_WAIT] = { "nine-csmt-wait", PIPE_DRIVER_QUERY_TYPE_MICROSECONDS, false },
+    [NINE_HUD_UPDATE_STATE] = { "nine-update-state", PIPE_DRIVER_QUERY_TYPE_MICROSECONDS, true },
+    [NINE_HUD_SHADER_COMPILES] = { "nine-shader-compiles", PIPE_DRIVER_QUERY_TYPE_UINT, true },
+    [NINE_HUD_UPLOAD_BYTES] = { "nine-upload-bytes", PIPE_DRIVER_QUERY_TYPE_BYTES, true },
+    [NINE_HUD_MEMFD_MAPS] = { "nine-memfd-maps", PIPE_DRIVER_QUERY_TYPE_UINT, true },
+    [NINE_HUD_MEMFD_UNMAPS] = { "nine-memfd-unmaps", PIPE_DRIVER_QUERY_TYPE_UINT, true },
+};
+
+void
+nine_hud_init(struct NineDevice9 *device)
+{
+    struct hud_frontend_counter *counters;
+    unsigned i;
+
+    /* The HUD needs the counters to parse GALLIUM_HUD */
+    counters = CALLOC(NINE_HUD_NUM_COUNTERS, sizeof(*counters));
+    if (counters) {
+        for (i = 0; i < NINE_HUD_NUM_COUNTERS; i++) {
+            counters[i].name = nine_hud_counter_info[i].name;
+            counters[i].type = nine_hud_counter_info[i].type;
+            counters[i].cumulative = nine_hud_counter_info[i].cumulative;
+        }
+    }
+
+    device->hud = hud_create(device->context.cso, NULL, NULL, counters,
+                             counters ? NINE_HUD_NUM_COUNTERS : 0);
+    if (!device->hud) {
+        FREE(counters);
+        return;
+    }
+    device->hud_counters = counters;
+}
+
+void
+nine_hud_fini(struct NineDevice9 *device)
+{
+    FREE(device->hud_counters);
+    device->hud_counters = NULL;
+}
+
+void
+nine_hud_update(struct NineDevice9 *device)
+{
+    struct hud_frontend_counter *counters = device->hud_counters;
+    const struct nine_csmt_stats *csmt = &device->csmt_stats;
+    unsigned long long maps = 0, unmaps = 0;
+
+    if (!counters)
+        return;
+
+    counters[NINE_HUD_CSMT_QUEUE_DEPTH].value = csmt->queue.flushes ?
+        csmt->queue.depth_sum / csmt->queue.flushes : 0;
+    counters[NINE_HUD_CSMT_WAIT].value = csmt->sync_ns / 1000;
+    counters[NINE_HUD_UPDATE_STATE].value =
+        p_atomic_read(&device->cpu_stats.update_state_ns) / 1000;
+    counters[NINE_HUD_SHADER_COMPILES].value =
+        p_atomic_read(&device->cpu_stats.shader_compiles);
+    counters[NINE_HUD_UPLOAD_BYTES].value =
+        p_atomic_read(&device->cpu_stats.upload_bytes);
+
+    if (device->allocator)
+        nine_allocator_get_map_stats(device->allocator, &maps, &unmaps);
+    counters[NINE_HUD_MEMFD_MAPS].value = maps;
+    counters[NINE_HUD_MEMFD_UNMAPS].value = unmaps;
+}
@@ -0,0 +1,47 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#ifndef _NINE_HUD_H_
+#define _NINE_HUD_H_
+
+struct NineDevice9;
+
+/* CPU side counters of nine, selectable in GALLIUM_HUD (see README):
+ * nine-csmt-queue-depth: average number of command buffers waiting for
+ *                        the worker thread when one is flushed
+ * nine-csmt-wait: time the application thread waited for the worker
+ * nine-update-state: time spent in nine_update_state
+ * nine-shader-compiles: shaders and shader variants compiled
+ * nine-upload-bytes: data uploaded to textures and buffers
+ * nine-memfd-maps, nine-memfd-unmaps: mappings of the memfd files
+ * The csmt counters are those of the previous frame. */
+
+/* Creates device->hud, which is NULL if GALLIUM_HUD is unset */
+void
+nine_hud_init(struct NineDevice9 *device);
+
+void
+nine_hud_fini(struct NineDevice9 *device);
+
+/* Called before drawing the HUD */
+void
+nine_hud_update(struct NineDevice9 *device);
+
+#endif /* _NINE_HUD_H_ */
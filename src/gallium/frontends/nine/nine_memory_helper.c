@@ -73,6 +73,12 @@
  * Multiple memfd files are used, each of 100MB. Thus memory usage (but not virtual memory usage) increases
  * by amounts of 100MB. When not on x86 32 bits, we do use the standard malloc.
  *
+ * Free regions are kept in red-black trees: one per file sorted by offset, to merge neighbours on release,
+ * and one for all files sorted by size, to find the best fitting region in O(log n).
+ * Mapped regions that are not locked anymore are kept in LRU lists (oldest unlock first), so that
+ * unmapping to reach the threshold releases the least recently used regions first, without walking
+ * every file.
+ *
  * Finally, for ease of use, we do not implement packing of allocation inside page-aligned regions.
  * One allocation is given one page-aligned region inside a memfd file.
  * Allocations smaller than a page (4KB on x86) go through malloc.
@@ -94,6 +100,7 @@
 #include <unistd.h>
 
 #include "util/list.h"
+#include "util/rb_tree.h"
 #include "util/u_memory.h"
 #include "util/slab.h"
 
@@ -119,24 +126,27 @@
 
 #ifdef NINE_ENABLE_MEMFD
 
+struct nine_memfd_file;
+
 struct nine_memfd_file_region {
+    struct nine_memfd_file *file; /* File the region belongs to */
     unsigned offset;
     unsigned size;
     void *map; /* pointer to the mapped content of the file. Can be NULL */
     int num_locks; /* Total number of locks blocking the munmap */
     int num_weak_unlocks; /* Number of users which weakly block the munmap */
     bool zero_filled;
-    struct list_head list;
+    struct list_head list; /* Allocated regions: list of the current state of the region */
+    struct rb_node node_offset; /* Free regions: node in the free tree of the file */
+    struct rb_node node_size; /* Free regions: node in the free tree of the allocator */
 };
 
 struct nine_memfd_file {
     int fd;
     int filesize; /* Size of the file */
-    struct list_head free_regions; /* This list is sorted by the offset, and consecutive regions are merged */
-    struct list_head unmapped_allocated_regions; /* This list and the following ones are not sorted */
+    struct rb_tree free_regions; /* Sorted by offset, and consecutive regions are merged */
+    struct list_head unmapped_allocated_regions; /* This list and the following one are not sorted */
     struct list_head locked_mapped_allocated_regions;
-    struct list_head weak_unlocked_mapped_allocated_regions;
-    struct list_head unlocked_mapped_allocated_regions;
 };
 
 /* The allocation is stored inside a memfd */
@@ -216,26 +226,42 @@ struct nine_allocator {
     struct slab_mempool allocation_pool;
     struct slab_mempool region_pool;
     struct nine_memfd_file *memfd_pool; /* Table (of size num_fd) of memfd files */
+    struct rb_tree free_regions; /* Free regions of all the files, sorted by size */
+    long long total_free_memory; /* Size of the free regions of all the files */
+    /* Mapped and unlocked regions of all the files, least recently unlocked first */
+    struct list_head unlocked_mapped_regions;
+    struct list_head weak_unlocked_mapped_regions;
     struct list_head pending_releases; /* List of allocations with unlocks depending on pending_counter */ /* TODO: Elements seem removed only on flush. Destruction ? */
 
     pthread_mutex_t mutex_pending_frees;
     struct list_head pending_frees;
+
+    struct {
+        unsigned long long memfd_allocs;
+        unsigned long long memfd_frees;
+        unsigned long long malloc_allocs;
+        unsigned long long maps;
+        unsigned long long unmaps;
+        unsigned long long evictions; /* unmaps to stay below the virtual memory limit */
+        unsigned long long splits;
+        unsigned long long merges;
+    } stats;
 };
 
 #ifdef DEBUG
 
 static void
-debug_dump_memfd_state(struct nine_memfd_file *memfd_file, bool details)
+debug_dump_memfd_state(struct nine_allocator *allocator, struct nine_memfd_file *memfd_file, bool details)
 {
     struct nine_memfd_file_region *region;
 
     DBG("fd: %d, filesize: %d\n", memfd_file->fd, memfd_file->filesize);
     if (!details)
         return;
-    LIST_FOR_EACH_ENTRY(region, &memfd_file->free_regions, list) {
+    rb_tree_foreach(struct nine_memfd_file_region, free_region, &memfd_file->free_regions, node_offset) {
         DBG("FREE block: offset %d, size %d, map=%p, locks=%d, weak=%d, z=%d\n",
-            region->offset, region->size, region->map,
-        region->num_locks, region->num_weak_unlocks, (int)region->zero_filled);
+            free_region->offset, free_region->size, free_region->map,
+        free_region->num_locks, free_region->num_weak_unlocks, (int)free_region->zero_filled);
     }
     LIST_FOR_EACH_ENTRY(region, &memfd_file->unmapped_allocated_regions, list) {
         DBG("UNMAPPED ALLOCATED block: offset %d, size %d, map=%p, locks=%d, weak=%d, z=%d\n",
@@ -247,12 +273,16 @@ debug_dump_memfd_state(struct nine_memfd_file *memfd_file, bool details)
             region->offset, region->size, region->map,
         region->num_locks, region->num_weak_unlocks, (int)region->zero_filled);
     }
-    LIST_FOR_EACH_ENTRY(region, &memfd_file->unlocked_mapped_allocated_regions, list) {
+    LIST_FOR_EACH_ENTRY(region, &allocator->unlocked_mapped_regions, list) {
+        if (region->file != memfd_file)
+            continue;
         DBG("UNLOCKED MAPPED ALLOCATED block: offset %d, size %d, map=%p, locks=%d, weak=%d, z=%d\n",
             region->offset, region->size, region->map,
         region->num_locks, region->num_weak_unlocks, (int)region->zero_filled);
     }
-    LIST_FOR_EACH_ENTRY(region, &memfd_file->weak_unlocked_mapped_allocated_regions, list) {
+    LIST_FOR_EACH_ENTRY(region, &allocator->weak_unlocked_mapped_regions, list) {
+        if (region->file != memfd_file)
+            continue;
         DBG("WEAK UNLOCKED MAPPED ALLOCATED block: offset %d, size %d, map=%p, locks=%d, weak=%d, z=%d\n",
             region->offset, region->size, region->map,
         region->num_locks, region->num_weak_unlocks, (int)region->zero_filled);
@@ -260,12 +290,12 @@ debug_dump_memfd_state(struct nine_memfd_file *memfd_file, bool details)
 }
 
 static void
-debug_dump_allocation_state(struct nine_allocation *allocation)
+debug_dump_allocation_state(struct nine_allocator *allocator, struct nine_allocation *allocation)
 {
     switch(allocation->allocation_type) {
         case NINE_MEMFD_ALLOC:
             DBG("Allocation is stored in this memfd file:\n");
-            debug_dump_memfd_state(allocation->memory.memfd.file, true);
+            debug_dump_memfd_state(allocator, allocation->memory.memfd.file, true);
             DBG("Allocation is offset: %d, size: %d\n",
                 allocation->memory.memfd.region->offset, allocation->memory.memfd.region->size);
             break;
@@ -273,7 +303,7 @@ debug_dump_allocation_state(struct nine_allocation *allocation)
             DBG("Allocation is suballocation at relative offset %d of this allocation:\n",
                 allocation->memory.submemfd.relative_offset);
             DBG("Parent allocation is stored in this memfd file:\n");
-            debug_dump_memfd_state(allocation->memory.submemfd.parent->file, false);
+            debug_dump_memfd_state(allocator, allocation->memory.submemfd.parent->file, false);
             DBG("Parent allocation is offset: %d, size: %d\n",
                 allocation->memory.submemfd.parent->region->offset,
                 allocation->memory.submemfd.parent->region->size);
@@ -292,15 +322,17 @@ debug_dump_allocation_state(struct nine_allocation *allocation)
 #else
 
 static void
-debug_dump_memfd_state(struct nine_memfd_file *memfd_file, bool details)
+debug_dump_memfd_state(struct nine_allocator *allocator, struct nine_memfd_file *memfd_file, bool details)
 {
+    (void)allocator;
     (void)memfd_file;
     (void)details;
 }
 
 static void
-debug_dump_allocation_state(struct nine_allocation *allocation)
+debug_dump_allocation_state(struct nine_allocator *allocator, struct nine_allocation *allocation)
 {
+   (void)allocator;
    (void)allocation;
 }
 
@@ -314,6 +346,19 @@ debug_dump_allocator_state(struct nine_allocator *allocator)
     DBG("Total virtual memory locked: %lld\n", allocator->total_locked_memory);
     DBG("Virtual memory used: %lld / %lld\n", allocator->total_virtual_memory, allocator->total_virtual_memory_limit);
     DBG("Num memfd files: %d / %d\n", allocator->num_fd, allocator->num_fd_max);
+    if (allocator->total_free_memory) {
+        struct rb_node *largest = rb_tree_last(&allocator->free_regions);
+        unsigned largest_size = rb_node_data(struct nine_memfd_file_region, largest, node_size)->size;
+        /* Share of the free memory not usable for an allocation of the largest free region size */
+        DBG("Memfd free memory: %lld, largest free region: %u, fragmentation: %d%%\n",
+            allocator->total_free_memory, largest_size,
+            (int)(100 - (100 * (long long)largest_size) / allocator->total_free_memory));
+    }
+    DBG("Memfd allocations: %llu, frees: %llu, malloc allocations: %llu\n",
+        allocator->stats.memfd_allocs, allocator->stats.memfd_frees, allocator->stats.malloc_allocs);
+    DBG("Maps: %llu, unmaps: %llu (evictions: %llu), splits: %llu, merges: %llu\n",
+        allocator->stats.maps, allocator->stats.unmaps, allocator->stats.evictions,
+        allocator->stats.splits, allocator->stats.merges);
 }
 
 
@@ -349,67 +394,122 @@ static void move_region(struct list_head *tail, struct nine_memfd_file_region *r
     list_addtail(&region->list, tail);
 }
 
-#if 0
-static void move_region_ordered(struct list_head *tail, struct nine_memfd_file_region *region)
+static int
+region_offset_cmp(const struct rb_node *a, const struct rb_node *b)
 {
-    struct nine_memfd_file_region *cur_region;
-    struct list_head *insertion_point = tail;
+    unsigned offset_a = rb_node_data(struct nine_memfd_file_region, a, node_offset)->offset;
+    unsigned offset_b = rb_node_data(struct nine_memfd_file_region, b, node_offset)->offset;
+    return (offset_b > offset_a) - (offset_b < offset_a);
+}
 
-    /* Remove from previous list (if any) */
-    list_delinit(&region->list);
+static int
+region_offset_search_cmp(const struct rb_node *node, const void *key)
+{
+    unsigned offset = rb_node_data(struct nine_memfd_file_region, node, node_offset)->offset;
+    unsigned key_offset = *(const unsigned *)key;
+    return (key_offset > offset) - (key_offset < offset);
+}
 
-    LIST_FOR_EACH_ENTRY(cur_region, tail, list) {
-        if (cur_region->offset > region->offset)
-            break;
-        insertion_point = &cur_region->list;
+/* Sort by size. Ties are broken by file and offset to keep the order stable */
+static int
+region_size_cmp(const struct rb_node *a, const struct rb_node *b)
+{
+    const struct nine_memfd_file_region *ra = rb_node_data(struct nine_memfd_file_region, a, node_size);
+    const struct nine_memfd_file_region *rb = rb_node_data(struct nine_memfd_file_region, b, node_size);
+    if (ra->size != rb->size)
+        return rb->size > ra->size ? 1 : -1;
+    if (ra->file->fd != rb->file->fd)
+        return rb->file->fd > ra->file->fd ? 1 : -1;
+    return (rb->offset > ra->offset) - (rb->offset < ra->offset);
+}
+
+static void
+free_region_insert(struct nine_allocator *allocator, struct nine_memfd_file_region *region)
+{
+    rb_tree_insert(&region->file->free_regions, &region->node_offset, region_offset_cmp);
+    rb_tree_insert(&allocator->free_regions, &region->node_size, region_size_cmp);
+    allocator->total_free_memory += region->size;
+}
+
+static void
+free_region_remove(struct nine_allocator *allocator, struct nine_memfd_file_region *region)
+{
+    rb_tree_remove(&region->file->free_regions, &region->node_offset);
+    rb_tree_remove(&allocator->free_regions, &region->node_size);
+    allocator->total_free_memory -= region->size;
+}
+
+/* Smallest free region of all the files of size at least 'size'. NULL if none. */
+static struct nine_memfd_file_region *
+free_region_best_fit(struct nine_allocator *allocator, unsigned size)
+{
+    struct rb_node *node = allocator->free_regions.root;
+    struct nine_memfd_file_region *best_region = NULL;
+
+    while (node) {
+        struct nine_memfd_file_region *region =
+            rb_node_data(struct nine_memfd_file_region, node, node_size);
+        if (region->size >= size) {
+            best_region = region;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
     }
-    /* Insert just before cur_region */
-    list_add(&region->list, insertion_point);
+    return best_region;
 }
-#endif
 
-static void move_region_ordered_merge(struct nine_allocator *allocator, struct list_head *tail, struct nine_memfd_file_region *region)
+/* Add a region to the free regions of its file, merging it with its neighbours */
+static void
+free_region_add_merge(struct nine_allocator *allocator, struct nine_memfd_file_region *region)
 {
-    struct nine_memfd_file_region *p, *cur_region = NULL, *prev_region = NULL;
+    struct nine_memfd_file_region *prev_region = NULL, *next_region = NULL;
+    struct rb_node *node, *neighbour;
 
     /* Remove from previous list (if any) */
     list_delinit(&region->list);
 
-    LIST_FOR_EACH_ENTRY(p, tail, list) {
-        cur_region = p;
-        if (cur_region->offset > region->offset)
-            break;
-        prev_region = cur_region;
+    node = rb_tree_search_sloppy(&region->file->free_regions, &region->offset, region_offset_search_cmp);
+    if (node) {
+        struct nine_memfd_file_region *p = rb_node_data(struct nine_memfd_file_region, node, node_offset);
+        assert(p->offset != region->offset);
+        if (p->offset < region->offset) {
+            prev_region = p;
+            neighbour = rb_node_next(node);
+            if (neighbour)
+                next_region = rb_node_data(struct nine_memfd_file_region, neighbour, node_offset);
+        } else {
+            next_region = p;
+            neighbour = rb_node_prev(node);
+            if (neighbour)
+                prev_region = rb_node_data(struct nine_memfd_file_region, neighbour, node_offset);
+        }
     }
 
-    /* Insert after prev_region and before cur_region. Try to merge */
     if (prev_region && ((prev_region->offset + prev_region->size) == region->offset)) {
-        if (cur_region && (cur_region->offset == (region->offset + region->size))) {
-            /* Merge all three regions */
-            prev_region->size += region->size + cur_region->size;
-            prev_region->zero_filled = prev_region->zero_filled && region->zero_filled && cur_region->zero_filled;
-            list_del(&cur_region->list);
-            slab_free_st(&allocator->region_pool, region);
-            slab_free_st(&allocator->region_pool, cur_region);
-        } else {
-            prev_region->size += region->size;
-            prev_region->zero_filled = prev_region->zero_filled && region->zero_filled;
-            slab_free_st(&allocator->region_pool, region);
-        }
-    } else if (cur_region && (cur_region->offset == (region->offset + region->size))) {
-        cur_region->offset = region->offset;
-        cur_region->size += region->size;
-        cur_region->zero_filled = region->zero_filled && cur_region->zero_filled;
+        free_region_remove(allocator, prev_region);
+        prev_region->size += region->size;
+        prev_region->zero_filled = prev_region->zero_filled && region->zero_filled;
         slab_free_st(&allocator->region_pool, region);
-    } else {
-        list_add(&region->list, prev_region ? &prev_region->list : tail);
+        region = prev_region;
+        allocator->stats.merges++;
+    }
+    if (next_region && (next_region->offset == (region->offset + region->size))) {
+        free_region_remove(allocator, next_region);
+        region->size += next_region->size;
+        region->zero_filled = region->zero_filled && next_region->zero_filled;
+        slab_free_st(&allocator->region_pool, next_region);
+        allocator->stats.merges++;
     }
+    free_region_insert(allocator, region);
 }
 
-static struct nine_memfd_file_region *allocate_region(struct nine_allocator *allocator, unsigned offset, unsigned size) {
-    struct nine_memfd_file_region *region = slab_alloc_st(&allocator->allocation_pool);
+static struct nine_memfd_file_region *allocate_region(struct nine_allocator *allocator, struct nine_memfd_file *memfd_file,
+                                                      unsigned offset, unsigned size) {
+    struct nine_memfd_file_region *region = slab_alloc_st(&allocator->region_pool);
     if (!region)
         return NULL;
+    region->file = memfd_file;
     region->offset = offset;
     region->size = size;
     region->num_locks = 0;
@@ -420,52 +520,46 @@ static struct nine_memfd_file_region *allocate_region(struct nine_allocator *all
     return region;
 }
 
-/* Go through memfd allocated files, and try to use unused memory for the requested allocation.
+/* Try to use unused memory of the memfd allocated files for the requested allocation.
  * Returns whether it suceeded */
 static bool
 insert_new_allocation(struct nine_allocator *allocator, struct nine_allocation *new_allocation, unsigned allocation_size)
 {
-    int memfd_index;
-    struct nine_memfd_file *memfd_file, *best_memfd_file;
-    struct nine_memfd_file_region *region, *best_region, *new_region;
-
+    struct nine_memfd_file_region *best_region, *new_region;
+    unsigned remaining_size;
 
     /* Find the smallest - but bigger than the requested size - unused memory
      * region inside the memfd files. */
-    int min_blocksize = INT_MAX;
-
-    for (memfd_index = 0; memfd_index < allocator->num_fd; memfd_index++) {
-        memfd_file = (void*)allocator->memfd_pool + memfd_index*sizeof(struct nine_memfd_file);
-
-        LIST_FOR_EACH_ENTRY(region, &memfd_file->free_regions, list) {
-            if (region->size <= min_blocksize && region->size >= allocation_size) {
-                min_blocksize = region->size;
-                best_region = region;
-                best_memfd_file = memfd_file;
-            }
-        }
-        if (min_blocksize == allocation_size)
-            break;
-    }
+    best_region = free_region_best_fit(allocator, allocation_size);
 
     /* The allocation doesn't fit in any memfd file */
-    if (min_blocksize == INT_MAX)
+    if (!best_region)
         return false;
 
     /* Target region found */
     /* Move from free to unmapped allocated */
+    free_region_remove(allocator, best_region);
+    remaining_size = best_region->size;
     best_region->size = DIVUP(allocation_size, allocator->page_size) * allocator->page_size;
-    assert(min_blocksize >= best_region->size);
-    move_region(&best_memfd_file->unmapped_allocated_regions, best_region);
+    assert(remaining_size >= best_region->size);
+    move_region(&best_region->file->unmapped_allocated_regions, best_region);
     new_allocation->memory.memfd.region = best_region;
-    new_allocation->memory.memfd.file = best_memfd_file;
-
-    /* If the original region is bigger than needed, add new region with remaining space */
-    min_blocksize -= best_region->size;
-    if (min_blocksize > 0) {
-        new_region = allocate_region(allocator, best_region->offset + best_region->size, min_blocksize);
-        new_region->zero_filled = best_region->zero_filled;
-        move_region_ordered_merge(allocator, &best_memfd_file->free_regions, new_region);
+    new_allocation->memory.memfd.file = best_region->file;
+
+    /* If the original region is bigger than needed, add new region with remaining space.
+     * Its neighbours are allocated (or it would have been merged before), thus no merge. */
+    remaining_size -= best_region->size;
+    if (remaining_size > 0) {
+        new_region = allocate_region(allocator, best_region->file,
+                                     best_region->offset + best_region->size, remaining_size);
+        if (new_region) {
+            new_region->zero_filled = best_region->zero_filled;
+            free_region_insert(allocator, new_region);
+            allocator->stats.splits++;
+        } else {
+            /* Keep the space in the allocation rather than losing it */
+            best_region->size += remaining_size;
+        }
     }
     allocator->total_allocations += best_region->size;
     return true;
@@ -481,7 +575,6 @@ nine_flush_pending_releases(struct nine_allocator *allocator)
         assert(allocation->locks_on_counter > 0);
         /* If pending_releases reached 0, remove from the list and update the status */
         if (*allocation->pending_counter == 0) {
-            struct nine_memfd_file *memfd_file = nine_get_memfd_file_backing(allocation);
             struct nine_memfd_file_region *region = nine_get_memfd_region_backing(allocation);
             region->num_locks -= allocation->locks_on_counter;
             allocation->locks_on_counter = 0;
@@ -489,9 +582,9 @@ nine_flush_pending_releases(struct nine_allocator *allocator)
             if (region->num_locks == 0) {
                 /* Move to the correct list */
                 if (region->num_weak_unlocks)
-                    move_region(&memfd_file->weak_unlocked_mapped_allocated_regions, region);
+                    move_region(&allocator->weak_unlocked_mapped_regions, region);
                 else
-                    move_region(&memfd_file->unlocked_mapped_allocated_regions, region);
+                    move_region(&allocator->unlocked_mapped_regions, region);
                 allocator->total_locked_memory -= region->size;
             }
         }
@@ -512,13 +605,12 @@ nine_flush_pending_frees(struct nine_allocator *allocator)
         /* Set the allocation in an unlocked state, and then free it */
         if (allocation->allocation_type == NINE_MEMFD_ALLOC ||
         allocation->allocation_type == NINE_MEMFD_SUBALLOC) {
-            struct nine_memfd_file *memfd_file = nine_get_memfd_file_backing(allocation);
             struct nine_memfd_file_region *region = nine_get_memfd_region_backing(allocation);
             if (region->num_locks != 0) {
                 region->num_locks = 0;
                 allocator->total_locked_memory -= region->size;
                 /* Useless, but to keep consistency */
-                move_region(&memfd_file->unlocked_mapped_allocated_regions, region);
+                move_region(&allocator->unlocked_mapped_regions, region);
             }
             region->num_weak_unlocks = 0;
             allocation->weak_unlock = false;
@@ -531,12 +623,10 @@ nine_flush_pending_frees(struct nine_allocator *allocator)
     pthread_mutex_unlock(&allocator->mutex_pending_frees);
 }
 
-/* Try to unmap the memfd_index-th file if not already unmapped.
- * If even_if_weak is False, will not unmap if there are weak unlocks */
+/* Unmap a mapped region */
 static void
 nine_memfd_unmap_region(struct nine_allocator *allocator,
-                            struct nine_memfd_file *memfd_file,
-                            struct nine_memfd_file_region *region)
+                        struct nine_memfd_file_region *region)
 {
     int error;
     DBG("Unmapping memfd mapped region at %d: size: %d, map=%p, locks=%d, weak=%d\n",
@@ -551,13 +641,14 @@ nine_memfd_unmap_region(struct nine_allocator *allocator,
 
     region->map = NULL;
     /* Move from one of the mapped region list to the unmapped one */
-    move_region(&memfd_file->unmapped_allocated_regions, region);
+    move_region(&region->file->unmapped_allocated_regions, region);
     allocator->total_virtual_memory -= region->size;
+    allocator->stats.unmaps++;
 }
 
 /* Unallocate a region of a memfd file */
 static void
-remove_allocation(struct nine_allocator *allocator, struct nine_memfd_file *memfd_file, struct nine_memfd_file_region *region)
+remove_allocation(struct nine_allocator *allocator, struct nine_memfd_file_region *region)
 {
     assert(region->num_locks == 0);
     region->num_weak_unlocks = 0;
@@ -571,31 +662,25 @@ remove_allocation(struct nine_allocator *allocator, struct nine_memfd_file *memf
             memset(region->map, 0, region->size);
             region->zero_filled = true;
         }
-        nine_memfd_unmap_region(allocator, memfd_file, region);
+        nine_memfd_unmap_region(allocator, region);
     }
     /* Move from unmapped region to free region */
     allocator->total_allocations -= region->size;
-    move_region_ordered_merge(allocator, &memfd_file->free_regions, region);
+    free_region_add_merge(allocator, region);
 }
 
-/* Try to unmap the regions of the memfd_index-th file if not already unmapped.
- * If even_if_weak is False, will not unmap if there are weak unlocks */
+/* Unmap the regions of an unlocked region LRU list, least recently
+ * unlocked first, until we are below memory_limit. */
 static void
-nine_memfd_try_unmap_file(struct nine_allocator *allocator,
-                          int memfd_index,
-                          bool weak)
+nine_memfd_unmap_lru(struct nine_allocator *allocator,
+                     struct list_head *lru,
+                     long long memory_limit)
 {
-    struct nine_memfd_file *memfd_file = (void*)allocator->memfd_pool + memfd_index*sizeof(struct nine_memfd_file);
-    struct nine_memfd_file_region *region, *ptr;
-    DBG("memfd file at %d: fd: %d, filesize: %d\n",
-        memfd_index, memfd_file->fd, memfd_file->filesize);
-    debug_dump_memfd_state(memfd_file, true);
-    LIST_FOR_EACH_ENTRY_SAFE(region, ptr,
-                             weak ?
-                                &memfd_file->weak_unlocked_mapped_allocated_regions :
-                                &memfd_file->unlocked_mapped_allocated_regions,
-                             list) {
-        nine_memfd_unmap_region(allocator, memfd_file, region);
+    while (!list_is_empty(lru) && memory_limit < allocator->total_virtual_memory) {
+        struct nine_memfd_file_region *region =
+            list_first_entry(lru, struct nine_memfd_file_region, list);
+        nine_memfd_unmap_region(allocator, region);
+        allocator->stats.evictions++;
     }
 }
 
@@ -608,7 +693,6 @@ nine_memfd_files_unmap(struct nine_allocator *allocator,
 {
     long long memory_limit = unmap_everything_possible ?
         0 : allocator->total_virtual_memory_limit;
-    int i;
 
     /* We are below the limit. Do nothing */
     if (memory_limit >= allocator->total_virtual_memory)
@@ -617,28 +701,23 @@ nine_memfd_files_unmap(struct nine_allocator *allocator,
     /* Update allocations with pending releases */
     nine_flush_pending_releases(allocator);
 
-    DBG("Trying to unmap files with no weak unlock (%lld / %lld)\n",
+    DBG("Trying to unmap regions with no weak unlock (%lld / %lld)\n",
         allocator->total_virtual_memory, memory_limit);
 
-    /* Try to release everything with no weak releases.
+    /* Try to release regions with no weak releases first.
      * Those have data not needed for a long time (and
      * possibly ever). */
-    for (i = 0; i < allocator->num_fd; i++) {
-        nine_memfd_try_unmap_file(allocator, i, false);
-        if (memory_limit >= allocator->total_virtual_memory) {
-            return;}
-    }
+    nine_memfd_unmap_lru(allocator, &allocator->unlocked_mapped_regions, memory_limit);
+    if (memory_limit >= allocator->total_virtual_memory)
+        return;
 
-    DBG("Trying to unmap files even with weak unlocks (%lld / %lld)\n",
+    DBG("Trying to unmap regions even with weak unlocks (%lld / %lld)\n",
         allocator->total_virtual_memory, memory_limit);
 
-    /* This wasn't enough. Also release files with weak releases */
-    for (i = 0; i < allocator->num_fd; i++) {
-        nine_memfd_try_unmap_file(allocator, i, true);
-        /* Stop if the target is reached */
-        if (memory_limit >= allocator->total_virtual_memory) {
-            return;}
-    }
+    /* This wasn't enough. Also release regions with weak releases */
+    nine_memfd_unmap_lru(allocator, &allocator->weak_unlocked_mapped_regions, memory_limit);
+    if (memory_limit >= allocator->total_virtual_memory)
+        return;
 
     if (!unmap_everything_possible)
         return;
@@ -653,10 +732,8 @@ nine_memfd_files_unmap(struct nine_allocator *allocator,
     DBG("Retrying after flushing (%lld / %lld)\n",
         allocator->total_virtual_memory, memory_limit);
 
-    for (i = 0; i < allocator->num_fd; i++) {
-        nine_memfd_try_unmap_file(allocator, i, false);
-        nine_memfd_try_unmap_file(allocator, i, true);
-    }
+    nine_memfd_unmap_lru(allocator, &allocator->unlocked_mapped_regions, memory_limit);
+    nine_memfd_unmap_lru(allocator, &allocator->weak_unlocked_mapped_regions, memory_limit);
     /* We have done all we could */
 }
 
@@ -668,7 +745,7 @@ nine_memfd_region_map(struct nine_allocator *allocator, struct nine_memfd_file *
     if (region->map != NULL)
         return true;
 
-    debug_dump_memfd_state(memfd_file, true);
+    debug_dump_memfd_state(allocator, memfd_file, true);
     nine_memfd_files_unmap(allocator, false);
 
     void *buf = mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_file->fd, region->offset);
@@ -687,6 +764,7 @@ nine_memfd_region_map(struct nine_allocator *allocator, struct nine_memfd_file *
     region->map = buf;
     /* no need to move to an unlocked mapped regions list, the caller will handle the list */
     allocator->total_virtual_memory += region->size;
+    allocator->stats.maps++;
     assert((uintptr_t)buf % NINE_ALLOCATION_ALIGNMENT == 0); /* mmap should be page_size aligned, so it should be fine */
 
     return true;
@@ -743,14 +821,17 @@ nine_memfd_allocator(struct nine_allocator *allocator,
         return false;
     }
 
-    list_inithead(&memfd_file->free_regions);
+    rb_tree_init(&memfd_file->free_regions);
     list_inithead(&memfd_file->unmapped_allocated_regions);
     list_inithead(&memfd_file->locked_mapped_allocated_regions);
-    list_inithead(&memfd_file->unlocked_mapped_allocated_regions);
-    list_inithead(&memfd_file->weak_unlocked_mapped_allocated_regions);
 
     /* Initialize the memfd file with empty region and the allocation */
-    region = allocate_region(allocator, 0, allocation_size);
+    region = allocate_region(allocator, memfd_file, 0, allocation_size);
+    if (!region) {
+        close(memfd_file->fd);
+        allocator->num_fd--;
+        return false;
+    }
     region->zero_filled = true; /* ftruncate does zero-fill the new data */
     list_add(&region->list, &memfd_file->unmapped_allocated_regions);
     new_allocation->memory.memfd.file = memfd_file;
@@ -761,9 +842,15 @@ nine_memfd_allocator(struct nine_allocator *allocator,
         return true;
 
     /* Add empty region */
-    region = allocate_region(allocator, allocation_size, memfd_file->filesize - allocation_size);
+    region = allocate_region(allocator, memfd_file, allocation_size, memfd_file->filesize - allocation_size);
+    if (!region) {
+        /* Unusable space, but the allocation is fine */
+        new_allocation->memory.memfd.region->size = memfd_file->filesize;
+        allocator->total_allocations += memfd_file->filesize - allocation_size;
+        return true;
+    }
     region->zero_filled = true; /* ftruncate does zero-fill the new data */
-    list_add(&region->list, &memfd_file->free_regions);
+    free_region_insert(allocator, region);
 
     return true;
 }
@@ -801,8 +888,9 @@ nine_allocate(struct nine_allocator *allocator, unsigned size)
              * weak forever. */
             nine_pointer_strongrelease(allocator, new_allocation);
         }
+        allocator->stats.memfd_allocs++;
         DBG("ALLOCATION SUCCESSFUL\n");
-        debug_dump_allocation_state(new_allocation);
+        debug_dump_allocation_state(allocator, new_allocation);
         return new_allocation;
     }
 
@@ -819,8 +907,9 @@ nine_allocate(struct nine_allocator *allocator, unsigned size)
     allocator->total_allocations += size;
     allocator->total_locked_memory += size;
     allocator->total_virtual_memory += size;
+    allocator->stats.malloc_allocs++;
     DBG("ALLOCATION SUCCESSFUL\n");
-    debug_dump_allocation_state(new_allocation);
+    debug_dump_allocation_state(allocator, new_allocation);
     return new_allocation;
 }
 
@@ -829,7 +918,7 @@ static void
 nine_free_internal(struct nine_allocator *allocator, struct nine_allocation *allocation)
 {
     DBG("RELEASING ALLOCATION\n");
-    debug_dump_allocation_state(allocation);
+    debug_dump_allocation_state(allocator, allocation);
     if (allocation->allocation_type == NINE_MALLOC_ALLOC) {
         allocator->total_allocations -= allocation->memory.malloc.allocation_size;
         allocator->total_locked_memory -= allocation->memory.malloc.allocation_size;
@@ -837,12 +926,13 @@ nine_free_internal(struct nine_allocator *allocator, struct nine_allocation *all
         align_free(allocation->memory.malloc.buf);
     } else if (allocation->allocation_type == NINE_MEMFD_ALLOC ||
         allocation->allocation_type == NINE_MEMFD_SUBALLOC) {
-        struct nine_memfd_file *memfd_file = nine_get_memfd_file_backing(allocation);
         struct nine_memfd_file_region *region = nine_get_memfd_region_backing(allocation);
         if (allocation->weak_unlock)
             region->num_weak_unlocks--;
-        if (allocation->allocation_type == NINE_MEMFD_ALLOC)
-            remove_allocation(allocator, memfd_file, region);
+        if (allocation->allocation_type == NINE_MEMFD_ALLOC) {
+            remove_allocation(allocator, region);
+            allocator->stats.memfd_frees++;
+        }
     }
 
     slab_free_st(&allocator->allocation_pool, allocation);
@@ -927,9 +1017,8 @@ nine_pointer_weakrelease(struct nine_allocator *allocator, struct nine_allocatio
     allocation->weak_unlock = true;
     region->num_locks--;
     if (region->num_locks == 0) {
-        struct nine_memfd_file *memfd_file = nine_get_memfd_file_backing(allocation);
         allocator->total_locked_memory -= region->size;
-        move_region(&memfd_file->weak_unlocked_mapped_allocated_regions, region);
+        move_region(&allocator->weak_unlocked_mapped_regions, region);
     }
 }
 
@@ -944,12 +1033,11 @@ nine_pointer_strongrelease(struct nine_allocator *allocator, struct nine_allocat
     region = nine_get_memfd_region_backing(allocation);
     region->num_locks--;
     if (region->num_locks == 0) {
-        struct nine_memfd_file *memfd_file = nine_get_memfd_file_backing(allocation);
         allocator->total_locked_memory -= region->size;
         if (region->num_weak_unlocks)
-            move_region(&memfd_file->weak_unlocked_mapped_allocated_regions, region);
+            move_region(&allocator->weak_unlocked_mapped_regions, region);
         else
-            move_region(&memfd_file->unlocked_mapped_allocated_regions, region);
+            move_region(&allocator->unlocked_mapped_regions, region);
     }
 }
 
@@ -995,7 +1083,7 @@ nine_suballocate(struct nine_allocator* allocator, struct nine_allocation *alloc
     new_allocation->pending_counter = NULL;
     new_allocation->weak_unlock = false;
     list_inithead(&new_allocation->list_release);
-    debug_dump_allocation_state(new_allocation);
+    debug_dump_allocation_state(allocator, new_allocation);
     return new_allocation;
 }
 
@@ -1030,13 +1118,18 @@ nine_allocator_create(struct NineDevice9 *device, int memfd_virtualsizelimit)
     allocator->total_locked_memory = 0;
     allocator->total_virtual_memory = 0;
     allocator->total_virtual_memory_limit = memfd_virtualsizelimit * (1 << 20);
+    allocator->total_free_memory = 0;
     allocator->num_fd = 0;
+    memset(&allocator->stats, 0, sizeof(allocator->stats));
 
     DBG("Allocator created (ps: %d; fm: %d)\n", allocator->page_size, allocator->num_fd_max);
 
     slab_create(&allocator->allocation_pool, sizeof(struct nine_allocation), 4096);
     slab_create(&allocator->region_pool, sizeof(struct nine_memfd_file_region), 4096);
     allocator->memfd_pool = CALLOC(allocator->num_fd_max, sizeof(struct nine_memfd_file));
+    rb_tree_init(&allocator->free_regions);
+    list_inithead(&allocator->unlocked_mapped_regions);
+    list_inithead(&allocator->weak_unlocked_mapped_regions);
     list_inithead(&allocator->pending_releases);
     list_inithead(&allocator->pending_frees);
     pthread_mutex_init(&allocator->mutex_pending_frees, NULL);
@@ -1056,15 +1149,16 @@ nine_allocator_destroy(struct nine_allocator* allocator)
 
     assert(list_is_empty(&allocator->pending_frees));
     assert(list_is_empty(&allocator->pending_releases));
+    assert(list_is_empty(&allocator->unlocked_mapped_regions));
+    assert(list_is_empty(&allocator->weak_unlocked_mapped_regions));
     for (i = 0; i < allocator->num_fd; i++) {
-        debug_dump_memfd_state(&allocator->memfd_pool[i], true);
+        struct rb_node *node = rb_tree_first(&allocator->memfd_pool[i].free_regions);
+        debug_dump_memfd_state(allocator, &allocator->memfd_pool[i], true);
         assert(list_is_empty(&allocator->memfd_pool[i].locked_mapped_allocated_regions));
-        assert(list_is_empty(&allocator->memfd_pool[i].weak_unlocked_mapped_allocated_regions));
-        assert(list_is_empty(&allocator->memfd_pool[i].unlocked_mapped_allocated_regions));
-        assert(list_is_singular(&allocator->memfd_pool[i].free_regions));
-        slab_free_st(&allocator->region_pool,
-                     list_first_entry(&allocator->memfd_pool[i].free_regions,
-                                      struct nine_memfd_file_region, list));
+        assert(node && node == rb_tree_last(&allocator->memfd_pool[i].free_regions));
+        if (node)
+            slab_free_st(&allocator->region_pool,
+                         rb_node_data(struct nine_memfd_file_region, node, node_offset));
         close(allocator->memfd_pool[i].fd);
     }
     slab_destroy(&allocator->allocation_pool);
@@ -1073,6 +1167,15 @@ nine_allocator_destroy(struct nine_allocator* allocator)
     FREE(allocator);
 }
 
+void
+nine_allocator_get_map_stats(struct nine_allocator *allocator,
+                             unsigned long long *maps,
+                             unsigned long long *unmaps)
+{
+    *maps = allocator->stats.maps;
+    *unmaps = allocator->stats.unmaps;
+}
+
 #else
 
 struct nine_allocation {
@@ -1188,4 +1291,14 @@ nine_allocator_destroy(struct nine_allocator *allocator)
     pthread_mutex_destroy(&allocator->mutex_slab);
 }
 
+void
+nine_allocator_get_map_stats(struct nine_allocator *allocator,
+                             unsigned long long *maps,
+                             unsigned long long *unmaps)
+{
+    (void)allocator;
+    *maps = 0;
+    *unmaps = 0;
+}
+
 #endif /* NINE_ENABLE_MEMFD */
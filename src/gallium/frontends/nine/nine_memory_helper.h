@@ -72,4 +72,10 @@ nine_allocator_create(struct NineDevice9 *device, int memfd_virtualsizelimit);
 void
 nine_allocator_destroy(struct nine_allocator *allocator);
 
+/* Number of mmap and munmap calls on the memfd files since the creation */
+void
+nine_allocator_get_map_stats(struct nine_allocator *allocator,
+                             unsigned long long *maps,
+                             unsigned long long *unmaps);
+
 #endif /* _NINE_MEMORY_HELPER_H_ */
@@ -22,13 +22,20 @@
 
 #include "nine_queue.h"
 #include "os/os_thread.h"
+#include "util/os_time.h"
+#include "util/futex.h"
 #include "util/macros.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
 #include "nine_helpers.h"
 
+#include <limits.h>
+
 #define NINE_CMD_BUF_INSTR (256)
 
-#define NINE_CMD_BUFS (32)
-#define NINE_CMD_BUFS_MASK (NINE_CMD_BUFS - 1)
+#define NINE_CMD_BUFS_DEFAULT (32)
+#define NINE_CMD_BUFS_MIN (2)
+#define NINE_CMD_BUFS_MAX (256)
 
 #define NINE_QUEUE_SIZE (8192 * 16 + 128)
 
@@ -56,43 +63,164 @@
  * Constrains:
  * Only a single consumer and a single producer are supported.
  *
+ * The cmdbufs form a ring. The producer publishes a cmdbuf by advancing
+ * the flushed sequence, the consumer releases it by advancing the consumed
+ * sequence. Sequences advance by 2, the low bit is set by a side going to
+ * sleep on the sequence of the other side (futex word), so that the other
+ * side only does a wake up syscall when someone is actually waiting.
+ * When the ring is full, the producer sleeps until a batch of cmdbufs has
+ * been released rather than being woken for every one of them.
  */
 
+#define NINE_SEQ_WAITER 1u
+#define NINE_SEQ_INC 2u
+
 struct nine_cmdbuf {
     unsigned instr_size[NINE_CMD_BUF_INSTR];
     unsigned num_instr;
     unsigned offset;
     void *mem_pool;
-    BOOL full;
 };
 
 struct nine_queue_pool {
-    struct nine_cmdbuf pool[NINE_CMD_BUFS];
-    unsigned head;
-    unsigned tail;
+    struct nine_cmdbuf *pool;
+    unsigned num_cmdbufs;
+    unsigned mask;
+    unsigned wake_batch;
+
+    /* Producer side */
+    uint32_t head; /* sequence of the cmdbuf being filled */
+    uint32_t producer_wake_at;
+    /* Consumer side */
+    uint32_t tail; /* sequence of the cmdbuf being executed */
     unsigned cur_instr;
-    BOOL worker_wait;
-    cnd_t event_pop;
-    cnd_t event_push;
-    mtx_t mutex_pop;
-    mtx_t mutex_push;
+
+    /* Shared futex words */
+    uint32_t flushed;
+    uint32_t consumed;
+
+    struct nine_queue_stats stats;
+
+#if !UTIL_FUTEX_SUPPORTED
+    mtx_t mutex;
+    cnd_t cond;
+#endif
 };
 
+/* Whether sequence @seq is at or past @target */
+static inline bool
+nine_seq_reached(uint32_t seq, uint32_t target)
+{
+    return (int32_t)((seq & ~NINE_SEQ_WAITER) - target) >= 0;
+}
+
+static inline struct nine_cmdbuf *
+nine_queue_cmdbuf(struct nine_queue_pool* ctx, uint32_t seq)
+{
+    return &ctx->pool[(seq / NINE_SEQ_INC) & ctx->mask];
+}
+
+#if UTIL_FUTEX_SUPPORTED
+static inline void
+nine_queue_sleep(struct nine_queue_pool* ctx, uint32_t *word, uint32_t value)
+{
+    (void) ctx;
+    futex_wait(word, value, NULL);
+}
+
+static inline void
+nine_queue_wake(struct nine_queue_pool* ctx, uint32_t *word)
+{
+    (void) ctx;
+    futex_wake(word, INT_MAX);
+}
+#else
+static inline void
+nine_queue_sleep(struct nine_queue_pool* ctx, uint32_t *word, uint32_t value)
+{
+    mtx_lock(&ctx->mutex);
+    while (p_atomic_read(word) == value)
+        cnd_wait(&ctx->cond, &ctx->mutex);
+    mtx_unlock(&ctx->mutex);
+}
+
+static inline void
+nine_queue_wake(struct nine_queue_pool* ctx, uint32_t *word)
+{
+    (void) word;
+    mtx_lock(&ctx->mutex);
+    cnd_broadcast(&ctx->cond);
+    mtx_unlock(&ctx->mutex);
+}
+#endif
+
+/* Waits until *word reaches @target. The waiter bit is set before sleeping,
+ * and cleared by the side advancing the sequence when it wakes us up. */
+static void
+nine_queue_wait_seq(struct nine_queue_pool* ctx, uint32_t *word, uint32_t target)
+{
+    uint32_t seq = p_atomic_read(word);
+
+    while (!nine_seq_reached(seq, target)) {
+        if (!(seq & NINE_SEQ_WAITER)) {
+            uint32_t old = p_atomic_cmpxchg(word, seq, seq | NINE_SEQ_WAITER);
+            if (old != seq) {
+                seq = old;
+                continue;
+            }
+            seq |= NINE_SEQ_WAITER;
+        }
+        nine_queue_sleep(ctx, word, seq);
+        seq = p_atomic_read(word);
+    }
+}
+
+/* Advances *word by one cmdbuf. Wakes the other side if it waits for
+ * *word to reach @wake_at. Returns TRUE if it was woken. */
+static bool
+nine_queue_advance_seq(struct nine_queue_pool* ctx, uint32_t *word,
+                       const uint32_t *wake_at)
+{
+    uint32_t seq = p_atomic_read(word);
+    uint32_t old, next;
+    bool wake;
+
+    do {
+        old = seq;
+        next = (old & ~NINE_SEQ_WAITER) + NINE_SEQ_INC;
+        wake = false;
+        if (old & NINE_SEQ_WAITER) {
+            if (!wake_at || nine_seq_reached(next, p_atomic_read(wake_at)))
+                wake = true;
+            else
+                next |= NINE_SEQ_WAITER;
+        }
+        seq = p_atomic_cmpxchg(word, old, next);
+    } while (seq != old);
+
+    if (wake)
+        nine_queue_wake(ctx, word);
+    return wake;
+}
+
 /* Consumer functions: */
 void
 nine_queue_wait_flush(struct nine_queue_pool* ctx)
 {
-    struct nine_cmdbuf *cmdbuf = &ctx->pool[ctx->tail];
+    const uint32_t target = ctx->tail + NINE_SEQ_INC;
+    struct nine_cmdbuf *cmdbuf;
 
     /* wait for cmdbuf full */
-    mtx_lock(&ctx->mutex_push);
-    while (!cmdbuf->full)
-    {
+    if (!nine_seq_reached(p_atomic_read(&ctx->flushed), target)) {
+        int64_t start = os_time_get_nano();
+
         DBG("waiting for full cmdbuf\n");
-        cnd_wait(&ctx->event_push, &ctx->mutex_push);
+        nine_queue_wait_seq(ctx, &ctx->flushed, target);
+        p_atomic_add(&ctx->stats.consumer_idle_ns, os_time_get_nano() - start);
     }
+
+    cmdbuf = nine_queue_cmdbuf(ctx, ctx->tail);
     DBG("got cmdbuf=%p\n", cmdbuf);
-    mtx_unlock(&ctx->mutex_push);
 
     cmdbuf->offset = 0;
     ctx->cur_instr = 0;
@@ -104,20 +232,16 @@ nine_queue_wait_flush(struct nine_queue_pool* ctx)
 void *
 nine_queue_get(struct nine_queue_pool* ctx)
 {
-    struct nine_cmdbuf *cmdbuf = &ctx->pool[ctx->tail];
+    struct nine_cmdbuf *cmdbuf = nine_queue_cmdbuf(ctx, ctx->tail);
     unsigned offset;
 
     /* At this pointer there's always a cmdbuf. */
 
     if (ctx->cur_instr == cmdbuf->num_instr) {
         /* signal waiting producer */
-        mtx_lock(&ctx->mutex_pop);
         DBG("freeing cmdbuf=%p\n", cmdbuf);
-        cmdbuf->full = 0;
-        cnd_signal(&ctx->event_pop);
-        mtx_unlock(&ctx->mutex_pop);
-
-        ctx->tail = (ctx->tail + 1) & NINE_CMD_BUFS_MASK;
+        ctx->tail += NINE_SEQ_INC;
+        nine_queue_advance_seq(ctx, &ctx->consumed, &ctx->producer_wake_at);
 
         return NULL;
     }
@@ -138,7 +262,8 @@ nine_queue_get(struct nine_queue_pool* ctx)
 void
 nine_queue_flush(struct nine_queue_pool* ctx)
 {
-    struct nine_cmdbuf *cmdbuf = &ctx->pool[ctx->head];
+    struct nine_cmdbuf *cmdbuf = nine_queue_cmdbuf(ctx, ctx->head);
+    uint32_t free_at;
 
     DBG("flushing cmdbuf=%p instr=%d size=%d\n",
            cmdbuf, cmdbuf->num_instr, cmdbuf->offset);
@@ -148,24 +273,34 @@ nine_queue_flush(struct nine_queue_pool* ctx)
         return;
 
     /* signal waiting worker */
-    mtx_lock(&ctx->mutex_push);
-    cmdbuf->full = 1;
-    cnd_signal(&ctx->event_push);
-    mtx_unlock(&ctx->mutex_push);
-
-    ctx->head = (ctx->head + 1) & NINE_CMD_BUFS_MASK;
-
-    cmdbuf = &ctx->pool[ctx->head];
+    ctx->head += NINE_SEQ_INC;
+    if (nine_queue_advance_seq(ctx, &ctx->flushed, NULL))
+        p_atomic_inc(&ctx->stats.consumer_wakeups);
+    p_atomic_inc(&ctx->stats.flushes);
+    p_atomic_add(&ctx->stats.depth_sum,
+                 (ctx->head - (p_atomic_read(&ctx->consumed) & ~NINE_SEQ_WAITER)) /
+                 NINE_SEQ_INC);
+
+    /* The next cmdbuf is free once the consumer is less than
+     * num_cmdbufs cmdbufs behind. */
+    free_at = ctx->head - (ctx->num_cmdbufs - 1) * NINE_SEQ_INC;
 
     /* wait for queue empty */
-    mtx_lock(&ctx->mutex_pop);
-    while (cmdbuf->full)
-    {
+    if (!nine_seq_reached(p_atomic_read(&ctx->consumed), free_at)) {
+        int64_t start = os_time_get_nano();
+
         DBG("waiting for empty cmdbuf\n");
-        cnd_wait(&ctx->event_pop, &ctx->mutex_pop);
+        /* Read by the consumer after it sees the waiter bit */
+        p_atomic_set(&ctx->producer_wake_at,
+                     free_at + (ctx->wake_batch - 1) * NINE_SEQ_INC);
+        nine_queue_wait_seq(ctx, &ctx->consumed, ctx->producer_wake_at);
+
+        p_atomic_inc(&ctx->stats.producer_stalls);
+        p_atomic_add(&ctx->stats.producer_stall_ns, os_time_get_nano() - start);
     }
+
+    cmdbuf = nine_queue_cmdbuf(ctx, ctx->head);
     DBG("got empty cmdbuf=%p\n", cmdbuf);
-    mtx_unlock(&ctx->mutex_pop);
     cmdbuf->offset = 0;
     cmdbuf->num_instr = 0;
 }
@@ -177,7 +312,7 @@ void *
 nine_queue_alloc(struct nine_queue_pool* ctx, unsigned space)
 {
     unsigned offset;
-    struct nine_cmdbuf *cmdbuf = &ctx->pool[ctx->head];
+    struct nine_cmdbuf *cmdbuf = nine_queue_cmdbuf(ctx, ctx->head);
 
     if (space > NINE_QUEUE_SIZE)
         return NULL;
@@ -189,7 +324,7 @@ nine_queue_alloc(struct nine_queue_pool* ctx, unsigned space)
 
         nine_queue_flush(ctx);
 
-        cmdbuf = &ctx->pool[ctx->head];
+        cmdbuf = nine_queue_cmdbuf(ctx, ctx->head);
     }
 
     DBG("cmdbuf=%p space=%d\n", cmdbuf, space);
@@ -210,7 +345,7 @@ nine_queue_alloc(struct nine_queue_pool* ctx, unsigned space)
 bool
 nine_queue_no_flushed_work(struct nine_queue_pool* ctx)
 {
-    return (ctx->tail == ctx->head);
+    return nine_seq_reached(p_atomic_read(&ctx->consumed), ctx->head);
 }
 
 /* Returns the current queue empty state.
@@ -219,42 +354,68 @@ nine_queue_no_flushed_work(struct nine_queue_pool* ctx)
 bool
 nine_queue_isempty(struct nine_queue_pool* ctx)
 {
-    struct nine_cmdbuf *cmdbuf = &ctx->pool[ctx->head];
+    struct nine_cmdbuf *cmdbuf = nine_queue_cmdbuf(ctx, ctx->head);
 
-    return (ctx->tail == ctx->head) && !cmdbuf->num_instr;
+    return nine_queue_no_flushed_work(ctx) && !cmdbuf->num_instr;
+}
+
+/* Returns the statistics accumulated since the previous call,
+ * and resets them. Called by the producer. */
+void
+nine_queue_get_stats(struct nine_queue_pool* ctx, struct nine_queue_stats *stats)
+{
+    stats->flushes = p_atomic_xchg(&ctx->stats.flushes, 0);
+    stats->producer_stalls = p_atomic_xchg(&ctx->stats.producer_stalls, 0);
+    stats->producer_stall_ns = p_atomic_xchg(&ctx->stats.producer_stall_ns, 0);
+    stats->consumer_wakeups = p_atomic_xchg(&ctx->stats.consumer_wakeups, 0);
+    stats->consumer_idle_ns = p_atomic_xchg(&ctx->stats.consumer_idle_ns, 0);
+    stats->depth_sum = p_atomic_xchg(&ctx->stats.depth_sum, 0);
 }
 
 struct nine_queue_pool*
-nine_queue_create(void)
+nine_queue_create(unsigned num_cmdbufs)
 {
     unsigned i;
     struct nine_queue_pool *ctx;
 
+    if (!num_cmdbufs)
+        num_cmdbufs = NINE_CMD_BUFS_DEFAULT;
+    num_cmdbufs = util_next_power_of_two(CLAMP(num_cmdbufs, NINE_CMD_BUFS_MIN,
+                                               NINE_CMD_BUFS_MAX));
+
     ctx = CALLOC_STRUCT(nine_queue_pool);
     if (!ctx)
         goto failed;
 
-    for (i = 0; i < NINE_CMD_BUFS; i++) {
+    ctx->pool = CALLOC(num_cmdbufs, sizeof(*ctx->pool));
+    if (!ctx->pool)
+        goto failed;
+    ctx->num_cmdbufs = num_cmdbufs;
+    ctx->mask = num_cmdbufs - 1;
+    ctx->wake_batch = MAX2(num_cmdbufs / 4, 1);
+
+    for (i = 0; i < num_cmdbufs; i++) {
         ctx->pool[i].mem_pool = MALLOC(NINE_QUEUE_SIZE);
         if (!ctx->pool[i].mem_pool)
             goto failed;
     }
 
-    cnd_init(&ctx->event_pop);
-    (void) mtx_init(&ctx->mutex_pop, mtx_plain);
-
-    cnd_init(&ctx->event_push);
-    (void) mtx_init(&ctx->mutex_push, mtx_plain);
+#if !UTIL_FUTEX_SUPPORTED
+    cnd_init(&ctx->cond);
+    (void) mtx_init(&ctx->mutex, mtx_plain);
+#endif
 
-    /* Block until first cmdbuf has been flushed. */
-    ctx->worker_wait = TRUE;
+    DBG("Created queue with %u cmdbufs\n", num_cmdbufs);
 
     return ctx;
 failed:
     if (ctx) {
-        for (i = 0; i < NINE_CMD_BUFS; i++) {
-            if (ctx->pool[i].mem_pool)
-                FREE(ctx->pool[i].mem_pool);
+        if (ctx->pool) {
+            for (i = 0; i < num_cmdbufs; i++) {
+                if (ctx->pool[i].mem_pool)
+                    FREE(ctx->pool[i].mem_pool);
+            }
+            FREE(ctx->pool);
         }
         FREE(ctx);
     }
@@ -266,14 +427,14 @@ nine_queue_delete(struct nine_queue_pool *ctx)
 {
     unsigned i;
 
-    mtx_destroy(&ctx->mutex_pop);
-    cnd_destroy(&ctx->event_pop);
-
-    mtx_destroy(&ctx->mutex_push);
-    cnd_destroy(&ctx->event_push);
+#if !UTIL_FUTEX_SUPPORTED
+    mtx_destroy(&ctx->mutex);
+    cnd_destroy(&ctx->cond);
+#endif
 
-    for (i = 0; i < NINE_CMD_BUFS; i++)
+    for (i = 0; i < ctx->num_cmdbufs; i++)
         FREE(ctx->pool[i].mem_pool);
+    FREE(ctx->pool);
 
     FREE(ctx);
 }
@@ -27,6 +27,16 @@
 
 struct nine_queue_pool;
 
+/* Handoff statistics between the producer and the consumer */
+struct nine_queue_stats {
+    unsigned flushes; /* cmdbufs handed to the consumer */
+    unsigned producer_stalls; /* flushes which waited for a free cmdbuf */
+    uint64_t producer_stall_ns;
+    unsigned consumer_wakeups; /* flushes which had to wake the consumer */
+    uint64_t consumer_idle_ns; /* time the consumer waited for cmdbufs */
+    uint64_t depth_sum; /* cmdbufs not consumed yet, summed at each flush */
+};
+
 void
 nine_queue_wait_flush(struct nine_queue_pool* ctx);
 
@@ -45,8 +55,12 @@ nine_queue_no_flushed_work(struct nine_queue_pool* ctx);
 bool
 nine_queue_isempty(struct nine_queue_pool* ctx);
 
+void
+nine_queue_get_stats(struct nine_queue_pool* ctx, struct nine_queue_stats *stats);
+
+/* num_cmdbufs is rounded to a power of two, 0 selects the default. */
 struct nine_queue_pool*
-nine_queue_create(void);
+nine_queue_create(unsigned num_cmdbufs);
 
 void
 nine_queue_delete(struct nine_queue_pool *ctx);
@@ -25,16 +25,22 @@
 
 #include "device9.h"
 #include "nine_debug.h"
+#include "nine_shader_cache.h"
+#include "nine_sm1.h"
 #include "nine_state.h"
 #include "vertexdeclaration9.h"
 
+#include "util/blob.h"
 #include "util/macros.h"
 #include "util/u_memory.h"
 #include "util/u_inlines.h"
 #include "pipe/p_shader_tokens.h"
 #include "tgsi/tgsi_ureg.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_scan.h"
 #include "nir/tgsi_to_nir.h"
+#include "compiler/nir/nir_serialize.h"
 
 #define DBG_CHANNEL DBG_SHADER
 
@@ -48,86 +54,15 @@ typedef HRESULT (*translate_instruction_func)(struct shader_translator *);
 static inline const char *d3dsio_to_string(unsigned opcode);
 
 
-#define NINED3D_SM1_VS 0xfffe
-#define NINED3D_SM1_PS 0xffff
-
 #define NINE_MAX_COND_DEPTH 64
 #define NINE_MAX_LOOP_DEPTH 64
 
-#define NINED3DSP_END 0x0000ffff
-
-#define NINED3DSPTYPE_FLOAT4  0
-#define NINED3DSPTYPE_INT4    1
-#define NINED3DSPTYPE_BOOL    2
-
-#define NINED3DSPR_IMMEDIATE (D3DSPR_PREDICATE + 1)
-
-#define NINED3DSP_WRITEMASK_MASK  D3DSP_WRITEMASK_ALL
-#define NINED3DSP_WRITEMASK_SHIFT 16
-
-#define NINED3DSHADER_INST_PREDICATED (1 << 28)
-
-#define NINED3DSHADER_REL_OP_GT 1
-#define NINED3DSHADER_REL_OP_EQ 2
-#define NINED3DSHADER_REL_OP_GE 3
-#define NINED3DSHADER_REL_OP_LT 4
-#define NINED3DSHADER_REL_OP_NE 5
-#define NINED3DSHADER_REL_OP_LE 6
-
-#define NINED3DSIO_OPCODE_FLAGS_SHIFT 16
-#define NINED3DSIO_OPCODE_FLAGS_MASK  (0xff << NINED3DSIO_OPCODE_FLAGS_SHIFT)
-
-#define NINED3DSI_TEXLD_PROJECT 0x1
-#define NINED3DSI_TEXLD_BIAS    0x2
-
-#define NINED3DSP_WRITEMASK_0   0x1
-#define NINED3DSP_WRITEMASK_1   0x2
-#define NINED3DSP_WRITEMASK_2   0x4
-#define NINED3DSP_WRITEMASK_3   0x8
-#define NINED3DSP_WRITEMASK_ALL 0xf
-
-#define NINED3DSP_NOSWIZZLE ((0 << 0) | (1 << 2) | (2 << 4) | (3 << 6))
-
 #define NINE_SWIZZLE4(x,y,z,w) \
    TGSI_SWIZZLE_##x, TGSI_SWIZZLE_##y, TGSI_SWIZZLE_##z, TGSI_SWIZZLE_##w
 
 #define NINE_APPLY_SWIZZLE(src, s) \
    ureg_swizzle(src, NINE_SWIZZLE4(s, s, s, s))
 
-#define NINED3DSPDM_SATURATE (D3DSPDM_SATURATE >> D3DSP_DSTMOD_SHIFT)
-#define NINED3DSPDM_PARTIALP (D3DSPDM_PARTIALPRECISION >> D3DSP_DSTMOD_SHIFT)
-#define NINED3DSPDM_CENTROID (D3DSPDM_MSAMPCENTROID >> D3DSP_DSTMOD_SHIFT)
-
-/*
- * NEG     all, not ps: m3x2, m3x3, m3x4, m4x3, m4x4
- * BIAS    <= PS 1.4 (x-0.5)
- * BIASNEG <= PS 1.4 (-(x-0.5))
- * SIGN    <= PS 1.4 (2(x-0.5))
- * SIGNNEG <= PS 1.4 (-2(x-0.5))
- * COMP    <= PS 1.4 (1-x)
- * X2       = PS 1.4 (2x)
- * X2NEG    = PS 1.4 (-2x)
- * DZ      <= PS 1.4, tex{ld,crd} (.xy/.z), z=0 => .11
- * DW      <= PS 1.4, tex{ld,crd} (.xy/.w), w=0 => .11
- * ABS     >= SM 3.0 (abs(x))
- * ABSNEG  >= SM 3.0 (-abs(x))
- * NOT     >= SM 2.0 pedication only
- */
-#define NINED3DSPSM_NONE    (D3DSPSM_NONE    >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_NEG     (D3DSPSM_NEG     >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_BIAS    (D3DSPSM_BIAS    >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_BIASNEG (D3DSPSM_BIASNEG >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_SIGN    (D3DSPSM_SIGN    >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_SIGNNEG (D3DSPSM_SIGNNEG >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_COMP    (D3DSPSM_COMP    >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_X2      (D3DSPSM_X2      >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_X2NEG   (D3DSPSM_X2NEG   >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_DZ      (D3DSPSM_DZ      >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_DW      (D3DSPSM_DW      >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_ABS     (D3DSPSM_ABS     >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_ABSNEG  (D3DSPSM_ABSNEG  >> D3DSP_SRCMOD_SHIFT)
-#define NINED3DSPSM_NOT     (D3DSPSM_NOT     >> D3DSP_SRCMOD_SHIFT)
-
 static const char *sm1_mod_str[] =
 {
     [NINED3DSPSM_NONE] = "",
@@ -555,6 +490,23 @@ nine_record_outputs(struct shader_translator *tx, BYTE Usage, BYTE UsageIndex,
     tx->num_outputs++;
 }
 
+/* vs < 3 outputs have no declaration: record them at their first write */
+static void
+nine_record_outputs_sm2(struct shader_translator *tx, BYTE Usage, BYTE UsageIndex,
+                        int mask, struct ureg_dst dst)
+{
+    int i;
+
+    if (!tx->info->process_vertices)
+        return;
+    for (i = 0; i < tx->num_outputs; i++) {
+        if (tx->output_info[i].output_semantic == Usage &&
+            tx->output_info[i].output_semantic_index == UsageIndex)
+            return;
+    }
+    nine_record_outputs(tx, Usage, UsageIndex, mask, dst.Index);
+}
+
 static struct ureg_src nine_float_constant_src(struct shader_translator *tx, int idx)
 {
     struct ureg_src src;
@@ -1349,9 +1301,11 @@ _tx_dst_param(struct shader_translator *tx, const struct sm1_dst_param *param)
             dst = tx->regs.oPos;
             break;
         case 1:
-            if (ureg_dst_is_undef(tx->regs.oFog))
+            if (ureg_dst_is_undef(tx->regs.oFog)) {
                 tx->regs.oFog =
                     ureg_saturate(ureg_DECL_output(tx->ureg, TGSI_SEMANTIC_GENERIC, 16));
+                nine_record_outputs_sm2(tx, D3DDECLUSAGE_FOG, 0, 0x1, tx->regs.oFog);
+            }
             dst = tx->regs.oFog;
             break;
         case 2:
@@ -1369,6 +1323,7 @@ _tx_dst_param(struct shader_translator *tx, const struct sm1_dst_param *param)
         if (tx->version.major < 3) {
             assert(!param->rel);
             dst = ureg_DECL_output(tx->ureg, tx->texcoord_sn, param->idx);
+            nine_record_outputs_sm2(tx, D3DDECLUSAGE_TEXCOORD, param->idx, 0xf, dst);
         } else {
             assert(!param->rel); /* TODO */
             assert(param->idx < ARRAY_SIZE(tx->regs.o));
@@ -1387,6 +1342,9 @@ _tx_dst_param(struct shader_translator *tx, const struct sm1_dst_param *param)
             } else {
                 tx->regs.oCol[param->idx] =
                     ureg_DECL_output(tx->ureg, TGSI_SEMANTIC_COLOR, param->idx);
+                if (IS_VS)
+                    nine_record_outputs_sm2(tx, D3DDECLUSAGE_COLOR, param->idx, 0xf,
+                                            tx->regs.oCol[param->idx]);
             }
         }
         dst = tx->regs.oCol[param->idx];
@@ -2082,12 +2040,12 @@ sm1_to_nine_declusage(struct sm1_semantic *dcl)
     return nine_d3d9_to_nine_declusage(dcl->usage, dcl->usage_idx);
 }
 
-static void
-sm1_declusage_to_tgsi(struct tgsi_declaration_semantic *sem,
-                      boolean tc,
-                      struct sm1_semantic *dcl)
+void
+nine_declusage_to_tgsi_semantic(struct tgsi_declaration_semantic *sem,
+                                boolean tc,
+                                BYTE usage,
+                                BYTE index)
 {
-    BYTE index = dcl->usage_idx;
 
     /* For everything that is not matching to a TGSI_SEMANTIC_****,
      * we match to a TGSI_SEMANTIC_GENERIC with index.
@@ -2109,7 +2067,7 @@ sm1_declusage_to_tgsi(struct tgsi_declaration_semantic *sem,
      * TESSFACTOR: 10 * index + 24
      */
 
-    switch (dcl->usage) {
+    switch (usage) {
     case D3DDECLUSAGE_POSITION:
     case D3DDECLUSAGE_POSITIONT:
     case D3DDECLUSAGE_DEPTH:
@@ -2182,6 +2140,14 @@ sm1_declusage_to_tgsi(struct tgsi_declaration_semantic *sem,
     }
 }
 
+static inline void
+sm1_declusage_to_tgsi(struct tgsi_declaration_semantic *sem,
+                      boolean tc,
+                      struct sm1_semantic *dcl)
+{
+    nine_declusage_to_tgsi_semantic(sem, tc, dcl->usage, dcl->usage_idx);
+}
+
 #define NINED3DSTT_1D     (D3DSTT_1D >> D3DSP_TEXTURETYPE_SHIFT)
 #define NINED3DSTT_2D     (D3DSTT_2D >> D3DSP_TEXTURETYPE_SHIFT)
 #define NINED3DSTT_VOLUME (D3DSTT_VOLUME >> D3DSP_TEXTURETYPE_SHIFT)
@@ -2323,7 +2289,8 @@ DECL_SPECIAL(DCL)
             assert(ureg_dst_is_undef(tx->regs.o[sem.reg.idx]) && "Nine doesn't support yet packing");
             tx->regs.o[sem.reg.idx] = ureg_DECL_output_masked(
                 ureg, tgsi.Name, tgsi.Index, sem.reg.mask, 0, 1);
-            nine_record_outputs(tx, sem.usage, sem.usage_idx, sem.reg.mask, sem.reg.idx);
+            nine_record_outputs(tx, sem.usage, sem.usage_idx, sem.reg.mask,
+                                tx->regs.o[sem.reg.idx].Index);
             if (tx->info->process_vertices && sem.usage == D3DDECLUSAGE_POSITION && sem.usage_idx == 0) {
                 tx->regs.oPos_out = tx->regs.o[sem.reg.idx];
                 tx->regs.o[sem.reg.idx] = ureg_DECL_temporary(ureg);
@@ -3692,6 +3659,12 @@ tx_ctor(struct shader_translator *tx, struct pipe_screen *screen, struct nine_sh
      */
     if (IS_VS) {
         tx->regs.oPos = ureg_DECL_output(tx->ureg, TGSI_SEMANTIC_POSITION, 0);
+        /* vs 3 does it at the dcl of the position */
+        if (info->process_vertices && tx->version.major < 3) {
+            nine_record_outputs_sm2(tx, D3DDECLUSAGE_POSITION, 0, 0xf, tx->regs.oPos);
+            tx->regs.oPos_out = tx->regs.oPos;
+            tx->regs.oPos = ureg_DECL_temporary(tx->ureg);
+        }
     } else {
         ureg_property(tx->ureg, TGSI_PROPERTY_FS_COORD_ORIGIN, TGSI_FS_COORD_ORIGIN_UPPER_LEFT);
         if (!tx->shift_wpos)
@@ -3744,22 +3717,35 @@ tx_dtor(struct shader_translator *tx)
 
 /* CONST[0].xyz = width/2, -height/2, zmax-zmin
  * CONST[1].xyz = x+width/2, y+height/2, zmin */
-static void
-shader_add_vs_viewport_transform(struct shader_translator *tx)
+/* The viewport scale and translation are in the constant buffer 4,
+ * see update_vs_constants_sw. */
+void
+nine_shader_add_vs_viewport_transform(struct ureg_program *ureg,
+                                      struct ureg_dst oPos_out,
+                                      struct ureg_src oPos,
+                                      boolean position_t)
 {
-    struct ureg_program *ureg = tx->ureg;
     struct ureg_src c0 = ureg_src_register(TGSI_FILE_CONSTANT, 0);
     struct ureg_src c1 = ureg_src_register(TGSI_FILE_CONSTANT, 1);
-    /* struct ureg_dst pos_tmp = ureg_DECL_temporary(ureg);*/
+    struct ureg_dst tmp;
 
+    ureg_DECL_constant2D(ureg, 0, 2, 4); /* Viewport data */
     c0 = ureg_src_dimension(c0, 4);
     c1 = ureg_src_dimension(c1, 4);
-    /* TODO: find out when we need to apply the viewport transformation or not.
-     * Likely will be XYZ vs XYZRHW in vdecl_out
-     * ureg_MUL(ureg, ureg_writemask(pos_tmp, TGSI_WRITEMASK_XYZ), ureg_src(tx->regs.oPos), c0);
-     * ureg_ADD(ureg, ureg_writemask(tx->regs.oPos_out, TGSI_WRITEMASK_XYZ), ureg_src(pos_tmp), c1);
-     */
-    ureg_MOV(ureg, ureg_writemask(tx->regs.oPos_out, TGSI_WRITEMASK_XYZ), ureg_src(tx->regs.oPos));
+
+    if (!position_t) {
+        ureg_MOV(ureg, oPos_out, oPos);
+        return;
+    }
+
+    /* Same as the hardware after clipping: division by w, rhw = 1/w */
+    tmp = ureg_DECL_temporary(ureg);
+    ureg_RCP(ureg, ureg_writemask(tmp, TGSI_WRITEMASK_W), ureg_scalar(oPos, TGSI_SWIZZLE_W));
+    ureg_MUL(ureg, ureg_writemask(tmp, TGSI_WRITEMASK_XYZ), oPos,
+             ureg_scalar(ureg_src(tmp), TGSI_SWIZZLE_W));
+    ureg_MAD(ureg, ureg_writemask(oPos_out, TGSI_WRITEMASK_XYZ), ureg_src(tmp), c0, c1);
+    ureg_MOV(ureg, ureg_writemask(oPos_out, TGSI_WRITEMASK_W), ureg_src(tmp));
+    ureg_release_temporary(ureg, tmp);
 }
 
 static void
@@ -3849,10 +3835,14 @@ static void parse_shader(struct shader_translator *tx)
         ureg_MAX(tx->ureg, tx->regs.oPts, ureg_src(tx->regs.oPts), ureg_imm1f(tx->ureg, info->point_size_min));
         ureg_MIN(tx->ureg, oPts, ureg_src(tx->regs.oPts), ureg_imm1f(tx->ureg, info->point_size_max));
         info->point_size = TRUE;
+        if (tx->version.major < 3)
+            nine_record_outputs_sm2(tx, D3DDECLUSAGE_PSIZE, 0, 0x1, oPts);
     }
 
     if (info->process_vertices)
-        shader_add_vs_viewport_transform(tx);
+        nine_shader_add_vs_viewport_transform(tx->ureg, tx->regs.oPos_out,
+                                              ureg_src(tx->regs.oPos),
+                                              info->vdecl_out && info->vdecl_out->position_t);
 
     ureg_END(tx->ureg);
 }
@@ -3863,6 +3853,7 @@ static void parse_shader(struct shader_translator *tx)
 #define NINE_SHADER_DEBUG_OPTION_NO_NIR_PS        (1 << 3)
 #define NINE_SHADER_DEBUG_OPTION_DUMP_NIR         (1 << 4)
 #define NINE_SHADER_DEBUG_OPTION_DUMP_TGSI        (1 << 5)
+#define NINE_SHADER_DEBUG_OPTION_NATIVE_NIR       (1 << 6)
 
 static const struct debug_named_value nine_shader_debug_options[] = {
     { "nir_vs", NINE_SHADER_DEBUG_OPTION_NIR_VS, "Use NIR for vertex shaders even if the driver doesn't prefer it." },
@@ -3871,6 +3862,7 @@ static const struct debug_named_value nine_shader_debug_options[] = {
     { "no_nir_ps", NINE_SHADER_DEBUG_OPTION_NO_NIR_PS, "Never use NIR for pixel shaders even if the driver prefers it." },
     { "dump_nir", NINE_SHADER_DEBUG_OPTION_DUMP_NIR, "Print translated NIR shaders." },
     { "dump_tgsi", NINE_SHADER_DEBUG_OPTION_DUMP_TGSI, "Print TGSI shaders." },
+    { "native_nir", NINE_SHADER_DEBUG_OPTION_NATIVE_NIR, "Translate SM2/SM3 shaders directly to NIR instead of going through TGSI when NIR is used." },
     DEBUG_NAMED_VALUE_END /* must be last */
 };
 
@@ -3909,22 +3901,10 @@ nine_pipe_nir_shader_state_from_tgsi(struct pipe_shader_state *state, const stru
     memset(&state->stream_output, 0, sizeof(state->stream_output));
 }
 
-static void *
-nine_ureg_create_shader(struct ureg_program                  *ureg,
-                        struct pipe_context                  *pipe,
-                        const struct pipe_stream_output_info   *so)
+/* Selects the IR the shaders of the given stage are handed to the driver in. */
+boolean
+nine_shader_use_nir(struct pipe_screen *screen, enum pipe_shader_type shader_type)
 {
-    struct pipe_shader_state state;
-    const struct tgsi_token *tgsi_tokens;
-    struct pipe_screen *screen = pipe->screen;
-
-    tgsi_tokens = ureg_finalize(ureg);
-    if (!tgsi_tokens)
-        return NULL;
-
-    assert(((struct tgsi_header *) &tgsi_tokens[0])->HeaderSize >= 2);
-    enum pipe_shader_type shader_type = ((struct tgsi_processor *) &tgsi_tokens[1])->Processor;
-
     int preferred_ir = screen->get_shader_param(screen, shader_type, PIPE_SHADER_CAP_PREFERRED_IR);
     bool prefer_nir = (preferred_ir == PIPE_SHADER_IR_NIR);
     bool use_nir = prefer_nir ||
@@ -3942,7 +3922,63 @@ nine_ureg_create_shader(struct ureg_program                  *ureg,
          prefer_nir ? "NIR" : "TGSI",
          use_nir ? "NIR" : "TGSI");
 
-    if (use_nir) {
+    return use_nir;
+}
+
+/* Whether SM2/SM3 shaders of the given stage skip TGSI and are translated
+ * directly to NIR. Shaders the direct translator can't handle still go
+ * through TGSI. */
+boolean
+nine_shader_use_native_nir(struct pipe_screen *screen, enum pipe_shader_type shader_type)
+{
+    return nine_shader_get_debug_flag(NINE_SHADER_DEBUG_OPTION_NATIVE_NIR) &&
+           nine_shader_use_nir(screen, shader_type);
+}
+
+static void *
+nine_pipe_create_shader(struct pipe_context *pipe,
+                        enum pipe_shader_type shader_type,
+                        const struct pipe_shader_state *state)
+{
+    switch (shader_type) {
+    case PIPE_SHADER_VERTEX:
+        return pipe->create_vs_state(pipe, state);
+    case PIPE_SHADER_FRAGMENT:
+        return pipe->create_fs_state(pipe, state);
+    default:
+        unreachable("unsupported shader type");
+    }
+}
+
+/* Appends the IR handed to the driver to the shader cache blob.
+ * Must be called before the driver takes ownership of the NIR. */
+static void
+nine_shader_state_serialize(struct blob *blob, const struct pipe_shader_state *state)
+{
+    blob_write_uint32(blob, state->type);
+    if (state->type == PIPE_SHADER_IR_NIR) {
+        nir_serialize(blob, state->ir.nir, true);
+    } else {
+        unsigned num_tokens = tgsi_num_tokens(state->tokens);
+
+        blob_write_uint32(blob, num_tokens);
+        blob_write_bytes(blob, state->tokens, num_tokens * sizeof(struct tgsi_token));
+    }
+}
+
+static void *
+nine_tgsi_create_shader(const struct tgsi_token             *tgsi_tokens,
+                        struct pipe_context                  *pipe,
+                        const struct pipe_stream_output_info   *so,
+                        struct blob                          *ir_blob)
+{
+    struct pipe_shader_state state;
+    struct pipe_screen *screen = pipe->screen;
+
+    assert(((struct tgsi_header *) &tgsi_tokens[0])->HeaderSize >= 2);
+    enum pipe_shader_type shader_type = ((struct tgsi_processor *) &tgsi_tokens[1])->Processor;
+
+    if (nine_shader_use_nir(screen, shader_type)) {
         nine_pipe_nir_shader_state_from_tgsi(&state, tgsi_tokens, screen);
     } else {
         pipe_shader_state_from_tgsi(&state, tgsi_tokens);
@@ -3950,30 +3986,232 @@ nine_ureg_create_shader(struct ureg_program                  *ureg,
 
     assert(state.tokens || state.ir.nir);
 
+    /* Stream output shaders are never cached */
+    if (ir_blob && !so)
+        nine_shader_state_serialize(ir_blob, &state);
+
     if (so)
         state.stream_output = *so;
 
-    switch (shader_type) {
-    case PIPE_SHADER_VERTEX:
-        return pipe->create_vs_state(pipe, &state);
-    case PIPE_SHADER_FRAGMENT:
-        return pipe->create_fs_state(pipe, &state);
-    default:
-        unreachable("unsupported shader type");
-    }
+    return nine_pipe_create_shader(pipe, shader_type, &state);
+}
+
+static void *
+nine_ureg_create_shader(struct ureg_program                  *ureg,
+                        struct pipe_context                  *pipe,
+                        const struct pipe_stream_output_info   *so,
+                        struct blob                          *ir_blob)
+{
+    const struct tgsi_token *tgsi_tokens = ureg_finalize(ureg);
+
+    if (!tgsi_tokens)
+        return NULL;
+    return nine_tgsi_create_shader(tgsi_tokens, pipe, so, ir_blob);
 }
 
 
+static void *
+nine_nir_create_shader(struct pipe_context *pipe,
+                       enum pipe_shader_type shader_type,
+                       struct nir_shader *nir,
+                       struct blob *ir_blob)
+{
+    struct pipe_shader_state state;
+
+    if (unlikely(nine_shader_get_debug_flag(NINE_SHADER_DEBUG_OPTION_DUMP_NIR)))
+        nir_print_shader(nir, stdout);
+
+    memset(&state, 0, sizeof(state));
+    state.type = PIPE_SHADER_IR_NIR;
+    state.ir.nir = nir;
+
+    if (ir_blob)
+        nine_shader_state_serialize(ir_blob, &state);
+
+    return nine_pipe_create_shader(pipe, shader_type, &state);
+}
+
 void *
 nine_create_shader_with_so_and_destroy(struct ureg_program                   *p,
                                        struct pipe_context                *pipe,
                                        const struct pipe_stream_output_info *so)
 {
-    void *result = nine_ureg_create_shader(p, pipe, so);
+    void *result = nine_ureg_create_shader(p, pipe, so, NULL);
+    ureg_destroy(p);
+    return result;
+}
+
+void *
+nine_create_shader_with_so_outputs_and_destroy(struct ureg_program *p,
+                                               struct pipe_context *pipe,
+                                               struct nine_shader_info *info)
+{
+    const struct tgsi_token *tgsi_tokens = ureg_finalize(p);
+    struct tgsi_shader_info scan;
+    void *result = NULL;
+    unsigned i;
+
+    if (!tgsi_tokens)
+        goto out;
+
+    tgsi_scan_shader(tgsi_tokens, &scan);
+    if (scan.num_outputs > PIPE_MAX_SO_OUTPUTS)
+        goto out;
+
+    memset(&info->so, 0, sizeof(info->so));
+    for (i = 0; i < scan.num_outputs; i++) {
+        info->so.output[i].register_index = i;
+        info->so.output[i].num_components = 4;
+        info->so.output[i].dst_offset = i * 4;
+        info->so_semantic_name[i] = scan.output_semantic_name[i];
+        info->so_semantic_index[i] = scan.output_semantic_index[i];
+    }
+    info->so.num_outputs = scan.num_outputs;
+    info->so.stride[0] = scan.num_outputs * 4;
+    info->so_num_outputs = scan.num_outputs;
+
+    result = nine_tgsi_create_shader(tgsi_tokens, pipe, &info->so, NULL);
+out:
     ureg_destroy(p);
     return result;
 }
 
+void *
+nine_create_shader_with_blob_and_destroy(struct ureg_program *p,
+                                         struct pipe_context *pipe,
+                                         struct blob *ir_blob)
+{
+    void *result = nine_ureg_create_shader(p, pipe, NULL, ir_blob);
+    ureg_destroy(p);
+    return result;
+}
+
+void *
+nine_create_shader_from_blob(struct pipe_context *pipe,
+                             enum pipe_shader_type shader_type,
+                             struct blob_reader *ir_blob)
+{
+    struct pipe_screen *screen = pipe->screen;
+    struct pipe_shader_state state;
+    struct tgsi_token *tokens = NULL;
+    void *cso;
+
+    memset(&state, 0, sizeof(state));
+    state.type = blob_read_uint32(ir_blob);
+
+    if (state.type == PIPE_SHADER_IR_NIR) {
+        const struct nir_shader_compiler_options *options =
+            screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR, shader_type);
+
+        state.ir.nir = nir_deserialize(NULL, options, ir_blob);
+        if (ir_blob->overrun) {
+            ralloc_free(state.ir.nir);
+            return NULL;
+        }
+        if (unlikely(nine_shader_get_debug_flag(NINE_SHADER_DEBUG_OPTION_DUMP_NIR)))
+            nir_print_shader(state.ir.nir, stdout);
+    } else if (state.type == PIPE_SHADER_IR_TGSI) {
+        unsigned num_tokens = blob_read_uint32(ir_blob);
+
+        if (ir_blob->overrun || !num_tokens)
+            return NULL;
+        tokens = MALLOC(num_tokens * sizeof(struct tgsi_token));
+        if (!tokens)
+            return NULL;
+        blob_copy_bytes(ir_blob, tokens, num_tokens * sizeof(struct tgsi_token));
+        if (ir_blob->overrun) {
+            FREE(tokens);
+            return NULL;
+        }
+        state.tokens = tokens;
+        if (unlikely(nine_shader_get_debug_flag(NINE_SHADER_DEBUG_OPTION_DUMP_TGSI)))
+            tgsi_dump(tokens, 0);
+    } else {
+        return NULL;
+    }
+
+    cso = nine_pipe_create_shader(pipe, shader_type, &state);
+    /* Drivers keep their own copy of the tokens */
+    FREE(tokens);
+    return cso;
+}
+
+/* Packs the used constant slots together. slot_map receives the new slot of
+ * every used slot, and the returned ranges (pairs of first slot and count,
+ * terminated by a range of size 0) describe which slots to upload. */
+unsigned *
+nine_shader_compact_const_slots(const boolean *slots_used,
+                                unsigned *slot_map,
+                                unsigned *num_slots)
+{
+    unsigned *const_ranges;
+    int i, j, num_ranges, prev;
+    unsigned c;
+
+    num_ranges = 0;
+    prev = -2;
+    for (i = 0; i < NINE_MAX_CONST_ALL; i++) {
+        if (slots_used[i]) {
+            if (prev != i - 1)
+                num_ranges++;
+            prev = i;
+        }
+    }
+    const_ranges = CALLOC(num_ranges + 1, 2 * sizeof(unsigned)); /* ranges stop when last is of size 0 */
+    if (!const_ranges)
+        return NULL;
+    c = 0;
+    j = -1;
+    prev = -2;
+    for (i = 0; i < NINE_MAX_CONST_ALL; i++) {
+        if (slots_used[i]) {
+            if (prev != i - 1)
+                j++;
+            /* Initialize first slot of the range */
+            if (!const_ranges[2*j+1])
+                const_ranges[2*j] = i;
+            const_ranges[2*j+1]++;
+            prev = i;
+            slot_map[i] = c++;
+        }
+    }
+    *num_slots = c;
+    return const_ranges;
+}
+
+/* Returns the size in bytes of the shader bytecode, without translating it.
+ * Returns 0 if the end token could not be found before an invalid token. */
+static DWORD
+nine_shader_scan_byte_size(const DWORD *byte_code)
+{
+    const DWORD *tok = byte_code;
+    unsigned major = D3DSHADER_VERSION_MAJOR(*tok);
+
+    /* Bound the scan so a shader missing its end token cannot
+     * send us reading forever. */
+    for (++tok; tok - byte_code < (1 << 20); ) {
+        DWORD opcode = *tok & D3DSI_OPCODE_MASK;
+
+        if (*tok == NINED3DSP_END)
+            return (tok - byte_code + 1) * sizeof(DWORD);
+        if (*tok & 0x80000000)
+            return 0; /* parameter token where an instruction is expected */
+
+        if (opcode == D3DSIO_COMMENT) {
+            tok += 1 + ((*tok & D3DSI_COMMENTSIZE_MASK) >> D3DSI_COMMENTSIZE_SHIFT);
+        } else if (major >= 2) {
+            tok += 1 + ((*tok & D3DSI_INSTLENGTH_MASK) >> D3DSI_INSTLENGTH_SHIFT);
+        } else if (opcode == D3DSIO_DEF) {
+            tok += 1 + 1 + 4; /* dst + 4 immediates */
+        } else {
+            /* sm1 doesn't encode the instruction length,
+             * but parameter tokens always have the bit 31 set. */
+            for (++tok; *tok & 0x80000000; ++tok);
+        }
+    }
+    return 0;
+}
+
 HRESULT
 nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info, struct pipe_context *pipe)
 {
@@ -3982,9 +4220,57 @@ nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info,
     const unsigned processor = info->type;
     struct pipe_screen *screen = info->process_vertices ? device->screen_sw : device->screen;
     unsigned *const_ranges = NULL;
+    cache_key key;
+    struct blob cache_blob;
+    DWORD scanned_byte_size = 0;
+    boolean use_cache = FALSE;
 
     user_assert(processor != ~0, D3DERR_INVALIDCALL);
 
+    /* ProcessVertices variants depend on the output declaration
+     * and are created on the software pipe: never cached. */
+    if (device->shader_cache.cache && !info->process_vertices) {
+        scanned_byte_size = nine_shader_scan_byte_size(info->byte_code);
+        use_cache = scanned_byte_size &&
+            nine_shader_cache_key_sm(device, info, scanned_byte_size, key);
+    }
+    if (use_cache && nine_shader_cache_load_sm(device, info, pipe, key))
+        return D3D_OK;
+
+    p_atomic_inc(&device->cpu_stats.shader_compiles);
+
+    if (!info->process_vertices && !info->swvp_on &&
+        nine_shader_use_native_nir(screen, processor)) {
+        struct nir_shader *nir = NULL;
+
+        hr = nine_translate_shader_nir(info, screen, &nir, &const_ranges);
+        if (SUCCEEDED(hr)) {
+            use_cache &= info->byte_size == scanned_byte_size;
+            if (use_cache) {
+                blob_init(&cache_blob);
+                nine_shader_cache_write_sm_info(&cache_blob, info, const_ranges,
+                                                info->byte_size);
+            }
+            info->cso = nine_nir_create_shader(pipe, processor, nir,
+                                               use_cache ? &cache_blob : NULL);
+            if (use_cache) {
+                if (info->cso && !cache_blob.out_of_memory)
+                    nine_shader_cache_put(device, key, &cache_blob);
+                blob_finish(&cache_blob);
+            }
+            if (!info->cso) {
+                FREE(const_ranges);
+                return D3DERR_DRIVERINTERNALERROR;
+            }
+            info->const_ranges = const_ranges;
+            return D3D_OK;
+        }
+        if (hr != D3DERR_NOTAVAILABLE)
+            return hr;
+        DBG("Shader not supported by the NIR translator, using TGSI\n");
+        hr = D3D_OK;
+    }
+
     tx = MALLOC_STRUCT(shader_translator);
     if (!tx)
         return E_OUTOFMEMORY;
@@ -4025,8 +4311,7 @@ nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info,
     /* Recompile after compacting constant slots if possible */
     if (!tx->indirect_const_access && !info->swvp_on && tx->num_slots > 0) {
         unsigned *slot_map;
-        unsigned c;
-        int i, j, num_ranges, prev;
+        ASSERTED unsigned num_slots;
 
         DBG("Recompiling shader for constant compaction\n");
         ureg_destroy(tx->ureg);
@@ -4036,36 +4321,14 @@ nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info,
         FREE(tx->lconstf);
         FREE(tx->regs.r);
 
-        num_ranges = 0;
-        prev = -2;
-        for (i = 0; i < NINE_MAX_CONST_ALL; i++) {
-            if (tx->slots_used[i]) {
-                if (prev != i - 1)
-                    num_ranges++;
-                prev = i;
-            }
-        }
         slot_map = MALLOC(NINE_MAX_CONST_ALL * sizeof(unsigned));
-        const_ranges = CALLOC(num_ranges + 1, 2 * sizeof(unsigned)); /* ranges stop when last is of size 0 */
+        const_ranges = slot_map ?
+            nine_shader_compact_const_slots(tx->slots_used, slot_map, &num_slots) : NULL;
         if (!slot_map || !const_ranges) {
+            FREE(slot_map);
             hr = E_OUTOFMEMORY;
             goto out;
         }
-        c = 0;
-        j = -1;
-        prev = -2;
-        for (i = 0; i < NINE_MAX_CONST_ALL; i++) {
-            if (tx->slots_used[i]) {
-                if (prev != i - 1)
-                    j++;
-                /* Initialize first slot of the range */
-                if (!const_ranges[2*j+1])
-                    const_ranges[2*j] = i;
-                const_ranges[2*j+1]++;
-                prev = i;
-                slot_map[i] = c++;
-            }
-        }
 
         if (tx_ctor(tx, screen, info) == E_OUTOFMEMORY) {
             hr = E_OUTOFMEMORY;
@@ -4074,15 +4337,7 @@ nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info,
         tx->slot_map = slot_map;
         parse_shader(tx);
         assert(!tx->failure);
-#if !defined(NDEBUG)
-        i = 0;
-        j = 0;
-        while (const_ranges[i*2+1] != 0) {
-            j += const_ranges[i*2+1];
-            i++;
-        }
-        assert(j == tx->num_slots);
-#endif
+        assert(num_slots == tx->num_slots);
     }
 
     /* record local constants */
@@ -4166,23 +4421,37 @@ nine_translate_shader(struct NineDevice9 *device, struct nine_shader_info *info,
          ureg_DECL_constant2D(tx->ureg, 0, 511, 3);
     }
 
-    if (info->process_vertices)
-        ureg_DECL_constant2D(tx->ureg, 0, 2, 4); /* Viewport data */
-
     if (unlikely(nine_shader_get_debug_flag(NINE_SHADER_DEBUG_OPTION_DUMP_TGSI))) {
         const struct tgsi_token *toks = ureg_get_tokens(tx->ureg, NULL);
         tgsi_dump(toks, 0);
         ureg_free_tokens(toks);
     }
 
-    if (info->process_vertices) {
+    if (info->process_vertices && !info->vdecl_out) {
+        info->cso = nine_create_shader_with_so_outputs_and_destroy(tx->ureg, pipe, info);
+    } else if (info->process_vertices) {
         NineVertexDeclaration9_FillStreamOutputInfo(info->vdecl_out,
                                                     tx->output_info,
                                                     tx->num_outputs,
                                                     &(info->so));
         info->cso = nine_create_shader_with_so_and_destroy(tx->ureg, pipe, &(info->so));
-    } else
-        info->cso = nine_create_shader_with_so_and_destroy(tx->ureg, pipe, NULL);
+    } else {
+        DWORD byte_size = (tx->parse - tx->byte_code) * sizeof(DWORD);
+
+        /* The key only covers the bytecode up to the scanned end token */
+        use_cache &= byte_size == scanned_byte_size;
+        if (use_cache) {
+            blob_init(&cache_blob);
+            nine_shader_cache_write_sm_info(&cache_blob, info, const_ranges, byte_size);
+        }
+        info->cso = nine_create_shader_with_blob_and_destroy(tx->ureg, pipe,
+                                                             use_cache ? &cache_blob : NULL);
+        if (use_cache) {
+            if (info->cso && !cache_blob.out_of_memory)
+                nine_shader_cache_put(device, key, &cache_blob);
+            blob_finish(&cache_blob);
+        }
+    }
     if (!info->cso) {
         hr = D3DERR_DRIVERINTERNALERROR;
         FREE(info->lconstf.data);
@@ -29,11 +29,18 @@
 #include "nine_helpers.h"
 #include "nine_state.h"
 #include "pipe/p_state.h" /* PIPE_MAX_ATTRIBS */
+#include "tgsi/tgsi_ureg.h"
+#include "util/hash_table.h"
+#include "util/u_math.h"
 #include "util/u_memory.h"
 
 struct NineDevice9;
 struct NineVertexDeclaration9;
 struct ureg_program;
+struct blob;
+struct blob_reader;
+struct nir_shader;
+struct tgsi_declaration_semantic;
 
 struct nine_lconstf /* NOTE: both pointers should be FREE'd by the user */
 {
@@ -100,6 +107,12 @@ struct nine_shader_info
     boolean process_vertices;
     struct NineVertexDeclaration9 *vdecl_out;
     struct pipe_stream_output_info so;
+
+    /* process_vertices without vdecl_out (swvp on the cpu): all the
+     * outputs are streamed out as vec4, with these semantics. */
+    unsigned so_num_outputs;
+    ubyte so_semantic_name[PIPE_MAX_SHADER_OUTPUTS];
+    ubyte so_semantic_index[PIPE_MAX_SHADER_OUTPUTS];
 };
 
 struct nine_vs_output_info
@@ -110,16 +123,73 @@ struct nine_vs_output_info
     int output_index;
 };
 
+boolean
+nine_shader_use_nir(struct pipe_screen *screen, enum pipe_shader_type shader_type);
+
+boolean
+nine_shader_use_native_nir(struct pipe_screen *screen, enum pipe_shader_type shader_type);
+
+void
+nine_declusage_to_tgsi_semantic(struct tgsi_declaration_semantic *sem,
+                                boolean tc,
+                                BYTE usage,
+                                BYTE index);
+
+unsigned *
+nine_shader_compact_const_slots(const boolean *slots_used,
+                                unsigned *slot_map,
+                                unsigned *num_slots);
+
+/* ProcessVertices: writes the position to the real output, with the
+ * viewport transformation for XYZRHW outputs. */
+void
+nine_shader_add_vs_viewport_transform(struct ureg_program *ureg,
+                                      struct ureg_dst oPos_out,
+                                      struct ureg_src oPos,
+                                      boolean position_t);
+
 void *
 nine_create_shader_with_so_and_destroy(struct ureg_program *p,
                                        struct pipe_context *pipe,
                                        const struct pipe_stream_output_info *so);
 
+/* Streams out all the outputs, and fills info->so and the
+ * info->so_* semantics. */
+void *
+nine_create_shader_with_so_outputs_and_destroy(struct ureg_program *p,
+                                               struct pipe_context *pipe,
+                                               struct nine_shader_info *info);
+
+/* Same as above without stream output, but also appends
+ * the IR given to the driver to ir_blob if not NULL. */
+void *
+nine_create_shader_with_blob_and_destroy(struct ureg_program *p,
+                                         struct pipe_context *pipe,
+                                         struct blob *ir_blob);
+
+void *
+nine_create_shader_from_blob(struct pipe_context *pipe,
+                             enum pipe_shader_type shader_type,
+                             struct blob_reader *ir_blob);
+
 HRESULT
 nine_translate_shader(struct NineDevice9 *device,
                       struct nine_shader_info *,
                       struct pipe_context *);
 
+/* Translates a SM2/SM3 shader directly to NIR, filling the same info
+ * fields as nine_translate_shader except cso. Returns D3DERR_NOTAVAILABLE
+ * for shaders using features it doesn't handle, which must then go
+ * through the TGSI translator. */
+HRESULT
+nine_translate_shader_nir(struct nine_shader_info *info,
+                          struct pipe_screen *screen,
+                          struct nir_shader **nir,
+                          unsigned **const_ranges);
+
+
+/* Number of variants above which the lookups go through a hash table */
+#define NINE_SHADER_VARIANT_HASH_MIN 8
 
 struct nine_shader_variant
 {
@@ -128,6 +198,9 @@ struct nine_shader_variant
     unsigned *const_ranges;
     unsigned const_used_size;
     uint64_t key;
+    /* List head only */
+    struct hash_table_u64 *ht; /* key -> variant, once the list is long enough */
+    unsigned num_added; /* Number of variants added after the head */
 };
 
 static inline void *
@@ -136,12 +209,18 @@ nine_shader_variant_get(struct nine_shader_variant *list,
                         unsigned *const_used_size,
                         uint64_t key)
 {
-    while (list->key != key && list->next)
-        list = list->next;
-    if (list->key == key) {
-        *const_ranges = list->const_ranges;
-        *const_used_size = list->const_used_size;
-        return list->cso;
+    struct nine_shader_variant *var = list;
+
+    if (list->ht) {
+        var = _mesa_hash_table_u64_search(list->ht, key);
+    } else {
+        while (var && var->key != key)
+            var = var->next;
+    }
+    if (var) {
+        *const_ranges = var->const_ranges;
+        *const_used_size = var->const_used_size;
+        return var->cso;
     }
     return NULL;
 }
@@ -152,18 +231,33 @@ nine_shader_variant_add(struct nine_shader_variant *list,
                         unsigned *const_ranges,
                         unsigned const_used_size)
 {
-    while (list->next) {
-        assert(list->key != key);
-        list = list->next;
-    }
-    list->next = MALLOC_STRUCT(nine_shader_variant);
-    if (!list->next)
+    struct nine_shader_variant *var = MALLOC_STRUCT(nine_shader_variant);
+
+    if (!var)
         return FALSE;
-    list->next->next = NULL;
-    list->next->key = key;
-    list->next->cso = cso;
-    list->next->const_ranges = const_ranges;
-    list->next->const_used_size = const_used_size;
+    var->key = key;
+    var->cso = cso;
+    var->const_ranges = const_ranges;
+    var->const_used_size = const_used_size;
+    var->ht = NULL;
+    var->num_added = 0;
+    /* The order doesn't matter, insert after the head */
+    var->next = list->next;
+    list->next = var;
+    list->num_added++;
+
+    if (list->ht) {
+        _mesa_hash_table_u64_insert(list->ht, key, var);
+    } else if (list->num_added >= NINE_SHADER_VARIANT_HASH_MIN) {
+        list->ht = _mesa_hash_table_u64_create(NULL);
+        for (var = list; var && list->ht; var = var->next)
+            _mesa_hash_table_u64_insert(list->ht, var->key, var);
+    }
+
+    /* Report when the number of variants doubles, to spot variant explosions */
+    if (list->num_added >= 16 && util_is_power_of_two_nonzero(list->num_added))
+        DBG_FLAG(DBG_SHADER, "Shader with %u variants (head cso %p)\n",
+                 list->num_added + 1, list->cso);
     return TRUE;
 }
 
@@ -175,6 +269,10 @@ nine_shader_variants_free(struct nine_shader_variant *list)
         list->next = ptr->next;
         FREE(ptr);
     }
+    if (list->ht)
+        _mesa_hash_table_u64_destroy(list->ht, NULL);
+    list->ht = NULL;
+    list->num_added = 0;
 }
 
 struct nine_shader_variant_so
@@ -219,7 +317,8 @@ nine_shader_variant_so_add(struct nine_shader_variant_so *list,
     if (!list->next)
         return FALSE;
     list->next->next = NULL;
-    nine_bind(&list->vdecl, vdecl);
+    list->next->vdecl = NULL;
+    nine_bind(&list->next->vdecl, vdecl);
     list->next->so = *so;
     list->next->cso = cso;
     return TRUE;
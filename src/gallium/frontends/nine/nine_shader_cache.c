@@ -0,0 +1,325 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "device9.h"
+#include "nine_debug.h"
+#include "nine_shader.h"
+#include "nine_shader_cache.h"
+
+#include "pipe/p_screen.h"
+#include "util/blob.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+
+#define DBG_CHANNEL DBG_SHADER
+
+/* Bump when the format of the entries or the translation changes
+ * in a way the driver cache id doesn't catch. */
+#define NINE_SHADER_CACHE_VERSION 1
+
+enum nine_shader_cache_entry_type {
+    NINE_SHADER_CACHE_SM = 1,
+    NINE_SHADER_CACHE_FF = 2,
+};
+
+void
+nine_shader_cache_init(struct NineDevice9 *device)
+{
+    struct pipe_screen *screen = device->screen;
+
+    device->shader_cache.cache = screen->get_disk_shader_cache ?
+        screen->get_disk_shader_cache(screen) : NULL;
+    device->shader_cache.hits = 0;
+    device->shader_cache.misses = 0;
+
+    DBG("Shader cache %s\n", device->shader_cache.cache ? "enabled" : "disabled");
+}
+
+void
+nine_shader_cache_fini(struct NineDevice9 *device)
+{
+    if (!device->shader_cache.cache)
+        return;
+
+    DBG("Shader cache: %u hits, %u misses\n",
+        device->shader_cache.hits, device->shader_cache.misses);
+    /* The cache is owned by the screen */
+    device->shader_cache.cache = NULL;
+}
+
+static void
+write_key_header(struct blob *blob, struct NineDevice9 *device,
+                 enum nine_shader_cache_entry_type entry, unsigned type)
+{
+    blob_write_uint32(blob, NINE_SHADER_CACHE_VERSION);
+    blob_write_uint32(blob, entry);
+    blob_write_uint32(blob, type);
+    blob_write_uint32(blob, device->max_vs_const_f);
+    blob_write_uint32(blob, device->max_ps_const_f);
+    blob_write_uint8(blob, device->driver_caps.window_space_position_support);
+    blob_write_uint8(blob, nine_shader_use_nir(device->screen, type));
+}
+
+boolean
+nine_shader_cache_key_sm(struct NineDevice9 *device,
+                         const struct nine_shader_info *info,
+                         DWORD byte_size,
+                         cache_key key)
+{
+    struct blob blob;
+    unsigned i;
+
+    blob_init(&blob);
+    write_key_header(&blob, device, NINE_SHADER_CACHE_SM, info->type);
+    blob_write_uint8(&blob, nine_shader_use_native_nir(device->screen, info->type));
+
+    /* Only hash the inputs the translator reads for this shader type,
+     * the others may be left uninitialized by the callers. */
+    blob_write_uint32(&blob, info->const_i_base);
+    blob_write_uint32(&blob, info->const_b_base);
+    blob_write_uint16(&blob, info->sampler_mask_shadow);
+    blob_write_uint16(&blob, info->fetch4);
+    blob_write_uint8(&blob, info->fog_enable);
+    blob_write_uint8(&blob, info->swvp_on);
+    if (info->type == PIPE_SHADER_VERTEX) {
+        blob_write_bytes(&blob, &info->point_size_min, sizeof(float));
+        blob_write_bytes(&blob, &info->point_size_max, sizeof(float));
+    } else {
+        blob_write_uint32(&blob, info->sampler_ps1xtypes);
+        blob_write_uint8(&blob, info->fog_enable ? info->fog_mode : 0);
+        blob_write_uint8(&blob, info->force_color_in_centroid);
+        blob_write_uint8(&blob, info->projected);
+    }
+
+    blob_write_uint8(&blob, !!info->add_constants_defs.c_combination);
+    if (info->add_constants_defs.c_combination) {
+        for (i = 0; i < NINE_MAX_CONST_I; ++i) {
+            boolean added = (*info->add_constants_defs.int_const_added)[i];
+            blob_write_uint8(&blob, added);
+            if (added)
+                blob_write_bytes(&blob, info->add_constants_defs.c_combination->const_i[i],
+                                 sizeof(info->add_constants_defs.c_combination->const_i[i]));
+        }
+        for (i = 0; i < NINE_MAX_CONST_B; ++i) {
+            boolean added = (*info->add_constants_defs.bool_const_added)[i];
+            blob_write_uint8(&blob, added);
+            if (added)
+                blob_write_uint8(&blob, !!info->add_constants_defs.c_combination->const_b[i]);
+        }
+    }
+
+    blob_write_bytes(&blob, info->byte_code, byte_size);
+
+    if (blob.out_of_memory) {
+        blob_finish(&blob);
+        return FALSE;
+    }
+
+    disk_cache_compute_key(device->shader_cache.cache, blob.data, blob.size, key);
+    blob_finish(&blob);
+    return TRUE;
+}
+
+void
+nine_shader_cache_write_sm_info(struct blob *blob,
+                                const struct nine_shader_info *info,
+                                const unsigned *const_ranges,
+                                DWORD byte_size)
+{
+    const struct nine_range *r;
+    unsigned n;
+
+    blob_write_uint8(blob, info->version);
+    blob_write_uint32(blob, byte_size);
+    blob_write_uint8(blob, info->num_inputs);
+    blob_write_bytes(blob, info->input_map, sizeof(info->input_map));
+    blob_write_uint8(blob, info->position_t);
+    blob_write_uint8(blob, info->point_size);
+    blob_write_uint16(blob, info->sampler_mask);
+    blob_write_uint8(blob, info->rt_mask);
+    blob_write_uint8(blob, info->bumpenvmat_needed);
+    blob_write_bytes(blob, info->int_slots_used, sizeof(info->int_slots_used));
+    blob_write_bytes(blob, info->bool_slots_used, sizeof(info->bool_slots_used));
+    blob_write_uint32(blob, info->const_float_slots);
+    blob_write_uint32(blob, info->const_int_slots);
+    blob_write_uint32(blob, info->const_bool_slots);
+    /* Not written by the translator for swvp shaders */
+    blob_write_uint32(blob, info->swvp_on ? 0 : info->const_used_size);
+
+    /* const_ranges stop with a range of size 0 */
+    n = 0;
+    if (const_ranges) {
+        while (const_ranges[2*n+1])
+            n++;
+    }
+    blob_write_uint32(blob, const_ranges ? n + 1 : 0);
+    if (const_ranges)
+        blob_write_bytes(blob, const_ranges, (n + 1) * 2 * sizeof(unsigned));
+
+    n = 0;
+    for (r = info->lconstf.ranges; r; r = r->next)
+        n++;
+    blob_write_uint32(blob, n);
+    for (r = info->lconstf.ranges; r; r = r->next) {
+        blob_write_uint16(blob, r->bgn);
+        blob_write_uint16(blob, r->end);
+    }
+    n = 0;
+    for (r = info->lconstf.ranges; r; r = r->next)
+        n += r->end - r->bgn;
+    if (n)
+        blob_write_bytes(blob, info->lconstf.data, n * 4 * sizeof(float));
+}
+
+static boolean
+read_sm_info(struct blob_reader *blob, struct nine_shader_info *info)
+{
+    unsigned i, n, num_const;
+
+    info->version = blob_read_uint8(blob);
+    info->byte_size = blob_read_uint32(blob);
+    info->num_inputs = blob_read_uint8(blob);
+    blob_copy_bytes(blob, info->input_map, sizeof(info->input_map));
+    info->position_t = blob_read_uint8(blob);
+    info->point_size = blob_read_uint8(blob);
+    info->sampler_mask = blob_read_uint16(blob);
+    info->rt_mask = blob_read_uint8(blob);
+    info->bumpenvmat_needed = blob_read_uint8(blob);
+    blob_copy_bytes(blob, info->int_slots_used, sizeof(info->int_slots_used));
+    blob_copy_bytes(blob, info->bool_slots_used, sizeof(info->bool_slots_used));
+    info->const_float_slots = blob_read_uint32(blob);
+    info->const_int_slots = blob_read_uint32(blob);
+    info->const_bool_slots = blob_read_uint32(blob);
+    n = blob_read_uint32(blob);
+    if (!info->swvp_on)
+        info->const_used_size = n;
+
+    info->const_ranges = NULL;
+    info->lconstf.ranges = NULL;
+    info->lconstf.data = NULL;
+
+    n = blob_read_uint32(blob);
+    if (blob->overrun || n > NINE_MAX_CONST_ALL + 1)
+        return FALSE;
+    if (n) {
+        info->const_ranges = MALLOC(n * 2 * sizeof(unsigned));
+        if (!info->const_ranges)
+            return FALSE;
+        blob_copy_bytes(blob, info->const_ranges, n * 2 * sizeof(unsigned));
+    }
+
+    n = blob_read_uint32(blob);
+    if (blob->overrun || n > NINE_MAX_CONST_ALL)
+        return FALSE;
+    if (!n)
+        return !blob->overrun;
+
+    info->lconstf.ranges = MALLOC(n * sizeof(struct nine_range));
+    if (!info->lconstf.ranges)
+        return FALSE;
+    num_const = 0;
+    for (i = 0; i < n; ++i) {
+        info->lconstf.ranges[i].bgn = blob_read_uint16(blob);
+        info->lconstf.ranges[i].end = blob_read_uint16(blob);
+        info->lconstf.ranges[i].next = i + 1 < n ? &info->lconstf.ranges[i + 1] : NULL;
+        num_const += info->lconstf.ranges[i].end - info->lconstf.ranges[i].bgn;
+    }
+    if (blob->overrun || num_const > NINE_MAX_CONST_F_SWVP)
+        return FALSE;
+    info->lconstf.data = MALLOC(num_const * 4 * sizeof(float));
+    if (!info->lconstf.data)
+        return FALSE;
+    blob_copy_bytes(blob, info->lconstf.data, num_const * 4 * sizeof(float));
+
+    return !blob->overrun;
+}
+
+boolean
+nine_shader_cache_load_sm(struct NineDevice9 *device,
+                          struct nine_shader_info *info,
+                          struct pipe_context *pipe,
+                          const cache_key key)
+{
+    struct nine_shader_info loaded = *info;
+    struct blob_reader blob;
+    size_t size;
+    void *data;
+
+    data = nine_shader_cache_get(device, key, &size);
+    if (!data)
+        return FALSE;
+
+    blob_reader_init(&blob, data, size);
+    if (read_sm_info(&blob, &loaded))
+        loaded.cso = nine_create_shader_from_blob(pipe, info->type, &blob);
+    else
+        loaded.cso = NULL;
+    FREE(data);
+
+    if (!loaded.cso) {
+        /* Corrupted entry, or the driver failed. Retranslate. */
+        DBG("Failed to load shader from cache\n");
+        FREE(loaded.const_ranges);
+        FREE(loaded.lconstf.ranges);
+        FREE(loaded.lconstf.data);
+        return FALSE;
+    }
+
+    *info = loaded;
+    return TRUE;
+}
+
+void
+nine_shader_cache_key_ff(struct NineDevice9 *device,
+                         unsigned type,
+                         const void *ff_key,
+                         size_t ff_key_size,
+                         cache_key key)
+{
+    struct blob blob;
+
+    blob_init(&blob);
+    write_key_header(&blob, device, NINE_SHADER_CACHE_FF, type);
+    blob_write_bytes(&blob, ff_key, ff_key_size);
+    disk_cache_compute_key(device->shader_cache.cache, blob.data, blob.size, key);
+    blob_finish(&blob);
+}
+
+void *
+nine_shader_cache_get(struct NineDevice9 *device,
+                      const cache_key key,
+                      size_t *size)
+{
+    void *data = disk_cache_get(device->shader_cache.cache, key, size);
+
+    if (data)
+        p_atomic_inc(&device->shader_cache.hits);
+    else
+        p_atomic_inc(&device->shader_cache.misses);
+    return data;
+}
+
+void
+nine_shader_cache_put(struct NineDevice9 *device,
+                      const cache_key key,
+                      const struct blob *blob)
+{
+    disk_cache_put(device->shader_cache.cache, key, blob->data, blob->size, NULL);
+}
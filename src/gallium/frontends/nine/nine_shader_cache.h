@@ -0,0 +1,83 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#ifndef _NINE_SHADER_CACHE_H_
+#define _NINE_SHADER_CACHE_H_
+
+#include "d3d9types.h"
+#include "pipe/p_compiler.h"
+#include "util/disk_cache.h"
+
+struct NineDevice9;
+struct nine_shader_info;
+struct pipe_context;
+struct blob;
+
+/* On-disk cache of the translated shaders, stored in the disk cache of the
+ * driver. An entry contains the nine side informations about the shader,
+ * followed by the IR (TGSI or serialized NIR) given to the driver. */
+
+void
+nine_shader_cache_init(struct NineDevice9 *device);
+
+void
+nine_shader_cache_fini(struct NineDevice9 *device);
+
+/* Translated SM1-3 shaders */
+
+boolean
+nine_shader_cache_key_sm(struct NineDevice9 *device,
+                         const struct nine_shader_info *info,
+                         DWORD byte_size,
+                         cache_key key);
+
+boolean
+nine_shader_cache_load_sm(struct NineDevice9 *device,
+                          struct nine_shader_info *info,
+                          struct pipe_context *pipe,
+                          const cache_key key);
+
+void
+nine_shader_cache_write_sm_info(struct blob *blob,
+                                const struct nine_shader_info *info,
+                                const unsigned *const_ranges,
+                                DWORD byte_size);
+
+/* Fixed function shaders. The ff key fully determines the shader. */
+
+void
+nine_shader_cache_key_ff(struct NineDevice9 *device,
+                         unsigned type,
+                         const void *ff_key,
+                         size_t ff_key_size,
+                         cache_key key);
+
+/* Returns a MALLOC'ed entry, or NULL on miss. */
+void *
+nine_shader_cache_get(struct NineDevice9 *device,
+                      const cache_key key,
+                      size_t *size);
+
+void
+nine_shader_cache_put(struct NineDevice9 *device,
+                      const cache_key key,
+                      const struct blob *blob);
+
+#endif /* _NINE_SHADER_CACHE_H_ */
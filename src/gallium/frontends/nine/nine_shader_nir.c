@@ -0,0 +1,1853 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+/* Direct translation of SM2 and SM3 shaders to NIR.
+ *
+ * The translation follows what nine_shader.c emits in TGSI and what
+ * tgsi_to_nir then does with it, so both paths give the same results
+ * to the driver, without going through ureg and tgsi_to_nir.
+ *
+ * Only the common subset of the bytecode is handled: relative
+ * addressing, predication, subroutines, the aL register and the vs
+ * address register are not. For these, D3DERR_NOTAVAILABLE is returned
+ * and the shader goes through the TGSI translator instead. */
+
+#include "nine_shader.h"
+
+#include "nine_debug.h"
+#include "nine_sm1.h"
+
+#include "pipe/p_screen.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/bitset.h"
+#include "util/u_memory.h"
+#include "nir/tgsi_to_nir.h"
+#include "compiler/nir/nir.h"
+#include "compiler/nir/nir_builder.h"
+
+#include <float.h>
+
+#define DBG_CHANNEL DBG_SHADER
+
+#define DUMP(args...) _nine_debug_printf(DBG_CHANNEL, NULL, args)
+
+#define NINE_NIR_MAX_TEMPS    32
+#define NINE_NIR_MAX_INPUTS   16
+#define NINE_NIR_MAX_OUTPUTS  32
+#define NINE_NIR_MAX_SAMPLERS 16
+#define NINE_NIR_MAX_CF_DEPTH 64
+
+/* Bound the parsing of shaders missing their end token */
+#define NINE_NIR_MAX_TOKENS (1 << 20)
+
+struct nine_nir_src_param
+{
+    BYTE file;
+    INT idx;
+    BYTE swizzle;
+    BYTE mod;
+};
+
+struct nine_nir_dst_param
+{
+    BYTE file;
+    INT idx;
+    BYTE mask;
+    BYTE mod;
+    int8_t shift;
+};
+
+struct nine_nir_output
+{
+    nir_variable *var; /* shader output */
+    nir_variable *tmp; /* vec4 written by the shader, stored to var at the end */
+    unsigned component; /* for scalar outputs */
+    boolean saturate;
+};
+
+enum nine_nir_cf_type
+{
+    NINE_NIR_CF_IF,
+    NINE_NIR_CF_LOOP,
+    NINE_NIR_CF_REP
+};
+
+struct nine_nir_cf
+{
+    enum nine_nir_cf_type type;
+    nir_if *nif;
+    nir_loop *loop;
+    nir_variable *ctr;
+};
+
+struct nine_nir_translator
+{
+    struct nine_shader_info *info;
+    struct pipe_screen *screen;
+    nir_builder b;
+
+    const DWORD *byte_code;
+    const DWORD *parse;
+    const DWORD *parse_next;
+
+    unsigned version; /* (major << 8) | minor */
+    boolean is_vs;
+    boolean failure;
+
+    /* current instruction */
+    unsigned opcode;
+    unsigned flags;
+    unsigned nsrc;
+    struct nine_nir_dst_param dst;
+    struct nine_nir_src_param src[4];
+
+    boolean want_texcoord;
+    boolean shift_wpos;
+    boolean wpos_is_sysval;
+    boolean face_is_sysval_integer;
+    unsigned num_constf_allowed;
+
+    nir_variable *r[NINE_NIR_MAX_TEMPS];
+
+    nir_variable *v[NINE_NIR_MAX_INPUTS];
+    boolean v_is_position[NINE_NIR_MAX_INPUTS]; /* ps3 dcl_depth */
+    nir_variable *vT[8]; /* ps2 texcoords */
+    nir_variable *vPos;
+    nir_variable *vFace;
+    nir_variable *fog_in;
+    unsigned num_inputs;
+
+    struct nine_nir_output outputs[NINE_NIR_MAX_OUTPUTS];
+    unsigned num_outputs;
+    nir_variable *o[NINE_NIR_MAX_OUTPUTS]; /* vs3 output registers */
+    nir_variable *oPts;
+    nir_variable *oCol0; /* ps < 3, fog is applied at the end */
+    boolean fog_written;
+
+    nir_variable *samplers[NINE_NIR_MAX_SAMPLERS];
+
+    struct nine_nir_cf cf[NINE_NIR_MAX_CF_DEPTH];
+    unsigned cf_depth;
+    unsigned loop_depth;
+
+    float lconstf[NINE_MAX_CONST_F][4];
+    boolean lconstf_set[NINE_MAX_CONST_F];
+    int lconsti[NINE_MAX_CONST_I][4];
+    boolean lconsti_set[NINE_MAX_CONST_I];
+    boolean lconstb[NINE_MAX_CONST_B];
+    boolean lconstb_set[NINE_MAX_CONST_B];
+
+    boolean slots_used[NINE_MAX_CONST_ALL];
+};
+
+#define NINE_NIR_UNSUPPORTED(tx, fmt, ...) \
+    do { \
+        if (!(tx)->failure) \
+            DBG("unsupported by the NIR translator: " fmt, ## __VA_ARGS__); \
+        (tx)->failure = TRUE; \
+    } while (0)
+
+#define V(maj, min) (((maj) << 8) | (min))
+
+struct nine_nir_op_info
+{
+    uint16_t vs_min, vs_max;
+    uint16_t ps_min, ps_max;
+    uint8_t ndst;
+};
+
+#define _OP(o, vmin, vmax, pmin, pmax, nd) \
+    [D3DSIO_##o] = { vmin, vmax, pmin, pmax, nd }
+#define _OP_ALL(o, nd) _OP(o, V(2,0), V(3,0), V(2,0), V(3,0), nd)
+#define _OP_VS(o, vmin, nd) _OP(o, vmin, V(3,0), 0, 0, nd)
+#define _OP_PS(o, pmin, nd) _OP(o, 0, 0, pmin, V(3,0), nd)
+
+/* The subset of inst_table in nine_shader.c handled here. */
+static const struct nine_nir_op_info nine_nir_ops[D3DSIO_BREAKP + 1] =
+{
+    _OP_ALL(NOP, 0),
+    _OP_ALL(MOV, 1),
+    _OP_ALL(ADD, 1),
+    _OP_ALL(SUB, 1),
+    _OP_ALL(MAD, 1),
+    _OP_ALL(MUL, 1),
+    _OP_ALL(RCP, 1),
+    _OP_ALL(RSQ, 1),
+    _OP_ALL(DP3, 1),
+    _OP_ALL(DP4, 1),
+    _OP_ALL(MIN, 1),
+    _OP_ALL(MAX, 1),
+    _OP_ALL(SLT, 1),
+    _OP_ALL(SGE, 1),
+    _OP_ALL(EXP, 1),
+    _OP_ALL(LOG, 1),
+    _OP_VS(LIT, V(2,0), 1),
+    _OP_ALL(DST, 1),
+    _OP_ALL(LRP, 1),
+    _OP_ALL(FRC, 1),
+    _OP_ALL(M4x4, 1),
+    _OP_ALL(M4x3, 1),
+    _OP_ALL(M3x4, 1),
+    _OP_ALL(M3x3, 1),
+    _OP_ALL(M3x2, 1),
+    _OP(LOOP, V(2,0), V(3,0), V(3,0), V(3,0), 0),
+    _OP(RET, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(ENDLOOP, V(2,0), V(3,0), V(3,0), V(3,0), 0),
+    _OP_ALL(DCL, 0),
+    _OP_ALL(POW, 1),
+    _OP_ALL(CRS, 1),
+    _OP_VS(SGN, V(2,0), 1),
+    _OP_ALL(ABS, 1),
+    _OP_ALL(NRM, 1),
+    _OP_ALL(SINCOS, 1),
+    _OP(REP, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(ENDREP, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(IF, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(IFC, V(2,1), V(3,0), V(2,1), V(3,0), 0),
+    _OP(ELSE, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(ENDIF, V(2,0), V(3,0), V(2,1), V(3,0), 0),
+    _OP(BREAK, V(2,1), V(3,0), V(2,1), V(3,0), 0),
+    _OP(BREAKC, V(2,1), V(3,0), V(2,1), V(3,0), 0),
+    _OP_ALL(DEFB, 1),
+    _OP_ALL(DEFI, 1),
+    _OP_PS(TEXKILL, V(2,0), 1),
+    _OP_PS(TEX, V(2,0), 1),
+    _OP_VS(EXPP, V(2,0), 1),
+    _OP_VS(LOGP, V(2,0), 1),
+    _OP_ALL(DEF, 1),
+    _OP_PS(CMP, V(2,0), 1),
+    _OP_PS(DP2ADD, V(2,0), 1),
+    _OP_PS(DSX, V(2,1), 1),
+    _OP_PS(DSY, V(2,1), 1),
+    _OP_PS(TEXLDD, V(2,1), 1),
+    _OP(TEXLDL, V(3,0), V(3,0), V(3,0), V(3,0), 1),
+};
+
+#undef _OP_PS
+#undef _OP_VS
+#undef _OP_ALL
+#undef _OP
+
+static inline nir_ssa_def *
+nine_nir_vec4(nir_builder *b, nir_ssa_def *def)
+{
+    static const unsigned swiz[4] = { 0, 1, 2, 3 };
+    unsigned s[4];
+    unsigned c;
+
+    if (def->num_components == 4)
+        return def;
+    for (c = 0; c < 4; ++c)
+        s[c] = MIN2(swiz[c], def->num_components - 1);
+    return nir_swizzle(b, def, s, 4);
+}
+
+static inline nir_ssa_def *
+nine_nir_replicate(nir_builder *b, nir_ssa_def *def, unsigned c)
+{
+    const unsigned swiz[4] = { c, c, c, c };
+    return nir_swizzle(b, def, swiz, 4);
+}
+
+/* Constants */
+
+static nir_ssa_def *
+nine_nir_load_slot(struct nine_nir_translator *tx, unsigned slot,
+                   nir_alu_type type)
+{
+    assert(slot < NINE_MAX_CONST_ALL);
+    tx->slots_used[slot] = TRUE;
+    /* The base is remapped once all the used slots are known */
+    return nir_load_uniform(&tx->b, 4, 32, nir_imm_int(&tx->b, 0),
+                            .base = slot, .range = 1, .dest_type = type);
+}
+
+static nir_ssa_def *
+nine_nir_float_constant(struct nine_nir_translator *tx, INT idx)
+{
+    struct nine_shader_info *info = tx->info;
+
+    if (info->const_float_slots < (idx + 1))
+        info->const_float_slots = idx + 1;
+    return nine_nir_load_slot(tx, idx, nir_type_float32);
+}
+
+static nir_ssa_def *
+nine_nir_src_constf(struct nine_nir_translator *tx, INT idx)
+{
+    const float *f;
+
+    if (idx < 0 || idx >= tx->num_constf_allowed) {
+        NINE_NIR_UNSUPPORTED(tx, "float constant %i out of range\n", idx);
+        return nir_ssa_undef(&tx->b, 4, 32);
+    }
+    if (!tx->lconstf_set[idx])
+        return nine_nir_float_constant(tx, idx);
+    f = tx->lconstf[idx];
+    return nir_imm_vec4(&tx->b, f[0], f[1], f[2], f[3]);
+}
+
+static nir_ssa_def *
+nine_nir_src_consti(struct nine_nir_translator *tx, INT idx)
+{
+    struct nine_shader_info *info = tx->info;
+    const int *i;
+
+    if (idx < 0 || idx >= NINE_MAX_CONST_I) {
+        NINE_NIR_UNSUPPORTED(tx, "integer constant %i out of range\n", idx);
+        return nir_ssa_undef(&tx->b, 4, 32);
+    }
+    if (tx->lconsti_set[idx]) {
+        i = tx->lconsti[idx];
+        return nir_imm_ivec4(&tx->b, i[0], i[1], i[2], i[3]);
+    }
+    info->int_slots_used[idx] = TRUE;
+    if (info->const_int_slots < (idx + 1))
+        info->const_int_slots = idx + 1;
+    return nine_nir_load_slot(tx, info->const_i_base + idx, nir_type_int32);
+}
+
+static nir_ssa_def *
+nine_nir_src_constb(struct nine_nir_translator *tx, INT idx)
+{
+    struct nine_shader_info *info = tx->info;
+    nir_ssa_def *slot;
+
+    if (idx < 0 || idx >= NINE_MAX_CONST_B) {
+        NINE_NIR_UNSUPPORTED(tx, "boolean constant %i out of range\n", idx);
+        return nir_ssa_undef(&tx->b, 4, 32);
+    }
+    /* Booleans are uploaded as 0 / ~0 with integer support */
+    if (tx->lconstb_set[idx]) {
+        const int v = tx->lconstb[idx] ? ~0 : 0;
+        return nir_imm_ivec4(&tx->b, v, v, v, v);
+    }
+    info->bool_slots_used[idx] = TRUE;
+    if (info->const_bool_slots < (idx + 1))
+        info->const_bool_slots = idx + 1;
+    slot = nine_nir_load_slot(tx, info->const_b_base + idx / 4, nir_type_uint32);
+    return nine_nir_replicate(&tx->b, slot, idx & 3);
+}
+
+static void
+nine_nir_set_lconstb(struct nine_nir_translator *tx, INT idx, BOOL b)
+{
+    if (idx < 0 || idx >= NINE_MAX_CONST_B) {
+        NINE_NIR_UNSUPPORTED(tx, "boolean constant %i out of range\n", idx);
+        return;
+    }
+    tx->lconstb[idx] = !!b;
+    tx->lconstb_set[idx] = TRUE;
+}
+
+static void
+nine_nir_set_lconsti(struct nine_nir_translator *tx, INT idx, const int i[4])
+{
+    if (idx < 0 || idx >= NINE_MAX_CONST_I) {
+        NINE_NIR_UNSUPPORTED(tx, "integer constant %i out of range\n", idx);
+        return;
+    }
+    memcpy(tx->lconsti[idx], i, sizeof(tx->lconsti[idx]));
+    tx->lconsti_set[idx] = TRUE;
+}
+
+/* Inputs */
+
+static nir_variable *
+nine_nir_add_input(struct nine_nir_translator *tx,
+                   const struct glsl_type *type,
+                   unsigned location,
+                   unsigned driver_location,
+                   enum glsl_interp_mode interp,
+                   boolean centroid)
+{
+    nir_shader *shader = tx->b.shader;
+    nir_variable *var = nir_variable_create(shader, nir_var_shader_in, type, NULL);
+
+    var->name = ralloc_asprintf(var, "in_%u", driver_location);
+    var->data.location = location;
+    var->data.driver_location = driver_location;
+    var->data.interpolation = interp;
+    var->data.centroid = centroid;
+    var->data.read_only = true;
+
+    shader->info.inputs_read |= BITFIELD64_BIT(location);
+    shader->num_inputs = MAX2(shader->num_inputs, driver_location + 1);
+    tx->num_inputs = MAX2(tx->num_inputs, driver_location + 1);
+    return var;
+}
+
+static nir_variable *
+nine_nir_add_fs_input(struct nine_nir_translator *tx, unsigned location,
+                      enum glsl_interp_mode interp, boolean centroid)
+{
+    return nine_nir_add_input(tx, glsl_vec4_type(), location, tx->num_inputs,
+                              interp, centroid);
+}
+
+static nir_ssa_def *
+nine_nir_position(struct nine_nir_translator *tx)
+{
+    if (tx->wpos_is_sysval)
+        return nir_load_frag_coord(&tx->b);
+    if (!tx->vPos)
+        tx->vPos = nine_nir_add_fs_input(tx, VARYING_SLOT_POS,
+                                         INTERP_MODE_NOPERSPECTIVE, FALSE);
+    return nir_load_var(&tx->b, tx->vPos);
+}
+
+static nir_ssa_def *
+nine_nir_face(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    nir_ssa_def *front_face;
+
+    if (tx->face_is_sysval_integer) {
+        front_face = nir_load_front_face(b, 1);
+    } else {
+        if (!tx->vFace)
+            tx->vFace = nine_nir_add_input(tx, glsl_bool_type(),
+                                           VARYING_SLOT_FACE, tx->num_inputs,
+                                           INTERP_MODE_FLAT, FALSE);
+        front_face = nir_load_var(b, tx->vFace);
+    }
+    return nine_nir_vec4(b, nir_bcsel(b, front_face, nir_imm_float(b, 1.0f),
+                                      nir_imm_float(b, -1.0f)));
+}
+
+static unsigned
+nine_nir_texcoord_location(struct nine_nir_translator *tx, unsigned idx)
+{
+    return tx->want_texcoord ? VARYING_SLOT_TEX0 + idx : VARYING_SLOT_VAR0 + idx;
+}
+
+static nir_ssa_def *
+nine_nir_src_input(struct nine_nir_translator *tx, INT idx)
+{
+    if (idx < 0 || idx >= NINE_NIR_MAX_INPUTS) {
+        NINE_NIR_UNSUPPORTED(tx, "input %i out of range\n", idx);
+        return nir_ssa_undef(&tx->b, 4, 32);
+    }
+    if (!tx->is_vs && tx->version < V(3,0) && !tx->v[idx]) {
+        /* ps2: v# are the colors */
+        if (idx >= 2) {
+            NINE_NIR_UNSUPPORTED(tx, "color input %i\n", idx);
+            return nir_ssa_undef(&tx->b, 4, 32);
+        }
+        tx->v[idx] = nine_nir_add_fs_input(tx, VARYING_SLOT_COL0 + idx,
+                                           INTERP_MODE_NONE,
+                                           tx->info->force_color_in_centroid);
+    }
+    if (tx->v_is_position[idx])
+        return nine_nir_position(tx);
+    if (!tx->v[idx]) {
+        NINE_NIR_UNSUPPORTED(tx, "undeclared input %i\n", idx);
+        return nir_ssa_undef(&tx->b, 4, 32);
+    }
+    return nir_load_var(&tx->b, tx->v[idx]);
+}
+
+/* Outputs */
+
+static struct nine_nir_output *
+nine_nir_add_output(struct nine_nir_translator *tx,
+                    const struct glsl_type *type,
+                    unsigned location,
+                    unsigned component,
+                    boolean saturate)
+{
+    nir_shader *shader = tx->b.shader;
+    struct nine_nir_output *out;
+    unsigned i;
+
+    for (i = 0; i < tx->num_outputs; ++i) {
+        if (tx->outputs[i].var->data.location == location)
+            return &tx->outputs[i];
+    }
+    if (tx->num_outputs == NINE_NIR_MAX_OUTPUTS) {
+        NINE_NIR_UNSUPPORTED(tx, "too many outputs\n");
+        return NULL;
+    }
+
+    out = &tx->outputs[tx->num_outputs];
+    out->var = nir_variable_create(shader, nir_var_shader_out, type, NULL);
+    out->var->name = ralloc_asprintf(out->var, "out_%u", tx->num_outputs);
+    out->var->data.location = location;
+    out->var->data.driver_location = tx->num_outputs;
+    out->tmp = nir_local_variable_create(tx->b.impl, glsl_vec4_type(), NULL);
+    out->component = component;
+    out->saturate = saturate;
+
+    shader->info.outputs_written |= BITFIELD64_BIT(location);
+    shader->num_outputs = ++tx->num_outputs;
+    return out;
+}
+
+static nir_variable *
+nine_nir_output_tmp(struct nine_nir_translator *tx, unsigned location,
+                    boolean saturate)
+{
+    struct nine_nir_output *out =
+        nine_nir_add_output(tx, glsl_vec4_type(), location, 0, saturate);
+    return out ? out->tmp : NULL;
+}
+
+static nir_variable *
+nine_nir_oPts(struct nine_nir_translator *tx)
+{
+    if (!tx->oPts)
+        tx->oPts = nir_local_variable_create(tx->b.impl, glsl_vec4_type(), "oPts");
+    return tx->oPts;
+}
+
+static nir_variable *
+nine_nir_temp(struct nine_nir_translator *tx, INT idx)
+{
+    if (idx < 0 || idx >= NINE_NIR_MAX_TEMPS) {
+        NINE_NIR_UNSUPPORTED(tx, "temporary %i out of range\n", idx);
+        return NULL;
+    }
+    if (!tx->r[idx])
+        tx->r[idx] = nir_local_variable_create(tx->b.impl, glsl_vec4_type(), NULL);
+    return tx->r[idx];
+}
+
+/* Parameters */
+
+static void
+nine_nir_parse_dst(struct nine_nir_dst_param *dst, DWORD tok)
+{
+    int8_t shift;
+
+    dst->file =
+        (tok & D3DSP_REGTYPE_MASK)  >> D3DSP_REGTYPE_SHIFT |
+        (tok & D3DSP_REGTYPE_MASK2) >> D3DSP_REGTYPE_SHIFT2;
+    dst->idx = tok & D3DSP_REGNUM_MASK;
+    dst->mask = (tok & NINED3DSP_WRITEMASK_MASK) >> NINED3DSP_WRITEMASK_SHIFT;
+    dst->mod = (tok & D3DSP_DSTMOD_MASK) >> D3DSP_DSTMOD_SHIFT;
+    shift = (tok & D3DSP_DSTSHIFT_MASK) >> D3DSP_DSTSHIFT_SHIFT;
+    dst->shift = (shift & 0x7) - (shift & 0x8);
+}
+
+static void
+nine_nir_parse_src(struct nine_nir_src_param *src, DWORD tok)
+{
+    src->file =
+        ((tok & D3DSP_REGTYPE_MASK)  >> D3DSP_REGTYPE_SHIFT) |
+        ((tok & D3DSP_REGTYPE_MASK2) >> D3DSP_REGTYPE_SHIFT2);
+    src->idx = tok & D3DSP_REGNUM_MASK;
+    src->swizzle = (tok & D3DSP_SWIZZLE_MASK) >> D3DSP_SWIZZLE_SHIFT;
+    src->mod = (tok & D3DSP_SRCMOD_MASK) >> D3DSP_SRCMOD_SHIFT;
+}
+
+static nir_ssa_def *
+nine_nir_src_param(struct nine_nir_translator *tx,
+                   const struct nine_nir_src_param *param)
+{
+    nir_builder *b = &tx->b;
+    nir_ssa_def *src = NULL;
+    nir_variable *var;
+
+    switch (param->file) {
+    case D3DSPR_TEMP:
+        var = nine_nir_temp(tx, param->idx);
+        if (var)
+            src = nir_load_var(b, var);
+        break;
+    case D3DSPR_INPUT:
+        src = nine_nir_src_input(tx, param->idx);
+        break;
+ /* case D3DSPR_TEXTURE: == D3DSPR_ADDR */
+    case D3DSPR_ADDR:
+        if (tx->is_vs || tx->version >= V(3,0) ||
+            param->idx < 0 || param->idx >= ARRAY_SIZE(tx->vT)) {
+            NINE_NIR_UNSUPPORTED(tx, "address register\n");
+            break;
+        }
+        if (!tx->vT[param->idx])
+            tx->vT[param->idx] =
+                nine_nir_add_fs_input(tx, nine_nir_texcoord_location(tx, param->idx),
+                                      INTERP_MODE_SMOOTH, FALSE);
+        src = nir_load_var(b, tx->vT[param->idx]);
+        break;
+    case D3DSPR_CONST:
+        src = nine_nir_src_constf(tx, param->idx);
+        break;
+    case D3DSPR_CONSTINT:
+        src = nine_nir_src_consti(tx, param->idx);
+        break;
+    case D3DSPR_CONSTBOOL:
+        src = nine_nir_src_constb(tx, param->idx);
+        break;
+    case D3DSPR_MISCTYPE:
+        if (tx->is_vs)
+            break;
+        switch (param->idx) {
+        case D3DSMO_POSITION:
+            src = nine_nir_position(tx);
+            if (tx->shift_wpos)
+                src = nir_fadd(b, src, nir_imm_vec4(b, -0.5f, -0.5f, 0.0f, 0.0f));
+            break;
+        case D3DSMO_FACE:
+            src = nine_nir_face(tx);
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+    if (!src) {
+        NINE_NIR_UNSUPPORTED(tx, "source register file %u\n", param->file);
+        return nir_ssa_undef(b, 4, 32);
+    }
+
+    if (param->swizzle != NINED3DSP_NOSWIZZLE) {
+        const unsigned swiz[4] = {
+            (param->swizzle >> 0) & 0x3,
+            (param->swizzle >> 2) & 0x3,
+            (param->swizzle >> 4) & 0x3,
+            (param->swizzle >> 6) & 0x3
+        };
+        src = nir_swizzle(b, src, swiz, 4);
+    }
+
+    switch (param->mod) {
+    case NINED3DSPSM_NONE:
+        break;
+    case NINED3DSPSM_NEG:
+        src = nir_fneg(b, src);
+        break;
+    case NINED3DSPSM_ABS:
+        src = nir_fabs(b, src);
+        break;
+    case NINED3DSPSM_ABSNEG:
+        src = nir_fneg(b, nir_fabs(b, src));
+        break;
+    case NINED3DSPSM_NOT:
+        if (param->file == D3DSPR_CONSTBOOL) {
+            src = nir_inot(b, src);
+            break;
+        }
+        /* fall through */
+    default:
+        NINE_NIR_UNSUPPORTED(tx, "source modifier %u\n", param->mod);
+        break;
+    }
+    return src;
+}
+
+static inline nir_ssa_def *
+nine_nir_src(struct nine_nir_translator *tx, unsigned i)
+{
+    assert(i < tx->nsrc);
+    return nine_nir_src_param(tx, &tx->src[i]);
+}
+
+/* Scalar operations read the first component of their source */
+static inline nir_ssa_def *
+nine_nir_src_x(struct nine_nir_translator *tx, unsigned i)
+{
+    return nir_channel(&tx->b, nine_nir_src(tx, i), 0);
+}
+
+static nir_variable *
+nine_nir_dst_var(struct nine_nir_translator *tx,
+                 const struct nine_nir_dst_param *param)
+{
+    const unsigned idx = param->idx;
+
+    switch (param->file) {
+    case D3DSPR_TEMP:
+        return nine_nir_temp(tx, param->idx);
+    case D3DSPR_RASTOUT:
+        if (!tx->is_vs || tx->version >= V(3,0))
+            break;
+        switch (idx) {
+        case 0:
+            return nine_nir_output_tmp(tx, VARYING_SLOT_POS, FALSE);
+        case 1:
+            tx->fog_written = TRUE;
+            return nine_nir_output_tmp(tx, VARYING_SLOT_VAR0 + 16, TRUE);
+        case 2:
+            return nine_nir_oPts(tx);
+        default:
+            break;
+        }
+        break;
+    case D3DSPR_ATTROUT: /* VS */
+ /* case D3DSPR_COLOROUT: PS */
+        if (tx->is_vs) {
+            if (tx->version >= V(3,0) || idx >= 2)
+                break;
+            return nine_nir_output_tmp(tx, VARYING_SLOT_COL0 + idx, TRUE);
+        }
+        if (idx >= 4)
+            break;
+        tx->info->rt_mask |= 1 << idx;
+        if (tx->version < V(3,0) && idx == 0) {
+            if (!tx->oCol0)
+                tx->oCol0 = nir_local_variable_create(tx->b.impl, glsl_vec4_type(), "oCol0");
+            return tx->oCol0;
+        }
+        return nine_nir_output_tmp(tx, FRAG_RESULT_DATA0 + idx, FALSE);
+ /* case D3DSPR_TEXCRDOUT: == D3DSPR_OUTPUT */
+    case D3DSPR_OUTPUT:
+        if (!tx->is_vs)
+            break;
+        if (tx->version < V(3,0)) {
+            if (idx >= 8)
+                break;
+            return nine_nir_output_tmp(tx, nine_nir_texcoord_location(tx, idx), FALSE);
+        }
+        if (idx < NINE_NIR_MAX_OUTPUTS && tx->o[idx])
+            return tx->o[idx];
+        break;
+    case D3DSPR_DEPTHOUT:
+        if (tx->is_vs)
+            break;
+        {
+            struct nine_nir_output *out =
+                nine_nir_add_output(tx, glsl_float_type(), FRAG_RESULT_DEPTH, 0, FALSE);
+            return out ? out->tmp : NULL;
+        }
+    default:
+        break;
+    }
+    NINE_NIR_UNSUPPORTED(tx, "destination register %u[%u]\n", param->file, idx);
+    return NULL;
+}
+
+static void
+nine_nir_store_dst(struct nine_nir_translator *tx, nir_ssa_def *val)
+{
+    nir_builder *b = &tx->b;
+    const struct nine_nir_dst_param *param = &tx->dst;
+    unsigned mask = param->mask;
+    nir_variable *var;
+
+    if (param->mod & ~(NINED3DSPDM_SATURATE | NINED3DSPDM_PARTIALP)) {
+        NINE_NIR_UNSUPPORTED(tx, "destination modifier %u\n", param->mod);
+        return;
+    }
+
+    var = nine_nir_dst_var(tx, param);
+    if (!var || !mask || tx->failure)
+        return;
+
+    val = nine_nir_vec4(b, val);
+    if (param->shift < 0)
+        val = nir_fmul_imm(b, val, 1.0 / (1 << -param->shift));
+    else if (param->shift > 0)
+        val = nir_fmul_imm(b, val, 1 << param->shift);
+    if (param->mod & NINED3DSPDM_SATURATE)
+        val = nir_fsat(b, val);
+
+    if (param->file == D3DSPR_DEPTHOUT) {
+        /* oDepth is a scalar, keep the first written component */
+        val = nine_nir_replicate(b, val, ffs(mask) - 1);
+        mask = NINED3DSP_WRITEMASK_ALL;
+    }
+
+    nir_store_var(b, var, val, mask);
+}
+
+/* Instructions */
+
+static nir_ssa_def *
+nine_nir_compare(struct nine_nir_translator *tx, nir_ssa_def *a, nir_ssa_def *c)
+{
+    nir_builder *b = &tx->b;
+
+    switch (tx->flags) {
+    case NINED3DSHADER_REL_OP_GT: return nir_flt(b, c, a);
+    case NINED3DSHADER_REL_OP_EQ: return nir_feq(b, a, c);
+    case NINED3DSHADER_REL_OP_GE: return nir_fge(b, a, c);
+    case NINED3DSHADER_REL_OP_LT: return nir_flt(b, a, c);
+    case NINED3DSHADER_REL_OP_NE: return nir_fneu(b, a, c);
+    case NINED3DSHADER_REL_OP_LE: return nir_fge(b, c, a);
+    default:
+        NINE_NIR_UNSUPPORTED(tx, "comparison %u\n", tx->flags);
+        return nir_imm_false(b);
+    }
+}
+
+static nir_ssa_def *
+nine_nir_src_cond(struct nine_nir_translator *tx)
+{
+    return nine_nir_compare(tx, nine_nir_src_x(tx, 0), nine_nir_src_x(tx, 1));
+}
+
+static struct nine_nir_cf *
+nine_nir_push_cf(struct nine_nir_translator *tx, enum nine_nir_cf_type type)
+{
+    struct nine_nir_cf *cf;
+
+    if (tx->cf_depth == NINE_NIR_MAX_CF_DEPTH) {
+        NINE_NIR_UNSUPPORTED(tx, "control flow too deep\n");
+        return NULL;
+    }
+    cf = &tx->cf[tx->cf_depth++];
+    memset(cf, 0, sizeof(*cf));
+    cf->type = type;
+    if (type != NINE_NIR_CF_IF)
+        tx->loop_depth++;
+    return cf;
+}
+
+static struct nine_nir_cf *
+nine_nir_pop_cf(struct nine_nir_translator *tx, enum nine_nir_cf_type type)
+{
+    struct nine_nir_cf *cf;
+
+    if (!tx->cf_depth || tx->cf[tx->cf_depth - 1].type != type) {
+        NINE_NIR_UNSUPPORTED(tx, "unbalanced control flow\n");
+        return NULL;
+    }
+    cf = &tx->cf[--tx->cf_depth];
+    if (type != NINE_NIR_CF_IF)
+        tx->loop_depth--;
+    return cf;
+}
+
+static void
+nine_nir_if(struct nine_nir_translator *tx, nir_ssa_def *cond)
+{
+    struct nine_nir_cf *cf = nine_nir_push_cf(tx, NINE_NIR_CF_IF);
+
+    if (cf)
+        cf->nif = nir_push_if(&tx->b, cond);
+}
+
+static void
+nine_nir_break_if(struct nine_nir_translator *tx, nir_ssa_def *cond)
+{
+    nir_if *nif;
+
+    if (!tx->loop_depth) {
+        NINE_NIR_UNSUPPORTED(tx, "break outside of a loop\n");
+        return;
+    }
+    /* Always inside an if, so that nothing follows the jump in its block */
+    nif = nir_push_if(&tx->b, cond);
+    nir_jump(&tx->b, nir_jump_break);
+    nir_pop_if(&tx->b, nif);
+}
+
+/* loop and rep: the number of iterations is in the x component of the
+ * integer constant. It is decremented at the end of every iteration
+ * and we stop when it reaches 0. */
+static void
+nine_nir_loop(struct nine_nir_translator *tx, enum nine_nir_cf_type type,
+              nir_ssa_def *count)
+{
+    nir_builder *b = &tx->b;
+    struct nine_nir_cf *cf = nine_nir_push_cf(tx, type);
+
+    if (!cf)
+        return;
+    cf->ctr = nir_local_variable_create(b->impl, glsl_int_type(), "loop_ctr");
+    nir_store_var(b, cf->ctr, nir_channel(b, count, 0), 0x1);
+    cf->loop = nir_push_loop(b);
+    nine_nir_break_if(tx, nir_ige(b, nir_imm_int(b, 0), nir_load_var(b, cf->ctr)));
+}
+
+static void
+nine_nir_endloop(struct nine_nir_translator *tx, enum nine_nir_cf_type type)
+{
+    nir_builder *b = &tx->b;
+    struct nine_nir_cf *cf = nine_nir_pop_cf(tx, type);
+
+    if (!cf)
+        return;
+    nir_store_var(b, cf->ctr, nir_iadd_imm(b, nir_load_var(b, cf->ctr), -1), 0x1);
+    nir_pop_loop(b, cf->loop);
+}
+
+static void
+nine_nir_matrix(struct nine_nir_translator *tx, unsigned k, unsigned n)
+{
+    nir_builder *b = &tx->b;
+    struct nine_nir_src_param row = tx->src[1];
+    nir_ssa_def *src = nine_nir_src(tx, 0);
+    nir_ssa_def *res[4];
+    unsigned i;
+
+    for (i = 0; i < n; ++i) {
+        nir_ssa_def *m = nine_nir_src_param(tx, &row);
+        res[i] = k == 3 ? nir_fdot3(b, src, m) : nir_fdot4(b, src, m);
+        row.idx++;
+    }
+    tx->dst.mask &= (1 << n) - 1;
+    nine_nir_store_dst(tx, nir_vec(b, res, n));
+}
+
+static void
+nine_nir_texture(struct nine_nir_translator *tx, nir_texop op)
+{
+    nir_builder *b = &tx->b;
+    const struct nine_nir_src_param *sampler = &tx->src[1];
+    nir_ssa_def *coord, *ddx = NULL, *ddy = NULL;
+    nir_variable *var;
+    nir_deref_instr *deref;
+    nir_tex_instr *instr;
+    boolean project = FALSE;
+    unsigned num_srcs, n = 0;
+    nir_ssa_def *res;
+
+    if (sampler->file != D3DSPR_SAMPLER || sampler->idx < 0 ||
+        sampler->idx >= NINE_NIR_MAX_SAMPLERS || !tx->samplers[sampler->idx]) {
+        NINE_NIR_UNSUPPORTED(tx, "undeclared sampler\n");
+        return;
+    }
+    if (tx->info->fetch4 & (1 << sampler->idx)) {
+        NINE_NIR_UNSUPPORTED(tx, "fetch4\n");
+        return;
+    }
+    var = tx->samplers[sampler->idx];
+
+    if (op == nir_texop_tex) {
+        switch (tx->flags) {
+        case 0:
+            break;
+        case NINED3DSI_TEXLD_PROJECT:
+            project = TRUE;
+            break;
+        case NINED3DSI_TEXLD_BIAS:
+            op = nir_texop_txb;
+            break;
+        default:
+            NINE_NIR_UNSUPPORTED(tx, "texld flags %u\n", tx->flags);
+            return;
+        }
+    }
+
+    coord = nine_nir_src(tx, 0);
+    if (op == nir_texop_txd) {
+        ddx = nine_nir_src(tx, 2);
+        ddy = nine_nir_src(tx, 3);
+    }
+
+    num_srcs = 3; /* texture, sampler, coord */
+    if (project || op == nir_texop_txb || op == nir_texop_txl)
+        num_srcs++;
+    if (op == nir_texop_txd)
+        num_srcs += 2;
+    if (glsl_sampler_type_is_shadow(var->type))
+        num_srcs++;
+
+    instr = nir_tex_instr_create(b->shader, num_srcs);
+    instr->op = op;
+    instr->sampler_dim = glsl_get_sampler_dim(var->type);
+    instr->is_shadow = glsl_sampler_type_is_shadow(var->type);
+    instr->is_array = false;
+    instr->coord_components =
+        glsl_get_sampler_dim_coordinate_components(instr->sampler_dim);
+    instr->dest_type = nir_type_float32;
+
+    deref = nir_build_deref_var(b, var);
+    instr->src[n].src = nir_src_for_ssa(&deref->dest.ssa);
+    instr->src[n++].src_type = nir_tex_src_texture_deref;
+    instr->src[n].src = nir_src_for_ssa(&deref->dest.ssa);
+    instr->src[n++].src_type = nir_tex_src_sampler_deref;
+
+    instr->src[n].src = nir_src_for_ssa(nir_channels(b, coord,
+                                                     (1 << instr->coord_components) - 1));
+    instr->src[n++].src_type = nir_tex_src_coord;
+
+    if (project) {
+        instr->src[n].src = nir_src_for_ssa(nir_channel(b, coord, 3));
+        instr->src[n++].src_type = nir_tex_src_projector;
+    } else if (op == nir_texop_txb) {
+        instr->src[n].src = nir_src_for_ssa(nir_channel(b, coord, 3));
+        instr->src[n++].src_type = nir_tex_src_bias;
+    } else if (op == nir_texop_txl) {
+        instr->src[n].src = nir_src_for_ssa(nir_channel(b, coord, 3));
+        instr->src[n++].src_type = nir_tex_src_lod;
+    } else if (op == nir_texop_txd) {
+        instr->src[n].src_type = nir_tex_src_ddx;
+        instr->src[n].src = nir_src_for_ssa(
+            nir_channels(b, ddx, (1 << nir_tex_instr_src_size(instr, n)) - 1));
+        n++;
+        instr->src[n].src_type = nir_tex_src_ddy;
+        instr->src[n].src = nir_src_for_ssa(
+            nir_channels(b, ddy, (1 << nir_tex_instr_src_size(instr, n)) - 1));
+        n++;
+    }
+
+    if (instr->is_shadow) {
+        /* only 1D and 2D shadow samplers */
+        instr->src[n].src = nir_src_for_ssa(nir_channel(b, coord, 2));
+        instr->src[n++].src_type = nir_tex_src_comparator;
+    }
+    assert(n == num_srcs);
+
+    nir_ssa_dest_init(&instr->instr, &instr->dest,
+                      nir_tex_instr_dest_size(instr), 32, NULL);
+    nir_builder_instr_insert(b, &instr->instr);
+
+    res = &instr->dest.ssa;
+    if (res->num_components == 1)
+        res = nine_nir_replicate(b, res, 0);
+    nine_nir_store_dst(tx, res);
+}
+
+static void
+nine_nir_dcl(struct nine_nir_translator *tx, DWORD tok_usg, DWORD tok_dst)
+{
+    struct nine_shader_info *info = tx->info;
+    struct nine_nir_dst_param reg;
+    struct tgsi_declaration_semantic sem;
+    BYTE usage, usage_idx, sampler_type;
+
+    usage = (tok_usg & D3DSP_DCL_USAGE_MASK) >> D3DSP_DCL_USAGE_SHIFT;
+    usage_idx = (tok_usg & D3DSP_DCL_USAGEINDEX_MASK) >> D3DSP_DCL_USAGEINDEX_SHIFT;
+    sampler_type = (tok_usg & D3DSP_TEXTURETYPE_MASK) >> D3DSP_TEXTURETYPE_SHIFT;
+    nine_nir_parse_dst(&reg, tok_dst);
+
+    if (reg.file == D3DSPR_SAMPLER) {
+        const unsigned s = reg.idx;
+        enum glsl_sampler_dim dim;
+        boolean shadow;
+        nir_variable *var;
+
+        if (s >= NINE_NIR_MAX_SAMPLERS) {
+            NINE_NIR_UNSUPPORTED(tx, "sampler %u\n", s);
+            return;
+        }
+        switch (sampler_type << D3DSP_TEXTURETYPE_SHIFT) {
+        case D3DSTT_1D: dim = GLSL_SAMPLER_DIM_1D; break;
+        case D3DSTT_2D: dim = GLSL_SAMPLER_DIM_2D; break;
+        case D3DSTT_VOLUME: dim = GLSL_SAMPLER_DIM_3D; break;
+        case D3DSTT_CUBE: dim = GLSL_SAMPLER_DIM_CUBE; break;
+        default:
+            NINE_NIR_UNSUPPORTED(tx, "sampler type %u\n", sampler_type);
+            return;
+        }
+        shadow = !!(info->sampler_mask_shadow & (1 << s));
+        if (shadow && dim != GLSL_SAMPLER_DIM_1D && dim != GLSL_SAMPLER_DIM_2D) {
+            NINE_NIR_UNSUPPORTED(tx, "shadow sampler type %u\n", sampler_type);
+            return;
+        }
+
+        var = nir_variable_create(tx->b.shader, nir_var_uniform,
+                                  glsl_sampler_type(dim, shadow, false, GLSL_TYPE_FLOAT),
+                                  "sampler");
+        var->data.binding = s;
+        var->data.explicit_binding = true;
+        tx->samplers[s] = var;
+
+        info->sampler_mask |= 1 << s;
+        BITSET_SET(tx->b.shader->info.textures_used, s);
+        tx->b.shader->info.num_textures =
+            MAX2(tx->b.shader->info.num_textures, s + 1);
+        return;
+    }
+
+    nine_declusage_to_tgsi_semantic(&sem, tx->want_texcoord, usage, usage_idx);
+    /* Outside of the ranges of the varying slots */
+    if ((sem.Name == TGSI_SEMANTIC_GENERIC && sem.Index >= 32) ||
+        (sem.Name == TGSI_SEMANTIC_TEXCOORD && sem.Index >= 8)) {
+        NINE_NIR_UNSUPPORTED(tx, "semantic %u[%u]\n", usage, usage_idx);
+        return;
+    }
+
+    if (tx->is_vs) {
+        if (reg.file == D3DSPR_INPUT) {
+            /* linkage outside of shader with vertex declaration */
+            if (reg.idx >= NINE_NIR_MAX_INPUTS) {
+                NINE_NIR_UNSUPPORTED(tx, "input %u\n", reg.idx);
+                return;
+            }
+            if (!tx->v[reg.idx])
+                tx->v[reg.idx] = nine_nir_add_input(tx, glsl_vec4_type(),
+                                                    VERT_ATTRIB_GENERIC0 + reg.idx,
+                                                    reg.idx, INTERP_MODE_NONE, FALSE);
+            info->input_map[reg.idx] = nine_d3d9_to_nine_declusage(usage, usage_idx);
+            info->num_inputs = MAX2(info->num_inputs, reg.idx + 1);
+        } else if (tx->version >= V(3,0)) {
+            /* SM2 output semantic determined by file */
+            if (reg.file != D3DSPR_OUTPUT || reg.idx >= NINE_NIR_MAX_OUTPUTS ||
+                tx->o[reg.idx]) {
+                NINE_NIR_UNSUPPORTED(tx, "output declaration\n");
+                return;
+            }
+            if (usage == D3DDECLUSAGE_POSITIONT)
+                info->position_t = TRUE;
+            if (sem.Name == TGSI_SEMANTIC_PSIZE)
+                tx->o[reg.idx] = nine_nir_oPts(tx);
+            else
+                tx->o[reg.idx] =
+                    nine_nir_output_tmp(tx, tgsi_varying_semantic_to_slot(sem.Name, sem.Index),
+                                        FALSE);
+        }
+        return;
+    }
+
+    /* ps2: input semantic determined by file */
+    if (reg.file != D3DSPR_INPUT || tx->version < V(3,0))
+        return;
+    if (reg.idx >= NINE_NIR_MAX_INPUTS || tx->v[reg.idx] || tx->v_is_position[reg.idx]) {
+        NINE_NIR_UNSUPPORTED(tx, "input declaration\n");
+        return;
+    }
+
+    switch (sem.Name) {
+    case TGSI_SEMANTIC_POSITION:
+        /* PositionT, tessfactor and Position0 are forbidden,
+         * leave the error to the TGSI path. */
+        if (usage != D3DDECLUSAGE_DEPTH) {
+            NINE_NIR_UNSUPPORTED(tx, "position input\n");
+            return;
+        }
+        tx->v_is_position[reg.idx] = TRUE;
+        break;
+    case TGSI_SEMANTIC_COLOR:
+        tx->v[reg.idx] =
+            nine_nir_add_fs_input(tx, tgsi_varying_semantic_to_slot(sem.Name, sem.Index),
+                                  INTERP_MODE_NONE,
+                                  (reg.mod & NINED3DSPDM_CENTROID) ||
+                                  info->force_color_in_centroid);
+        break;
+    case TGSI_SEMANTIC_GENERIC:
+    case TGSI_SEMANTIC_TEXCOORD:
+    case TGSI_SEMANTIC_PSIZE:
+        if (usage == D3DDECLUSAGE_POSITIONT || usage == D3DDECLUSAGE_TESSFACTOR) {
+            NINE_NIR_UNSUPPORTED(tx, "input usage %u\n", usage);
+            return;
+        }
+        tx->v[reg.idx] =
+            nine_nir_add_fs_input(tx, tgsi_varying_semantic_to_slot(sem.Name, sem.Index),
+                                  sem.Name == TGSI_SEMANTIC_PSIZE ?
+                                      INTERP_MODE_FLAT : INTERP_MODE_SMOOTH,
+                                  !!(reg.mod & NINED3DSPDM_CENTROID));
+        break;
+    default:
+        NINE_NIR_UNSUPPORTED(tx, "input usage %u\n", usage);
+        break;
+    }
+}
+
+static void
+nine_nir_alu(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    nir_ssa_def *s0, *s1, *s2, *tmp, *res = NULL;
+
+    switch (tx->opcode) {
+    case D3DSIO_MOV:
+        res = nine_nir_src(tx, 0);
+        break;
+    case D3DSIO_ADD:
+        res = nir_fadd(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_SUB:
+        res = nir_fsub(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_MAD:
+        res = nir_ffma(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1), nine_nir_src(tx, 2));
+        break;
+    case D3DSIO_MUL:
+        res = nir_fmul(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_RCP:
+        /* FLT_MAX has issues with Rayman */
+        res = nir_frcp(b, nine_nir_src_x(tx, 0));
+        res = nir_fmax(b, nir_fmin(b, res, nir_imm_float(b, FLT_MAX / 2.f)),
+                       nir_imm_float(b, -FLT_MAX / 2.f));
+        break;
+    case D3DSIO_RSQ:
+        res = nir_frsq(b, nir_fabs(b, nine_nir_src_x(tx, 0)));
+        res = nir_fmin(b, res, nir_imm_float(b, FLT_MAX));
+        break;
+    case D3DSIO_DP3:
+        res = nir_fdot3(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_DP4:
+        res = nir_fdot4(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_MIN:
+        res = nir_fmin(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_MAX:
+        res = nir_fmax(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_SLT:
+        res = nir_slt(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_SGE:
+        res = nir_sge(b, nine_nir_src(tx, 0), nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_EXP:
+    case D3DSIO_EXPP:
+        res = nir_fexp2(b, nine_nir_src_x(tx, 0));
+        break;
+    case D3DSIO_LOG:
+    case D3DSIO_LOGP:
+        res = nir_flog2(b, nir_fabs(b, nine_nir_src_x(tx, 0)));
+        res = nir_fmax(b, res, nir_imm_float(b, -FLT_MAX));
+        break;
+    case D3DSIO_LIT:
+        /* d3d9 states dst.z is 0 when src.y <= 0 */
+        s0 = nine_nir_src(tx, 0);
+        tmp = nir_fmax(b, nir_fmin(b, nir_channel(b, s0, 3), nir_imm_float(b, 128.0f)),
+                       nir_imm_float(b, -128.0f));
+        tmp = nir_fpow(b, nir_fmax(b, nir_channel(b, s0, 1), nir_imm_float(b, 0.0f)), tmp);
+        tmp = nir_bcsel(b, nir_flt(b, nir_channel(b, s0, 0), nir_imm_float(b, 0.0f)),
+                        nir_imm_float(b, 0.0f), tmp);
+        tmp = nir_bcsel(b, nir_flt(b, nir_imm_float(b, 0.0f), nir_channel(b, s0, 1)),
+                        tmp, nir_imm_float(b, 0.0f));
+        res = nir_vec4(b, nir_imm_float(b, 1.0f),
+                       nir_fmax(b, nir_channel(b, s0, 0), nir_imm_float(b, 0.0f)),
+                       tmp, nir_imm_float(b, 1.0f));
+        break;
+    case D3DSIO_DST:
+        s0 = nine_nir_src(tx, 0);
+        s1 = nine_nir_src(tx, 1);
+        res = nir_vec4(b, nir_imm_float(b, 1.0f),
+                       nir_fmul(b, nir_channel(b, s0, 1), nir_channel(b, s1, 1)),
+                       nir_channel(b, s0, 2), nir_channel(b, s1, 3));
+        break;
+    case D3DSIO_LRP:
+        res = nir_flrp(b, nine_nir_src(tx, 2), nine_nir_src(tx, 1), nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_FRC:
+        res = nir_ffract(b, nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_POW:
+        res = nir_fpow(b, nir_fabs(b, nine_nir_src_x(tx, 0)), nine_nir_src_x(tx, 1));
+        break;
+    case D3DSIO_CRS: {
+        static const unsigned yzx[4] = { 1, 2, 0, 0 };
+        static const unsigned zxy[4] = { 2, 0, 1, 0 };
+        s0 = nine_nir_src(tx, 0);
+        s1 = nine_nir_src(tx, 1);
+        tmp = nir_fmul(b, nir_swizzle(b, s0, yzx, 3), nir_swizzle(b, s1, zxy, 3));
+        tmp = nir_ffma(b, nir_swizzle(b, s0, zxy, 3),
+                       nir_fneg(b, nir_swizzle(b, s1, yzx, 3)), tmp);
+        res = nir_vec4(b, nir_channel(b, tmp, 0), nir_channel(b, tmp, 1),
+                       nir_channel(b, tmp, 2), nir_imm_float(b, 1.0f));
+        break;
+    }
+    case D3DSIO_SGN:
+        /* ignore src1,2 */
+        res = nir_fsign(b, nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_ABS:
+        res = nir_fabs(b, nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_NRM:
+        s0 = nine_nir_src(tx, 0);
+        tmp = nir_frsq(b, nir_fdot3(b, s0, s0));
+        tmp = nir_fmin(b, tmp, nir_imm_float(b, FLT_MAX));
+        res = nir_fmul(b, s0, tmp);
+        break;
+    case D3DSIO_SINCOS:
+        /* z undefined, w untouched */
+        s0 = nine_nir_src_x(tx, 0);
+        tx->dst.mask &= NINED3DSP_WRITEMASK_0 | NINED3DSP_WRITEMASK_1;
+        res = nir_vec2(b, nir_fcos(b, s0), nir_fsin(b, s0));
+        break;
+    case D3DSIO_CMP:
+        s0 = nine_nir_src(tx, 0);
+        s1 = nine_nir_src(tx, 1);
+        s2 = nine_nir_src(tx, 2);
+        res = nir_bcsel(b, nir_flt(b, s0, nir_imm_float(b, 0.0f)), s2, s1);
+        break;
+    case D3DSIO_DP2ADD:
+        s0 = nine_nir_src(tx, 0);
+        s1 = nine_nir_src(tx, 1);
+        res = nir_fadd(b, nine_nir_src(tx, 2), nir_fdot2(b, s0, s1));
+        break;
+    case D3DSIO_DSX:
+        res = nir_fddx(b, nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_DSY:
+        res = nir_fddy(b, nine_nir_src(tx, 0));
+        break;
+    default:
+        NINE_NIR_UNSUPPORTED(tx, "opcode %u\n", tx->opcode);
+        return;
+    }
+    nine_nir_store_dst(tx, res);
+}
+
+static void
+nine_nir_texkill(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    struct nine_nir_src_param reg;
+    unsigned s[4];
+    unsigned n, c;
+
+    /* The destination register is the source */
+    reg.file = tx->dst.file;
+    reg.idx = tx->dst.idx;
+    reg.mod = NINED3DSPSM_NONE;
+    reg.swizzle = NINED3DSP_NOSWIZZLE;
+    if (tx->dst.mask && tx->dst.mask != NINED3DSP_WRITEMASK_ALL) {
+        for (n = 0, c = 0; c < 4; ++c)
+            if (tx->dst.mask & (1 << c))
+                s[n++] = c;
+        for (c = n; c < 4; ++c)
+            s[c] = s[n - 1];
+        reg.swizzle = s[0] | (s[1] << 2) | (s[2] << 4) | (s[3] << 6);
+    }
+
+    b->exact = true;
+    nir_discard_if(b, nir_bany(b, nir_flt(b, nine_nir_src_param(tx, &reg),
+                                          nir_imm_float(b, 0.0f))));
+    b->exact = false;
+    b->shader->info.fs.uses_discard = true;
+}
+
+static void
+nine_nir_instruction(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    const struct nine_nir_op_info *op = NULL;
+    const DWORD *tok;
+    DWORD inst = *tx->parse;
+    unsigned len, ndst, i;
+
+    tx->opcode = inst & D3DSI_OPCODE_MASK;
+    tx->flags = (inst & NINED3DSIO_OPCODE_FLAGS_MASK) >> NINED3DSIO_OPCODE_FLAGS_SHIFT;
+    len = (inst & D3DSI_INSTLENGTH_MASK) >> D3DSI_INSTLENGTH_SHIFT;
+    tok = tx->parse + 1;
+    tx->parse_next = tok + len;
+
+    if (tx->opcode < ARRAY_SIZE(nine_nir_ops))
+        op = &nine_nir_ops[tx->opcode];
+    if (!op || !(tx->is_vs ? op->vs_max : op->ps_max) ||
+        tx->version < (tx->is_vs ? op->vs_min : op->ps_min) ||
+        tx->version > (tx->is_vs ? op->vs_max : op->ps_max)) {
+        NINE_NIR_UNSUPPORTED(tx, "opcode %u\n", tx->opcode);
+        return;
+    }
+    if (inst & (NINED3DSHADER_INST_PREDICATED | D3DSI_COISSUE)) {
+        NINE_NIR_UNSUPPORTED(tx, "predication\n");
+        return;
+    }
+
+    switch (tx->opcode) {
+    case D3DSIO_DCL:
+        if (len != 2) {
+            NINE_NIR_UNSUPPORTED(tx, "dcl length %u\n", len);
+            return;
+        }
+        nine_nir_dcl(tx, tok[0], tok[1]);
+        return;
+    case D3DSIO_DEF:
+    case D3DSIO_DEFI:
+    case D3DSIO_DEFB:
+        if (len != (tx->opcode == D3DSIO_DEFB ? 2 : 5)) {
+            NINE_NIR_UNSUPPORTED(tx, "def length %u\n", len);
+            return;
+        }
+        nine_nir_parse_dst(&tx->dst, tok[0]);
+        if (tx->opcode == D3DSIO_DEF) {
+            if (tx->dst.idx >= tx->num_constf_allowed) {
+                NINE_NIR_UNSUPPORTED(tx, "float constant %i out of range\n", tx->dst.idx);
+                return;
+            }
+            memcpy(tx->lconstf[tx->dst.idx], &tok[1], 4 * sizeof(float));
+            tx->lconstf_set[tx->dst.idx] = TRUE;
+        } else if (tx->opcode == D3DSIO_DEFI) {
+            nine_nir_set_lconsti(tx, tx->dst.idx, (const int *)&tok[1]);
+        } else {
+            nine_nir_set_lconstb(tx, tx->dst.idx, tok[1]);
+        }
+        return;
+    default:
+        break;
+    }
+
+    ndst = op->ndst;
+    if (len < ndst || len - ndst > ARRAY_SIZE(tx->src)) {
+        NINE_NIR_UNSUPPORTED(tx, "instruction length %u\n", len);
+        return;
+    }
+    tx->nsrc = len - ndst;
+    for (i = 0; i < len; ++i) {
+        if (tok[i] & D3DSHADER_ADDRMODE_RELATIVE) {
+            NINE_NIR_UNSUPPORTED(tx, "relative addressing\n");
+            return;
+        }
+    }
+    if (ndst)
+        nine_nir_parse_dst(&tx->dst, tok[0]);
+    for (i = 0; i < tx->nsrc; ++i)
+        nine_nir_parse_src(&tx->src[i], tok[ndst + i]);
+    for (i = 0; i < tx->nsrc; ++i) {
+        if (tx->src[i].file == D3DSPR_LOOP || tx->src[i].file == D3DSPR_PREDICATE) {
+            NINE_NIR_UNSUPPORTED(tx, "source register file %u\n", tx->src[i].file);
+            return;
+        }
+    }
+
+    switch (tx->opcode) {
+    case D3DSIO_NOP:
+        break;
+    case D3DSIO_M4x4: nine_nir_matrix(tx, 4, 4); break;
+    case D3DSIO_M4x3: nine_nir_matrix(tx, 4, 3); break;
+    case D3DSIO_M3x4: nine_nir_matrix(tx, 3, 4); break;
+    case D3DSIO_M3x3: nine_nir_matrix(tx, 3, 3); break;
+    case D3DSIO_M3x2: nine_nir_matrix(tx, 3, 2); break;
+    case D3DSIO_LOOP:
+        /* src0 is aL, src1 the integer constant */
+        if (tx->nsrc != 2 || tx->src[1].file != D3DSPR_CONSTINT) {
+            NINE_NIR_UNSUPPORTED(tx, "loop\n");
+            return;
+        }
+        nine_nir_loop(tx, NINE_NIR_CF_LOOP, nine_nir_src(tx, 1));
+        break;
+    case D3DSIO_ENDLOOP:
+        nine_nir_endloop(tx, NINE_NIR_CF_LOOP);
+        break;
+    case D3DSIO_REP:
+        if (tx->nsrc != 1 || tx->src[0].file != D3DSPR_CONSTINT) {
+            NINE_NIR_UNSUPPORTED(tx, "rep\n");
+            return;
+        }
+        nine_nir_loop(tx, NINE_NIR_CF_REP, nine_nir_src(tx, 0));
+        break;
+    case D3DSIO_ENDREP:
+        nine_nir_endloop(tx, NINE_NIR_CF_REP);
+        break;
+    case D3DSIO_IF:
+        if (tx->nsrc != 1 || tx->src[0].file != D3DSPR_CONSTBOOL) {
+            NINE_NIR_UNSUPPORTED(tx, "if on predicate\n");
+            return;
+        }
+        nine_nir_if(tx, nir_ine(b, nine_nir_src_x(tx, 0), nir_imm_int(b, 0)));
+        break;
+    case D3DSIO_IFC:
+        nine_nir_if(tx, nine_nir_src_cond(tx));
+        break;
+    case D3DSIO_ELSE:
+        if (!tx->cf_depth || tx->cf[tx->cf_depth - 1].type != NINE_NIR_CF_IF) {
+            NINE_NIR_UNSUPPORTED(tx, "unbalanced control flow\n");
+            return;
+        }
+        nir_push_else(b, tx->cf[tx->cf_depth - 1].nif);
+        break;
+    case D3DSIO_ENDIF: {
+        struct nine_nir_cf *cf = nine_nir_pop_cf(tx, NINE_NIR_CF_IF);
+        if (cf)
+            nir_pop_if(b, cf->nif);
+        break;
+    }
+    case D3DSIO_BREAK:
+        nine_nir_break_if(tx, nir_imm_true(b));
+        break;
+    case D3DSIO_BREAKC:
+        nine_nir_break_if(tx, nine_nir_src_cond(tx));
+        break;
+    case D3DSIO_RET:
+        /* RET as a last instruction can be safely ignored */
+        if (*tx->parse_next != NINED3DSP_END)
+            NINE_NIR_UNSUPPORTED(tx, "ret\n");
+        break;
+    case D3DSIO_TEXKILL:
+        nine_nir_texkill(tx);
+        break;
+    case D3DSIO_TEX:
+        if (tx->nsrc != 2) {
+            NINE_NIR_UNSUPPORTED(tx, "texld\n");
+            return;
+        }
+        nine_nir_texture(tx, nir_texop_tex);
+        break;
+    case D3DSIO_TEXLDL:
+        if (tx->nsrc != 2) {
+            NINE_NIR_UNSUPPORTED(tx, "texldl\n");
+            return;
+        }
+        nine_nir_texture(tx, nir_texop_txl);
+        break;
+    case D3DSIO_TEXLDD:
+        if (tx->nsrc != 4) {
+            NINE_NIR_UNSUPPORTED(tx, "texldd\n");
+            return;
+        }
+        nine_nir_texture(tx, nir_texop_txd);
+        break;
+    default:
+        if (!ndst || !tx->nsrc) {
+            NINE_NIR_UNSUPPORTED(tx, "opcode %u\n", tx->opcode);
+            return;
+        }
+        nine_nir_alu(tx);
+        break;
+    }
+}
+
+static void
+nine_nir_parse(struct nine_nir_translator *tx)
+{
+    while (!tx->failure) {
+        DWORD tok = *tx->parse;
+
+        if (tx->parse - tx->byte_code >= NINE_NIR_MAX_TOKENS) {
+            NINE_NIR_UNSUPPORTED(tx, "missing end token\n");
+            return;
+        }
+        if (tok == NINED3DSP_END) {
+            tx->parse++;
+            return;
+        }
+        if ((tok & D3DSI_OPCODE_MASK) == D3DSIO_COMMENT) {
+            tx->parse += 1 + ((tok & D3DSI_COMMENTSIZE_MASK) >> D3DSI_COMMENTSIZE_SHIFT);
+            continue;
+        }
+        nine_nir_instruction(tx);
+        tx->parse = tx->parse_next;
+    }
+}
+
+/* Same as shader_add_ps_fog_stage in nine_shader.c */
+static void
+nine_nir_ps_fog_stage(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    struct nine_shader_info *info = tx->info;
+    struct nine_nir_output *oCol0;
+    nir_ssa_def *src_col, *fog_color, *fog_params, *fog_factor;
+    nir_ssa_def *depth = NULL, *pos, *res;
+
+    src_col = tx->oCol0 ? nir_load_var(b, tx->oCol0) : nir_ssa_undef(b, 4, 32);
+    oCol0 = nine_nir_add_output(tx, glsl_vec4_type(), FRAG_RESULT_DATA0, 0, FALSE);
+    if (!oCol0)
+        return;
+
+    if (!info->fog_enable) {
+        nir_store_var(b, oCol0->tmp, src_col, 0xf);
+        return;
+    }
+
+    if (info->fog_mode != D3DFOG_NONE) {
+        /* Depth used for fog is perspective interpolated */
+        pos = nine_nir_position(tx);
+        depth = nir_fmul(b, nir_channel(b, pos, 2), nir_frcp(b, nir_channel(b, pos, 3)));
+    }
+
+    fog_color = nine_nir_float_constant(tx, 32);
+    fog_params = nine_nir_float_constant(tx, 33);
+
+    if (info->fog_mode == D3DFOG_LINEAR) {
+        fog_factor = nir_fsub(b, nir_channel(b, fog_params, 0), depth);
+        fog_factor = nir_fsat(b, nir_fmul(b, fog_factor, nir_channel(b, fog_params, 1)));
+    } else if (info->fog_mode == D3DFOG_EXP) {
+        fog_factor = nir_fmul(b, depth, nir_channel(b, fog_params, 0));
+        fog_factor = nir_fexp2(b, nir_fmul_imm(b, fog_factor, -1.442695f));
+    } else if (info->fog_mode == D3DFOG_EXP2) {
+        fog_factor = nir_fmul(b, depth, nir_channel(b, fog_params, 0));
+        fog_factor = nir_fmul(b, fog_factor, fog_factor);
+        fog_factor = nir_fexp2(b, nir_fmul_imm(b, fog_factor, -1.442695f));
+    } else {
+        if (!tx->fog_in)
+            tx->fog_in = nine_nir_add_fs_input(tx, VARYING_SLOT_VAR0 + 16,
+                                               INTERP_MODE_SMOOTH, FALSE);
+        fog_factor = nir_channel(b, nir_load_var(b, tx->fog_in), 0);
+    }
+
+    res = nir_flrp(b, fog_color, src_col, fog_factor);
+    res = nir_vec4(b, nir_channel(b, res, 0), nir_channel(b, res, 1),
+                   nir_channel(b, res, 2), nir_channel(b, src_col, 3));
+    nir_store_var(b, oCol0->tmp, res, 0xf);
+}
+
+static void
+nine_nir_epilogue(struct nine_nir_translator *tx)
+{
+    nir_builder *b = &tx->b;
+    struct nine_shader_info *info = tx->info;
+    unsigned i;
+
+    if (!tx->is_vs && tx->version < V(3,0))
+        nine_nir_ps_fog_stage(tx);
+
+    if (tx->is_vs && tx->version < V(3,0) && !tx->fog_written && info->fog_enable) {
+        nir_variable *oFog = nine_nir_output_tmp(tx, VARYING_SLOT_VAR0 + 16, FALSE);
+        if (oFog)
+            nir_store_var(b, oFog, nir_imm_vec4(b, 0.0f, 0.0f, 0.0f, 0.0f), 0x1);
+    }
+
+    if (tx->is_vs && tx->oPts) {
+        struct nine_nir_output *psize =
+            nine_nir_add_output(tx, glsl_float_type(), VARYING_SLOT_PSIZ, 0, FALSE);
+        nir_ssa_def *pts = nir_channel(b, nir_load_var(b, tx->oPts), 0);
+
+        pts = nir_fmax(b, pts, nir_imm_float(b, info->point_size_min));
+        pts = nir_fmin(b, pts, nir_imm_float(b, info->point_size_max));
+        if (psize)
+            nir_store_var(b, psize->tmp, nine_nir_replicate(b, pts, 0), 0xf);
+        info->point_size = TRUE;
+    }
+
+    if (tx->failure)
+        return;
+
+    for (i = 0; i < tx->num_outputs; ++i) {
+        struct nine_nir_output *out = &tx->outputs[i];
+        nir_ssa_def *val = nir_load_var(b, out->tmp);
+
+        if (out->saturate)
+            val = nir_fsat(b, val);
+        if (glsl_type_is_scalar(out->var->type))
+            val = nir_channel(b, val, out->component);
+        nir_store_var(b, out->var, val, BITFIELD_MASK(val->num_components));
+    }
+}
+
+/* Replaces the constant slots of the uniform loads by their compacted
+ * slots, the same as the TGSI path does when recompiling. */
+static void
+nine_nir_remap_uniforms(nir_shader *nir, const unsigned *slot_map)
+{
+    nir_foreach_function(function, nir) {
+        if (!function->impl)
+            continue;
+        nir_foreach_block(block, function->impl) {
+            nir_foreach_instr(instr, block) {
+                nir_intrinsic_instr *intrin;
+
+                if (instr->type != nir_instr_type_intrinsic)
+                    continue;
+                intrin = nir_instr_as_intrinsic(instr);
+                if (intrin->intrinsic != nir_intrinsic_load_uniform)
+                    continue;
+                nir_intrinsic_set_base(intrin, slot_map[nir_intrinsic_base(intrin)]);
+            }
+        }
+    }
+}
+
+/* Same passes as tgsi_to_nir runs before handing the shader to the driver */
+static void
+nine_nir_finalize(struct nine_nir_translator *tx)
+{
+    struct pipe_screen *screen = tx->screen;
+    nir_shader *nir = tx->b.shader;
+    unsigned num_textures = nir->info.num_textures;
+
+    NIR_PASS_V(nir, nir_lower_vars_to_ssa);
+    NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+    NIR_PASS_V(nir, nir_split_var_copies);
+    NIR_PASS_V(nir, nir_lower_var_copies);
+    NIR_PASS_V(nir, nir_lower_system_values);
+
+    if (!screen->get_param(screen, PIPE_CAP_TEXRECT)) {
+        const struct nir_lower_tex_options opts = { .lower_rect = true, };
+        NIR_PASS_V(nir, nir_lower_tex, &opts);
+    }
+
+    if (nir->options->lower_uniforms_to_ubo)
+        NIR_PASS_V(nir, nir_lower_uniforms_to_ubo, 16);
+
+    if (!screen->get_param(screen, PIPE_CAP_NIR_SAMPLERS_AS_DEREF))
+        NIR_PASS_V(nir, nir_lower_samplers);
+
+    if (screen->finalize_nir) {
+        screen->finalize_nir(screen, nir, true);
+    } else {
+        bool progress;
+
+        do {
+            progress = false;
+            NIR_PASS_V(nir, nir_lower_vars_to_ssa);
+            NIR_PASS(progress, nir, nir_copy_prop);
+            NIR_PASS(progress, nir, nir_opt_remove_phis);
+            NIR_PASS(progress, nir, nir_opt_dce);
+            NIR_PASS(progress, nir, nir_opt_dead_cf);
+            NIR_PASS(progress, nir, nir_opt_cse);
+            NIR_PASS(progress, nir, nir_opt_algebraic);
+            NIR_PASS(progress, nir, nir_opt_constant_folding);
+            NIR_PASS(progress, nir, nir_opt_undef);
+        } while (progress);
+        nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+    }
+
+    nir->info.num_textures = num_textures;
+    nir_validate_shader(nir, "nine: after NIR translation");
+}
+
+static void
+nine_nir_translator_init(struct nine_nir_translator *tx,
+                         struct nine_shader_info *info,
+                         struct pipe_screen *screen)
+{
+    const nir_shader_compiler_options *options =
+        screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR, info->type);
+    nir_shader *shader;
+    unsigned i;
+
+    memset(tx, 0, sizeof(*tx));
+    tx->info = info;
+    tx->screen = screen;
+    tx->byte_code = info->byte_code;
+    tx->parse = info->byte_code + 1;
+    tx->version = (D3DSHADER_VERSION_MAJOR(info->byte_code[0]) << 8) |
+                  D3DSHADER_VERSION_MINOR(info->byte_code[0]);
+    tx->is_vs = info->type == PIPE_SHADER_VERTEX;
+
+    tx->want_texcoord = screen->get_param(screen, PIPE_CAP_TGSI_TEXCOORD);
+    tx->shift_wpos = !screen->get_param(screen, PIPE_CAP_TGSI_FS_COORD_PIXEL_CENTER_INTEGER);
+    tx->wpos_is_sysval = screen->get_param(screen, PIPE_CAP_TGSI_FS_POSITION_IS_SYSVAL);
+    tx->face_is_sysval_integer = screen->get_param(screen, PIPE_CAP_TGSI_FS_FACE_IS_INTEGER_SYSVAL);
+
+    if (tx->is_vs)
+        tx->num_constf_allowed = NINE_MAX_CONST_F;
+    else if (tx->version < V(3,0))
+        tx->num_constf_allowed = 32;
+    else
+        tx->num_constf_allowed = NINE_MAX_CONST_F_PS3;
+
+    for (i = 0; i < ARRAY_SIZE(info->input_map); ++i)
+        info->input_map[i] = NINE_DECLUSAGE_NONE;
+    info->num_inputs = 0;
+    info->position_t = FALSE;
+    info->point_size = FALSE;
+    memset(info->int_slots_used, 0, sizeof(info->int_slots_used));
+    memset(info->bool_slots_used, 0, sizeof(info->bool_slots_used));
+    info->const_float_slots = 0;
+    info->const_int_slots = 0;
+    info->const_bool_slots = 0;
+    info->sampler_mask = 0x0;
+    info->rt_mask = 0x0;
+    info->lconstf.data = NULL;
+    info->lconstf.ranges = NULL;
+    info->bumpenvmat_needed = 0;
+    info->version = (D3DSHADER_VERSION_MAJOR(info->byte_code[0]) << 4) |
+                    D3DSHADER_VERSION_MINOR(info->byte_code[0]);
+
+    tx->b = nir_builder_init_simple_shader(tx->is_vs ? MESA_SHADER_VERTEX :
+                                                       MESA_SHADER_FRAGMENT,
+                                           options, "nine");
+    shader = tx->b.shader;
+
+    if (tx->is_vs) {
+        /* VS must always write position. Declare it first
+         * like the TGSI path, some drivers rely on that. */
+        nine_nir_output_tmp(tx, VARYING_SLOT_POS, FALSE);
+    } else {
+        shader->info.fs.untyped_color_outputs = true;
+        shader->info.fs.origin_upper_left = true;
+        shader->info.fs.pixel_center_integer = !tx->shift_wpos;
+    }
+
+    /* Additional definition of constants */
+    if (info->add_constants_defs.c_combination) {
+        for (i = 0; i < NINE_MAX_CONST_I; ++i) {
+            if ((*info->add_constants_defs.int_const_added)[i])
+                nine_nir_set_lconsti(tx, i, info->add_constants_defs.c_combination->const_i[i]);
+        }
+        for (i = 0; i < NINE_MAX_CONST_B; ++i) {
+            if ((*info->add_constants_defs.bool_const_added)[i])
+                nine_nir_set_lconstb(tx, i, info->add_constants_defs.c_combination->const_b[i]);
+        }
+    }
+}
+
+HRESULT
+nine_translate_shader_nir(struct nine_shader_info *info,
+                          struct pipe_screen *screen,
+                          struct nir_shader **nir,
+                          unsigned **const_ranges)
+{
+    struct nine_nir_translator *tx;
+    const unsigned processor = info->type;
+    unsigned *slot_map = NULL;
+    unsigned num_slots = 0;
+    unsigned major, minor;
+    HRESULT hr = D3D_OK;
+
+    *nir = NULL;
+    *const_ranges = NULL;
+
+    major = D3DSHADER_VERSION_MAJOR(info->byte_code[0]);
+    minor = D3DSHADER_VERSION_MINOR(info->byte_code[0]);
+    if (major < 2 || major > 3 || (major == 3 && minor) ||
+        (info->byte_code[0] >> 16) != (processor == PIPE_SHADER_VERTEX ?
+                                       NINED3D_SM1_VS : NINED3D_SM1_PS))
+        return D3DERR_NOTAVAILABLE;
+
+    /* tgsi_to_nir can't handle these either, we keep the TGSI behaviour */
+    if (screen->get_param(screen, PIPE_CAP_TGSI_MUL_ZERO_WINS) ||
+        !screen->get_shader_param(screen, processor, PIPE_SHADER_CAP_INTEGERS))
+        return D3DERR_NOTAVAILABLE;
+
+    tx = MALLOC_STRUCT(nine_nir_translator);
+    if (!tx)
+        return E_OUTOFMEMORY;
+    nine_nir_translator_init(tx, info, screen);
+
+    DUMP("%s%u.%u (NIR)\n", processor == PIPE_SHADER_VERTEX ? "VS" : "PS",
+         major, minor);
+
+    nine_nir_parse(tx);
+    if (!tx->failure && tx->cf_depth)
+        NINE_NIR_UNSUPPORTED(tx, "unbalanced control flow\n");
+    if (!tx->failure)
+        nine_nir_epilogue(tx);
+    if (tx->failure) {
+        hr = D3DERR_NOTAVAILABLE;
+        goto fail;
+    }
+
+    if (info->position_t)
+        tx->b.shader->info.vs.window_space_position = true;
+
+    /* Compact the constant slots */
+    slot_map = MALLOC(NINE_MAX_CONST_ALL * sizeof(unsigned));
+    if (!slot_map) {
+        hr = E_OUTOFMEMORY;
+        goto fail;
+    }
+    *const_ranges = nine_shader_compact_const_slots(tx->slots_used, slot_map, &num_slots);
+    if (!*const_ranges) {
+        hr = E_OUTOFMEMORY;
+        goto fail;
+    }
+    if (!num_slots) {
+        FREE(*const_ranges);
+        *const_ranges = NULL;
+    }
+    nine_nir_remap_uniforms(tx->b.shader, slot_map);
+    tx->b.shader->num_uniforms = num_slots;
+    info->const_used_size = sizeof(float[4]) * num_slots;
+
+    nine_nir_finalize(tx);
+
+    info->byte_size = (tx->parse - tx->byte_code) * sizeof(DWORD);
+    *nir = tx->b.shader;
+    FREE(slot_map);
+    FREE(tx);
+    return D3D_OK;
+
+fail:
+    FREE(*const_ranges);
+    *const_ranges = NULL;
+    FREE(slot_map);
+    ralloc_free(tx->b.shader);
+    FREE(tx);
+    return hr;
+}
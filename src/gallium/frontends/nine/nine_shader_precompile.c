@@ -0,0 +1,206 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "device9.h"
+#include "nine_debug.h"
+#include "nine_shader.h"
+#include "nine_shader_precompile.h"
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "util/u_atomic.h"
+#include "util/u_memory.h"
+
+#define DBG_CHANNEL DBG_SHADER
+
+void
+nine_shader_precompile_init(struct NineDevice9 *device, boolean enable)
+{
+    struct pipe_screen *screen = device->screen;
+    struct pipe_context *pipe;
+
+    device->shader_precompile.active = FALSE;
+    device->shader_precompile.pipe = NULL;
+    device->shader_precompile.compiled = 0;
+    device->shader_precompile.used = 0;
+    device->shader_precompile.waits = 0;
+
+    if (!enable || !screen->get_param(screen, PIPE_CAP_SHAREABLE_SHADERS)) {
+        DBG("Shader precompilation disabled\n");
+        return;
+    }
+
+    /* Only used by the queue thread */
+    pipe = screen->context_create(screen, NULL, 0);
+    if (!pipe)
+        return;
+
+    /* A single thread: it owns the pipe context. The queue grows instead
+     * of blocking the nine_context thread when many shaders are created
+     * at once (loading screens). */
+    if (!util_queue_init(&device->shader_precompile.queue, "nine_shader",
+                         32, 1, UTIL_QUEUE_INIT_RESIZE_IF_FULL)) {
+        pipe->destroy(pipe);
+        return;
+    }
+
+    device->shader_precompile.pipe = pipe;
+    device->shader_precompile.active = TRUE;
+}
+
+void
+nine_shader_precompile_fini(struct NineDevice9 *device)
+{
+    if (!device->shader_precompile.active)
+        return;
+
+    /* Queued jobs are signalled without being executed */
+    util_queue_destroy(&device->shader_precompile.queue);
+    device->shader_precompile.pipe->destroy(device->shader_precompile.pipe);
+    device->shader_precompile.pipe = NULL;
+    device->shader_precompile.active = FALSE;
+
+    DBG("Shader precompilation: %u compiled, %u used, %u waits\n",
+        device->shader_precompile.compiled, device->shader_precompile.used,
+        device->shader_precompile.waits);
+}
+
+static void
+nine_shader_precompile_execute(void *data, int thread_index)
+{
+    struct nine_shader_precompile_job *job = data;
+    struct NineDevice9 *device = job->device;
+    HRESULT hr;
+
+    (void) thread_index;
+
+    hr = nine_translate_shader(device, &job->info, device->shader_precompile.pipe);
+    if (FAILED(hr)) {
+        job->info.cso = NULL;
+        return;
+    }
+    /* The shader keeps the local constants of its first translation */
+    FREE(job->info.lconstf.data);
+    FREE(job->info.lconstf.ranges);
+    job->info.lconstf.data = NULL;
+    job->info.lconstf.ranges = NULL;
+
+    p_atomic_inc(&device->shader_precompile.compiled);
+}
+
+void
+nine_shader_precompile_submit(struct NineDevice9 *device,
+                              struct nine_shader_precompile_job **jobs,
+                              uint64_t key,
+                              const struct nine_shader_info *info)
+{
+    struct nine_shader_precompile_job *job;
+
+    assert(device->shader_precompile.active);
+
+    job = MALLOC_STRUCT(nine_shader_precompile_job);
+    if (!job)
+        return;
+
+    job->device = device;
+    job->key = key;
+    job->info = *info;
+    job->info.cso = NULL;
+    job->info.const_ranges = NULL;
+    util_queue_fence_init(&job->fence);
+
+    job->next = *jobs;
+    *jobs = job;
+
+    DBG("Precompiling variant 0x%016"PRIx64"\n", key);
+    util_queue_add_job(&device->shader_precompile.queue, job, &job->fence,
+                       nine_shader_precompile_execute, NULL, 0);
+}
+
+boolean
+nine_shader_precompile_pending(struct nine_shader_precompile_job *jobs,
+                               uint64_t key)
+{
+    for (; jobs; jobs = jobs->next) {
+        if (jobs->key == key)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+void *
+nine_shader_precompile_take(struct nine_shader_precompile_job **jobs,
+                            uint64_t key,
+                            unsigned **const_ranges,
+                            unsigned *const_used_size)
+{
+    struct nine_shader_precompile_job **prev, *job;
+    struct NineDevice9 *device;
+    void *cso;
+
+    for (prev = jobs; *prev && (*prev)->key != key; prev = &(*prev)->next);
+    job = *prev;
+    if (!job)
+        return NULL;
+    *prev = job->next;
+
+    device = job->device;
+    if (!util_queue_fence_is_signalled(&job->fence)) {
+        device->shader_precompile.waits++;
+        util_queue_fence_wait(&job->fence);
+    }
+
+    cso = job->info.cso;
+    if (cso) {
+        device->shader_precompile.used++;
+        *const_ranges = job->info.const_ranges;
+        *const_used_size = job->info.const_used_size;
+    }
+
+    util_queue_fence_destroy(&job->fence);
+    FREE(job);
+    return cso;
+}
+
+void
+nine_shader_precompile_free(struct NineDevice9 *device,
+                            struct nine_shader_precompile_job **jobs,
+                            struct pipe_context *pipe)
+{
+    while (*jobs) {
+        struct nine_shader_precompile_job *job = *jobs;
+
+        *jobs = job->next;
+
+        /* No-op if the queue is already destroyed:
+         * all the fences are signalled then. */
+        util_queue_drop_job(&device->shader_precompile.queue, &job->fence);
+
+        if (job->info.cso) {
+            if (job->info.type == PIPE_SHADER_VERTEX)
+                pipe->delete_vs_state(pipe, job->info.cso);
+            else
+                pipe->delete_fs_state(pipe, job->info.cso);
+            FREE(job->info.const_ranges);
+        }
+        util_queue_fence_destroy(&job->fence);
+        FREE(job);
+    }
+}
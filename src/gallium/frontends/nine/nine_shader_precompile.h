@@ -0,0 +1,85 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#ifndef _NINE_SHADER_PRECOMPILE_H_
+#define _NINE_SHADER_PRECOMPILE_H_
+
+#include "d3d9types.h"
+#include "pipe/p_compiler.h"
+#include "util/u_queue.h"
+
+#include "nine_shader.h"
+
+struct NineDevice9;
+struct pipe_context;
+
+/* Background compilation of the shader variants that are likely to be
+ * needed. When a shader is created, the nine_context thread computes the
+ * variant key from its current state and the translation is done on the
+ * device precompile queue, with its own pipe context. GetVariant picks
+ * the result up on a variant cache miss, and only compiles inline if no
+ * job matches the key.
+ * The CSOs are created on another context than the one they are bound to,
+ * thus this is only enabled with PIPE_CAP_SHAREABLE_SHADERS. */
+
+struct nine_shader_precompile_job
+{
+    struct nine_shader_precompile_job *next;
+    struct NineDevice9 *device;
+    struct util_queue_fence fence;
+    uint64_t key;
+    struct nine_shader_info info; /* info.cso is NULL if the job failed */
+};
+
+void
+nine_shader_precompile_init(struct NineDevice9 *device, boolean enable);
+
+/* Waits for the running job and drops the queued ones */
+void
+nine_shader_precompile_fini(struct NineDevice9 *device);
+
+/* Queues the translation of info. The job is added to *jobs, which is
+ * only accessed by the nine_context thread (and the shader dtor). */
+void
+nine_shader_precompile_submit(struct NineDevice9 *device,
+                              struct nine_shader_precompile_job **jobs,
+                              uint64_t key,
+                              const struct nine_shader_info *info);
+
+boolean
+nine_shader_precompile_pending(struct nine_shader_precompile_job *jobs,
+                               uint64_t key);
+
+/* Waits for the job of the key and removes it from *jobs. Returns the cso,
+ * whose ownership goes to the caller with const_ranges, or NULL if there
+ * was no such job or it failed. */
+void *
+nine_shader_precompile_take(struct nine_shader_precompile_job **jobs,
+                            uint64_t key,
+                            unsigned **const_ranges,
+                            unsigned *const_used_size);
+
+/* Cancels or waits for the jobs and frees them with their results. */
+void
+nine_shader_precompile_free(struct NineDevice9 *device,
+                            struct nine_shader_precompile_job **jobs,
+                            struct pipe_context *pipe);
+
+#endif /* _NINE_SHADER_PRECOMPILE_H_ */
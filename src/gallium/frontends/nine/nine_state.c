@@ -35,6 +35,9 @@
 #include "pixelshader9.h"
 #include "nine_pipe.h"
 #include "nine_ff.h"
+#include "nine_format.h"
+#include "nine_swvp_cpu.h"
+#include "nine_texture_upload.h"
 #include "nine_limits.h"
 #include "pipe/p_context.h"
 #include "pipe/p_state.h"
@@ -50,6 +53,8 @@
 #include "nine_queue.h"
 #include "nine_csmt_helper.h"
 #include "os/os_thread.h"
+#include "util/os_time.h"
+#include "util/u_queue.h"
 
 #define DBG_CHANNEL DBG_DEVICE
 
@@ -63,27 +68,53 @@ struct csmt_context {
     thrd_t worker;
     struct nine_queue_pool* pool;
     BOOL terminate;
-    cnd_t event_processed;
-    mtx_t mutex_processed;
+    struct util_queue_fence processed;
     struct NineDevice9 *device;
-    BOOL processed;
     BOOL toPause;
     BOOL hasPaused;
     mtx_t thread_running;
     mtx_t thread_resume;
+    /* Waits of the application thread for the worker, since last frame */
+    unsigned syncs;
+    uint64_t sync_ns;
 };
 
+static int
+nine_context_draw_primitive_rx(struct NineDevice9 *device,
+                               struct csmt_instruction *instr);
+static int
+nine_context_draw_indexed_primitive_rx(struct NineDevice9 *device,
+                                       struct csmt_instruction *instr);
+
+/* Sends the merged draws to the driver. Called by the worker before any
+ * instruction other than a draw which can be merged, and before the
+ * application thread can access the pipe context. */
+static void
+nine_context_flush_draws(struct NineDevice9 *device)
+{
+    struct nine_context *context = &device->context;
+
+    if (!context->draw_batch.count)
+        return;
+
+    context->pipe->draw_vbo(context->pipe, &context->draw_batch.info, NULL,
+                            context->draw_batch.draws,
+                            context->draw_batch.count);
+    p_atomic_add(&context->draw_batch.merged, context->draw_batch.count - 1);
+    context->draw_batch.count = 0;
+}
+
 /* Wait for instruction to be processed.
  * Caller has to ensure that only one thread waits at time.
  */
 static void
 nine_csmt_wait_processed(struct csmt_context *ctx)
 {
-    mtx_lock(&ctx->mutex_processed);
-    while (!p_atomic_read(&ctx->processed)) {
-        cnd_wait(&ctx->event_processed, &ctx->mutex_processed);
-    }
-    mtx_unlock(&ctx->mutex_processed);
+    int64_t start = os_time_get_nano();
+
+    util_queue_fence_wait(&ctx->processed);
+    ctx->syncs++;
+    ctx->sync_ns += os_time_get_nano() - start;
 }
 
 /* CSMT worker thread */
@@ -105,14 +136,16 @@ nine_csmt_worker(void *arg)
         while (!p_atomic_read(&ctx->terminate) &&
                (instr = (struct csmt_instruction *)nine_queue_get(ctx->pool))) {
 
+            /* Any other instruction can change the state of the draws */
+            if (instr->func != nine_context_draw_primitive_rx &&
+                instr->func != nine_context_draw_indexed_primitive_rx)
+                nine_context_flush_draws(ctx->device);
+
             /* decode */
-            if (instr->func(ctx->device, instr)) {
-                mtx_lock(&ctx->mutex_processed);
-                p_atomic_set(&ctx->processed, TRUE);
-                cnd_signal(&ctx->event_processed);
-                mtx_unlock(&ctx->mutex_processed);
-            }
+            if (instr->func(ctx->device, instr))
+                util_queue_fence_signal(&ctx->processed);
             if (p_atomic_read(&ctx->toPause)) {
+                nine_context_flush_draws(ctx->device);
                 mtx_unlock(&ctx->thread_running);
                 /* will wait here the thread can be resumed */
                 mtx_lock(&ctx->thread_resume);
@@ -121,12 +154,10 @@ nine_csmt_worker(void *arg)
             }
         }
 
+        nine_context_flush_draws(ctx->device);
         mtx_unlock(&ctx->thread_running);
         if (p_atomic_read(&ctx->terminate)) {
-            mtx_lock(&ctx->mutex_processed);
-            p_atomic_set(&ctx->processed, TRUE);
-            cnd_signal(&ctx->event_processed);
-            mtx_unlock(&ctx->mutex_processed);
+            util_queue_fence_signal(&ctx->processed);
             break;
         }
     }
@@ -139,7 +170,7 @@ nine_csmt_worker(void *arg)
  * Spawns a worker thread.
  */
 struct csmt_context *
-nine_csmt_create( struct NineDevice9 *This )
+nine_csmt_create( struct NineDevice9 *This, unsigned queue_depth )
 {
     struct csmt_context *ctx;
 
@@ -147,13 +178,12 @@ nine_csmt_create( struct NineDevice9 *This )
     if (!ctx)
         return NULL;
 
-    ctx->pool = nine_queue_create();
+    ctx->pool = nine_queue_create(queue_depth);
     if (!ctx->pool) {
         FREE(ctx);
         return NULL;
     }
-    cnd_init(&ctx->event_processed);
-    (void) mtx_init(&ctx->mutex_processed, mtx_plain);
+    util_queue_fence_init(&ctx->processed);
     (void) mtx_init(&ctx->thread_running, mtx_plain);
     (void) mtx_init(&ctx->thread_resume, mtx_plain);
 
@@ -205,7 +235,7 @@ nine_csmt_process( struct NineDevice9 *device )
     assert(instr);
     instr->func = nop_func;
 
-    p_atomic_set(&ctx->processed, FALSE);
+    util_queue_fence_reset(&ctx->processed);
     nine_queue_flush(ctx->pool);
 
     nine_csmt_wait_processed(ctx);
@@ -237,7 +267,7 @@ nine_csmt_destroy( struct NineDevice9 *device, struct csmt_context *ctx )
     assert(instr);
     instr->func = nop_func;
 
-    p_atomic_set(&ctx->processed, FALSE);
+    util_queue_fence_reset(&ctx->processed);
     /* Signal worker to terminate. */
     p_atomic_set(&ctx->terminate, TRUE);
     nine_queue_flush(ctx->pool);
@@ -248,14 +278,39 @@ nine_csmt_destroy( struct NineDevice9 *device, struct csmt_context *ctx )
     mtx_destroy(&ctx->thread_resume);
     mtx_destroy(&ctx->thread_running);
 
-    mtx_destroy(&ctx->mutex_processed);
-    cnd_destroy(&ctx->event_processed);
+    util_queue_fence_destroy(&ctx->processed);
 
     FREE(ctx);
 
     thrd_join(render_thread, NULL);
 }
 
+/* Collects the statistics of the frame which just ended. */
+void
+nine_csmt_end_frame( struct NineDevice9 *device )
+{
+    struct csmt_context *ctx = device->csmt_ctx;
+    struct nine_csmt_stats *stats = &device->csmt_stats;
+
+    if (!device->csmt_active)
+        return;
+
+    nine_queue_get_stats(ctx->pool, &stats->queue);
+    stats->syncs = ctx->syncs;
+    stats->sync_ns = ctx->sync_ns;
+    stats->merged_draws = p_atomic_xchg(&device->context.draw_batch.merged, 0);
+    ctx->syncs = 0;
+    ctx->sync_ns = 0;
+
+    DBG("flushes=%u stalls=%u (%u us) syncs=%u (%u us) "
+        "worker wakeups=%u idle=%u us merged draws=%u\n",
+        stats->queue.flushes, stats->queue.producer_stalls,
+        (unsigned)(stats->queue.producer_stall_ns / 1000), stats->syncs,
+        (unsigned)(stats->sync_ns / 1000), stats->queue.consumer_wakeups,
+        (unsigned)(stats->queue.consumer_idle_ns / 1000),
+        stats->merged_draws);
+}
+
 static void
 nine_csmt_pause( struct NineDevice9 *device )
 {
@@ -385,6 +440,155 @@ prepare_rasterizer(struct NineDevice9 *device)
     device->context.commit |= NINE_STATE_COMMIT_RASTERIZER;
 }
 
+/* Constant buffer ranges tracking.
+ * When few registers changed since the previous upload and the layout of the
+ * buffer is the same, only those are written to the new upload slice, the
+ * rest is copied from the previous slice by the driver. */
+
+static inline void
+nine_const_range_add(unsigned range[2], unsigned bgn, unsigned end)
+{
+    if (range[0] >= range[1]) {
+        range[0] = bgn;
+        range[1] = end;
+    } else {
+        range[0] = MIN2(range[0], bgn);
+        range[1] = MAX2(range[1], end);
+    }
+}
+
+static inline void
+nine_const_range_add_all(unsigned range[2])
+{
+    range[0] = 0;
+    range[1] = ~0u;
+}
+
+/* Byte span [*bgn, *end) of the uploaded buffer containing the registers
+ * of range. The buffer contains the registers of const_ranges packed
+ * (all the registers below used_size if const_ranges is NULL) */
+static void
+nine_const_range_to_span(const unsigned range[2], const unsigned *const_ranges,
+                         unsigned used_size, unsigned *bgn, unsigned *end)
+{
+    unsigned i, offset = 0;
+
+    *bgn = used_size;
+    *end = 0;
+    if (range[0] >= range[1])
+        return;
+
+    if (!const_ranges) {
+        *bgn = MIN2(range[0] * sizeof(float[4]), used_size);
+        *end = MIN2((uint64_t)range[1] * sizeof(float[4]), used_size);
+        return;
+    }
+
+    for (i = 0; const_ranges[i*2+1] != 0; i++) {
+        unsigned r_bgn = MAX2(const_ranges[i*2], range[0]);
+        unsigned r_end = MIN2(const_ranges[i*2] + const_ranges[i*2+1], range[1]);
+        if (r_bgn < r_end) {
+            *bgn = MIN2(*bgn, offset + (r_bgn - const_ranges[i*2]) * sizeof(float[4]));
+            *end = MAX2(*end, offset + (r_end - const_ranges[i*2]) * sizeof(float[4]));
+        }
+        offset += const_ranges[i*2+1] * sizeof(float[4]);
+    }
+}
+
+/* Write the bytes [bgn, end) of the packed constant buffer to dst */
+static void
+nine_const_upload_span(uint8_t *dst, const float *src, const unsigned *const_ranges,
+                       unsigned bgn, unsigned end)
+{
+    unsigned i, offset = 0;
+
+    if (!const_ranges) {
+        memcpy(dst + bgn, (const uint8_t *)src + bgn, end - bgn);
+        return;
+    }
+
+    for (i = 0; const_ranges[i*2+1] != 0 && offset < end; i++) {
+        unsigned size = const_ranges[i*2+1] * sizeof(float[4]);
+        unsigned r_bgn = MAX2(offset, bgn);
+        unsigned r_end = MIN2(offset + size, end);
+        if (r_bgn < r_end)
+            memcpy(dst + r_bgn,
+                   (const uint8_t *)&src[4 * const_ranges[i*2]] + (r_bgn - offset),
+                   r_end - r_bgn);
+        offset += size;
+    }
+}
+
+/* Upload the constants to a new slice of the const uploader, and update cb.
+ * prev is the previously uploaded buffer for this stage. */
+static void
+nine_const_upload(struct nine_context *context,
+                  struct pipe_constant_buffer *prev,
+                  struct pipe_constant_buffer *cb,
+                  const unsigned *const_ranges,
+                  unsigned range[2])
+{
+    struct pipe_context *pipe = context->pipe;
+    uint8_t *upload_ptr = NULL;
+    unsigned bgn = 0, end = cb->buffer_size;
+    boolean partial = FALSE;
+
+    /* The previous slice has the same layout unless the whole range
+     * was marked (shader or swvp change). Only worth it if little changed. */
+    if (prev->buffer && prev->buffer_size == cb->buffer_size && range[1] != ~0u) {
+        nine_const_range_to_span(range, const_ranges, cb->buffer_size, &bgn, &end);
+        if (bgn >= end) {
+            bgn = end = 0;
+        }
+        partial = (end - bgn) <= cb->buffer_size / 2;
+        if (!partial) {
+            bgn = 0;
+            end = cb->buffer_size;
+        }
+    }
+
+    u_upload_alloc(pipe->const_uploader,
+                  0,
+                  cb->buffer_size,
+                  256, /* Be conservative about alignment */
+                  &(cb->buffer_offset),
+                  &(cb->buffer),
+                  (void**)&upload_ptr);
+
+    assert(cb->buffer && upload_ptr);
+
+    /* Note: We probably don't want to do separate memcpy to
+     * upload_ptr directly, if we have to copy some constants
+     * at random locations (lconstf), to have efficient WC.
+     * Thus for this case we really want that intermediate buffer. */
+    if (bgn < end)
+        nine_const_upload_span(upload_ptr, cb->user_buffer, const_ranges, bgn, end);
+
+    u_upload_unmap(pipe->const_uploader);
+    cb->user_buffer = NULL;
+
+    if (partial) {
+        struct pipe_box box;
+
+        if (bgn > 0) {
+            u_box_1d(prev->buffer_offset, bgn, &box);
+            pipe->resource_copy_region(pipe, cb->buffer, 0, cb->buffer_offset, 0, 0,
+                                       prev->buffer, 0, &box);
+        }
+        if (end < cb->buffer_size) {
+            u_box_1d(prev->buffer_offset + end, cb->buffer_size - end, &box);
+            pipe->resource_copy_region(pipe, cb->buffer, 0, cb->buffer_offset + end, 0, 0,
+                                       prev->buffer, 0, &box);
+        }
+    }
+
+    /* Free previous resource */
+    pipe_resource_reference(&prev->buffer, NULL);
+
+    *prev = *cb;
+    range[0] = range[1] = 0;
+}
+
 static void
 prepare_vs_constants_userbuf_swvp(struct NineDevice9 *device)
 {
@@ -460,7 +664,6 @@ static void
 prepare_vs_constants_userbuf(struct NineDevice9 *device)
 {
     struct nine_context *context = &device->context;
-    uint8_t *upload_ptr = NULL;
     struct pipe_constant_buffer cb;
     cb.buffer = NULL;
     cb.buffer_offset = 0;
@@ -472,6 +675,9 @@ prepare_vs_constants_userbuf(struct NineDevice9 *device)
         return;
     }
 
+    if (context->changed.group & NINE_STATE_SWVP)
+        nine_const_range_add_all(context->changed.vs_const_range);
+
     if (context->changed.vs_const_i || context->changed.group & NINE_STATE_SWVP) {
         int *idst = (int *)&context->vs_const_f[4 * device->max_vs_const_f];
         memcpy(idst, context->vs_const_i, NINE_MAX_CONST_I * sizeof(int[4]));
@@ -506,43 +712,10 @@ prepare_vs_constants_userbuf(struct NineDevice9 *device)
         cb.user_buffer = dst;
     }
 
-    /* Note: We probably don't want to do separate memcpy to
-     * upload_ptr directly, if we have to copy some constants
-     * at random locations (context->vs->lconstf.ranges),
-     * to have efficient WC. Thus for this case we really want
-     * that intermediate buffer. */
+    nine_const_upload(context, &context->pipe_data.cb_vs, &cb,
+                      context->cso_shader.vs_const_ranges,
+                      context->changed.vs_const_range);
 
-    u_upload_alloc(context->pipe->const_uploader,
-                  0,
-                  cb.buffer_size,
-                  256, /* Be conservative about alignment */
-                  &(cb.buffer_offset),
-                  &(cb.buffer),
-                  (void**)&upload_ptr);
-
-    assert(cb.buffer && upload_ptr);
-
-    if (!context->cso_shader.vs_const_ranges) {
-        memcpy(upload_ptr, cb.user_buffer, cb.buffer_size);
-    } else {
-        unsigned i = 0;
-        unsigned offset = 0;
-        while (context->cso_shader.vs_const_ranges[i*2+1] != 0) {
-            memcpy(upload_ptr+offset,
-                   &((float*)cb.user_buffer)[4*context->cso_shader.vs_const_ranges[i*2]],
-                   context->cso_shader.vs_const_ranges[i*2+1] * sizeof(float[4]));
-            offset += context->cso_shader.vs_const_ranges[i*2+1] * sizeof(float[4]);
-            i++;
-        }
-    }
-
-    u_upload_unmap(context->pipe->const_uploader);
-    cb.user_buffer = NULL;
-
-    /* Free previous resource */
-    pipe_resource_reference(&context->pipe_data.cb_vs.buffer, NULL);
-
-    context->pipe_data.cb_vs = cb;
     context->changed.vs_const_f = 0;
 
     context->changed.group &= ~NINE_STATE_VS_CONST;
@@ -553,7 +726,6 @@ static void
 prepare_ps_constants_userbuf(struct NineDevice9 *device)
 {
     struct nine_context *context = &device->context;
-    uint8_t *upload_ptr = NULL;
     struct pipe_constant_buffer cb;
     cb.buffer = NULL;
     cb.buffer_offset = 0;
@@ -574,12 +746,17 @@ prepare_ps_constants_userbuf(struct NineDevice9 *device)
 
     /* Upload special constants needed to implement PS1.x instructions like TEXBEM,TEXBEML and BEM */
     if (context->ps->bumpenvmat_needed) {
+        nine_const_range_add(context->changed.ps_const_range, 8, 8 + ARRAY_SIZE(context->bumpmap_vars) / 4);
         memcpy(context->ps_lconstf_temp, cb.user_buffer, 8 * sizeof(float[4]));
         memcpy(&context->ps_lconstf_temp[4 * 8], &device->context.bumpmap_vars, sizeof(device->context.bumpmap_vars));
 
         cb.user_buffer = context->ps_lconstf_temp;
     }
 
+    /* The fog constants are toggled with D3DRS_FOGENABLE */
+    if (context->ps->byte_code.version < 0x30)
+        nine_const_range_add(context->changed.ps_const_range, 32, 34);
+
     if (context->ps->byte_code.version < 0x30 &&
         context->rs[D3DRS_FOGENABLE]) {
         float *dst = &context->ps_lconstf_temp[4 * 32];
@@ -600,37 +777,10 @@ prepare_ps_constants_userbuf(struct NineDevice9 *device)
     if (!cb.buffer_size)
         return;
 
-    u_upload_alloc(context->pipe->const_uploader,
-                  0,
-                  cb.buffer_size,
-                  256, /* Be conservative about alignment */
-                  &(cb.buffer_offset),
-                  &(cb.buffer),
-                  (void**)&upload_ptr);
-
-    assert(cb.buffer && upload_ptr);
-
-    if (!context->cso_shader.ps_const_ranges) {
-        memcpy(upload_ptr, cb.user_buffer, cb.buffer_size);
-    } else {
-        unsigned i = 0;
-        unsigned offset = 0;
-        while (context->cso_shader.ps_const_ranges[i*2+1] != 0) {
-            memcpy(upload_ptr+offset,
-                   &((float*)cb.user_buffer)[4*context->cso_shader.ps_const_ranges[i*2]],
-                   context->cso_shader.ps_const_ranges[i*2+1] * sizeof(float[4]));
-            offset += context->cso_shader.ps_const_ranges[i*2+1] * sizeof(float[4]);
-            i++;
-        }
-    }
-
-    u_upload_unmap(context->pipe->const_uploader);
-    cb.user_buffer = NULL;
+    nine_const_upload(context, &context->pipe_data.cb_ps, &cb,
+                      context->cso_shader.ps_const_ranges,
+                      context->changed.ps_const_range);
 
-    /* Free previous resource */
-    pipe_resource_reference(&context->pipe_data.cb_ps.buffer, NULL);
-
-    context->pipe_data.cb_ps = cb;
     context->changed.ps_const_f = 0;
 
     context->changed.group &= ~NINE_STATE_PS_CONST;
@@ -653,9 +803,16 @@ prepare_vs(struct NineDevice9 *device, uint8_t shader_changed)
 
     /* likely because we dislike FF */
     if (likely(context->programmable_vs)) {
+        unsigned *old_ranges = context->cso_shader.vs_const_ranges;
+        unsigned old_used_size = context->cso_shader.vs_const_used_size;
+
         context->cso_shader.vs = NineVertexShader9_GetVariant(vs,
                                                               &context->cso_shader.vs_const_ranges,
                                                               &context->cso_shader.vs_const_used_size);
+        /* The layout of the constant buffer changed */
+        if (old_ranges != context->cso_shader.vs_const_ranges ||
+            old_used_size != context->cso_shader.vs_const_used_size)
+            nine_const_range_add_all(context->changed.vs_const_range);
     } else {
         vs = device->ff.vs;
         context->cso_shader.vs = vs->ff_cso;
@@ -689,9 +846,16 @@ prepare_ps(struct NineDevice9 *device, uint8_t shader_changed)
         return 0;
 
     if (likely(ps)) {
+        unsigned *old_ranges = context->cso_shader.ps_const_ranges;
+        unsigned old_used_size = context->cso_shader.ps_const_used_size;
+
         context->cso_shader.ps = NinePixelShader9_GetVariant(ps,
                                                              &context->cso_shader.ps_const_ranges,
                                                              &context->cso_shader.ps_const_used_size);
+        /* The layout of the constant buffer changed */
+        if (old_ranges != context->cso_shader.ps_const_ranges ||
+            old_used_size != context->cso_shader.ps_const_used_size)
+            nine_const_range_add_all(context->changed.ps_const_range);
     } else {
         ps = device->ff.ps;
         context->cso_shader.ps = ps->ff_cso;
@@ -917,6 +1081,11 @@ update_vertex_elements(struct NineDevice9 *device)
 
     ve.count = vs->num_inputs;
     cso_set_vertex_elements(context->cso, &ve);
+
+    if (device->swvp_cpu.active) {
+        memcpy(context->swvp_velems, ve.velems, ve.count * sizeof(ve.velems[0]));
+        context->swvp_num_velems = ve.count;
+    }
 }
 
 static void
@@ -1153,6 +1322,14 @@ commit_vs_constants(struct NineDevice9 *device)
     }
 }
 
+/* The vertex shaders running on the cpu read the constants in place */
+static inline boolean
+nine_context_swvp_on_cpu(struct NineDevice9 *device)
+{
+    return unlikely(device->swvp_cpu.active && device->context.swvp) &&
+           nine_swvp_cpu_use(device);
+}
+
 static inline void
 commit_ps_constants(struct NineDevice9 *device)
 {
@@ -1222,7 +1399,10 @@ nine_update_state(struct NineDevice9 *device)
 {
     struct nine_context *context = &device->context;
     struct pipe_context *pipe = context->pipe;
+    /* Only measured when it can be displayed */
+    const int64_t start = device->hud ? os_time_get_nano() : 0;
     uint32_t group;
+    uint32_t commit_kept = 0;
 
     DBG("changed state groups: %x\n", context->changed.group);
 
@@ -1280,8 +1460,13 @@ nine_update_state(struct NineDevice9 *device)
         commit_dsa(device);
     if (context->commit & NINE_STATE_COMMIT_RASTERIZER)
         commit_rasterizer(device);
-    if (context->commit & NINE_STATE_COMMIT_CONST_VS)
-        commit_vs_constants(device);
+    if (context->commit & NINE_STATE_COMMIT_CONST_VS) {
+        /* Kept for the next draw with the hardware vertex shader */
+        if (nine_context_swvp_on_cpu(device))
+            commit_kept |= NINE_STATE_COMMIT_CONST_VS;
+        else
+            commit_vs_constants(device);
+    }
     if (context->commit & NINE_STATE_COMMIT_CONST_PS)
         commit_ps_constants(device);
     if (context->commit & NINE_STATE_COMMIT_VS)
@@ -1289,7 +1474,7 @@ nine_update_state(struct NineDevice9 *device)
     if (context->commit & NINE_STATE_COMMIT_PS)
         commit_ps(device);
 
-    context->commit = 0;
+    context->commit = commit_kept;
 
     if (unlikely(context->changed.ucp)) {
         pipe->set_clip_state(pipe, &context->clip);
@@ -1322,6 +1507,9 @@ nine_update_state(struct NineDevice9 *device)
     context->changed.group &=
         (NINE_STATE_FF | NINE_STATE_VS_CONST | NINE_STATE_PS_CONST);
 
+    if (device->hud)
+        p_atomic_add(&device->cpu_stats.update_state_ns, os_time_get_nano() - start);
+
     DBG("finished\n");
 }
 
@@ -1670,6 +1858,8 @@ CSMT_ITEM_NO_WAIT(nine_context_set_vertex_shader,
     if (!was_programmable_vs && context->programmable_vs)
         context->commit |= NINE_STATE_COMMIT_CONST_VS;
 
+    /* The previous constant buffer may have another layout */
+    nine_const_range_add_all(context->changed.vs_const_range);
     context->changed.group |= NINE_STATE_VS;
 }
 
@@ -1694,6 +1884,9 @@ CSMT_ITEM_NO_WAIT(nine_context_set_vertex_shader_constant_f,
                    Vector4fCount * 4 * sizeof(context->vs_const_f[0]));
     }
 
+    if (StartRegister < device->max_vs_const_f)
+        nine_const_range_add(context->changed.vs_const_range, StartRegister,
+                             MIN2(StartRegister + Vector4fCount, device->max_vs_const_f));
     context->changed.vs_const_f = TRUE;
     context->changed.group |= NINE_STATE_VS_CONST;
 }
@@ -1720,6 +1913,10 @@ CSMT_ITEM_NO_WAIT(nine_context_set_vertex_shader_constant_i,
         }
     }
 
+    if (StartRegister < NINE_MAX_CONST_I)
+        nine_const_range_add(context->changed.vs_const_range,
+                             device->max_vs_const_f + StartRegister,
+                             device->max_vs_const_f + MIN2(StartRegister + Vector4iCount, NINE_MAX_CONST_I));
     context->changed.vs_const_i = TRUE;
     context->changed.group |= NINE_STATE_VS_CONST | NINE_STATE_VS_PARAMS_MISC;
 }
@@ -1739,6 +1936,12 @@ CSMT_ITEM_NO_WAIT(nine_context_set_vertex_shader_constant_b,
     for (i = 0; i < BoolCount; i++)
         context->vs_const_b[StartRegister + i] = pConstantData[i] ? bool_true : 0;
 
+    /* 4 bools per register */
+    if (StartRegister < NINE_MAX_CONST_B)
+        nine_const_range_add(context->changed.vs_const_range,
+                             device->max_vs_const_f + NINE_MAX_CONST_I + StartRegister / 4,
+                             device->max_vs_const_f + NINE_MAX_CONST_I +
+                             DIV_ROUND_UP(MIN2(StartRegister + BoolCount, NINE_MAX_CONST_B), 4));
     context->changed.vs_const_b = TRUE;
     context->changed.group |= NINE_STATE_VS_CONST | NINE_STATE_VS_PARAMS_MISC;
 }
@@ -1756,6 +1959,8 @@ CSMT_ITEM_NO_WAIT(nine_context_set_pixel_shader,
 
     nine_bind(&context->ps, ps);
 
+    /* The previous constant buffer may have another layout */
+    nine_const_range_add_all(context->changed.ps_const_range);
     context->changed.group |= NINE_STATE_PS;
 
     mask = context->ps ? context->ps->rt_mask : 1;
@@ -1777,6 +1982,8 @@ CSMT_ITEM_NO_WAIT(nine_context_set_pixel_shader_constant_f,
            pConstantData,
            pConstantData_size);
 
+    nine_const_range_add(context->changed.ps_const_range, StartRegister,
+                         StartRegister + Vector4fCount);
     context->changed.ps_const_f = TRUE;
     context->changed.group |= NINE_STATE_PS_CONST;
 }
@@ -1794,6 +2001,9 @@ CSMT_ITEM_NO_WAIT(nine_context_set_pixel_shader_constant_i_transformed,
            pConstantData,
            Vector4iCount * sizeof(context->ps_const_i[0]));
 
+    nine_const_range_add(context->changed.ps_const_range,
+                         device->max_ps_const_f + StartRegister,
+                         device->max_ps_const_f + StartRegister + Vector4iCount);
     context->changed.ps_const_i = TRUE;
     context->changed.group |= NINE_STATE_PS_CONST | NINE_STATE_PS_PARAMS_MISC;
 }
@@ -1819,6 +2029,9 @@ CSMT_ITEM_NO_WAIT(nine_context_set_pixel_shader_constant_i,
             context->ps_const_i[StartRegister+i][3] = fui((float)(pConstantData[4*i+3]));
         }
     }
+    nine_const_range_add(context->changed.ps_const_range,
+                         device->max_ps_const_f + StartRegister,
+                         device->max_ps_const_f + StartRegister + Vector4iCount);
     context->changed.ps_const_i = TRUE;
     context->changed.group |= NINE_STATE_PS_CONST | NINE_STATE_PS_PARAMS_MISC;
 }
@@ -1838,10 +2051,27 @@ CSMT_ITEM_NO_WAIT(nine_context_set_pixel_shader_constant_b,
     for (i = 0; i < BoolCount; i++)
         context->ps_const_b[StartRegister + i] = pConstantData[i] ? bool_true : 0;
 
+    /* 4 bools per register */
+    nine_const_range_add(context->changed.ps_const_range,
+                         device->max_ps_const_f + NINE_MAX_CONST_I + StartRegister / 4,
+                         device->max_ps_const_f + NINE_MAX_CONST_I +
+                         DIV_ROUND_UP(StartRegister + BoolCount, 4));
     context->changed.ps_const_b = TRUE;
     context->changed.group |= NINE_STATE_PS_CONST | NINE_STATE_PS_PARAMS_MISC;
 }
 
+CSMT_ITEM_NO_WAIT(nine_context_precompile_vertex_shader,
+                  ARG_BIND_REF(struct NineVertexShader9, vs))
+{
+    NineVertexShader9_Precompile(vs);
+}
+
+CSMT_ITEM_NO_WAIT(nine_context_precompile_pixel_shader,
+                  ARG_BIND_REF(struct NinePixelShader9, ps))
+{
+    NinePixelShader9_Precompile(ps);
+}
+
 /* XXX: use resource, as resource might change */
 CSMT_ITEM_NO_WAIT(nine_context_set_render_target,
                   ARG_VAL(DWORD, RenderTargetIndex),
@@ -2019,13 +2249,35 @@ CSMT_ITEM_NO_WAIT(nine_context_set_swvp,
     context->changed.group |= NINE_STATE_SWVP;
 }
 
+/* Restrict [*bgn, *end) to the smallest range containing all the elements
+ * that differ between cur and src. Returns FALSE if they are all equal. */
+static boolean
+nine_range_diff(const void *cur, const void *src, unsigned elem_size,
+                unsigned *bgn, unsigned *end)
+{
+    const uint8_t *c = cur, *s = src;
+    unsigned b = *bgn, e = *end;
+
+    while (b < e && !memcmp(&c[b * elem_size], &s[b * elem_size], elem_size))
+        b++;
+    while (e > b && !memcmp(&c[(e - 1) * elem_size], &s[(e - 1) * elem_size], elem_size))
+        e--;
+    *bgn = b;
+    *end = e;
+    return b < e;
+}
+
 /* Do not write to nine_context directly. Slower,
  * but works with csmt. TODO: write a special csmt version that
  * would record the list of commands as much as possible,
  * and use the version above else.
+ * cur is the device state before the stateblock is applied (device->state).
+ * As for the device Set* functions, values equal in cur and src are skipped,
+ * such that only the groups actually changed get dirty in the context.
  */
 void
 nine_context_apply_stateblock(struct NineDevice9 *device,
+                              const struct nine_state *cur,
                               const struct nine_state *src)
 {
     int i;
@@ -2038,7 +2290,8 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
         while (m) {
             const int r = ffs(m) - 1;
             m &= ~(1 << r);
-            nine_context_set_render_state(device, i * 32 + r, src->rs_advertised[i * 32 + r]);
+            if (cur->rs_advertised[i * 32 + r] != src->rs_advertised[i * 32 + r])
+                nine_context_set_render_state(device, i * 32 + r, src->rs_advertised[i * 32 + r]);
         }
     }
 
@@ -2049,7 +2302,7 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
 
         for (s = 0; m; ++s, m >>= 1) {
             struct NineBaseTexture9 *tex = src->texture[s];
-            if (!(m & 1))
+            if (!(m & 1) || cur->texture[s] == tex)
                 continue;
             nine_context_set_texture(device, s, tex);
         }
@@ -2064,7 +2317,8 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
             while (m) {
                 const int i = ffs(m) - 1;
                 m &= ~(1 << i);
-                nine_context_set_sampler_state(device, s, i, src->samp_advertised[s][i]);
+                if (cur->samp_advertised[s][i] != src->samp_advertised[s][i])
+                    nine_context_set_sampler_state(device, s, i, src->samp_advertised[s][i]);
             }
         }
     }
@@ -2073,85 +2327,110 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
     if (src->changed.vtxbuf | src->changed.stream_freq) {
         uint32_t m = src->changed.vtxbuf | src->changed.stream_freq;
         for (i = 0; m; ++i, m >>= 1) {
-            if (src->changed.vtxbuf & (1 << i))
+            if ((src->changed.vtxbuf & (1 << i)) &&
+                (cur->stream[i] != src->stream[i] ||
+                 cur->vtxbuf[i].buffer_offset != src->vtxbuf[i].buffer_offset ||
+                 cur->vtxbuf[i].stride != src->vtxbuf[i].stride))
                 nine_context_set_stream_source(device, i, src->stream[i], src->vtxbuf[i].buffer_offset, src->vtxbuf[i].stride);
-            if (src->changed.stream_freq & (1 << i))
+            if ((src->changed.stream_freq & (1 << i)) &&
+                cur->stream_freq[i] != src->stream_freq[i])
                 nine_context_set_stream_source_freq(device, i, src->stream_freq[i]);
         }
     }
 
     /* Index buffer */
-    if (src->changed.group & NINE_STATE_IDXBUF)
+    if ((src->changed.group & NINE_STATE_IDXBUF) && cur->idxbuf != src->idxbuf)
         nine_context_set_indices(device, src->idxbuf);
 
     /* Vertex declaration */
-    if ((src->changed.group & NINE_STATE_VDECL) && src->vdecl)
+    if ((src->changed.group & NINE_STATE_VDECL) && src->vdecl && cur->vdecl != src->vdecl)
         nine_context_set_vertex_declaration(device, src->vdecl);
 
     /* Vertex shader */
-    if (src->changed.group & NINE_STATE_VS)
+    if ((src->changed.group & NINE_STATE_VS) && cur->vs != src->vs)
         nine_context_set_vertex_shader(device, src->vs);
 
     /* Pixel shader */
-    if (src->changed.group & NINE_STATE_PS)
+    if ((src->changed.group & NINE_STATE_PS) && cur->ps != src->ps)
         nine_context_set_pixel_shader(device, src->ps);
 
     /* Vertex constants */
     if (src->changed.group & NINE_STATE_VS_CONST) {
         struct nine_range *r;
-        for (r = src->changed.vs_const_f; r; r = r->next)
-            nine_context_set_vertex_shader_constant_f(device, r->bgn,
-                                                      &src->vs_const_f[r->bgn * 4],
-                                                      sizeof(float[4]) * (r->end - r->bgn),
-                                                      r->end - r->bgn);
-        for (r = src->changed.vs_const_i; r; r = r->next)
-            nine_context_set_vertex_shader_constant_i(device, r->bgn,
-                                                      &src->vs_const_i[r->bgn * 4],
-                                                      sizeof(int[4]) * (r->end - r->bgn),
-                                                      r->end - r->bgn);
-        for (r = src->changed.vs_const_b; r; r = r->next)
-            nine_context_set_vertex_shader_constant_b(device, r->bgn,
-                                                      &src->vs_const_b[r->bgn * 4],
-                                                      sizeof(BOOL) * (r->end - r->bgn),
-                                                      r->end - r->bgn);
+        unsigned bgn, end;
+        for (r = src->changed.vs_const_f; r; r = r->next) {
+            bgn = r->bgn;
+            end = r->end;
+            if (nine_range_diff(cur->vs_const_f, src->vs_const_f, sizeof(float[4]), &bgn, &end))
+                nine_context_set_vertex_shader_constant_f(device, bgn,
+                                                          &src->vs_const_f[bgn * 4],
+                                                          sizeof(float[4]) * (end - bgn),
+                                                          end - bgn);
+        }
+        for (r = src->changed.vs_const_i; r; r = r->next) {
+            bgn = r->bgn;
+            end = r->end;
+            if (nine_range_diff(cur->vs_const_i, src->vs_const_i, sizeof(int[4]), &bgn, &end))
+                nine_context_set_vertex_shader_constant_i(device, bgn,
+                                                          &src->vs_const_i[bgn * 4],
+                                                          sizeof(int[4]) * (end - bgn),
+                                                          end - bgn);
+        }
+        for (r = src->changed.vs_const_b; r; r = r->next) {
+            bgn = r->bgn;
+            end = r->end;
+            if (nine_range_diff(cur->vs_const_b, src->vs_const_b, sizeof(BOOL), &bgn, &end))
+                nine_context_set_vertex_shader_constant_b(device, bgn,
+                                                          &src->vs_const_b[bgn],
+                                                          sizeof(BOOL) * (end - bgn),
+                                                          end - bgn);
+        }
     }
 
     /* Pixel constants */
     if (src->changed.group & NINE_STATE_PS_CONST) {
         struct nine_range *r;
-        for (r = src->changed.ps_const_f; r; r = r->next)
-            nine_context_set_pixel_shader_constant_f(device, r->bgn,
-                                                     &src->ps_const_f[r->bgn * 4],
-                                                     sizeof(float[4]) * (r->end - r->bgn),
-                                                     r->end - r->bgn);
+        unsigned bgn, end;
+        for (r = src->changed.ps_const_f; r; r = r->next) {
+            bgn = r->bgn;
+            end = r->end;
+            if (nine_range_diff(cur->ps_const_f, src->ps_const_f, sizeof(float[4]), &bgn, &end))
+                nine_context_set_pixel_shader_constant_f(device, bgn,
+                                                         &src->ps_const_f[bgn * 4],
+                                                         sizeof(float[4]) * (end - bgn),
+                                                         end - bgn);
+        }
         if (src->changed.ps_const_i) {
             uint16_t m = src->changed.ps_const_i;
             for (i = ffs(m) - 1, m >>= i; m; ++i, m >>= 1)
-                if (m & 1)
+                if ((m & 1) && memcmp(cur->ps_const_i[i], src->ps_const_i[i], sizeof(int[4])))
                     nine_context_set_pixel_shader_constant_i_transformed(device, i,
                                                                          src->ps_const_i[i], sizeof(int[4]), 1);
         }
         if (src->changed.ps_const_b) {
             uint16_t m = src->changed.ps_const_b;
             for (i = ffs(m) - 1, m >>= i; m; ++i, m >>= 1)
-                if (m & 1)
+                if ((m & 1) && cur->ps_const_b[i] != src->ps_const_b[i])
                     nine_context_set_pixel_shader_constant_b(device, i,
                                                              &src->ps_const_b[i], sizeof(BOOL), 1);
         }
     }
 
     /* Viewport */
-    if (src->changed.group & NINE_STATE_VIEWPORT)
+    if ((src->changed.group & NINE_STATE_VIEWPORT) &&
+        memcmp(&cur->viewport, &src->viewport, sizeof(src->viewport)))
         nine_context_set_viewport(device, &src->viewport);
 
     /* Scissor */
-    if (src->changed.group & NINE_STATE_SCISSOR)
+    if ((src->changed.group & NINE_STATE_SCISSOR) &&
+        memcmp(&cur->scissor, &src->scissor, sizeof(src->scissor)))
         nine_context_set_scissor(device, &src->scissor);
 
     /* User Clip Planes */
     if (src->changed.ucp)
         for (i = 0; i < PIPE_MAX_CLIP_PLANES; ++i)
-            if (src->changed.ucp & (1 << i))
+            if ((src->changed.ucp & (1 << i)) &&
+                memcmp(cur->clip.ucp[i], src->clip.ucp[i], sizeof(src->clip.ucp[i])))
                 nine_context_set_clip_plane(device, i, (struct nine_clipplane*)&src->clip.ucp[i][0]);
 
     if (!(src->changed.group & NINE_STATE_FF))
@@ -2159,23 +2438,31 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
 
     /* Fixed function state. */
 
-    if (src->changed.group & NINE_STATE_FF_MATERIAL)
+    if ((src->changed.group & NINE_STATE_FF_MATERIAL) &&
+        memcmp(&cur->ff.material, &src->ff.material, sizeof(src->ff.material)))
         nine_context_set_material(device, &src->ff.material);
 
     if (src->changed.group & NINE_STATE_FF_PS_CONSTS) {
         unsigned s;
         for (s = 0; s < NINE_MAX_TEXTURE_STAGES; ++s) {
             for (i = 0; i < NINED3DTSS_COUNT; ++i)
-                if (src->ff.changed.tex_stage[s][i / 32] & (1 << (i % 32)))
+                if ((src->ff.changed.tex_stage[s][i / 32] & (1 << (i % 32))) &&
+                    cur->ff.tex_stage[s][i] != src->ff.tex_stage[s][i])
                    nine_context_set_texture_stage_state(device, s, i, src->ff.tex_stage[s][i]);
         }
     }
     if (src->changed.group & NINE_STATE_FF_LIGHTING) {
         for (i = 0; i < src->ff.num_lights; ++i)
-            if (src->ff.light[i].Type != NINED3DLIGHT_INVALID)
+            if (src->ff.light[i].Type != NINED3DLIGHT_INVALID &&
+                (i >= cur->ff.num_lights ||
+                 memcmp(&cur->ff.light[i], &src->ff.light[i], sizeof(src->ff.light[i]))))
                 nine_context_set_light(device, i, &src->ff.light[i]);
 
-        nine_context_light_enable_stateblock(device, src->ff.active_light, src->ff.num_lights_active);
+        /* Changing the set of active lights requires a sync with the worker */
+        if (cur->ff.num_lights_active != src->ff.num_lights_active ||
+            memcmp(cur->ff.active_light, src->ff.active_light,
+                   src->ff.num_lights_active * sizeof(src->ff.active_light[0])))
+            nine_context_light_enable_stateblock(device, src->ff.active_light, src->ff.num_lights_active);
     }
     if (src->changed.group & NINE_STATE_FF_VSTRANSF) {
         for (i = 0; i < ARRAY_SIZE(src->ff.changed.transform); ++i) {
@@ -2183,6 +2470,7 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
             if (!src->ff.changed.transform[i])
                 continue;
             for (s = i * 32; s < (i * 32 + 32); ++s) {
+                const D3DMATRIX *M;
                 if (!(src->ff.changed.transform[i] & (1 << (s % 32))))
                     continue;
                 /* MaxVertexBlendMatrixIndex is 8, which means
@@ -2191,10 +2479,11 @@ nine_context_apply_stateblock(struct NineDevice9 *device,
                  * implement it for now. */
                 if (s > D3DTS_WORLDMATRIX(8))
                     break;
-                nine_context_set_transform(device, s,
-                                           nine_state_access_transform(
-                                               (struct nine_ff_state *)&src->ff,
-                                                                       s, FALSE));
+                M = nine_state_access_transform((struct nine_ff_state *)&src->ff, s, FALSE);
+                if (!memcmp(M, nine_state_access_transform((struct nine_ff_state *)&cur->ff, s, FALSE),
+                            sizeof(*M)))
+                    continue;
+                nine_context_set_transform(device, s, M);
             }
         }
     }
@@ -2369,14 +2658,102 @@ init_draw_info(struct pipe_draw_info *info,
     info->restart_index = 0;
 }
 
+/* Appends the draw to the pending batch if it only differs from it by the
+ * draw range. The worker flushes the batch before any other instruction,
+ * thus the state can't have changed since the previous draw of the batch,
+ * and nine_update_state can be skipped. */
+static boolean
+nine_context_merge_draw(struct NineDevice9 *device,
+                        D3DPRIMITIVETYPE PrimitiveType,
+                        unsigned index_size,
+                        int index_bias,
+                        unsigned min_index,
+                        unsigned max_index,
+                        unsigned start,
+                        unsigned count)
+{
+    struct nine_context *context = &device->context;
+    struct pipe_draw_info *info = &context->draw_batch.info;
+    struct pipe_draw_start_count *draw;
+
+    if (!context->draw_batch.count)
+        return FALSE;
+
+    if (context->draw_batch.count == NINE_MAX_MERGED_DRAWS ||
+        info->mode != d3dprimitivetype_to_pipe_prim(PrimitiveType) ||
+        info->index_size != index_size ||
+        info->index_bias != index_bias) {
+        nine_context_flush_draws(device);
+        return FALSE;
+    }
+
+    info->min_index = MIN2(info->min_index, min_index);
+    info->max_index = MAX2(info->max_index, max_index);
+
+    draw = &context->draw_batch.draws[context->draw_batch.count++];
+    draw->start = start;
+    draw->count = count;
+    return TRUE;
+}
+
+/* Returns TRUE if the draw was done with the vertex shader on the cpu */
+static boolean
+nine_context_draw_swvp_cpu(struct NineDevice9 *device,
+                           const struct pipe_draw_info *info,
+                           const struct pipe_draw_start_count *draw,
+                           const struct pipe_vertex_buffer *vbuf0)
+{
+    struct nine_context *context = &device->context;
+
+    if (likely(!nine_context_swvp_on_cpu(device)))
+        return FALSE;
+    if (nine_swvp_cpu_draw(device, info, draw, vbuf0))
+        return TRUE;
+
+    /* The hardware vertex shader needs its constants */
+    if (context->commit & NINE_STATE_COMMIT_CONST_VS) {
+        commit_vs_constants(device);
+        context->commit &= ~NINE_STATE_COMMIT_CONST_VS;
+    }
+    return FALSE;
+}
+
+static void
+nine_context_draw(struct NineDevice9 *device,
+                  const struct pipe_draw_info *info,
+                  const struct pipe_draw_start_count *draw)
+{
+    struct nine_context *context = &device->context;
+
+    if (nine_context_draw_swvp_cpu(device, info, draw, NULL))
+        return;
+
+    /* Without csmt, the draws are executed immediately and there is
+     * no next instruction to flush the batch */
+    if (!device->csmt_active) {
+        context->pipe->draw_vbo(context->pipe, info, NULL, draw, 1);
+        return;
+    }
+
+    assert(!context->draw_batch.count);
+    context->draw_batch.info = *info;
+    context->draw_batch.draws[0] = *draw;
+    context->draw_batch.count = 1;
+}
+
 CSMT_ITEM_NO_WAIT(nine_context_draw_primitive,
                   ARG_VAL(D3DPRIMITIVETYPE, PrimitiveType),
                   ARG_VAL(UINT, StartVertex),
                   ARG_VAL(UINT, PrimitiveCount))
 {
-    struct nine_context *context = &device->context;
     struct pipe_draw_info info;
     struct pipe_draw_start_count draw;
+    const unsigned count = prim_count_to_vertex_count(PrimitiveType, PrimitiveCount);
+
+    if (nine_context_merge_draw(device, PrimitiveType, 0, 0,
+                                StartVertex, StartVertex + count - 1,
+                                StartVertex, count))
+        return;
 
     nine_update_state(device);
 
@@ -2388,7 +2765,7 @@ CSMT_ITEM_NO_WAIT(nine_context_draw_primitive,
     info.max_index = draw.start + draw.count - 1;
     info.index.resource = NULL;
 
-    context->pipe->draw_vbo(context->pipe, &info, NULL, &draw, 1);
+    nine_context_draw(device, &info, &draw);
 }
 
 CSMT_ITEM_NO_WAIT(nine_context_draw_indexed_primitive,
@@ -2403,6 +2780,13 @@ CSMT_ITEM_NO_WAIT(nine_context_draw_indexed_primitive,
     struct pipe_draw_info info;
     struct pipe_draw_start_count draw;
 
+    if (nine_context_merge_draw(device, PrimitiveType, context->index_size,
+                                BaseVertexIndex, MinVertexIndex,
+                                MinVertexIndex + NumVertices - 1,
+                                context->index_offset / context->index_size + StartIndex,
+                                prim_count_to_vertex_count(PrimitiveType, PrimitiveCount)))
+        return;
+
     nine_update_state(device);
 
     init_draw_info(&info, &draw, device, PrimitiveType, PrimitiveCount);
@@ -2415,7 +2799,7 @@ CSMT_ITEM_NO_WAIT(nine_context_draw_indexed_primitive,
     info.max_index = MinVertexIndex + NumVertices - 1;
     info.index.resource = context->idxbuf;
 
-    context->pipe->draw_vbo(context->pipe, &info, NULL, &draw, 1);
+    nine_context_draw(device, &info, &draw);
 }
 
 CSMT_ITEM_NO_WAIT(nine_context_draw_indexed_primitive_from_vtxbuf_idxbuf,
@@ -2448,6 +2832,9 @@ CSMT_ITEM_NO_WAIT(nine_context_draw_indexed_primitive_from_vtxbuf_idxbuf,
     else
         info.index.user = user_ibuf;
 
+    if (nine_context_draw_swvp_cpu(device, &info, &draw, vbuf))
+        return;
+
     context->pipe->set_vertex_buffers(context->pipe, 0, 1, 0, false, vbuf);
     context->changed.vtxbuf |= 1;
 
@@ -2540,6 +2927,19 @@ CSMT_ITEM_NO_WAIT_WITH_COUNTER(nine_context_range_upload,
     context->pipe->buffer_subdata(context->pipe, res, usage, offset, size, data);
 }
 
+/* Same as nine_context_range_upload, but the data is copied in the queue,
+ * so the caller can reuse the memory right away. */
+CSMT_ITEM_NO_WAIT(nine_context_range_upload_copy,
+                  ARG_BIND_RES(struct pipe_resource, res),
+                  ARG_VAL(unsigned, offset),
+                  ARG_MEM(uint8_t, data),
+                  ARG_MEM_SIZE(unsigned, data_size))
+{
+    struct nine_context *context = &device->context;
+
+    context->pipe->buffer_subdata(context->pipe, res, 0, offset, data_size, data);
+}
+
 CSMT_ITEM_NO_WAIT_WITH_COUNTER(nine_context_box_upload,
                                ARG_BIND_REF(struct NineUnknown, src_ref),
                                ARG_BIND_RES(struct pipe_resource, res),
@@ -2579,9 +2979,13 @@ CSMT_ITEM_NO_WAIT_WITH_COUNTER(nine_context_box_upload,
     if (!map)
         return;
 
+    p_atomic_add(&device->cpu_stats.upload_bytes,
+                 util_format_get_2d_size(src_format, src_stride, src_box->height) *
+                 src_box->depth);
+
     /* Note: if formats are the sames, it will revert
      * to normal memcpy */
-    (void) util_format_translate_3d(res->format,
+    (void) nine_format_translate_3d(res->format,
                                     map, transfer->stride,
                                     transfer->layer_stride,
                                     0, 0, 0,
@@ -2595,6 +2999,49 @@ CSMT_ITEM_NO_WAIT_WITH_COUNTER(nine_context_box_upload,
     pipe_transfer_unmap(pipe, transfer);
 }
 
+CSMT_ITEM_NO_WAIT_WITH_COUNTER(nine_context_box_upload_staged,
+                               ARG_BIND_REF(struct NineUnknown, src_ref),
+                               ARG_BIND_RES(struct pipe_resource, res),
+                               ARG_VAL(unsigned, level),
+                               ARG_COPY_REF(struct pipe_box, dst_box),
+                               ARG_VAL(struct nine_texture_upload_job *, job))
+{
+    /* Binding src_ref avoids release before upload */
+    (void)src_ref;
+
+    nine_texture_upload_finish(device, device->context.pipe, job,
+                               res, level, dst_box);
+}
+
+/* Same as nine_context_box_upload, but the copy of the data is done
+ * by the upload thread when possible. */
+void
+nine_context_box_upload_async(struct NineDevice9 *device,
+                              unsigned *counter,
+                              struct NineUnknown *src_ref,
+                              struct pipe_resource *res,
+                              unsigned level,
+                              const struct pipe_box *dst_box,
+                              enum pipe_format src_format,
+                              const void *src, unsigned src_stride,
+                              unsigned src_layer_stride,
+                              const struct pipe_box *src_box)
+{
+    struct nine_texture_upload_job *job;
+
+    job = nine_texture_upload_submit(device, res, src_format, src, src_stride,
+                                     src_layer_stride, src_box);
+    if (!job) {
+        nine_context_box_upload(device, counter, src_ref, res, level, dst_box,
+                                src_format, src, src_stride, src_layer_stride,
+                                src_box);
+        return;
+    }
+
+    nine_context_box_upload_staged(device, counter, src_ref, res, level,
+                                   dst_box, job);
+}
+
 struct pipe_query *
 nine_context_create_query(struct NineDevice9 *device, unsigned query_type)
 {
@@ -3155,20 +3602,32 @@ update_vertex_buffers_sw(struct NineDevice9 *device, int start_vertice, int num_
 }
 
 static void
-update_vs_constants_sw(struct NineDevice9 *device)
+update_vs_constants_sw(struct NineDevice9 *device, bool programmable_vs)
 {
     struct nine_state *state = &device->state;
     struct pipe_context *pipe_sw = device->pipe_sw;
+    /* The shaders are translated with swvp on, but without may_swvp
+     * the constant arrays have the hardware size. */
+    const unsigned num_const_f = device->may_swvp ? NINE_MAX_CONST_F_SWVP : NINE_MAX_CONST_F;
 
     DBG("updating\n");
 
-    {
+    if (!programmable_vs) {
+        struct pipe_constant_buffer cb;
+
+        cb.buffer = NULL;
+        cb.buffer_offset = 0;
+        cb.buffer_size = NINE_FF_NUM_VS_CONST * sizeof(float[4]);
+        cb.user_buffer = device->ff.vs_const;
+
+        pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 0, false, &cb);
+    } else {
         struct pipe_constant_buffer cb;
         const void *buf;
 
         cb.buffer = NULL;
         cb.buffer_offset = 0;
-        cb.buffer_size = 4096 * sizeof(float[4]);
+        cb.buffer_size = MIN2(num_const_f, 4096) * sizeof(float[4]);
         cb.user_buffer = state->vs_const_f;
 
         if (state->vs->lconstf.ranges) {
@@ -3177,7 +3636,7 @@ update_vs_constants_sw(struct NineDevice9 *device)
             unsigned n = 0;
             float *dst = device->state.vs_lconstf_temp;
             float *src = (float *)cb.user_buffer;
-            memcpy(dst, src, 8192 * sizeof(float[4]));
+            memcpy(dst, src, num_const_f * sizeof(float[4]));
             while (r) {
                 unsigned p = r->bgn;
                 unsigned c = r->end - r->bgn;
@@ -3194,19 +3653,22 @@ update_vs_constants_sw(struct NineDevice9 *device)
         if (cb.buffer)
             pipe_resource_reference(&cb.buffer, NULL);
 
-        cb.user_buffer = (char *)buf + 4096 * sizeof(float[4]);
+        if (num_const_f > 4096) {
+            cb.user_buffer = (char *)buf + 4096 * sizeof(float[4]);
 
-        pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 1, false, &cb);
-        if (cb.buffer)
-            pipe_resource_reference(&cb.buffer, NULL);
+            pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 1, false, &cb);
+            if (cb.buffer)
+                pipe_resource_reference(&cb.buffer, NULL);
+        } else
+            pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 1, false, NULL);
     }
 
-    {
+    if (programmable_vs) {
         struct pipe_constant_buffer cb;
 
         cb.buffer = NULL;
         cb.buffer_offset = 0;
-        cb.buffer_size = 2048 * sizeof(float[4]);
+        cb.buffer_size = VS_CONST_I_SIZE(device);
         cb.user_buffer = state->vs_const_i;
 
         pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 2, false, &cb);
@@ -3214,12 +3676,12 @@ update_vs_constants_sw(struct NineDevice9 *device)
             pipe_resource_reference(&cb.buffer, NULL);
     }
 
-    {
+    if (programmable_vs) {
         struct pipe_constant_buffer cb;
 
         cb.buffer = NULL;
         cb.buffer_offset = 0;
-        cb.buffer_size = 512 * sizeof(float[4]);
+        cb.buffer_size = VS_CONST_B_SIZE(device);
         cb.user_buffer = state->vs_const_b;
 
         pipe_sw->set_constant_buffer(pipe_sw, PIPE_SHADER_VERTEX, 3, false, &cb);
@@ -3260,23 +3722,31 @@ update_vs_constants_sw(struct NineDevice9 *device)
 
 }
 
-void
+HRESULT
 nine_state_prepare_draw_sw(struct NineDevice9 *device, struct NineVertexDeclaration9 *vdecl_out,
                            int start_vertice, int num_vertices, struct pipe_stream_output_info *so)
 {
     struct nine_state *state = &device->state;
     bool programmable_vs = state->vs && !(state->vdecl && state->vdecl->position_t);
-    struct NineVertexShader9 *vs = programmable_vs ? device->state.vs : device->ff.vs;
-
-    assert(programmable_vs);
+    void *cso;
 
     DBG("Preparing draw\n");
-    cso_set_vertex_shader_handle(device->cso_sw,
-                                 NineVertexShader9_GetVariantProcessVertices(vs, vdecl_out, so));
+    if (programmable_vs) {
+        cso = NineVertexShader9_GetVariantProcessVertices(state->vs, vdecl_out, so);
+    } else {
+        /* The ff shader and its constants are computed from the context */
+        nine_csmt_process(device);
+        cso = nine_ff_get_vs_process_vertices(device, vdecl_out, so);
+    }
+    if (!cso)
+        return D3DERR_DRIVERINTERNALERROR;
+
+    cso_set_vertex_shader_handle(device->cso_sw, cso);
     update_vertex_elements_sw(device);
     update_vertex_buffers_sw(device, start_vertice, num_vertices);
-    update_vs_constants_sw(device);
+    update_vs_constants_sw(device, programmable_vs);
     DBG("Preparation succeeded\n");
+    return D3D_OK;
 }
 
 void
@@ -3294,13 +3764,62 @@ nine_state_after_draw_sw(struct NineDevice9 *device)
         sw_internal->transfers_so[i] = NULL;
     }
     nine_context_get_pipe_release(device);
+
+    /* The variant may be destroyed before the next ProcessVertices
+     * (ff cache pruned, shader released) */
+    cso_set_vertex_shader_handle(device->cso_sw, NULL);
+}
+
+/* The stream output buffer of ProcessVertices is kept between calls,
+ * and only reallocated when a bigger one is needed. */
+struct pipe_stream_output_target *
+nine_state_get_so_target_sw(struct NineDevice9 *device, unsigned size)
+{
+    struct nine_state_sw_internal *sw_internal = &device->state_sw_internal;
+    struct pipe_screen *screen_sw = device->screen_sw;
+    struct pipe_context *pipe_sw = device->pipe_sw;
+    struct pipe_resource templ;
+
+    if (sw_internal->so_target && sw_internal->so_buffer->width0 >= size)
+        return sw_internal->so_target;
+
+    if (sw_internal->so_target)
+        pipe_sw->stream_output_target_destroy(pipe_sw, sw_internal->so_target);
+    sw_internal->so_target = NULL;
+    pipe_resource_reference(&sw_internal->so_buffer, NULL);
+
+    memset(&templ, 0, sizeof(templ));
+    templ.target = PIPE_BUFFER;
+    templ.format = PIPE_FORMAT_R8_UNORM;
+    templ.width0 = util_next_power_of_two(MAX2(size, 64 * 1024));
+    templ.flags = 0;
+    templ.bind = PIPE_BIND_STREAM_OUTPUT;
+    templ.usage = PIPE_USAGE_STREAM;
+    templ.height0 = templ.depth0 = templ.array_size = 1;
+    templ.last_level = templ.nr_samples = templ.nr_storage_samples = 0;
+
+    sw_internal->so_buffer = screen_sw->resource_create(screen_sw, &templ);
+    if (!sw_internal->so_buffer)
+        return NULL;
+    sw_internal->so_target =
+        pipe_sw->create_stream_output_target(pipe_sw, sw_internal->so_buffer,
+                                             0, templ.width0);
+    if (!sw_internal->so_target)
+        pipe_resource_reference(&sw_internal->so_buffer, NULL);
+    return sw_internal->so_target;
 }
 
 void
 nine_state_destroy_sw(struct NineDevice9 *device)
 {
-    (void) device;
-    /* Everything destroyed with cso */
+    struct nine_state_sw_internal *sw_internal = &device->state_sw_internal;
+
+    /* Everything else destroyed with cso */
+    if (sw_internal->so_target)
+        device->pipe_sw->stream_output_target_destroy(device->pipe_sw,
+                                                      sw_internal->so_target);
+    sw_internal->so_target = NULL;
+    pipe_resource_reference(&sw_internal->so_buffer, NULL);
 }
 
 /*
@@ -26,6 +26,7 @@
 #include "d3d9.h"
 #include "iunknown.h"
 #include "nine_defines.h"
+#include "nine_queue.h"
 #include "pipe/p_state.h"
 #include "util/list.h"
 
@@ -57,6 +58,9 @@
 #define NINED3DTSS_COUNT  (NINED3DTSS_LAST + 1)
 #define NINED3DTS_COUNT   (NINED3DTS_LAST + 1)
 
+/* Maximum number of draws the csmt worker merges into one draw_vbo */
+#define NINE_MAX_MERGED_DRAWS 64
+
 #define NINE_STATE_FB          (1 <<  0)
 #define NINE_STATE_VIEWPORT    (1 <<  1)
 #define NINE_STATE_SCISSOR     (1 <<  2)
@@ -232,6 +236,10 @@ struct nine_context {
         BOOL ps_const_i;
         BOOL ps_const_b;
         BOOL ucp;
+        /* Registers [bgn, end) of the constant buffer layout (float constants,
+         * then int and bool constants) modified since the last upload */
+        unsigned vs_const_range[2];
+        unsigned ps_const_range[2];
     } changed;
 
     uint32_t bumpmap_vars[6 * NINE_MAX_TEXTURE_STAGES];
@@ -313,6 +321,9 @@ struct nine_context {
 
     /* software vertex processing */
     boolean swvp;
+    /* vertex elements of the draws, for the swvp on the cpu */
+    struct pipe_vertex_element swvp_velems[PIPE_MAX_ATTRIBS];
+    unsigned swvp_num_velems;
 
     uint32_t commit;
     struct {
@@ -329,10 +340,21 @@ struct nine_context {
         struct pipe_constant_buffer cb_vs_ff;
         struct pipe_constant_buffer cb_ps_ff;
     } pipe_data;
+
+    /* Consecutive draws with the same state, merged by the csmt worker
+     * into one multi draw. */
+    struct {
+        struct pipe_draw_info info;
+        struct pipe_draw_start_count draws[NINE_MAX_MERGED_DRAWS];
+        unsigned count;
+        unsigned merged; /* draws merged since the last frame */
+    } draw_batch;
 };
 
 struct nine_state_sw_internal {
     struct pipe_transfer *transfers_so[4];
+    struct pipe_resource *so_buffer;
+    struct pipe_stream_output_target *so_target;
 };
 
 struct nine_clipplane {
@@ -452,6 +474,16 @@ nine_context_set_pixel_shader_constant_b(struct NineDevice9 *device,
                                          const unsigned pConstantData_size,
                                          UINT BoolCount);
 
+/* Start the background compilation of the variant matching the current
+ * state. No-op if it is already compiled. */
+void
+nine_context_precompile_vertex_shader(struct NineDevice9 *device,
+                                      struct NineVertexShader9 *vs);
+
+void
+nine_context_precompile_pixel_shader(struct NineDevice9 *device,
+                                     struct NinePixelShader9 *ps);
+
 void
 nine_context_set_viewport(struct NineDevice9 *device,
                           const D3DVIEWPORT9 *viewport);
@@ -505,6 +537,7 @@ nine_context_set_swvp(struct NineDevice9 *device,
 
 void
 nine_context_apply_stateblock(struct NineDevice9 *device,
+                              const struct nine_state *cur,
                               const struct nine_state *src);
 
 void
@@ -583,6 +616,14 @@ nine_context_range_upload(struct NineDevice9 *device,
                           unsigned usage,
                           const void *data);
 
+/* size has to be small enough to fit in the csmt queue */
+void
+nine_context_range_upload_copy(struct NineDevice9 *device,
+                               struct pipe_resource *res,
+                               unsigned offset,
+                               const uint8_t *data,
+                               unsigned data_size);
+
 void
 nine_context_box_upload(struct NineDevice9 *device,
                         unsigned *counter,
@@ -595,6 +636,29 @@ nine_context_box_upload(struct NineDevice9 *device,
                         unsigned src_layer_stride,
                         const struct pipe_box *src_box);
 
+struct nine_texture_upload_job;
+
+void
+nine_context_box_upload_staged(struct NineDevice9 *device,
+                               unsigned *counter,
+                               struct NineUnknown *src_ref,
+                               struct pipe_resource *res,
+                               unsigned level,
+                               const struct pipe_box *dst_box,
+                               struct nine_texture_upload_job *job);
+
+void
+nine_context_box_upload_async(struct NineDevice9 *device,
+                              unsigned *counter,
+                              struct NineUnknown *src_ref,
+                              struct pipe_resource *res,
+                              unsigned level,
+                              const struct pipe_box *dst_box,
+                              enum pipe_format src_format,
+                              const void *src, unsigned src_stride,
+                              unsigned src_layer_stride,
+                              const struct pipe_box *src_box);
+
 struct pipe_query *
 nine_context_create_query(struct NineDevice9 *device, unsigned query_type);
 
@@ -623,12 +687,14 @@ void nine_context_clear(struct NineDevice9 *);
 void nine_context_update_state(struct NineDevice9 *);
 
 void nine_state_init_sw(struct NineDevice9 *device);
-void nine_state_prepare_draw_sw(struct NineDevice9 *device,
-                                struct NineVertexDeclaration9 *vdecl_out,
-                                int start_vertice,
-                                int num_vertices,
-                                struct pipe_stream_output_info *so);
+HRESULT nine_state_prepare_draw_sw(struct NineDevice9 *device,
+                                   struct NineVertexDeclaration9 *vdecl_out,
+                                   int start_vertice,
+                                   int num_vertices,
+                                   struct pipe_stream_output_info *so);
 void nine_state_after_draw_sw(struct NineDevice9 *device);
+struct pipe_stream_output_target *
+nine_state_get_so_target_sw(struct NineDevice9 *device, unsigned size);
 void nine_state_destroy_sw(struct NineDevice9 *device);
 
 void
@@ -653,8 +719,17 @@ const char *nine_d3drs_to_string(DWORD State);
 /* CSMT functions */
 struct csmt_context;
 
+/* Per frame statistics of the CSMT handoff */
+struct nine_csmt_stats {
+    struct nine_queue_stats queue;
+    unsigned syncs; /* waits for the worker to finish its work */
+    uint64_t sync_ns;
+    unsigned merged_draws; /* draws merged with the previous draw */
+};
+
+/* queue_depth is the number of command buffers, 0 for the default. */
 struct csmt_context *
-nine_csmt_create( struct NineDevice9 *This );
+nine_csmt_create( struct NineDevice9 *This, unsigned queue_depth );
 
 void
 nine_csmt_destroy( struct NineDevice9 *This, struct csmt_context *ctx );
@@ -667,6 +742,10 @@ nine_csmt_process( struct NineDevice9 *This );
 void
 nine_csmt_flush( struct NineDevice9 *This );
 
+/* To be called once per frame, updates the csmt statistics of the device */
+void
+nine_csmt_end_frame( struct NineDevice9 *This );
+
 /* Get the pipe_context (should not be called from the worker thread).
  * All the work in the worker thread is finished before returning. */
 struct pipe_context *
@@ -0,0 +1,413 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "device9.h"
+#include "nine_debug.h"
+#include "nine_shader.h"
+#include "nine_swvp_cpu.h"
+#include "vertexshader9.h"
+
+#include "cso_cache/cso_context.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "tgsi/tgsi_ureg.h"
+#include "util/format/u_format.h"
+#include "util/u_box.h"
+#include "util/u_inlines.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_prim.h"
+#include "util/u_simple_shaders.h"
+#include "util/u_upload_mgr.h"
+
+#define DBG_CHANNEL DBG_DEVICE
+
+void
+nine_swvp_cpu_init(struct NineDevice9 *device, boolean enable)
+{
+    struct pipe_screen *screen_sw = device->screen_sw;
+    struct pipe_rasterizer_state rast;
+    struct pipe_blend_state blend;
+    struct pipe_depth_stencil_alpha_state dsa;
+    struct pipe_framebuffer_state fb;
+    struct pipe_context *pipe;
+    struct cso_context *cso;
+
+    memset(&device->swvp_cpu, 0, sizeof(device->swvp_cpu));
+
+    /* Without software screen, the device runs the vertex shaders anyway */
+    if (!enable || !device->may_swvp || screen_sw == device->screen)
+        return;
+    if (!screen_sw->get_param(screen_sw, PIPE_CAP_MAX_STREAM_OUTPUT_BUFFERS) ||
+        !device->driver_caps.user_sw_vbufs)
+        return;
+
+    /* pipe_sw is used by ProcessVertices from the application thread */
+    pipe = screen_sw->context_create(screen_sw, NULL, 0);
+    if (!pipe)
+        return;
+    cso = cso_create_context(pipe, 0);
+    if (!cso) {
+        pipe->destroy(pipe);
+        return;
+    }
+
+    /* Only the stream output is used. The strips and fans are
+     * decomposed with the first vertex provoking, as for d3d. */
+    memset(&rast, 0, sizeof(rast));
+    rast.rasterizer_discard = true;
+    rast.flatshade_first = true;
+    rast.point_quad_rasterization = 1; /* to make llvmpipe happy */
+    cso_set_rasterizer(cso, &rast);
+
+    /* dummy settings */
+    memset(&blend, 0, sizeof(blend));
+    memset(&dsa, 0, sizeof(dsa));
+    memset(&fb, 0, sizeof(fb));
+    cso_set_blend(cso, &blend);
+    cso_set_depth_stencil_alpha(cso, &dsa);
+    cso_set_framebuffer(cso, &fb);
+    cso_set_viewport_dims(cso, 1.0, 1.0, false);
+    device->swvp_cpu.fs = util_make_empty_fragment_shader(pipe);
+    cso_set_fragment_shader_handle(cso, device->swvp_cpu.fs);
+
+    device->swvp_cpu.pipe = pipe;
+    device->swvp_cpu.cso = cso;
+    device->swvp_cpu.active = TRUE;
+}
+
+void
+nine_swvp_cpu_fini(struct NineDevice9 *device)
+{
+    struct pipe_context *pipe = device->swvp_cpu.pipe;
+
+    if (!device->swvp_cpu.active)
+        return;
+
+    DBG("swvp draws: %u on the cpu, %u on the device\n",
+        device->swvp_cpu.draws, device->swvp_cpu.fallbacks);
+
+    /* The shader variants were destroyed with the shaders */
+    cso_destroy_context(device->swvp_cpu.cso);
+    if (device->swvp_cpu.so_target)
+        pipe->stream_output_target_destroy(pipe, device->swvp_cpu.so_target);
+    pipe_resource_reference(&device->swvp_cpu.so_buffer, NULL);
+    if (device->swvp_cpu.fs)
+        pipe->delete_fs_state(pipe, device->swvp_cpu.fs);
+    pipe->destroy(pipe);
+    memset(&device->swvp_cpu, 0, sizeof(device->swvp_cpu));
+}
+
+boolean
+nine_swvp_cpu_use(struct NineDevice9 *device)
+{
+    struct nine_context *context = &device->context;
+    const struct NineVertexShader9 *vs = context->vs;
+
+    return device->swvp_cpu.active && context->swvp && context->programmable_vs &&
+           !vs->sampler_mask && !vs->position_t;
+}
+
+/* Same as nine_state_get_so_target_sw, for the cpu context */
+static struct pipe_stream_output_target *
+get_so_target(struct NineDevice9 *device, unsigned size)
+{
+    struct pipe_screen *screen_sw = device->screen_sw;
+    struct pipe_context *pipe = device->swvp_cpu.pipe;
+    struct pipe_resource templ;
+
+    if (device->swvp_cpu.so_target && device->swvp_cpu.so_buffer->width0 >= size)
+        return device->swvp_cpu.so_target;
+
+    if (device->swvp_cpu.so_target)
+        pipe->stream_output_target_destroy(pipe, device->swvp_cpu.so_target);
+    device->swvp_cpu.so_target = NULL;
+    pipe_resource_reference(&device->swvp_cpu.so_buffer, NULL);
+
+    memset(&templ, 0, sizeof(templ));
+    templ.target = PIPE_BUFFER;
+    templ.format = PIPE_FORMAT_R8_UNORM;
+    templ.width0 = util_next_power_of_two(MAX2(size, 64 * 1024));
+    templ.bind = PIPE_BIND_STREAM_OUTPUT;
+    templ.usage = PIPE_USAGE_STREAM;
+    templ.height0 = templ.depth0 = templ.array_size = 1;
+
+    device->swvp_cpu.so_buffer = screen_sw->resource_create(screen_sw, &templ);
+    if (!device->swvp_cpu.so_buffer)
+        return NULL;
+    device->swvp_cpu.so_target =
+        pipe->create_stream_output_target(pipe, device->swvp_cpu.so_buffer,
+                                          0, templ.width0);
+    if (!device->swvp_cpu.so_target)
+        pipe_resource_reference(&device->swvp_cpu.so_buffer, NULL);
+    return device->swvp_cpu.so_target;
+}
+
+/* Runs the vertex shader on the cpu context, with the vertex data of the
+ * device mapped. Returns the number of vertices streamed out, 0 on failure. */
+static unsigned
+process_vertices(struct NineDevice9 *device,
+                 const struct nine_swvp_cpu_variant *variant,
+                 const struct pipe_draw_info *info,
+                 const struct pipe_draw_start_count *draw,
+                 const struct pipe_vertex_buffer *vbuf0)
+{
+    static const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    struct nine_context *context = &device->context;
+    struct pipe_context *pipe = context->pipe;
+    struct pipe_context *pipe_cpu = device->swvp_cpu.pipe;
+    struct pipe_transfer *transfers[PIPE_MAX_ATTRIBS + 1] = { NULL };
+    struct pipe_stream_output_target *target;
+    struct cso_velems_state ve;
+    struct pipe_draw_info info_cpu = *info;
+    struct pipe_draw_start_count draw_cpu = *draw;
+    const unsigned num_vertices =
+        u_decomposed_prims_for_vertices(info->mode, draw->count) *
+        u_vertices_per_prim(u_reduced_prim(info->mode)) * info->instance_count;
+    const int first = info->min_index + (info->index_size ? info->index_bias : 0);
+    const int last = info->max_index + (info->index_size ? info->index_bias : 0);
+    unsigned elem_end[PIPE_MAX_ATTRIBS] = { 0 };
+    uint32_t streams = 0, instanced = 0;
+    unsigned offsets[1] = { 0 };
+    unsigned i, num_streams;
+    unsigned ret = 0;
+
+    target = get_so_target(device, num_vertices * variant->num_outputs * sizeof(float[4]));
+    if (!target)
+        return 0;
+
+    ve.count = context->swvp_num_velems;
+    memcpy(ve.velems, context->swvp_velems, ve.count * sizeof(ve.velems[0]));
+    for (i = 0; i < ve.count; i++) {
+        const unsigned b = ve.velems[i].vertex_buffer_index;
+
+        streams |= 1 << b;
+        if (ve.velems[i].instance_divisor)
+            instanced |= 1 << b;
+        elem_end[b] = MAX2(elem_end[b], ve.velems[i].src_offset +
+                           util_format_get_blocksize(ve.velems[i].src_format));
+    }
+    num_streams = util_last_bit(streams);
+
+    /* Only the range of the draw is mapped, the vertex buffers can be huge */
+    for (i = 0; i < num_streams; i++) {
+        const struct pipe_vertex_buffer *src = i == 0 && vbuf0 ? vbuf0 : &context->vtxbuf[i];
+        struct pipe_vertex_buffer vtxbuf;
+
+        if (!(streams & (1 << i)))
+            continue;
+
+        memset(&vtxbuf, 0, sizeof(vtxbuf));
+        vtxbuf.is_user_buffer = true;
+
+        if ((int)i == context->dummy_vbo_bound_at) {
+            vtxbuf.buffer.user = zero;
+        } else if (src->is_user_buffer) {
+            vtxbuf = *src;
+        } else if (src->buffer.resource) {
+            struct pipe_resource *res = src->buffer.resource;
+            unsigned start = src->buffer_offset;
+            unsigned size = res->width0 - MIN2(start, res->width0);
+            int base = 0;
+            uint8_t *map;
+
+            if (!(instanced & (1 << i))) {
+                base = first;
+                start += first * src->stride;
+                size = MIN2((last - first) * src->stride + elem_end[i],
+                            res->width0 - MIN2(start, res->width0));
+            }
+            if (!size)
+                goto out;
+            map = pipe_buffer_map_range(pipe, res, start, size,
+                                        PIPE_MAP_READ, &transfers[i]);
+            if (!map)
+                goto out;
+            vtxbuf.stride = src->stride;
+            vtxbuf.buffer.user = map - base * (int)src->stride;
+        } else {
+            goto out;
+        }
+        pipe_cpu->set_vertex_buffers(pipe_cpu, i, 1, 0, false, &vtxbuf);
+    }
+
+    if (info->index_size) {
+        const unsigned offset = draw->start * info->index_size;
+        const unsigned size = draw->count * info->index_size;
+
+        if (info->has_user_indices) {
+            info_cpu.index.user = (const uint8_t *)info->index.user + offset;
+        } else {
+            info_cpu.index.user = pipe_buffer_map_range(pipe, info->index.resource,
+                                                        offset, size, PIPE_MAP_READ,
+                                                        &transfers[PIPE_MAX_ATTRIBS]);
+            if (!info_cpu.index.user)
+                goto out;
+        }
+        info_cpu.has_user_indices = true;
+        draw_cpu.start = 0;
+    }
+
+    /* The constant arrays are used in place: the draw module runs
+     * the vertex shader before draw_vbo returns. */
+    pipe_cpu->set_constant_buffer(pipe_cpu, PIPE_SHADER_VERTEX, 0, false, &context->pipe_data.cb0_swvp);
+    pipe_cpu->set_constant_buffer(pipe_cpu, PIPE_SHADER_VERTEX, 1, false, &context->pipe_data.cb1_swvp);
+    pipe_cpu->set_constant_buffer(pipe_cpu, PIPE_SHADER_VERTEX, 2, false, &context->pipe_data.cb2_swvp);
+    pipe_cpu->set_constant_buffer(pipe_cpu, PIPE_SHADER_VERTEX, 3, false, &context->pipe_data.cb3_swvp);
+
+    cso_set_vertex_shader_handle(device->swvp_cpu.cso, variant->cso);
+    cso_set_vertex_elements(device->swvp_cpu.cso, &ve);
+    pipe_cpu->set_stream_output_targets(pipe_cpu, 1, &target, offsets);
+
+    pipe_cpu->draw_vbo(pipe_cpu, &info_cpu, NULL, &draw_cpu, 1);
+
+    pipe_cpu->set_stream_output_targets(pipe_cpu, 0, NULL, NULL);
+    ret = num_vertices;
+
+out:
+    pipe_cpu->set_vertex_buffers(pipe_cpu, 0, 0, num_streams, false, NULL);
+    for (i = 0; i < ARRAY_SIZE(transfers); i++)
+        if (transfers[i])
+            pipe->transfer_unmap(pipe, transfers[i]);
+    return ret;
+}
+
+boolean
+nine_swvp_cpu_draw(struct NineDevice9 *device,
+                   const struct pipe_draw_info *info,
+                   const struct pipe_draw_start_count *draw,
+                   const struct pipe_vertex_buffer *vbuf0)
+{
+    struct nine_context *context = &device->context;
+    struct pipe_context *pipe = context->pipe;
+    struct pipe_context *pipe_cpu = device->swvp_cpu.pipe;
+    struct nine_swvp_cpu_variant *variant;
+    struct pipe_transfer *transfer;
+    struct pipe_vertex_buffer vtxbuf;
+    struct cso_velems_state ve;
+    struct pipe_draw_info info_hw;
+    struct pipe_draw_start_count draw_hw;
+    unsigned num_vertices, size, i;
+    const void *map;
+
+    variant = NineVertexShader9_GetVariantSwvpCpu(context->vs);
+    if (!variant || !variant->cso || !variant->cso_passthrough) {
+        device->swvp_cpu.fallbacks++;
+        return FALSE;
+    }
+
+    num_vertices = process_vertices(device, variant, info, draw, vbuf0);
+    if (!num_vertices) {
+        device->swvp_cpu.fallbacks++;
+        return FALSE;
+    }
+
+    /* The draw module is done with the buffer */
+    size = num_vertices * variant->num_outputs * sizeof(float[4]);
+    map = pipe_buffer_map_range(pipe_cpu, device->swvp_cpu.so_buffer, 0, size,
+                                PIPE_MAP_READ, &transfer);
+    if (!map) {
+        device->swvp_cpu.fallbacks++;
+        return FALSE;
+    }
+    memset(&vtxbuf, 0, sizeof(vtxbuf));
+    vtxbuf.stride = variant->num_outputs * sizeof(float[4]);
+    u_upload_data(pipe->stream_uploader, 0, size, 16, map,
+                  &vtxbuf.buffer_offset, &vtxbuf.buffer.resource);
+    u_upload_unmap(pipe->stream_uploader);
+    pipe_cpu->transfer_unmap(pipe_cpu, transfer);
+    if (!vtxbuf.buffer.resource) {
+        device->swvp_cpu.fallbacks++;
+        return FALSE;
+    }
+
+    ve.count = variant->num_outputs;
+    for (i = 0; i < ve.count; i++) {
+        ve.velems[i].src_offset = i * sizeof(float[4]);
+        ve.velems[i].instance_divisor = 0;
+        ve.velems[i].vertex_buffer_index = 0;
+        ve.velems[i].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+    }
+
+    /* The vertices are in primitive order, without instancing */
+    memset(&info_hw, 0, sizeof(info_hw));
+    info_hw.mode = u_reduced_prim(info->mode);
+    info_hw.instance_count = 1;
+    info_hw.max_index = num_vertices - 1;
+    draw_hw.start = 0;
+    draw_hw.count = num_vertices;
+
+    cso_save_state(context->cso, CSO_BIT_VERTEX_ELEMENTS);
+    cso_set_vertex_elements(context->cso, &ve);
+    pipe->bind_vs_state(pipe, variant->cso_passthrough);
+    pipe->set_vertex_buffers(pipe, 0, 1, 0, false, &vtxbuf);
+    pipe_vertex_buffer_unreference(&vtxbuf);
+
+    pipe->draw_vbo(pipe, &info_hw, NULL, &draw_hw, 1);
+
+    /* Restore the state of the hardware vertex shader */
+    pipe->bind_vs_state(pipe, context->cso_shader.vs);
+    cso_restore_state(context->cso);
+    if (context->dummy_vbo_bound_at == 0)
+        context->vbo_bound_done = FALSE;
+    context->changed.vtxbuf |= 1;
+
+    device->swvp_cpu.draws++;
+    return TRUE;
+}
+
+void *
+nine_swvp_cpu_create_passthrough(struct pipe_context *pipe,
+                                 const struct nine_shader_info *info)
+{
+    struct ureg_program *ureg = ureg_create(PIPE_SHADER_VERTEX);
+    unsigned i;
+
+    if (!ureg)
+        return NULL;
+
+    /* Same output semantics as the hardware variant,
+     * for the linkage with the pixel shader */
+    for (i = 0; i < info->so_num_outputs; i++)
+        ureg_MOV(ureg, ureg_DECL_output(ureg, info->so_semantic_name[i],
+                                        info->so_semantic_index[i]),
+                 ureg_DECL_vs_input(ureg, i));
+    ureg_END(ureg);
+
+    return nine_create_shader_with_so_and_destroy(ureg, pipe, NULL);
+}
+
+void
+nine_swvp_cpu_variants_free(struct NineDevice9 *device,
+                            struct nine_swvp_cpu_variant *list,
+                            struct pipe_context *pipe)
+{
+    while (list) {
+        struct nine_swvp_cpu_variant *next = list->next;
+
+        if (list->cso)
+            device->swvp_cpu.pipe->delete_vs_state(device->swvp_cpu.pipe, list->cso);
+        if (list->cso_passthrough)
+            pipe->delete_vs_state(pipe, list->cso_passthrough);
+        FREE(list);
+        list = next;
+    }
+}
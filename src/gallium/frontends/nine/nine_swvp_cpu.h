@@ -0,0 +1,81 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#ifndef _NINE_SWVP_CPU_H_
+#define _NINE_SWVP_CPU_H_
+
+#include "pipe/p_compiler.h"
+
+struct NineDevice9;
+struct nine_shader_info;
+struct pipe_context;
+struct pipe_draw_info;
+struct pipe_draw_start_count;
+struct pipe_vertex_buffer;
+
+/* Software vertex processing on the software renderer.
+ * With force_sw_rendering_on_cpu, the vertex shaders of the swvp draws
+ * run on a context of the software screen (the draw module of llvmpipe),
+ * which reads the constant arrays of nine_context directly. Their outputs
+ * are captured with stream output, and the device draws them with a
+ * passthrough vertex shader. The device then doesn't need the 8192 float
+ * constants uploaded for each draw.
+ * Shaders with samplers or a POSITIONT output, and the fixed function,
+ * keep the hardware vertex shaders. Only used by nine_context. */
+
+struct nine_swvp_cpu_variant
+{
+    struct nine_swvp_cpu_variant *next;
+    uint64_t key;
+    void *cso; /* on the cpu context, streams out all the outputs. NULL on failure */
+    void *cso_passthrough; /* on the device context */
+    unsigned num_outputs;
+};
+
+void
+nine_swvp_cpu_init(struct NineDevice9 *device, boolean enable);
+
+void
+nine_swvp_cpu_fini(struct NineDevice9 *device);
+
+/* Whether the vertex shader of the current state runs on the cpu */
+boolean
+nine_swvp_cpu_use(struct NineDevice9 *device);
+
+/* Called after nine_update_state. Returns FALSE if the draw has to be
+ * done with the hardware vertex shader instead.
+ * vbuf0, if not NULL, replaces the vertex buffer of the stream 0. */
+boolean
+nine_swvp_cpu_draw(struct NineDevice9 *device,
+                   const struct pipe_draw_info *info,
+                   const struct pipe_draw_start_count *draw,
+                   const struct pipe_vertex_buffer *vbuf0);
+
+/* Vertex shader reading the stream output of a variant */
+void *
+nine_swvp_cpu_create_passthrough(struct pipe_context *pipe,
+                                 const struct nine_shader_info *info);
+
+void
+nine_swvp_cpu_variants_free(struct NineDevice9 *device,
+                            struct nine_swvp_cpu_variant *list,
+                            struct pipe_context *pipe);
+
+#endif /* _NINE_SWVP_CPU_H_ */
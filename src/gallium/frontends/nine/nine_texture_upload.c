@@ -0,0 +1,255 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#include "device9.h"
+#include "nine_debug.h"
+#include "nine_pipe.h"
+#include "nine_texture_upload.h"
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "util/u_atomic.h"
+#include "util/u_box.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_queue.h"
+#include "util/u_surface.h"
+
+#define DBG_CHANNEL DBG_DEVICE
+
+/* Smaller uploads are cheaper to do directly */
+#define NINE_TEXTURE_UPLOAD_MIN_SIZE (64 * 1024)
+/* Above that amount in flight, uploads are done directly */
+#define NINE_TEXTURE_UPLOAD_MAX_PENDING (64 * 1024 * 1024)
+
+struct nine_texture_upload_job
+{
+    struct NineDevice9 *device;
+    struct util_queue_fence ready; /* the upload thread is done */
+
+    /* in */
+    enum pipe_format format;
+    const uint8_t *src;
+    unsigned src_stride;
+    unsigned src_layer_stride;
+    struct pipe_box src_box;
+    unsigned size;
+
+    /* out */
+    struct pipe_resource *staging; /* NULL on failure */
+    struct pipe_fence_handle *fence;
+};
+
+void
+nine_texture_upload_init(struct NineDevice9 *device, boolean enable)
+{
+    struct pipe_screen *screen = device->screen;
+    struct pipe_context *pipe;
+
+    memset(&device->texture_upload, 0, sizeof(device->texture_upload));
+
+    /* Without csmt, the command would wait for the job right away */
+    if (!enable || !device->csmt_active)
+        return;
+
+    /* Only used by the upload thread */
+    pipe = screen->context_create(screen, NULL, 0);
+    if (!pipe)
+        return;
+
+    if (!util_queue_init(&device->texture_upload.queue, "nine_upload",
+                         32, 1, UTIL_QUEUE_INIT_RESIZE_IF_FULL)) {
+        pipe->destroy(pipe);
+        return;
+    }
+
+    device->texture_upload.pipe = pipe;
+    device->texture_upload.active = TRUE;
+}
+
+void
+nine_texture_upload_fini(struct NineDevice9 *device)
+{
+    if (!device->texture_upload.active)
+        return;
+
+    /* All the jobs have been consumed by the nine_context commands */
+    util_queue_destroy(&device->texture_upload.queue);
+    device->texture_upload.pipe->destroy(device->texture_upload.pipe);
+    device->texture_upload.pipe = NULL;
+    device->texture_upload.active = FALSE;
+
+    DBG("Texture uploads: %u staged, %u direct, %u waits\n",
+        device->texture_upload.staged, device->texture_upload.direct,
+        device->texture_upload.waits);
+}
+
+static void
+nine_texture_upload_execute(void *data, int thread_index)
+{
+    struct nine_texture_upload_job *job = data;
+    struct pipe_context *pipe = job->device->texture_upload.pipe;
+    struct pipe_screen *screen = job->device->screen;
+    struct pipe_resource templ;
+    struct pipe_transfer *transfer = NULL;
+    struct pipe_box box;
+    uint8_t *map;
+
+    (void) thread_index;
+
+    memset(&templ, 0, sizeof(templ));
+    templ.target = job->src_box.depth > 1 ? PIPE_TEXTURE_3D : PIPE_TEXTURE_2D;
+    templ.format = job->format;
+    templ.width0 = job->src_box.width;
+    templ.height0 = job->src_box.height;
+    templ.depth0 = job->src_box.depth;
+    templ.array_size = 1;
+    templ.usage = PIPE_USAGE_STAGING;
+
+    job->staging = screen->resource_create(screen, &templ);
+    if (!job->staging)
+        return;
+
+    u_box_3d(0, 0, 0, job->src_box.width, job->src_box.height,
+             job->src_box.depth, &box);
+    map = pipe->transfer_map(pipe, job->staging, 0,
+                             PIPE_MAP_WRITE | PIPE_MAP_DISCARD_WHOLE_RESOURCE,
+                             &box, &transfer);
+    if (!map) {
+        pipe_resource_reference(&job->staging, NULL);
+        return;
+    }
+
+    util_copy_box(map, job->format,
+                  transfer->stride, transfer->layer_stride,
+                  0, 0, 0,
+                  job->src_box.width, job->src_box.height, job->src_box.depth,
+                  job->src, job->src_stride, job->src_layer_stride,
+                  job->src_box.x, job->src_box.y, job->src_box.z);
+
+    pipe->transfer_unmap(pipe, transfer);
+    pipe->flush(pipe, &job->fence, 0);
+}
+
+struct nine_texture_upload_job *
+nine_texture_upload_submit(struct NineDevice9 *device,
+                           struct pipe_resource *res,
+                           enum pipe_format src_format,
+                           const void *src, unsigned src_stride,
+                           unsigned src_layer_stride,
+                           const struct pipe_box *src_box)
+{
+    struct nine_texture_upload_job *job;
+    unsigned size;
+
+    if (!device->texture_upload.active)
+        return NULL;
+
+    size = util_format_get_2d_size(src_format, src_stride, src_box->height) *
+        src_box->depth;
+    /* The staging texture is copied on the GPU, which requires the same
+     * format. The ATI1/ATI2 surfaces can be smaller than a block. */
+    if (size < NINE_TEXTURE_UPLOAD_MIN_SIZE ||
+        src_format != res->format || is_ATI1_ATI2(src_format) ||
+        res->target == PIPE_BUFFER ||
+        p_atomic_read(&device->texture_upload.pending_bytes) + size >
+            NINE_TEXTURE_UPLOAD_MAX_PENDING) {
+        device->texture_upload.direct++;
+        return NULL;
+    }
+
+    job = CALLOC_STRUCT(nine_texture_upload_job);
+    if (!job)
+        return NULL;
+
+    job->device = device;
+    job->format = src_format;
+    job->src = src;
+    job->src_stride = src_stride;
+    job->src_layer_stride = src_layer_stride;
+    job->src_box = *src_box;
+    job->size = size;
+    util_queue_fence_init(&job->ready);
+
+    p_atomic_add(&device->texture_upload.pending_bytes, size);
+    device->texture_upload.staged++;
+    util_queue_add_job(&device->texture_upload.queue, job, &job->ready,
+                       nine_texture_upload_execute, NULL, 0);
+    return job;
+}
+
+void
+nine_texture_upload_finish(struct NineDevice9 *device,
+                           struct pipe_context *pipe,
+                           struct nine_texture_upload_job *job,
+                           struct pipe_resource *res,
+                           unsigned level,
+                           const struct pipe_box *dst_box)
+{
+    struct pipe_screen *screen = device->screen;
+    struct pipe_box box;
+
+    if (!util_queue_fence_is_signalled(&job->ready)) {
+        p_atomic_inc(&device->texture_upload.waits);
+        util_queue_fence_wait(&job->ready);
+    }
+
+    if (job->staging) {
+        /* The staging texture was written by another context.
+         * The flush may not have produced a fence. */
+        if (job->fence) {
+            if (pipe->fence_server_sync)
+                pipe->fence_server_sync(pipe, job->fence);
+            else
+                screen->fence_finish(screen, NULL, job->fence, PIPE_TIMEOUT_INFINITE);
+        }
+
+        u_box_3d(0, 0, 0, dst_box->width, dst_box->height, dst_box->depth, &box);
+        pipe->resource_copy_region(pipe, res, level,
+                                   dst_box->x, dst_box->y, dst_box->z,
+                                   job->staging, 0, &box);
+        pipe_resource_reference(&job->staging, NULL);
+        screen->fence_reference(screen, &job->fence, NULL);
+    } else {
+        /* Failed to create or map the staging texture.
+         * The source data is still valid. */
+        struct pipe_transfer *transfer = NULL;
+        uint8_t *map;
+
+        map = pipe->transfer_map(pipe, res, level,
+                                 PIPE_MAP_WRITE | PIPE_MAP_DISCARD_RANGE,
+                                 dst_box, &transfer);
+        if (map) {
+            util_copy_box(map, job->format,
+                          transfer->stride, transfer->layer_stride,
+                          0, 0, 0,
+                          dst_box->width, dst_box->height, dst_box->depth,
+                          job->src, job->src_stride, job->src_layer_stride,
+                          job->src_box.x, job->src_box.y, job->src_box.z);
+            pipe->transfer_unmap(pipe, transfer);
+        }
+    }
+
+    p_atomic_add(&device->cpu_stats.upload_bytes, job->size);
+    p_atomic_add(&device->texture_upload.pending_bytes, -(int)job->size);
+    util_queue_fence_destroy(&job->ready);
+    FREE(job);
+}
@@ -0,0 +1,71 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+#ifndef _NINE_TEXTURE_UPLOAD_H_
+#define _NINE_TEXTURE_UPLOAD_H_
+
+#include "pipe/p_compiler.h"
+#include "pipe/p_format.h"
+
+struct NineDevice9;
+struct pipe_box;
+struct pipe_context;
+struct pipe_resource;
+struct nine_texture_upload_job;
+
+/* Upload of the managed textures through staging textures filled by a
+ * dedicated thread with its own pipe context.
+ * The application thread queues the copy of the system memory data to a
+ * new staging texture on the upload thread, and a command that copies the
+ * staging texture to the texture on the GPU in the nine_context queue.
+ * The nine_context thread thus only waits for the uploads it reaches
+ * before the upload thread, instead of doing the memcpy itself.
+ * The system memory data must stay valid until the nine_context command
+ * is executed, which the pending_uploads_counter of the surfaces and
+ * volumes already ensures. Only used with csmt. */
+
+void
+nine_texture_upload_init(struct NineDevice9 *device, boolean enable);
+
+/* The csmt queue must be empty */
+void
+nine_texture_upload_fini(struct NineDevice9 *device);
+
+/* Queues the copy to the staging texture. Returns NULL if the upload
+ * has to be done directly (too small, too much data in flight, ...). */
+struct nine_texture_upload_job *
+nine_texture_upload_submit(struct NineDevice9 *device,
+                           struct pipe_resource *res,
+                           enum pipe_format src_format,
+                           const void *src, unsigned src_stride,
+                           unsigned src_layer_stride,
+                           const struct pipe_box *src_box);
+
+/* Called by the nine_context thread: waits for the job, copies the staging
+ * texture to dst_box and frees the job. */
+void
+nine_texture_upload_finish(struct NineDevice9 *device,
+                           struct pipe_context *pipe,
+                           struct nine_texture_upload_job *job,
+                           struct pipe_resource *res,
+                           unsigned level,
+                           const struct pipe_box *dst_box);
+
+#endif /* _NINE_TEXTURE_UPLOAD_H_ */
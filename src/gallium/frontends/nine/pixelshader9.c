@@ -22,6 +22,7 @@
 
 #include "nine_helpers.h"
 #include "nine_shader.h"
+#include "nine_shader_precompile.h"
 
 #include "pixelshader9.h"
 
@@ -62,6 +63,7 @@ NinePixelShader9_ctor( struct NinePixelShader9 *This,
     info.sampler_ps1xtypes = 0x0;
     info.fog_enable = 0;
     info.projected = 0;
+    info.force_color_in_centroid = 0;
     info.add_constants_defs.c_combination = NULL;
     info.add_constants_defs.int_const_added = NULL;
     info.add_constants_defs.bool_const_added = NULL;
@@ -134,6 +136,8 @@ NinePixelShader9_dtor( struct NinePixelShader9 *This )
                 pipe->bind_fs_state(pipe, NULL);
             pipe->delete_fs_state(pipe, This->ff_cso);
         }
+
+        nine_shader_precompile_free(This->base.device, &This->precompile, pipe);
     }
     nine_shader_variants_free(&This->variant);
 
@@ -164,6 +168,43 @@ NinePixelShader9_GetFunction( struct NinePixelShader9 *This,
     return D3D_OK;
 }
 
+static void
+NinePixelShader9_FillVariantInfo( struct NinePixelShader9 *This,
+                                  uint64_t key,
+                                  struct nine_shader_info *info )
+{
+    struct NineDevice9 *device = This->base.device;
+
+    info->type = PIPE_SHADER_FRAGMENT;
+    info->const_i_base = NINE_CONST_I_BASE(device->max_ps_const_f) / 16;
+    info->const_b_base = NINE_CONST_B_BASE(device->max_ps_const_f) / 16;
+    info->byte_code = This->byte_code.tokens;
+    info->sampler_mask_shadow = key & 0xffff;
+    /* intended overlap with sampler_mask_shadow */
+    if (unlikely(This->byte_code.version < 0x20)) {
+        if (This->byte_code.version < 0x14) {
+            info->sampler_ps1xtypes = (key >> 4) & 0xff;
+            info->projected = (key >> 12) & 0xff;
+        } else {
+            info->sampler_ps1xtypes = (key >> 6) & 0xfff;
+            info->projected = 0;
+        }
+    } else {
+        info->sampler_ps1xtypes = 0;
+        info->projected = 0;
+    }
+    info->fog_enable = device->context.rs[D3DRS_FOGENABLE];
+    info->fog_mode = device->context.rs[D3DRS_FOGTABLEMODE];
+    info->force_color_in_centroid = (key >> 22) & 1;
+    info->add_constants_defs.c_combination =
+        nine_shader_constant_combination_get(This->c_combinations, (key >> 24) & 0xff);
+    info->add_constants_defs.int_const_added = &This->int_slots_used;
+    info->add_constants_defs.bool_const_added = &This->bool_slots_used;
+    info->fetch4 = key >> 32 ;
+    info->process_vertices = false;
+    info->swvp_on = false;
+}
+
 void *
 NinePixelShader9_GetVariant( struct NinePixelShader9 *This,
                              unsigned **const_ranges,
@@ -183,40 +224,18 @@ NinePixelShader9_GetVariant( struct NinePixelShader9 *This,
     }
 
     cso = nine_shader_variant_get(&This->variant, const_ranges, const_used_size, key);
+    if (!cso && This->precompile) {
+        cso = nine_shader_precompile_take(&This->precompile, key,
+                                          const_ranges, const_used_size);
+        if (cso)
+            nine_shader_variant_add(&This->variant, key, cso,
+                                    *const_ranges, *const_used_size);
+    }
     if (!cso) {
-        struct NineDevice9 *device = This->base.device;
         struct nine_shader_info info;
         HRESULT hr;
 
-        info.type = PIPE_SHADER_FRAGMENT;
-        info.const_i_base = NINE_CONST_I_BASE(device->max_ps_const_f) / 16;
-        info.const_b_base = NINE_CONST_B_BASE(device->max_ps_const_f) / 16;
-        info.byte_code = This->byte_code.tokens;
-        info.sampler_mask_shadow = key & 0xffff;
-        /* intended overlap with sampler_mask_shadow */
-        if (unlikely(This->byte_code.version < 0x20)) {
-            if (This->byte_code.version < 0x14) {
-                info.sampler_ps1xtypes = (key >> 4) & 0xff;
-                info.projected = (key >> 12) & 0xff;
-            } else {
-                info.sampler_ps1xtypes = (key >> 6) & 0xfff;
-                info.projected = 0;
-            }
-        } else {
-            info.sampler_ps1xtypes = 0;
-            info.projected = 0;
-        }
-        info.fog_enable = device->context.rs[D3DRS_FOGENABLE];
-        info.fog_mode = device->context.rs[D3DRS_FOGTABLEMODE];
-        info.force_color_in_centroid = (key >> 22) & 1;
-        info.add_constants_defs.c_combination =
-            nine_shader_constant_combination_get(This->c_combinations, (key >> 24) & 0xff);
-        info.add_constants_defs.int_const_added = &This->int_slots_used;
-        info.add_constants_defs.bool_const_added = &This->bool_slots_used;
-        info.fetch4 = key >> 32 ;
-        info.process_vertices = false;
-        info.swvp_on = false;
-
+        NinePixelShader9_FillVariantInfo(This, key, &info);
         hr = nine_translate_shader(This->base.device, &info, pipe);
         if (FAILED(hr))
             return NULL;
@@ -235,6 +254,29 @@ NinePixelShader9_GetVariant( struct NinePixelShader9 *This,
     return cso;
 }
 
+void
+NinePixelShader9_Precompile( struct NinePixelShader9 *This )
+{
+    struct NineDevice9 *device = This->base.device;
+    struct nine_shader_info info;
+    unsigned *const_ranges;
+    unsigned const_used_size;
+    uint64_t key;
+
+    /* Called from nine_context, like GetVariant */
+    if (!device->context.rt[0])
+        return;
+
+    key = NinePixelShader9_ComputeKey(This, &device->context);
+    if (key == This->last_key ||
+        nine_shader_variant_get(&This->variant, &const_ranges, &const_used_size, key) ||
+        nine_shader_precompile_pending(This->precompile, key))
+        return;
+
+    NinePixelShader9_FillVariantInfo(This, key, &info);
+    nine_shader_precompile_submit(device, &This->precompile, key, &info);
+}
+
 IDirect3DPixelShader9Vtbl NinePixelShader9_vtable = {
     (void *)NineUnknown_QueryInterface,
     (void *)NineUnknown_AddRef,
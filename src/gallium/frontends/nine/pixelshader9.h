@@ -31,6 +31,7 @@
 #include "surface9.h"
 
 struct nine_lconstf;
+struct nine_shader_precompile_job;
 
 struct NinePixelShader9
 {
@@ -57,6 +58,7 @@ struct NinePixelShader9
 
     uint64_t ff_key[6];
     void *ff_cso;
+    struct list_head ff_link; /* in device->ff LRU list */
 
     uint64_t last_key;
     void *last_cso;
@@ -64,6 +66,8 @@ struct NinePixelShader9
     unsigned last_const_used_size; /* in bytes */
 
     uint64_t next_key;
+
+    struct nine_shader_precompile_job *precompile;
 };
 static inline struct NinePixelShader9 *
 NinePixelShader9( void *data )
@@ -71,16 +75,15 @@ NinePixelShader9( void *data )
     return (struct NinePixelShader9 *)data;
 }
 
-static inline BOOL
-NinePixelShader9_UpdateKey( struct NinePixelShader9 *ps,
-                            struct nine_context *context )
+static inline uint64_t
+NinePixelShader9_ComputeKey( struct NinePixelShader9 *ps,
+                             struct nine_context *context )
 {
     uint16_t samplers_shadow;
     uint16_t samplers_fetch4;
     uint16_t samplers_ps1_types;
     uint8_t projected;
     uint64_t key;
-    BOOL res;
 
     samplers_shadow = (uint16_t)((context->samplers_shadow & NINE_PS_SAMPLERS_MASK) >> NINE_SAMPLER_PS(0));
     samplers_fetch4 = (uint16_t)((context->samplers_fetch4 & NINE_PS_SAMPLERS_MASK) >> NINE_SAMPLER_PS(0));
@@ -128,6 +131,16 @@ NinePixelShader9_UpdateKey( struct NinePixelShader9 *ps,
                                                                context->ps_const_b)) << 24;
 
     key |= ((uint64_t)(context->rs[NINED3DRS_FETCH4] & samplers_fetch4)) << 32;
+    return key;
+}
+
+static inline BOOL
+NinePixelShader9_UpdateKey( struct NinePixelShader9 *ps,
+                            struct nine_context *context )
+{
+    uint64_t key = NinePixelShader9_ComputeKey(ps, context);
+    BOOL res;
+
     res = ps->last_key != key;
     if (res)
         ps->next_key = key;
@@ -139,6 +152,9 @@ NinePixelShader9_GetVariant( struct NinePixelShader9 *ps,
                              unsigned **const_ranges,
                              unsigned *const_used_size );
 
+void
+NinePixelShader9_Precompile( struct NinePixelShader9 *ps );
+
 /*** public ***/
 
 HRESULT
@@ -565,13 +565,14 @@ NineStateBlock9_Apply( struct NineStateBlock9 *This )
 
     DBG("This=%p\n", This);
 
+    /* Compares against the current device state, thus before the copy */
+    nine_context_apply_stateblock(device, dst, src);
+
     if (This->type == NINESBT_ALL)
         nine_state_copy_common_all(device, dst, src, src, TRUE, pool, MaxStreams);
     else
         nine_state_copy_common(device, dst, src, src, TRUE, pool);
 
-    nine_context_apply_stateblock(device, src);
-
     if ((src->changed.group & NINE_STATE_VDECL) && src->vdecl)
         nine_bind(&dst->vdecl, src->vdecl);
 
@@ -32,6 +32,7 @@
 #include "nine_helpers.h"
 #include "nine_pipe.h"
 #include "nine_dump.h"
+#include "nine_format.h"
 #include "nine_memory_helper.h"
 #include "nine_state.h"
 
@@ -222,6 +223,106 @@ NineSurface9_ctor( struct NineSurface9 *This,
     return D3D_OK;
 }
 
+static void
+NineSurface9_DropReadback( struct NineSurface9 *This )
+{
+    if (!This->readback)
+        return;
+    pipe_resource_reference(&This->readback, NULL);
+    p_atomic_add(&This->base.base.device->shadow_memory.used,
+                 -(long long)This->readback_size);
+    This->readback_size = 0;
+}
+
+/* Copies the result of a deferred GetRenderTargetData to the system memory.
+ * This is the only place the application waits for the worker thread. */
+static void
+NineSurface9_ResolveReadback( struct NineSurface9 *This )
+{
+    struct pipe_context *pipe;
+    struct pipe_transfer *transfer;
+    struct pipe_box box;
+    uint8_t *p_dst;
+    const uint8_t *p_src;
+
+    if (!This->readback)
+        return;
+
+    DBG("This=%p readback=%p\n", This, This->readback);
+
+    u_box_origin_2d(This->desc.Width, This->desc.Height, &box);
+
+    pipe = NineDevice9_GetPipe(This->base.base.device);
+    p_src = pipe->transfer_map(pipe, This->readback, 0,
+                               PIPE_MAP_READ,
+                               &box, &transfer);
+    p_dst = nine_get_pointer(This->base.base.device->allocator, This->data);
+
+    assert (p_src && p_dst);
+
+    util_copy_rect(p_dst, This->base.info.format,
+                   This->stride, 0, 0,
+                   This->desc.Width, This->desc.Height,
+                   p_src,
+                   transfer->stride, 0, 0);
+
+    pipe->transfer_unmap(pipe, transfer);
+
+    nine_pointer_weakrelease(This->base.base.device->allocator, This->data);
+    NineSurface9_DropReadback(This);
+}
+
+/* Queues the copy of From into a staging resource, if it fits
+ * in the shadow memory budget. */
+static boolean
+NineSurface9_DeferReadback( struct NineSurface9 *This,
+                            struct NineSurface9 *From,
+                            const struct pipe_box *src_box )
+{
+    struct NineDevice9 *device = This->base.base.device;
+    struct pipe_screen *screen = device->screen;
+    struct pipe_resource templ;
+    struct pipe_box dst_box;
+    unsigned size;
+
+    /* The app reads shared memory without locking it first */
+    if (!device->csmt_active || !device->shadow_memory.limit ||
+        This->data_shared)
+        return FALSE;
+
+    size = This->stride * util_format_get_nblocksy(This->base.info.format,
+                                                   This->desc.Height);
+    if (p_atomic_add_return(&device->shadow_memory.used, (long long)size) >
+        device->shadow_memory.limit) {
+        p_atomic_add(&device->shadow_memory.used, -(long long)size);
+        return FALSE;
+    }
+
+    memset(&templ, 0, sizeof(templ));
+    templ.target = PIPE_TEXTURE_2D;
+    templ.format = From->base.resource->format;
+    templ.width0 = This->desc.Width;
+    templ.height0 = This->desc.Height;
+    templ.depth0 = 1;
+    templ.array_size = 1;
+    templ.usage = PIPE_USAGE_STAGING;
+
+    This->readback = screen->resource_create(screen, &templ);
+    if (!This->readback) {
+        p_atomic_add(&device->shadow_memory.used, -(long long)size);
+        return FALSE;
+    }
+    This->readback_size = size;
+
+    u_box_origin_2d(This->desc.Width, This->desc.Height, &dst_box);
+    nine_context_resource_copy_region(device, (struct NineUnknown *)This,
+                                      (struct NineUnknown *)From,
+                                      This->readback, 0, &dst_box,
+                                      From->base.resource, From->level,
+                                      src_box);
+    return TRUE;
+}
+
 void
 NineSurface9_dtor( struct NineSurface9 *This )
 {
@@ -240,6 +341,8 @@ NineSurface9_dtor( struct NineSurface9 *This )
     if (p_atomic_read(&This->pending_uploads_counter))
         nine_csmt_process(This->base.base.device);
 
+    NineSurface9_DropReadback(This);
+
     pipe_surface_reference(&This->surface[0], NULL);
     pipe_surface_reference(&This->surface[1], NULL);
 
@@ -514,6 +617,8 @@ NineSurface9_LockRect( struct NineSurface9 *This,
 
     user_warn(This->desc.Format == D3DFMT_NULL);
 
+    NineSurface9_ResolveReadback(This);
+
     if (p_atomic_read(&This->pending_uploads_counter))
         nine_csmt_process(This->base.base.device);
 
@@ -594,7 +699,7 @@ NineSurface9_UnlockRect( struct NineSurface9 *This )
     if (This->data_internal) {
         nine_pointer_weakrelease(This->base.base.device->allocator, This->data_internal);
         if (This->data) {
-            (void) util_format_translate(This->base.info.format,
+            (void) nine_format_translate(This->base.info.format,
                                          nine_get_pointer(This->base.base.device->allocator, This->data),
                                          This->stride,
                                          0, 0,
@@ -680,6 +785,8 @@ NineSurface9_CopyMemToDefault( struct NineSurface9 *This,
     assert(This->base.pool == D3DPOOL_DEFAULT &&
            From->base.pool == D3DPOOL_SYSTEMMEM);
 
+    NineSurface9_ResolveReadback(From);
+
     if (pDestPoint) {
         dst_x = pDestPoint->x;
         dst_y = pDestPoint->y;
@@ -706,7 +813,7 @@ NineSurface9_CopyMemToDefault( struct NineSurface9 *This,
                     copy_width, copy_height, &src_box);
 
     if (This->data_internal) {
-        (void) util_format_translate(This->format_internal,
+        (void) nine_format_translate(This->format_internal,
                                      nine_get_pointer(This->base.base.device->allocator, This->data_internal),
                                      This->stride_internal,
                                      dst_x, dst_y,
@@ -769,6 +876,14 @@ NineSurface9_CopyDefaultToMem( struct NineSurface9 *This,
     u_box_origin_2d(This->desc.Width, This->desc.Height, &src_box);
     src_box.z = From->layer;
 
+    /* The previous content is overwritten */
+    NineSurface9_DropReadback(This);
+
+    /* The copy to the system memory is done on the next access
+     * of the surface, without waiting for the worker thread here. */
+    if (NineSurface9_DeferReadback(This, From, &src_box))
+        return;
+
     if (p_atomic_read(&This->pending_uploads_counter))
         nine_csmt_process(This->base.base.device);
 
@@ -819,17 +934,17 @@ NineSurface9_UploadSelf( struct NineSurface9 *This,
         box.depth = 1;
     }
 
-    nine_context_box_upload(This->base.base.device,
-                            &This->pending_uploads_counter,
-                            (struct NineUnknown *)This,
-                            res,
-                            This->level,
-                            &box,
-                            res->format,
-                            nine_get_pointer(This->base.base.device->allocator, This->data),
-                            This->stride,
-                            0, /* depth = 1 */
-                            &box);
+    nine_context_box_upload_async(This->base.base.device,
+                                  &This->pending_uploads_counter,
+                                  (struct NineUnknown *)This,
+                                  res,
+                                  This->level,
+                                  &box,
+                                  res->format,
+                                  nine_get_pointer(This->base.base.device->allocator, This->data),
+                                  This->stride,
+                                  0, /* depth = 1 */
+                                  &box);
     nine_pointer_delayedstrongrelease(This->base.base.device->allocator, This->data, &This->pending_uploads_counter);
 
     return D3D_OK;
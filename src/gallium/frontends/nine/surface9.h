@@ -48,12 +48,18 @@ struct NineSurface9
     D3DSURFACE_DESC desc;
 
     struct nine_allocation *data; /* system memory backing */
+    boolean data_shared; /* data is also accessed by the app directly */
     struct nine_allocation *data_internal; /* for conversions */
     enum pipe_format format_internal;
     unsigned stride; /* for system memory backing */
     unsigned stride_internal;
 
     unsigned pending_uploads_counter; /* pending uploads */
+
+    /* Staging copy of the source of the last GetRenderTargetData,
+     * copied to data on the next access. */
+    struct pipe_resource *readback;
+    unsigned readback_size;
 };
 static inline struct NineSurface9 *
 NineSurface9( void *data )
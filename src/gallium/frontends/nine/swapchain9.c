@@ -27,6 +27,7 @@
 #include "nine_helpers.h"
 #include "nine_pipe.h"
 #include "nine_dump.h"
+#include "nine_hud.h"
 
 #include "util/u_atomic.h"
 #include "util/u_inlines.h"
@@ -665,6 +666,7 @@ handle_draw_cursor_and_hud( struct NineSwapChain9 *This, struct pipe_resource *r
     if (device->hud && resource) {
         /* Implicit use of context pipe */
         (void)NineDevice9_GetPipe(This->base.device);
+        nine_hud_update(device);
         hud_run(device->hud, NULL, resource); /* XXX: no offset */
         /* HUD doesn't clobber stipple */
         nine_state_restore_non_cso(device);
@@ -980,6 +982,8 @@ NineSwapChain9_Present( struct NineSwapChain9 *This,
     if (hr == D3DERR_WASSTILLDRAWING)
         return hr;
 
+    nine_csmt_end_frame(This->base.device);
+
     if (This->base.device->minor_version_num > 2 &&
         This->actx->discard_delayed_release &&
         This->params.SwapEffect == D3DSWAPEFFECT_DISCARD &&
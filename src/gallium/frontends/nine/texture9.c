@@ -214,6 +214,8 @@ NineTexture9_ctor( struct NineTexture9 *This,
                               &sfdesc, &This->surfaces[l]);
         if (FAILED(hr))
             return hr;
+        /* D3DPOOL_SYSTEMMEM memory shared with the app */
+        This->surfaces[l]->data_shared = pSharedHandle != NULL;
     }
 
     /* Textures start initially dirty */
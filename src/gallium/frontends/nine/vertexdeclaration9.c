@@ -421,11 +421,18 @@ NineVertexDeclaration9_FillStreamOutputInfo(
 
     memset(so, 0, sizeof(struct pipe_stream_output_info));
 
-    for (i = 0; i < numOutputs; i++) {
-        BYTE output_semantic = ShaderOutputsInfo[i].output_semantic;
-        unsigned output_semantic_index = ShaderOutputsInfo[i].output_semantic_index;
+    /* One output per element, in the order of the declaration,
+     * as expected by NineVertexDeclaration9_ConvertStreamOutput.
+     * Elements the shader doesn't write get no component. */
+    for (j = 0; j < This->nelems; j++) {
+        so->output[so_outputs].output_buffer = 0;
+        so->output[so_outputs].dst_offset = so_outputs * sizeof(float[4])/4;
+        so->output[so_outputs].stream = 0;
+
+        for (i = 0; i < numOutputs; i++) {
+            BYTE output_semantic = ShaderOutputsInfo[i].output_semantic;
+            unsigned output_semantic_index = ShaderOutputsInfo[i].output_semantic_index;
 
-        for (j = 0; j < This->nelems; j++) {
             if ((This->decls[j].Usage == output_semantic ||
                  (output_semantic == D3DDECLUSAGE_POSITION &&
                   This->decls[j].Usage == D3DDECLUSAGE_POSITIONT)) &&
@@ -443,13 +450,12 @@ NineVertexDeclaration9_FillStreamOutputInfo(
                     so->output[so_outputs].num_components = 2;
                 else
                     so->output[so_outputs].num_components = 1;
-                so->output[so_outputs].output_buffer = 0;
-                so->output[so_outputs].dst_offset = so_outputs * sizeof(float[4])/4;
-                so->output[so_outputs].stream = 0;
-                so_outputs++;
                 break;
             }
         }
+        if (i == numOutputs)
+            DBG("Element %d not written by the shader\n", j);
+        so_outputs++;
     }
 
     so->num_outputs = so_outputs;
@@ -482,9 +488,19 @@ NineVertexDeclaration9_ConvertStreamOutput(
         This, pDstBuf, DestIndex, VertexCount, pSrcBuf, so);
 
     transkey.output_stride = 0;
+    transkey.nr_elements = 0;
     for (i = 0; i < This->nelems; ++i) {
+        unsigned n = transkey.nr_elements;
         enum pipe_format format;
 
+        transkey.output_stride +=
+            util_format_get_blocksize(This->elems[i].src_format);
+        assert(!(transkey.output_stride & 3));
+
+        /* Not written by the shader: left untouched */
+        if (!so->output[i].num_components)
+            continue;
+
         switch (so->output[i].num_components) {
         case 1: format = PIPE_FORMAT_R32_FLOAT; break;
         case 2: format = PIPE_FORMAT_R32G32_FLOAT; break;
@@ -494,29 +510,27 @@ NineVertexDeclaration9_ConvertStreamOutput(
             format = PIPE_FORMAT_R32G32B32A32_FLOAT;
             break;
         }
-        transkey.element[i].type = TRANSLATE_ELEMENT_NORMAL;
-        transkey.element[i].input_format = format;
-        transkey.element[i].input_buffer = 0;
-        transkey.element[i].input_offset = so->output[i].dst_offset * 4;
-        transkey.element[i].instance_divisor = 0;
-
-        transkey.element[i].output_format = This->elems[i].src_format;
-        transkey.element[i].output_offset = This->elems[i].src_offset;
-        transkey.output_stride +=
-            util_format_get_blocksize(This->elems[i].src_format);
-
-        assert(!(transkey.output_stride & 3));
+        transkey.element[n].type = TRANSLATE_ELEMENT_NORMAL;
+        transkey.element[n].input_format = format;
+        transkey.element[n].input_buffer = 0;
+        transkey.element[n].input_offset = so->output[i].dst_offset * 4;
+        transkey.element[n].instance_divisor = 0;
+
+        transkey.element[n].output_format = This->elems[i].src_format;
+        transkey.element[n].output_offset = This->elems[i].src_offset;
+        transkey.nr_elements++;
     }
-    transkey.nr_elements = This->nelems;
 
     translate = translate_create(&transkey);
     if (!translate)
         return E_OUTOFMEMORY;
 
+    /* Not DISCARD: the vertices outside the range are kept, which
+     * matters when several calls write to the same buffer. */
     hr = NineVertexBuffer9_Lock(pDstBuf,
                                 transkey.output_stride * DestIndex,
                                 transkey.output_stride * VertexCount,
-                                &dst_map, D3DLOCK_DISCARD);
+                                &dst_map, 0);
     if (FAILED(hr))
         goto out;
 
@@ -22,6 +22,7 @@
 
 #include "nine_helpers.h"
 #include "nine_shader.h"
+#include "nine_shader_precompile.h"
 
 #include "vertexdeclaration9.h"
 #include "vertexshader9.h"
@@ -101,6 +102,7 @@ NineVertexShader9_ctor( struct NineVertexShader9 *This,
     This->last_const_ranges = info.const_ranges;
     This->last_const_used_size = info.const_used_size;
     This->last_key = (uint32_t) (info.swvp_on << 9);
+    This->variant.key = This->last_key;
 
     This->lconstf = info.lconstf;
     This->sampler_mask = info.sampler_mask;
@@ -154,6 +156,10 @@ NineVertexShader9_dtor( struct NineVertexShader9 *This )
                 pipe->bind_vs_state(pipe, NULL);
             pipe->delete_vs_state(pipe, This->ff_cso);
         }
+
+        nine_swvp_cpu_variants_free(This->base.device, This->variant_swvp_cpu, pipe);
+
+        nine_shader_precompile_free(This->base.device, &This->precompile, pipe);
     }
     nine_shader_variants_free(&This->variant);
     nine_shader_variants_so_free(&This->variant_so);
@@ -186,6 +192,30 @@ NineVertexShader9_GetFunction( struct NineVertexShader9 *This,
     return D3D_OK;
 }
 
+static void
+NineVertexShader9_FillVariantInfo( struct NineVertexShader9 *This,
+                                   uint64_t key,
+                                   struct nine_shader_info *info )
+{
+    struct NineDevice9 *device = This->base.device;
+
+    info->type = PIPE_SHADER_VERTEX;
+    info->const_i_base = NINE_CONST_I_BASE(device->max_vs_const_f) / 16;
+    info->const_b_base = NINE_CONST_B_BASE(device->max_vs_const_f) / 16;
+    info->byte_code = This->byte_code.tokens;
+    info->sampler_mask_shadow = key & 0xf;
+    info->fetch4 = 0x0;
+    info->fog_enable = device->context.rs[D3DRS_FOGENABLE];
+    info->point_size_min = asfloat(device->context.rs[D3DRS_POINTSIZE_MIN]);
+    info->point_size_max = asfloat(device->context.rs[D3DRS_POINTSIZE_MAX]);
+    info->add_constants_defs.c_combination =
+        nine_shader_constant_combination_get(This->c_combinations, (key >> 16) & 0xff);
+    info->add_constants_defs.int_const_added = &This->int_slots_used;
+    info->add_constants_defs.bool_const_added = &This->bool_slots_used;
+    info->swvp_on = device->context.swvp;
+    info->process_vertices = false;
+}
+
 void *
 NineVertexShader9_GetVariant( struct NineVertexShader9 *This,
                               unsigned **const_ranges,
@@ -205,27 +235,18 @@ NineVertexShader9_GetVariant( struct NineVertexShader9 *This,
     }
 
     cso = nine_shader_variant_get(&This->variant, const_ranges, const_used_size, key);
+    if (!cso && This->precompile) {
+        cso = nine_shader_precompile_take(&This->precompile, key,
+                                          const_ranges, const_used_size);
+        if (cso)
+            nine_shader_variant_add(&This->variant, key, cso,
+                                    *const_ranges, *const_used_size);
+    }
     if (!cso) {
-        struct NineDevice9 *device = This->base.device;
         struct nine_shader_info info;
         HRESULT hr;
 
-        info.type = PIPE_SHADER_VERTEX;
-        info.const_i_base = NINE_CONST_I_BASE(device->max_vs_const_f) / 16;
-        info.const_b_base = NINE_CONST_B_BASE(device->max_vs_const_f) / 16;
-        info.byte_code = This->byte_code.tokens;
-        info.sampler_mask_shadow = key & 0xf;
-        info.fetch4 = 0x0;
-        info.fog_enable = device->context.rs[D3DRS_FOGENABLE];
-        info.point_size_min = asfloat(device->context.rs[D3DRS_POINTSIZE_MIN]);
-        info.point_size_max = asfloat(device->context.rs[D3DRS_POINTSIZE_MAX]);
-        info.add_constants_defs.c_combination =
-            nine_shader_constant_combination_get(This->c_combinations, (key >> 16) & 0xff);
-        info.add_constants_defs.int_const_added = &This->int_slots_used;
-        info.add_constants_defs.bool_const_added = &This->bool_slots_used;
-        info.swvp_on = device->context.swvp;
-        info.process_vertices = false;
-
+        NineVertexShader9_FillVariantInfo(This, key, &info);
         hr = nine_translate_shader(This->base.device, &info, pipe);
         if (FAILED(hr))
             return NULL;
@@ -244,6 +265,26 @@ NineVertexShader9_GetVariant( struct NineVertexShader9 *This,
     return cso;
 }
 
+void
+NineVertexShader9_Precompile( struct NineVertexShader9 *This )
+{
+    struct NineDevice9 *device = This->base.device;
+    struct nine_shader_info info;
+    unsigned *const_ranges;
+    unsigned const_used_size;
+    uint64_t key;
+
+    /* Called from nine_context, like GetVariant */
+    key = NineVertexShader9_ComputeKey(This, device);
+    if (key == This->last_key ||
+        nine_shader_variant_get(&This->variant, &const_ranges, &const_used_size, key) ||
+        nine_shader_precompile_pending(This->precompile, key))
+        return;
+
+    NineVertexShader9_FillVariantInfo(This, key, &info);
+    nine_shader_precompile_submit(device, &This->precompile, key, &info);
+}
+
 void *
 NineVertexShader9_GetVariantProcessVertices( struct NineVertexShader9 *This,
                                              struct NineVertexDeclaration9 *vdecl_out,
@@ -265,7 +306,7 @@ NineVertexShader9_GetVariantProcessVertices( struct NineVertexShader9 *This,
     info.fetch4 = 0x0;
     info.fog_enable = false;
     info.point_size_min = 0;
-    info.point_size_max = 0;
+    info.point_size_max = This->base.device->caps.MaxPointSize;
     info.add_constants_defs.c_combination = NULL;
     info.add_constants_defs.int_const_added = NULL;
     info.add_constants_defs.bool_const_added = NULL;
@@ -280,6 +321,45 @@ NineVertexShader9_GetVariantProcessVertices( struct NineVertexShader9 *This,
     return info.cso;
 }
 
+/* Called from nine_context, after prepare_vs updated next_key */
+struct nine_swvp_cpu_variant *
+NineVertexShader9_GetVariantSwvpCpu( struct NineVertexShader9 *This )
+{
+    struct NineDevice9 *device = This->base.device;
+    struct nine_swvp_cpu_variant *variant;
+    struct nine_shader_info info;
+    const uint64_t key = This->next_key;
+
+    for (variant = This->variant_swvp_cpu; variant; variant = variant->next) {
+        if (variant->key == key)
+            return variant;
+    }
+
+    /* Failures are kept too, to not retry at every draw */
+    variant = CALLOC_STRUCT(nine_swvp_cpu_variant);
+    if (!variant)
+        return NULL;
+    variant->key = key;
+
+    NineVertexShader9_FillVariantInfo(This, key, &info);
+    info.process_vertices = true;
+    info.vdecl_out = NULL;
+    if (SUCCEEDED(nine_translate_shader(device, &info, device->swvp_cpu.pipe))) {
+        variant->cso = info.cso;
+        variant->num_outputs = info.so_num_outputs;
+        variant->cso_passthrough =
+            nine_swvp_cpu_create_passthrough(device->context.pipe, &info);
+        /* The local constants are the ones of the hardware variants */
+        FREE(info.lconstf.data);
+        FREE(info.lconstf.ranges);
+        FREE(info.const_ranges);
+    }
+
+    variant->next = This->variant_swvp_cpu;
+    This->variant_swvp_cpu = variant;
+    return variant;
+}
+
 IDirect3DVertexShader9Vtbl NineVertexShader9_vtable = {
     (void *)NineUnknown_QueryInterface,
     (void *)NineUnknown_AddRef,
@@ -30,8 +30,10 @@
 #include "nine_helpers.h"
 #include "nine_shader.h"
 #include "nine_state.h"
+#include "nine_swvp_cpu.h"
 
 struct NineVertexDeclaration9;
+struct nine_shader_precompile_job;
 
 struct NineVertexShader9
 {
@@ -67,6 +69,7 @@ struct NineVertexShader9
 
     uint64_t ff_key[3];
     void *ff_cso;
+    struct list_head ff_link; /* in device->ff LRU list */
 
     uint64_t last_key;
     void *last_cso;
@@ -75,8 +78,12 @@ struct NineVertexShader9
 
     uint64_t next_key;
 
+    struct nine_shader_precompile_job *precompile;
+
     /* so */
     struct nine_shader_variant_so variant_so;
+
+    struct nine_swvp_cpu_variant *variant_swvp_cpu;
 };
 static inline struct NineVertexShader9 *
 NineVertexShader9( void *data )
@@ -84,14 +91,13 @@ NineVertexShader9( void *data )
     return (struct NineVertexShader9 *)data;
 }
 
-static inline BOOL
-NineVertexShader9_UpdateKey( struct NineVertexShader9 *vs,
-                             struct NineDevice9 *device )
+static inline uint64_t
+NineVertexShader9_ComputeKey( struct NineVertexShader9 *vs,
+                              struct NineDevice9 *device )
 {
     struct nine_context *context = &(device->context);
     uint8_t samplers_shadow;
     uint64_t key;
-    BOOL res;
 
     samplers_shadow = (uint8_t)((context->samplers_shadow & NINE_VS_SAMPLERS_MASK) >> NINE_SAMPLER_VS(0));
     samplers_shadow &= vs->sampler_mask;
@@ -116,6 +122,16 @@ NineVertexShader9_UpdateKey( struct NineVertexShader9 *vs,
         key |= ((uint64_t)_mesa_float_to_half(asfloat(context->rs[D3DRS_POINTSIZE_MAX]))) << 48;
     }
 
+    return key;
+}
+
+static inline BOOL
+NineVertexShader9_UpdateKey( struct NineVertexShader9 *vs,
+                             struct NineDevice9 *device )
+{
+    uint64_t key = NineVertexShader9_ComputeKey(vs, device);
+    BOOL res;
+
     res = vs->last_key != key;
     if (res)
         vs->next_key = key;
@@ -127,11 +143,17 @@ NineVertexShader9_GetVariant( struct NineVertexShader9 *vs,
                               unsigned **const_ranges,
                               unsigned *const_used_size );
 
+void
+NineVertexShader9_Precompile( struct NineVertexShader9 *vs );
+
 void *
 NineVertexShader9_GetVariantProcessVertices( struct NineVertexShader9 *vs,
                                              struct NineVertexDeclaration9 *vdecl_out,
                                              struct pipe_stream_output_info *so );
 
+struct nine_swvp_cpu_variant *
+NineVertexShader9_GetVariantSwvpCpu( struct NineVertexShader9 *vs );
+
 /*** public ***/
 
 HRESULT
@@ -27,6 +27,7 @@
 #include "nine_helpers.h"
 #include "nine_pipe.h"
 #include "nine_dump.h"
+#include "nine_format.h"
 
 #include "util/format/u_format.h"
 #include "util/u_surface.h"
@@ -399,7 +400,7 @@ NineVolume9_UnlockBox( struct NineVolume9 *This )
 
 
         if (This->data) {
-            (void) util_format_translate_3d(This->info.format,
+            (void) nine_format_translate_3d(This->info.format,
                                             This->data, This->stride,
                                             This->layer_stride,
                                             0, 0, 0,
@@ -477,7 +478,7 @@ NineVolume9_CopyMemToDefault( struct NineVolume9 *This,
                             &src_box);
 
     if (This->data_internal)
-        (void) util_format_translate_3d(This->format_internal,
+        (void) nine_format_translate_3d(This->format_internal,
                                         This->data_internal,
                                         This->stride_internal,
                                         This->layer_stride_internal,
@@ -520,16 +521,16 @@ NineVolume9_UploadSelf( struct NineVolume9 *This,
         box.depth = This->desc.Depth;
     }
 
-    nine_context_box_upload(This->base.device,
-                            &This->pending_uploads_counter,
-                            (struct NineUnknown *)This,
-                            res,
-                            This->level,
-                            &box,
-                            res->format,
-                            This->data, This->stride,
-                            This->layer_stride,
-                            &box);
+    nine_context_box_upload_async(This->base.device,
+                                  &This->pending_uploads_counter,
+                                  (struct NineUnknown *)This,
+                                  res,
+                                  This->level,
+                                  &box,
+                                  res->format,
+                                  This->data, This->stride,
+                                  This->layer_stride,
+                                  &box);
 
     return D3D_OK;
 }
@@ -58,10 +58,16 @@ const driOptionDescription __driConfigOptionsNine[] = {
         DRI_CONF_NINE_ALLOWDISCARDDELAYEDRELEASE(true)
         DRI_CONF_NINE_TEARFREEDISCARD(true)
         DRI_CONF_NINE_CSMT(-1)
+        DRI_CONF_NINE_CSMT_QUEUE_DEPTH(32)
+        DRI_CONF_NINE_CSMT_SHADOW_MEMORY(64)
         DRI_CONF_NINE_DYNAMICTEXTUREWORKAROUND(true)
         DRI_CONF_NINE_SHADERINLINECONSTANTS(false)
+        DRI_CONF_NINE_SHADERPRECOMPILE(true)
+        DRI_CONF_NINE_FFSHADERCACHESIZE(1024)
+        DRI_CONF_NINE_TEXTUREUPLOADTHREAD(true)
         DRI_CONF_NINE_SHMEM_LIMIT()
         DRI_CONF_NINE_FORCESWRENDERINGONCPU(false)
+        DRI_CONF_NINE_SWVPONCPU(false)
     DRI_CONF_SECTION_END
     DRI_CONF_SECTION_DEBUG
         DRI_CONF_OVERRIDE_VRAM_SIZE()
@@ -281,11 +287,17 @@ drm_create_adapter( int fd,
     }
 
     ctx->base.csmt_force = driQueryOptioni(&userInitOptions, "csmt_force");
+    ctx->base.csmt_queue_depth = driQueryOptioni(&userInitOptions, "csmt_queue_depth");
+    ctx->base.csmt_shadow_memory = driQueryOptioni(&userInitOptions, "csmt_shadow_memory");
     ctx->base.dynamic_texture_workaround = driQueryOptionb(&userInitOptions, "dynamic_texture_workaround");
     ctx->base.shader_inline_constants = driQueryOptionb(&userInitOptions, "shader_inline_constants");
+    ctx->base.shader_precompile = driQueryOptionb(&userInitOptions, "shader_precompile");
+    ctx->base.ff_shader_cache_size = driQueryOptioni(&userInitOptions, "ff_shader_cache_size");
+    ctx->base.texture_upload_thread = driQueryOptionb(&userInitOptions, "texture_upload_thread");
     ctx->base.memfd_virtualsizelimit = driQueryOptioni(&userInitOptions, "texture_memory_limit");
     ctx->base.override_vram_size = driQueryOptioni(&userInitOptions, "override_vram_size");
     sw_rendering = driQueryOptionb(&userInitOptions, "force_sw_rendering_on_cpu");
+    ctx->base.swvp_on_cpu = driQueryOptionb(&userInitOptions, "swvp_on_cpu");
 
     driDestroyOptionCache(&userInitOptions);
     driDestroyOptionInfo(&defaultInitOptions);
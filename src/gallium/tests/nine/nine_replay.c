@@ -0,0 +1,1054 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE. */
+
+/*
+ * Headless benchmark of gallium nine.
+ *
+ * Creates a nine device on a DRM device through the d3dadapter9 drm
+ * interface, with a dummy presentation backend, and replays scripted
+ * streams of D3D9 calls. Meant to measure the CPU overhead of nine on a
+ * machine without GPU, with a drm-shim noop device:
+ *
+ *   LD_PRELOAD=libfreedreno_noop_drm_shim.so nine-replay draws lock
+ *
+ * force_sw_rendering_on_cpu is enabled unless set in the environment, so
+ * that software vertex processing runs on llvmpipe.
+ * The other driconf options of nine (csmt_force, ...) can be set through
+ * the environment as well.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "d3dadapter/d3dadapter9.h"
+#include "d3dadapter/drm.h"
+#include "d3dadapter/present.h"
+
+#include "util/macros.h"
+#include "util/os_time.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+struct D3DWindowBuffer {
+    int width;
+    int height;
+};
+
+/* Dummy presentation backend: the frames are never displayed */
+
+static HRESULT WINAPI
+present_QueryInterface(ID3DPresent *This, REFIID riid, void **ppvObject)
+{
+    (void) This;
+    (void) riid;
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI
+present_AddRef(ID3DPresent *This)
+{
+    (void) This;
+    return 1;
+}
+
+static ULONG WINAPI
+present_Release(ID3DPresent *This)
+{
+    (void) This;
+    return 1;
+}
+
+static HRESULT WINAPI
+present_SetPresentParameters(ID3DPresent *This,
+                             D3DPRESENT_PARAMETERS *pPresentationParameters,
+                             D3DDISPLAYMODEEX *pFullscreenDisplayMode)
+{
+    (void) This;
+    (void) pFullscreenDisplayMode;
+    if (!pPresentationParameters->BackBufferWidth)
+        pPresentationParameters->BackBufferWidth = WIDTH;
+    if (!pPresentationParameters->BackBufferHeight)
+        pPresentationParameters->BackBufferHeight = HEIGHT;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_NewD3DWindowBufferFromDmaBuf(ID3DPresent *This, int dmaBufFd,
+                                     int width, int height, int stride,
+                                     int depth, int bpp, D3DWindowBuffer **out)
+{
+    struct D3DWindowBuffer *buffer = calloc(1, sizeof(*buffer));
+
+    (void) This;
+    (void) stride;
+    (void) depth;
+    (void) bpp;
+    close(dmaBufFd);
+    if (!buffer)
+        return E_OUTOFMEMORY;
+    buffer->width = width;
+    buffer->height = height;
+    *out = buffer;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_DestroyD3DWindowBuffer(ID3DPresent *This, D3DWindowBuffer *buffer)
+{
+    (void) This;
+    free(buffer);
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_WaitBufferReleased(ID3DPresent *This, D3DWindowBuffer *buffer)
+{
+    (void) This;
+    (void) buffer;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_FrontBufferCopy(ID3DPresent *This, D3DWindowBuffer *buffer)
+{
+    (void) This;
+    (void) buffer;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_PresentBuffer(ID3DPresent *This, D3DWindowBuffer *buffer,
+                      HWND hWndOverride, const RECT *pSourceRect,
+                      const RECT *pDestRect, const RGNDATA *pDirtyRegion,
+                      DWORD Flags)
+{
+    (void) This;
+    (void) buffer;
+    (void) hWndOverride;
+    (void) pSourceRect;
+    (void) pDestRect;
+    (void) pDirtyRegion;
+    (void) Flags;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_GetRasterStatus(ID3DPresent *This, D3DRASTER_STATUS *pRasterStatus)
+{
+    (void) This;
+    memset(pRasterStatus, 0, sizeof(*pRasterStatus));
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_GetDisplayMode(ID3DPresent *This, D3DDISPLAYMODEEX *pMode,
+                       D3DDISPLAYROTATION *pRotation)
+{
+    (void) This;
+    pMode->Size = sizeof(*pMode);
+    pMode->Width = WIDTH;
+    pMode->Height = HEIGHT;
+    pMode->RefreshRate = 60;
+    pMode->Format = D3DFMT_X8R8G8B8;
+    pMode->ScanLineOrdering = D3DSCANLINEORDERING_PROGRESSIVE;
+    if (pRotation)
+        *pRotation = D3DDISPLAYROTATION_IDENTITY;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_GetPresentStats(ID3DPresent *This, D3DPRESENTSTATS *pStats)
+{
+    (void) This;
+    memset(pStats, 0, sizeof(*pStats));
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_GetCursorPos(ID3DPresent *This, POINT *pPoint)
+{
+    (void) This;
+    pPoint->x = 0;
+    pPoint->y = 0;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_SetCursorPos(ID3DPresent *This, POINT *pPoint)
+{
+    (void) This;
+    (void) pPoint;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_SetCursor(ID3DPresent *This, void *pBitmap, POINT *pHotspot, BOOL bShow)
+{
+    (void) This;
+    (void) pBitmap;
+    (void) pHotspot;
+    (void) bShow;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_SetGammaRamp(ID3DPresent *This, const D3DGAMMARAMP *pRamp,
+                     HWND hWndOverride)
+{
+    (void) This;
+    (void) pRamp;
+    (void) hWndOverride;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+present_GetWindowInfo(ID3DPresent *This, HWND hWnd, int *width, int *height,
+                      int *depth)
+{
+    (void) This;
+    (void) hWnd;
+    *width = WIDTH;
+    *height = HEIGHT;
+    *depth = 24;
+    return D3D_OK;
+}
+
+static BOOL WINAPI
+present_GetWindowOccluded(ID3DPresent *This)
+{
+    (void) This;
+    return FALSE;
+}
+
+static BOOL WINAPI
+present_ResolutionMismatch(ID3DPresent *This)
+{
+    (void) This;
+    return FALSE;
+}
+
+static HANDLE WINAPI
+present_CreateThread(ID3DPresent *This, void *pThreadfunc, void *pParam)
+{
+    (void) This;
+    (void) pThreadfunc;
+    (void) pParam;
+    return NULL;
+}
+
+static BOOL WINAPI
+present_WaitForThread(ID3DPresent *This, HANDLE thread)
+{
+    (void) This;
+    (void) thread;
+    return FALSE;
+}
+
+static HRESULT WINAPI
+present_SetPresentParameters2(ID3DPresent *This,
+                              D3DPRESENT_PARAMETERS2 *pParameters)
+{
+    (void) This;
+    (void) pParameters;
+    return D3D_OK;
+}
+
+static BOOL WINAPI
+present_IsBufferReleased(ID3DPresent *This, D3DWindowBuffer *buffer)
+{
+    (void) This;
+    (void) buffer;
+    return TRUE;
+}
+
+static HRESULT WINAPI
+present_WaitBufferReleaseEvent(ID3DPresent *This)
+{
+    (void) This;
+    return D3D_OK;
+}
+
+static ID3DPresentVtbl present_vtable = {
+    present_QueryInterface,
+    present_AddRef,
+    present_Release,
+    present_SetPresentParameters,
+    present_NewD3DWindowBufferFromDmaBuf,
+    present_DestroyD3DWindowBuffer,
+    present_WaitBufferReleased,
+    present_FrontBufferCopy,
+    present_PresentBuffer,
+    present_GetRasterStatus,
+    present_GetDisplayMode,
+    present_GetPresentStats,
+    present_GetCursorPos,
+    present_SetCursorPos,
+    present_SetCursor,
+    present_SetGammaRamp,
+    present_GetWindowInfo,
+    present_GetWindowOccluded,
+    present_ResolutionMismatch,
+    present_CreateThread,
+    present_WaitForThread,
+    present_SetPresentParameters2,
+    present_IsBufferReleased,
+    present_WaitBufferReleaseEvent,
+};
+
+static ID3DPresent present = { &present_vtable };
+
+static HRESULT WINAPI
+group_QueryInterface(ID3DPresentGroup *This, REFIID riid, void **ppvObject)
+{
+    (void) This;
+    (void) riid;
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI
+group_AddRef(ID3DPresentGroup *This)
+{
+    (void) This;
+    return 1;
+}
+
+static ULONG WINAPI
+group_Release(ID3DPresentGroup *This)
+{
+    (void) This;
+    return 1;
+}
+
+static UINT WINAPI
+group_GetMultiheadCount(ID3DPresentGroup *This)
+{
+    (void) This;
+    return 1;
+}
+
+static HRESULT WINAPI
+group_GetPresent(ID3DPresentGroup *This, UINT Index, ID3DPresent **ppPresent)
+{
+    (void) This;
+    (void) Index;
+    *ppPresent = &present;
+    return D3D_OK;
+}
+
+static HRESULT WINAPI
+group_CreateAdditionalPresent(ID3DPresentGroup *This,
+                              D3DPRESENT_PARAMETERS *pPresentationParameters,
+                              ID3DPresent **ppPresent)
+{
+    (void) This;
+    (void) pPresentationParameters;
+    *ppPresent = &present;
+    return D3D_OK;
+}
+
+static void WINAPI
+group_GetVersion(ID3DPresentGroup *This, int *major, int *minor)
+{
+    (void) This;
+    *major = 1;
+    *minor = 3;
+}
+
+static ID3DPresentGroupVtbl group_vtable = {
+    group_QueryInterface,
+    group_AddRef,
+    group_Release,
+    group_GetMultiheadCount,
+    group_GetPresent,
+    group_CreateAdditionalPresent,
+    group_GetVersion,
+};
+
+static ID3DPresentGroup present_group = { &group_vtable };
+
+/* The device only keeps a reference to the IDirect3D9 */
+
+static HRESULT WINAPI
+d3d9_QueryInterface(IDirect3D9 *This, REFIID riid, void **ppvObject)
+{
+    (void) This;
+    (void) riid;
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI
+d3d9_AddRef(IDirect3D9 *This)
+{
+    (void) This;
+    return 1;
+}
+
+static ULONG WINAPI
+d3d9_Release(IDirect3D9 *This)
+{
+    (void) This;
+    return 1;
+}
+
+static IDirect3D9Vtbl d3d9_vtable = {
+    .QueryInterface = d3d9_QueryInterface,
+    .AddRef = d3d9_AddRef,
+    .Release = d3d9_Release,
+};
+
+static IDirect3D9 d3d9 = { &d3d9_vtable };
+
+/* Scenarios */
+
+struct vertex {
+    float x, y, z;
+    DWORD color;
+};
+
+#define FVF (D3DFVF_XYZ | D3DFVF_DIFFUSE)
+#define NUM_TRIANGLES 1024
+
+struct bench {
+    IDirect3DDevice9 *device;
+    IDirect3DVertexBuffer9 *vb; /* NUM_TRIANGLES static triangles */
+    unsigned frames;
+    unsigned calls_per_frame;
+    uint64_t calls; /* D3D9 calls of the current scenario */
+};
+
+struct scenario {
+    const char *name;
+    const char *description;
+    unsigned default_calls_per_frame;
+    HRESULT (*init)(struct bench *bench, void **data);
+    /* Issues the calls of one frame, between BeginScene and EndScene */
+    HRESULT (*frame)(struct bench *bench, void *data, unsigned frame);
+    void (*fini)(struct bench *bench, void *data);
+};
+
+#define CALL(bench, expr) \
+    do { \
+        HRESULT hr_ = (expr); \
+        (bench)->calls++; \
+        if (FAILED(hr_)) { \
+            fprintf(stderr, "%s:%d: %s failed: 0x%x\n", \
+                    __FILE__, __LINE__, #expr, (unsigned)hr_); \
+            return hr_; \
+        } \
+    } while (0)
+
+static void
+fill_triangles(struct vertex *v, unsigned num_triangles, unsigned seed)
+{
+    unsigned i;
+
+    for (i = 0; i < num_triangles * 3; i++) {
+        float x = (float)((i * 37 + seed) % 200) / 100.0f - 1.0f;
+        float y = (float)((i * 53 + seed) % 200) / 100.0f - 1.0f;
+
+        v[i].x = x;
+        v[i].y = y;
+        v[i].z = 0.5f;
+        v[i].color = 0xff000000 | (i * 0x10305 + seed);
+    }
+}
+
+static void
+set_matrix(D3DMATRIX *m, float scale, float tx)
+{
+    memset(m, 0, sizeof(*m));
+    m->_11 = scale;
+    m->_22 = scale;
+    m->_33 = 1.0f;
+    m->_41 = tx;
+    m->_44 = 1.0f;
+}
+
+/* Draw storm: many small draws with no state change in between */
+
+static HRESULT
+draws_frame(struct bench *bench, void *data, unsigned frame)
+{
+    IDirect3DDevice9 *dev = bench->device;
+    unsigned i;
+
+    (void) data;
+    (void) frame;
+    for (i = 0; i < bench->calls_per_frame; i++)
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   (i % NUM_TRIANGLES) * 3, 1));
+    return D3D_OK;
+}
+
+/* Draw storm with a render state change between the draws */
+
+static HRESULT
+draws_state_frame(struct bench *bench, void *data, unsigned frame)
+{
+    IDirect3DDevice9 *dev = bench->device;
+    unsigned i;
+
+    (void) data;
+    (void) frame;
+    for (i = 0; i < bench->calls_per_frame; i++) {
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_CULLMODE,
+                                                    i & 1 ? D3DCULL_CW : D3DCULL_NONE));
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   (i % NUM_TRIANGLES) * 3, 1));
+    }
+    return D3D_OK;
+}
+
+/* Lock/Unlock: dynamic vertex buffer filled with NOOVERWRITE/DISCARD
+ * before each draw, and a managed texture updated once per frame. */
+
+#define LOCK_VB_VERTICES (16 * 1024)
+#define LOCK_TEX_SIZE 256
+
+struct lock_data {
+    IDirect3DVertexBuffer9 *vb;
+    IDirect3DTexture9 *tex;
+    unsigned offset; /* in vertices */
+};
+
+static HRESULT
+lock_init(struct bench *bench, void **data)
+{
+    struct lock_data *lock = calloc(1, sizeof(*lock));
+
+    if (!lock)
+        return E_OUTOFMEMORY;
+    *data = lock;
+
+    CALL(bench, IDirect3DDevice9_CreateVertexBuffer(bench->device,
+                                                    LOCK_VB_VERTICES * sizeof(struct vertex),
+                                                    D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+                                                    FVF, D3DPOOL_DEFAULT,
+                                                    &lock->vb, NULL));
+    CALL(bench, IDirect3DDevice9_CreateTexture(bench->device,
+                                               LOCK_TEX_SIZE, LOCK_TEX_SIZE, 1, 0,
+                                               D3DFMT_A8R8G8B8, D3DPOOL_MANAGED,
+                                               &lock->tex, NULL));
+    return D3D_OK;
+}
+
+static HRESULT
+lock_frame(struct bench *bench, void *data, unsigned frame)
+{
+    struct lock_data *lock = data;
+    IDirect3DDevice9 *dev = bench->device;
+    D3DLOCKED_RECT rect;
+    unsigned i, y;
+
+    CALL(bench, IDirect3DTexture9_LockRect(lock->tex, 0, &rect, NULL, 0));
+    for (y = 0; y < LOCK_TEX_SIZE; y++)
+        memset((uint8_t *)rect.pBits + y * rect.Pitch, frame + y, LOCK_TEX_SIZE * 4);
+    CALL(bench, IDirect3DTexture9_UnlockRect(lock->tex, 0));
+
+    CALL(bench, IDirect3DDevice9_SetTexture(dev, 0, (IDirect3DBaseTexture9 *)lock->tex));
+    CALL(bench, IDirect3DDevice9_SetStreamSource(dev, 0, lock->vb, 0, sizeof(struct vertex)));
+
+    for (i = 0; i < bench->calls_per_frame; i++) {
+        DWORD flags = D3DLOCK_NOOVERWRITE;
+        void *ptr;
+
+        if (lock->offset + 3 > LOCK_VB_VERTICES) {
+            lock->offset = 0;
+            flags = D3DLOCK_DISCARD;
+        }
+        CALL(bench, IDirect3DVertexBuffer9_Lock(lock->vb,
+                                                lock->offset * sizeof(struct vertex),
+                                                3 * sizeof(struct vertex),
+                                                &ptr, flags));
+        fill_triangles(ptr, 1, i);
+        CALL(bench, IDirect3DVertexBuffer9_Unlock(lock->vb));
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   lock->offset, 1));
+        lock->offset += 3;
+    }
+
+    CALL(bench, IDirect3DDevice9_SetTexture(dev, 0, NULL));
+    CALL(bench, IDirect3DDevice9_SetStreamSource(dev, 0, bench->vb, 0, sizeof(struct vertex)));
+    return D3D_OK;
+}
+
+static void
+lock_fini(struct bench *bench, void *data)
+{
+    struct lock_data *lock = data;
+
+    (void) bench;
+    if (lock->vb)
+        IDirect3DVertexBuffer9_Release(lock->vb);
+    if (lock->tex)
+        IDirect3DTexture9_Release(lock->tex);
+    free(lock);
+}
+
+/* Stateblocks: recorded stateblocks applied before each draw */
+
+#define NUM_STATEBLOCKS 8
+
+struct stateblock_data {
+    IDirect3DStateBlock9 *sb[NUM_STATEBLOCKS];
+    IDirect3DStateBlock9 *all;
+};
+
+static HRESULT
+stateblock_init(struct bench *bench, void **data)
+{
+    struct stateblock_data *sbd = calloc(1, sizeof(*sbd));
+    IDirect3DDevice9 *dev = bench->device;
+    D3DMATRIX m;
+    unsigned i;
+
+    if (!sbd)
+        return E_OUTOFMEMORY;
+    *data = sbd;
+
+    CALL(bench, IDirect3DDevice9_CreateStateBlock(dev, D3DSBT_ALL, &sbd->all));
+
+    for (i = 0; i < NUM_STATEBLOCKS; i++) {
+        CALL(bench, IDirect3DDevice9_BeginStateBlock(dev));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_ALPHABLENDENABLE, i & 1));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_SRCBLEND, D3DBLEND_SRCALPHA));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_ZENABLE, (i >> 1) & 1));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_CULLMODE,
+                                                    i & 4 ? D3DCULL_CCW : D3DCULL_NONE));
+        CALL(bench, IDirect3DDevice9_SetTextureStageState(dev, 0, D3DTSS_COLOROP,
+                                                          i & 2 ? D3DTOP_MODULATE : D3DTOP_SELECTARG2));
+        set_matrix(&m, 1.0f - i * 0.05f, i * 0.01f);
+        CALL(bench, IDirect3DDevice9_SetTransform(dev, D3DTS_WORLD, &m));
+        CALL(bench, IDirect3DDevice9_EndStateBlock(dev, &sbd->sb[i]));
+    }
+    return D3D_OK;
+}
+
+static HRESULT
+stateblock_frame(struct bench *bench, void *data, unsigned frame)
+{
+    struct stateblock_data *sbd = data;
+    IDirect3DDevice9 *dev = bench->device;
+    unsigned i;
+
+    (void) frame;
+    CALL(bench, IDirect3DStateBlock9_Apply(sbd->all));
+    for (i = 0; i < bench->calls_per_frame; i++) {
+        CALL(bench, IDirect3DStateBlock9_Apply(sbd->sb[i % NUM_STATEBLOCKS]));
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   (i % NUM_TRIANGLES) * 3, 1));
+    }
+    return D3D_OK;
+}
+
+static void
+stateblock_fini(struct bench *bench, void *data)
+{
+    struct stateblock_data *sbd = data;
+    unsigned i;
+
+    if (sbd->all) {
+        /* Restore the initial state for the next scenarios */
+        IDirect3DStateBlock9_Apply(sbd->all);
+        IDirect3DStateBlock9_Release(sbd->all);
+    }
+    for (i = 0; i < NUM_STATEBLOCKS; i++)
+        if (sbd->sb[i])
+            IDirect3DStateBlock9_Release(sbd->sb[i]);
+    (void) bench;
+    free(sbd);
+}
+
+/* Stateblock replay: a recorded sequence of per object stateblocks, as
+ * titles that capture the state of each object and Apply it before the
+ * object is drawn. Objects of the same material record the same values in
+ * distinct stateblocks, so most Apply calls only partially change the
+ * device state. */
+
+#define REPLAY_OBJECTS 64
+#define REPLAY_MATERIALS 8
+#define REPLAY_CONSTANTS 16 /* vs float constants per stateblock */
+
+struct replay_data {
+    IDirect3DStateBlock9 *sb[REPLAY_OBJECTS];
+    IDirect3DStateBlock9 *all;
+    unsigned sequence[REPLAY_OBJECTS]; /* draw order of the objects */
+};
+
+static HRESULT
+replay_init(struct bench *bench, void **data)
+{
+    struct replay_data *replay = calloc(1, sizeof(*replay));
+    IDirect3DDevice9 *dev = bench->device;
+    float constants[REPLAY_CONSTANTS * 4];
+    D3DMATRIX m;
+    unsigned i, j;
+
+    if (!replay)
+        return E_OUTOFMEMORY;
+    *data = replay;
+
+    CALL(bench, IDirect3DDevice9_CreateStateBlock(dev, D3DSBT_ALL, &replay->all));
+
+    for (i = 0; i < REPLAY_OBJECTS; i++) {
+        unsigned material = i % REPLAY_MATERIALS;
+
+        CALL(bench, IDirect3DDevice9_BeginStateBlock(dev));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_ALPHABLENDENABLE, material & 1));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_SRCBLEND, D3DBLEND_SRCALPHA));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_ZWRITEENABLE, !(material & 1)));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_CULLMODE,
+                                                    material & 2 ? D3DCULL_CCW : D3DCULL_NONE));
+        CALL(bench, IDirect3DDevice9_SetTextureStageState(dev, 0, D3DTSS_COLOROP,
+                                                          material & 4 ? D3DTOP_MODULATE : D3DTOP_SELECTARG2));
+        /* Per material constants, and a per object position in c0 */
+        for (j = 0; j < REPLAY_CONSTANTS * 4; j++)
+            constants[j] = (float)(material * 100 + j) / 1000.0f;
+        constants[0] = (float)i / REPLAY_OBJECTS;
+        CALL(bench, IDirect3DDevice9_SetVertexShaderConstantF(dev, 0, constants,
+                                                              REPLAY_CONSTANTS));
+        set_matrix(&m, 1.0f, (float)i / REPLAY_OBJECTS);
+        CALL(bench, IDirect3DDevice9_SetTransform(dev, D3DTS_WORLD, &m));
+        CALL(bench, IDirect3DDevice9_EndStateBlock(dev, &replay->sb[i]));
+    }
+
+    /* Objects are drawn sorted by material */
+    for (i = 0; i < REPLAY_OBJECTS; i++)
+        replay->sequence[i] = (i % (REPLAY_OBJECTS / REPLAY_MATERIALS)) * REPLAY_MATERIALS +
+                              i / (REPLAY_OBJECTS / REPLAY_MATERIALS);
+    return D3D_OK;
+}
+
+static HRESULT
+replay_frame(struct bench *bench, void *data, unsigned frame)
+{
+    struct replay_data *replay = data;
+    IDirect3DDevice9 *dev = bench->device;
+    unsigned i;
+
+    (void) frame;
+    for (i = 0; i < bench->calls_per_frame; i++) {
+        CALL(bench, IDirect3DStateBlock9_Apply(replay->sb[replay->sequence[i % REPLAY_OBJECTS]]));
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   (i % NUM_TRIANGLES) * 3, 1));
+    }
+    return D3D_OK;
+}
+
+static void
+replay_fini(struct bench *bench, void *data)
+{
+    struct replay_data *replay = data;
+    unsigned i;
+
+    if (replay->all) {
+        /* Restore the initial state for the next scenarios */
+        IDirect3DStateBlock9_Apply(replay->all);
+        IDirect3DStateBlock9_Release(replay->all);
+    }
+    for (i = 0; i < REPLAY_OBJECTS; i++)
+        if (replay->sb[i])
+            IDirect3DStateBlock9_Release(replay->sb[i]);
+    (void) bench;
+    free(replay);
+}
+
+/* Fixed function state churn: transforms, lights, material, texture
+ * stages and fog change between the draws, which requires many fixed
+ * function shader variants. */
+
+static HRESULT
+ff_frame(struct bench *bench, void *data, unsigned frame)
+{
+    IDirect3DDevice9 *dev = bench->device;
+    D3DLIGHT9 light;
+    D3DMATERIAL9 material;
+    D3DMATRIX m;
+    unsigned i;
+
+    (void) data;
+    memset(&light, 0, sizeof(light));
+    light.Type = D3DLIGHT_DIRECTIONAL;
+    light.Diffuse.r = light.Diffuse.g = light.Diffuse.b = light.Diffuse.a = 1.0f;
+    light.Direction.z = 1.0f;
+    memset(&material, 0, sizeof(material));
+    material.Diffuse.r = material.Diffuse.g = material.Diffuse.b = material.Diffuse.a = 1.0f;
+
+    for (i = 0; i < bench->calls_per_frame; i++) {
+        set_matrix(&m, 1.0f, (float)((i + frame) % 100) / 100.0f);
+        CALL(bench, IDirect3DDevice9_SetTransform(dev, D3DTS_WORLD, &m));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_LIGHTING, i & 1));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_FOGENABLE, (i >> 1) & 1));
+        CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_FOGVERTEXMODE,
+                                                    i & 4 ? D3DFOG_LINEAR : D3DFOG_EXP));
+        CALL(bench, IDirect3DDevice9_SetTextureStageState(dev, 0, D3DTSS_COLOROP,
+                                                          i & 8 ? D3DTOP_ADD : D3DTOP_SELECTARG2));
+        if ((i & 3) == 0) {
+            light.Diffuse.r = (float)(i % 16) / 16.0f;
+            material.Power = (float)(i % 8);
+            CALL(bench, IDirect3DDevice9_SetLight(dev, i % 4, &light));
+            CALL(bench, IDirect3DDevice9_LightEnable(dev, i % 4, (i >> 2) & 1));
+            CALL(bench, IDirect3DDevice9_SetMaterial(dev, &material));
+        }
+        CALL(bench, IDirect3DDevice9_DrawPrimitive(dev, D3DPT_TRIANGLELIST,
+                                                   (i % NUM_TRIANGLES) * 3, 1));
+    }
+
+    CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_LIGHTING, FALSE));
+    CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_FOGENABLE, FALSE));
+    return D3D_OK;
+}
+
+static const struct scenario scenarios[] = {
+    { "draws", "draws with no state change", 4000, NULL, draws_frame, NULL },
+    { "draws-state", "draws with a render state change each", 2000, NULL, draws_state_frame, NULL },
+    { "lock", "dynamic vertex buffer and managed texture locks", 1000, lock_init, lock_frame, lock_fini },
+    { "stateblock", "stateblock Apply before each draw", 1000, stateblock_init, stateblock_frame, stateblock_fini },
+    { "sb-replay", "recorded per object stateblock sequence", 1000, replay_init, replay_frame, replay_fini },
+    { "ff", "fixed function state churn", 1000, NULL, ff_frame, NULL },
+};
+
+static HRESULT
+run_scenario(struct bench *bench, const struct scenario *sc)
+{
+    IDirect3DDevice9 *dev = bench->device;
+    void *data = NULL;
+    int64_t start, frame_start, frame_time, max_frame_time = 0;
+    HRESULT hr = D3D_OK;
+    unsigned frame;
+
+    bench->calls = 0;
+    if (sc->init)
+        hr = sc->init(bench, &data);
+
+    start = os_time_get_nano();
+    for (frame = 0; SUCCEEDED(hr) && frame < bench->frames; frame++) {
+        frame_start = os_time_get_nano();
+
+        bench->calls += 4;
+        hr = IDirect3DDevice9_Clear(dev, 0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER,
+                                    0xff000000 | frame, 1.0f, 0);
+        if (SUCCEEDED(hr))
+            hr = IDirect3DDevice9_BeginScene(dev);
+        if (SUCCEEDED(hr))
+            hr = sc->frame(bench, data, frame);
+        if (SUCCEEDED(hr))
+            hr = IDirect3DDevice9_EndScene(dev);
+        if (SUCCEEDED(hr))
+            hr = IDirect3DDevice9_Present(dev, NULL, NULL, NULL, NULL);
+
+        frame_time = os_time_get_nano() - frame_start;
+        if (frame_time > max_frame_time)
+            max_frame_time = frame_time;
+    }
+
+    if (SUCCEEDED(hr)) {
+        double seconds = (os_time_get_nano() - start) / 1e9;
+
+        printf("%-12s %6u frames %10"PRIu64" calls %9.3f ms/frame (max %9.3f) %12.0f calls/s\n",
+               sc->name, bench->frames, bench->calls,
+               seconds * 1000.0 / bench->frames, max_frame_time / 1e6,
+               bench->calls / seconds);
+    } else {
+        fprintf(stderr, "%s: failed at frame %u: 0x%x\n", sc->name, frame,
+                (unsigned)hr);
+    }
+
+    if (sc->fini)
+        sc->fini(bench, data);
+    return hr;
+}
+
+static HRESULT
+bench_init(struct bench *bench)
+{
+    IDirect3DDevice9 *dev = bench->device;
+    void *ptr;
+
+    CALL(bench, IDirect3DDevice9_CreateVertexBuffer(dev,
+                                                    NUM_TRIANGLES * 3 * sizeof(struct vertex),
+                                                    D3DUSAGE_WRITEONLY, FVF,
+                                                    D3DPOOL_DEFAULT, &bench->vb, NULL));
+    CALL(bench, IDirect3DVertexBuffer9_Lock(bench->vb, 0, 0, &ptr, 0));
+    fill_triangles(ptr, NUM_TRIANGLES, 0);
+    CALL(bench, IDirect3DVertexBuffer9_Unlock(bench->vb));
+
+    CALL(bench, IDirect3DDevice9_SetFVF(dev, FVF));
+    CALL(bench, IDirect3DDevice9_SetStreamSource(dev, 0, bench->vb, 0, sizeof(struct vertex)));
+    CALL(bench, IDirect3DDevice9_SetRenderState(dev, D3DRS_LIGHTING, FALSE));
+    return D3D_OK;
+}
+
+static void
+usage(const char *name)
+{
+    unsigned i;
+
+    fprintf(stderr,
+            "usage: %s [options] [scenario[:calls_per_frame]]...\n"
+            "options:\n"
+            "  --device PATH   DRM device (default /dev/dri/renderD128)\n"
+            "  --frames N      frames per scenario (default 100)\n"
+            "  --swvp          software vertex processing\n"
+            "scenarios (all by default):\n", name);
+    for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+        fprintf(stderr, "  %-12s %s (%u calls per frame)\n", scenarios[i].name,
+                scenarios[i].description, scenarios[i].default_calls_per_frame);
+}
+
+static const struct scenario *
+find_scenario(const char *arg, unsigned *calls_per_frame)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(scenarios); i++) {
+        if (strlen(scenarios[i].name) == len &&
+            strncmp(scenarios[i].name, arg, len) == 0) {
+            *calls_per_frame = colon ? strtoul(colon + 1, NULL, 0) :
+                                       scenarios[i].default_calls_per_frame;
+            return &scenarios[i];
+        }
+    }
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *device_path = "/dev/dri/renderD128";
+    const struct D3DAdapter9DRM *drm;
+    D3DPRESENT_PARAMETERS params;
+    ID3DAdapter9 *adapter = NULL;
+    struct bench bench;
+    DWORD behavior = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+    const char **runs;
+    unsigned num_runs = 0;
+    HRESULT hr;
+    int i, fd, ret = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.frames = 100;
+
+    runs = calloc(argc, sizeof(*runs));
+    if (!runs)
+        return 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            device_path = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            bench.frames = MAX2(strtoul(argv[++i], NULL, 0), 1);
+        } else if (strcmp(argv[i], "--swvp") == 0) {
+            behavior = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+        } else if (argv[i][0] != '-') {
+            unsigned calls;
+
+            if (!find_scenario(argv[i], &calls)) {
+                fprintf(stderr, "unknown scenario '%s'\n", argv[i]);
+                usage(argv[0]);
+                return 1;
+            }
+            runs[num_runs++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Software vertex processing on llvmpipe, unless chosen otherwise */
+    setenv("force_sw_rendering_on_cpu", "true", 0);
+
+    drm = D3DAdapter9GetProc(D3DADAPTER9DRM_NAME);
+    if (!drm || drm->major_version != D3DADAPTER9DRM_MAJOR) {
+        fprintf(stderr, "incompatible d3dadapter9 drm interface\n");
+        return 1;
+    }
+
+    fd = open(device_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", device_path, strerror(errno));
+        return 1;
+    }
+
+    /* Takes ownership of fd */
+    hr = drm->create_adapter(fd, &adapter);
+    if (FAILED(hr)) {
+        fprintf(stderr, "failed to create the adapter: 0x%x\n", (unsigned)hr);
+        return 1;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.BackBufferWidth = WIDTH;
+    params.BackBufferHeight = HEIGHT;
+    params.BackBufferFormat = D3DFMT_X8R8G8B8;
+    params.BackBufferCount = 1;
+    params.SwapEffect = D3DSWAPEFFECT_DISCARD;
+    params.hDeviceWindow = (HWND)1;
+    params.Windowed = TRUE;
+    params.EnableAutoDepthStencil = TRUE;
+    params.AutoDepthStencilFormat = D3DFMT_D24S8;
+    params.PresentationInterval = D3DPRESENT_INTERVAL_IMMEDIATE;
+
+    hr = ID3DAdapter9_CreateDevice(adapter, 0, D3DDEVTYPE_HAL, params.hDeviceWindow,
+                                   behavior, &params, &d3d9, &present_group,
+                                   &bench.device);
+    if (FAILED(hr)) {
+        fprintf(stderr, "failed to create the device: 0x%x\n", (unsigned)hr);
+        ID3DAdapter9_Release(adapter);
+        return 1;
+    }
+
+    if (FAILED(bench_init(&bench))) {
+        ret = 1;
+    } else if (!num_runs) {
+        for (i = 0; i < (int)ARRAY_SIZE(scenarios); i++) {
+            bench.calls_per_frame = scenarios[i].default_calls_per_frame;
+            if (FAILED(run_scenario(&bench, &scenarios[i])))
+                ret = 1;
+        }
+    } else {
+        for (i = 0; i < (int)num_runs; i++) {
+            const struct scenario *sc = find_scenario(runs[i], &bench.calls_per_frame);
+
+            if (FAILED(run_scenario(&bench, sc)))
+                ret = 1;
+        }
+    }
+
+    if (bench.vb)
+        IDirect3DVertexBuffer9_Release(bench.vb);
+    IDirect3DDevice9_Release(bench.device);
+    ID3DAdapter9_Release(adapter);
+    free(runs);
+    return ret;
+}
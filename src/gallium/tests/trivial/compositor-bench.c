@@ -0,0 +1,505 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Compositor benchmark for the software drivers.
+ *
+ * Renders a frame the way a desktop compositor does: an opaque wallpaper
+ * blit, premultiplied alpha windows drawn 1:1, scaled down window
+ * thumbnails and small alpha blended icons.  The frame is rendered with
+ * the llvmpipe linear rasterizer disabled and enabled (LP_LINEAR_RAST),
+ * and the frame time, speedup and largest channel difference between the
+ * two results are printed.
+ *
+ * usage: compositor-bench [frames]
+ */
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define WIN_WIDTH 640
+#define WIN_HEIGHT 400
+#define ICON_SIZE 48
+#define NUM_WINDOWS 6
+#define NUM_THUMBS 6
+#define NUM_ICONS 32
+#define NUM_QUADS (1 + NUM_WINDOWS + NUM_THUMBS + NUM_ICONS)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipe/p_state.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_inlines.h"
+#include "cso_cache/cso_context.h"
+#include "util/u_box.h"
+#include "util/u_draw_quad.h"
+#include "util/u_memory.h"
+#include "util/u_sampler.h"
+#include "util/u_simple_shaders.h"
+#include "util/os_time.h"
+#include "pipe-loader/pipe_loader.h"
+
+enum layer {
+	LAYER_WALLPAPER,
+	LAYER_WINDOWS,
+	LAYER_THUMBS,
+	LAYER_ICONS,
+	NUM_LAYERS
+};
+
+static const struct {
+	unsigned first_quad;
+	unsigned num_quads;
+} layers[NUM_LAYERS] = {
+	{ 0, 1 },
+	{ 1, NUM_WINDOWS },
+	{ 1 + NUM_WINDOWS, NUM_THUMBS },
+	{ 1 + NUM_WINDOWS + NUM_THUMBS, NUM_ICONS },
+};
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend[NUM_LAYERS];
+	struct pipe_sampler_state sampler[NUM_LAYERS];
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct cso_velems_state velem;
+
+	void *vs;
+	void *fs;
+
+	union pipe_color_union clear_color;
+
+	struct pipe_resource *vbuf;
+	struct pipe_resource *target;
+	struct pipe_resource *tex[NUM_LAYERS];
+	struct pipe_sampler_view *view[NUM_LAYERS];
+};
+
+/* Pixel rectangle to two triangles with texture coordinates */
+static void emit_quad(float (*v)[2][4], float x, float y, float w, float h)
+{
+	static const float corners[6][2] = {
+		{ 0, 0 }, { 1, 0 }, { 1, 1 },
+		{ 0, 0 }, { 1, 1 }, { 0, 1 },
+	};
+	unsigned i;
+
+	for (i = 0; i < 6; i++) {
+		float s = corners[i][0];
+		float t = corners[i][1];
+
+		v[i][0][0] = -1.0f + 2.0f * (x + s * w) / WIDTH;
+		v[i][0][1] = -1.0f + 2.0f * (y + t * h) / HEIGHT;
+		v[i][0][2] = 0.0f;
+		v[i][0][3] = 1.0f;
+		v[i][1][0] = s;
+		v[i][1][1] = t;
+		v[i][1][2] = 0.0f;
+		v[i][1][3] = 1.0f;
+	}
+}
+
+static void fill_vertices(float (*v)[2][4])
+{
+	unsigned i;
+
+	emit_quad(v, 0, 0, WIDTH, HEIGHT);
+	v += 6;
+
+	/* Cascaded windows, texel aligned */
+	for (i = 0; i < NUM_WINDOWS; i++, v += 6)
+		emit_quad(v, 100 + i * 160, 80 + i * 90, WIN_WIDTH, WIN_HEIGHT);
+
+	/* Task switcher thumbnails, scaled down */
+	for (i = 0; i < NUM_THUMBS; i++, v += 6)
+		emit_quad(v, 160 + i * 270, 820, WIN_WIDTH * 0.37f, WIN_HEIGHT * 0.37f);
+
+	/* Dock icons */
+	for (i = 0; i < NUM_ICONS; i++, v += 6)
+		emit_quad(v, 200 + i * (ICON_SIZE + 8), HEIGHT - ICON_SIZE - 4,
+			  ICON_SIZE, ICON_SIZE);
+}
+
+static uint32_t texel(enum layer layer, unsigned x, unsigned y)
+{
+	unsigned a, r, g, b;
+
+	switch (layer) {
+	case LAYER_WALLPAPER:
+		/* Opaque gradient */
+		r = x * 255 / WIDTH;
+		g = y * 255 / HEIGHT;
+		b = ((x ^ y) >> 3) & 0xff;
+		return 0xff000000 | r << 16 | g << 8 | b;
+	case LAYER_WINDOWS:
+		/* Premultiplied, translucent decorations around an opaque body */
+		a = x < 8 || y < 24 || x >= WIN_WIDTH - 8 || y >= WIN_HEIGHT - 8 ?
+		    0xa0 : 0xff;
+		r = (0xe0 - (y & 0x3f)) * a / 255;
+		g = (0xe0 - (x & 0x1f)) * a / 255;
+		b = 0xf0 * a / 255;
+		return a << 24 | r << 16 | g << 8 | b;
+	default: {
+		/* Straight alpha disc */
+		int dx = (int)x - ICON_SIZE / 2;
+		int dy = (int)y - ICON_SIZE / 2;
+		int d2 = dx * dx + dy * dy;
+		int r2 = ICON_SIZE * ICON_SIZE / 4;
+
+		a = d2 >= r2 ? 0 : d2 >= r2 - 4 * ICON_SIZE ? 0x80 : 0xff;
+		return a << 24 | (x * 5) << 16 | (y * 5) << 8 | 0x40;
+	}
+	}
+}
+
+static struct pipe_resource *create_texture(struct program *p,
+					    enum layer layer,
+					    unsigned width, unsigned height,
+					    enum pipe_format format)
+{
+	struct pipe_resource tmplt;
+	struct pipe_resource *tex;
+	struct pipe_transfer *t;
+	struct pipe_box box;
+	uint8_t *map;
+	unsigned x, y;
+
+	memset(&tmplt, 0, sizeof(tmplt));
+	tmplt.target = PIPE_TEXTURE_2D;
+	tmplt.format = format;
+	tmplt.width0 = width;
+	tmplt.height0 = height;
+	tmplt.depth0 = 1;
+	tmplt.array_size = 1;
+	tmplt.last_level = 0;
+	tmplt.bind = PIPE_BIND_SAMPLER_VIEW;
+
+	tex = p->screen->resource_create(p->screen, &tmplt);
+
+	u_box_origin_2d(width, height, &box);
+	map = p->pipe->transfer_map(p->pipe, tex, 0, PIPE_MAP_WRITE, &box, &t);
+	for (y = 0; y < height; y++) {
+		uint32_t *row = (uint32_t *)(map + y * t->stride);
+
+		for (x = 0; x < width; x++)
+			row[x] = texel(layer, x, y);
+	}
+	p->pipe->transfer_unmap(p->pipe, t);
+
+	return tex;
+}
+
+static struct program *init_prog(bool linear)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	struct pipe_surface surf_tmpl;
+	unsigned i;
+
+	/* Read by the driver at screen creation */
+	setenv("LP_LINEAR_RAST", linear ? "true" : "false", 1);
+
+	if (!pipe_loader_sw_probe_null(&p->dev)) {
+		fprintf(stderr, "no software device\n");
+		exit(1);
+	}
+	p->screen = pipe_loader_create_screen(p->dev);
+	if (!p->screen) {
+		fprintf(stderr, "failed to create the screen\n");
+		exit(1);
+	}
+
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	p->clear_color.f[0] = 0.0;
+	p->clear_color.f[1] = 0.0;
+	p->clear_color.f[2] = 0.0;
+	p->clear_color.f[3] = 1.0;
+
+	/* vertex buffer */
+	{
+		unsigned size = NUM_QUADS * 6 * sizeof(float[2][4]);
+		float (*vertices)[2][4] = MALLOC(size);
+
+		fill_vertices(vertices);
+		p->vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+					     PIPE_USAGE_DEFAULT, size);
+		pipe_buffer_write(p->pipe, p->vbuf, 0, size, vertices);
+		FREE(vertices);
+	}
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* sampler textures, the thumbnails reuse the window texture */
+	p->tex[LAYER_WALLPAPER] = create_texture(p, LAYER_WALLPAPER, WIDTH, HEIGHT,
+						 PIPE_FORMAT_B8G8R8X8_UNORM);
+	p->tex[LAYER_WINDOWS] = create_texture(p, LAYER_WINDOWS,
+					       WIN_WIDTH, WIN_HEIGHT,
+					       PIPE_FORMAT_B8G8R8A8_UNORM);
+	pipe_resource_reference(&p->tex[LAYER_THUMBS], p->tex[LAYER_WINDOWS]);
+	p->tex[LAYER_ICONS] = create_texture(p, LAYER_ICONS, ICON_SIZE, ICON_SIZE,
+					     PIPE_FORMAT_B8G8R8A8_UNORM);
+
+	for (i = 0; i < NUM_LAYERS; i++) {
+		struct pipe_sampler_view v_tmplt;
+
+		u_sampler_view_default_template(&v_tmplt, p->tex[i], p->tex[i]->format);
+		p->view[i] = p->pipe->create_sampler_view(p->pipe, p->tex[i], &v_tmplt);
+
+		memset(&p->sampler[i], 0, sizeof(p->sampler[i]));
+		p->sampler[i].wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+		p->sampler[i].wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+		p->sampler[i].wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+		p->sampler[i].min_mip_filter = PIPE_TEX_MIPFILTER_NONE;
+		p->sampler[i].min_img_filter = i == LAYER_THUMBS ?
+			PIPE_TEX_FILTER_LINEAR : PIPE_TEX_FILTER_NEAREST;
+		p->sampler[i].mag_img_filter = p->sampler[i].min_img_filter;
+		p->sampler[i].normalized_coords = 1;
+
+		memset(&p->blend[i], 0, sizeof(p->blend[i]));
+		p->blend[i].rt[0].colormask = PIPE_MASK_RGBA;
+		if (i == LAYER_WALLPAPER)
+			continue;
+
+		/* premultiplied windows, straight alpha icons */
+		p->blend[i].rt[0].blend_enable = 1;
+		p->blend[i].rt[0].rgb_func = PIPE_BLEND_ADD;
+		p->blend[i].rt[0].rgb_src_factor = i == LAYER_ICONS ?
+			PIPE_BLENDFACTOR_SRC_ALPHA : PIPE_BLENDFACTOR_ONE;
+		p->blend[i].rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+		p->blend[i].rt[0].alpha_func = PIPE_BLEND_ADD;
+		p->blend[i].rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+		p->blend[i].rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+	}
+
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+	p->viewport.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+	p->viewport.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+	p->viewport.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+	p->viewport.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+
+	memset(&p->velem, 0, sizeof(p->velem));
+	p->velem.count = 2;
+	p->velem.velems[0].src_offset = 0;
+	p->velem.velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+	p->velem.velems[1].src_offset = 4 * sizeof(float);
+	p->velem.velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	{
+		const enum tgsi_semantic semantic_names[] =
+			{ TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	p->fs = util_make_fragment_tex_shader(p->pipe, TGSI_TEXTURE_2D,
+					      TGSI_INTERPOLATE_PERSPECTIVE,
+					      TGSI_RETURN_TYPE_FLOAT,
+					      TGSI_RETURN_TYPE_FLOAT, false,
+					      false);
+
+	return p;
+}
+
+static void close_prog(struct program *p)
+{
+	unsigned i;
+
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	for (i = 0; i < NUM_LAYERS; i++) {
+		pipe_sampler_view_reference(&p->view[i], NULL);
+		pipe_resource_reference(&p->tex[i], NULL);
+	}
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->vbuf, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+
+	FREE(p);
+}
+
+static void draw_frame(struct program *p)
+{
+	struct pipe_fence_handle *fence = NULL;
+	unsigned i;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, NULL, &p->clear_color, 0, 0);
+
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, &p->velem);
+
+	for (i = 0; i < NUM_LAYERS; i++) {
+		const struct pipe_sampler_state *samplers[] = {&p->sampler[i]};
+
+		cso_set_blend(p->cso, &p->blend[i]);
+		cso_set_samplers(p->cso, PIPE_SHADER_FRAGMENT, 1, samplers);
+		p->pipe->set_sampler_views(p->pipe, PIPE_SHADER_FRAGMENT, 0, 1, 0,
+					   &p->view[i]);
+
+		util_draw_vertex_buffer(p->pipe, p->cso,
+		                        p->vbuf, 0,
+		                        layers[i].first_quad * 6 * sizeof(float[2][4]),
+		                        PIPE_PRIM_TRIANGLES,
+		                        layers[i].num_quads * 6,
+		                        2);
+	}
+
+	p->pipe->flush(p->pipe, &fence, 0);
+	p->screen->fence_finish(p->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+	p->screen->fence_reference(p->screen, &fence, NULL);
+}
+
+/* Copy out the frame, or compare it with a previous copy */
+static unsigned read_frame(struct program *p, uint32_t *pixels, bool compare)
+{
+	struct pipe_transfer *t;
+	struct pipe_box box;
+	unsigned max_diff = 0;
+	uint8_t *map;
+	unsigned x, y, c;
+
+	u_box_origin_2d(WIDTH, HEIGHT, &box);
+	map = p->pipe->transfer_map(p->pipe, p->target, 0, PIPE_MAP_READ, &box, &t);
+	for (y = 0; y < HEIGHT; y++) {
+		const uint32_t *row = (const uint32_t *)(map + y * t->stride);
+		uint32_t *dst = pixels + y * WIDTH;
+
+		if (!compare) {
+			memcpy(dst, row, WIDTH * 4);
+			continue;
+		}
+
+		/* RGB only, the X channel is undefined */
+		for (x = 0; x < WIDTH; x++) {
+			for (c = 0; c < 24; c += 8) {
+				int a = (row[x] >> c) & 0xff;
+				int b = (dst[x] >> c) & 0xff;
+				max_diff = MAX2(max_diff, (unsigned)abs(a - b));
+			}
+		}
+	}
+	p->pipe->transfer_unmap(p->pipe, t);
+
+	return max_diff;
+}
+
+int main(int argc, char** argv)
+{
+	static const char *names[] = { "jit", "linear" };
+	unsigned frames = 50;
+	uint32_t *pixels = MALLOC(WIDTH * HEIGHT * 4);
+	double base = 0.0;
+	unsigned n, i;
+
+	if (argc > 1)
+		frames = MAX2(1, atoi(argv[1]));
+
+	printf("path      ms/frame   speedup  max diff\n");
+	for (n = 0; n < 2; n++) {
+		struct program *p = init_prog(n == 1);
+		unsigned max_diff;
+		int64_t start;
+		double ms;
+
+		/* Warm up, compiles the shader variants */
+		draw_frame(p);
+
+		start = os_time_get_nano();
+		for (i = 0; i < frames; i++)
+			draw_frame(p);
+		ms = (os_time_get_nano() - start) / 1e6 / frames;
+
+		max_diff = read_frame(p, pixels, n != 0);
+
+		if (n == 0)
+			base = ms;
+		printf("%-6s %11.3f %9.2f %9u\n", names[n], ms, base / ms, max_diff);
+
+		close_prog(p);
+	}
+
+	FREE(pixels);
+
+	return 0;
+}
@@ -0,0 +1,439 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Texture sampling benchmark for the software drivers.
+ *
+ * Draws fullscreen quads sampling a large mipmapped texture with trilinear
+ * filtering, rotated and scaled so that the texel footprints walk across
+ * texture rows as well as along them.  The frame is rendered with the
+ * llvmpipe linear and tiled texture layouts (LP_TILED_TEXTURES), and the
+ * frame time, speedup and largest channel difference between the two
+ * results are printed.
+ *
+ * usage: tex-bench [frames]
+ */
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define TEX_SIZE 2048
+#define TEX_LEVELS 12
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipe/p_state.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_inlines.h"
+#include "cso_cache/cso_context.h"
+#include "util/u_box.h"
+#include "util/u_draw_quad.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_sampler.h"
+#include "util/u_simple_shaders.h"
+#include "util/os_time.h"
+#include "pipe-loader/pipe_loader.h"
+
+/* Rotation (degrees) and texels per pixel of the quads */
+static const float quads[][2] = {
+	{   0.0f, 1.0f },
+	{  90.0f, 1.0f },
+	{  30.0f, 0.7f },
+	{ -60.0f, 1.3f },
+	{ 110.0f, 2.5f },
+	{  45.0f, 5.0f },
+};
+
+#define NUM_QUADS ARRAY_SIZE(quads)
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend;
+	struct pipe_sampler_state sampler;
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct cso_velems_state velem;
+
+	void *vs;
+	void *fs;
+
+	union pipe_color_union clear_color;
+
+	struct pipe_resource *vbuf;
+	struct pipe_resource *target;
+	struct pipe_resource *tex;
+	struct pipe_sampler_view *view;
+};
+
+/* Fullscreen quad, with texcoords rotated and scaled around the centre */
+static void emit_quad(float (*v)[2][4], float angle, float scale)
+{
+	static const float corners[6][2] = {
+		{ 0, 0 }, { 1, 0 }, { 1, 1 },
+		{ 0, 0 }, { 1, 1 }, { 0, 1 },
+	};
+	float c = cosf(angle * (float)M_PI / 180.0f);
+	float s = sinf(angle * (float)M_PI / 180.0f);
+	unsigned i;
+
+	for (i = 0; i < 6; i++) {
+		float x = (corners[i][0] - 0.5f) * WIDTH * scale / TEX_SIZE;
+		float y = (corners[i][1] - 0.5f) * HEIGHT * scale / TEX_SIZE;
+
+		v[i][0][0] = -1.0f + 2.0f * corners[i][0];
+		v[i][0][1] = -1.0f + 2.0f * corners[i][1];
+		v[i][0][2] = 0.0f;
+		v[i][0][3] = 1.0f;
+		v[i][1][0] = 0.5f + c * x - s * y;
+		v[i][1][1] = 0.5f + s * x + c * y;
+		v[i][1][2] = 0.0f;
+		v[i][1][3] = 1.0f;
+	}
+}
+
+static uint32_t texel(unsigned level, unsigned x, unsigned y)
+{
+	unsigned r, g, b;
+
+	/* Smooth gradients with some high frequency detail on top */
+	x <<= level;
+	y <<= level;
+	r = (x >> 3) & 0xff;
+	g = (y >> 3) & 0xff;
+	b = ((x ^ y) & 0x10 ? 0xc0 : 0x40) + level * 8;
+	return 0xff000000 | b << 16 | g << 8 | r;
+}
+
+static struct pipe_resource *create_texture(struct program *p)
+{
+	struct pipe_resource tmplt;
+	struct pipe_resource *tex;
+	unsigned level;
+
+	memset(&tmplt, 0, sizeof(tmplt));
+	tmplt.target = PIPE_TEXTURE_2D;
+	tmplt.format = PIPE_FORMAT_R8G8B8A8_UNORM;
+	tmplt.width0 = TEX_SIZE;
+	tmplt.height0 = TEX_SIZE;
+	tmplt.depth0 = 1;
+	tmplt.array_size = 1;
+	tmplt.last_level = TEX_LEVELS - 1;
+	tmplt.bind = PIPE_BIND_SAMPLER_VIEW;
+
+	tex = p->screen->resource_create(p->screen, &tmplt);
+
+	for (level = 0; level < TEX_LEVELS; level++) {
+		unsigned size = u_minify(TEX_SIZE, level);
+		struct pipe_transfer *t;
+		struct pipe_box box;
+		uint8_t *map;
+		unsigned x, y;
+
+		u_box_origin_2d(size, size, &box);
+		map = p->pipe->transfer_map(p->pipe, tex, level,
+					    PIPE_MAP_WRITE |
+					    PIPE_MAP_DISCARD_RANGE,
+					    &box, &t);
+		for (y = 0; y < size; y++) {
+			uint32_t *row = (uint32_t *)(map + y * t->stride);
+
+			for (x = 0; x < size; x++)
+				row[x] = texel(level, x, y);
+		}
+		p->pipe->transfer_unmap(p->pipe, t);
+	}
+
+	return tex;
+}
+
+static struct program *init_prog(bool tiled)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	struct pipe_surface surf_tmpl;
+	struct pipe_sampler_view v_tmplt;
+
+	/* Read by the driver at screen creation */
+	setenv("LP_TILED_TEXTURES", tiled ? "true" : "false", 1);
+
+	if (!pipe_loader_sw_probe_null(&p->dev)) {
+		fprintf(stderr, "no software device\n");
+		exit(1);
+	}
+	p->screen = pipe_loader_create_screen(p->dev);
+	if (!p->screen) {
+		fprintf(stderr, "failed to create the screen\n");
+		exit(1);
+	}
+
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	p->clear_color.f[0] = 0.0;
+	p->clear_color.f[1] = 0.0;
+	p->clear_color.f[2] = 0.0;
+	p->clear_color.f[3] = 1.0;
+
+	/* vertex buffer */
+	{
+		unsigned size = NUM_QUADS * 6 * sizeof(float[2][4]);
+		float (*vertices)[2][4] = MALLOC(size);
+		unsigned i;
+
+		for (i = 0; i < NUM_QUADS; i++)
+			emit_quad(vertices + i * 6, quads[i][0], quads[i][1]);
+		p->vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+					     PIPE_USAGE_DEFAULT, size);
+		pipe_buffer_write(p->pipe, p->vbuf, 0, size, vertices);
+		FREE(vertices);
+	}
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_R8G8B8A8_UNORM;
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* sampler texture */
+	p->tex = create_texture(p);
+	u_sampler_view_default_template(&v_tmplt, p->tex, p->tex->format);
+	p->view = p->pipe->create_sampler_view(p->pipe, p->tex, &v_tmplt);
+
+	memset(&p->sampler, 0, sizeof(p->sampler));
+	p->sampler.wrap_s = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.wrap_t = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.wrap_r = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.min_mip_filter = PIPE_TEX_MIPFILTER_LINEAR;
+	p->sampler.min_img_filter = PIPE_TEX_FILTER_LINEAR;
+	p->sampler.mag_img_filter = PIPE_TEX_FILTER_LINEAR;
+	p->sampler.max_lod = TEX_LEVELS - 1;
+	p->sampler.normalized_coords = 1;
+
+	/* every quad overwrites the whole frame */
+	memset(&p->blend, 0, sizeof(p->blend));
+	p->blend.rt[0].colormask = PIPE_MASK_RGBA;
+
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_R8G8B8A8_UNORM;
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+	p->viewport.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+	p->viewport.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+	p->viewport.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+	p->viewport.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+
+	memset(&p->velem, 0, sizeof(p->velem));
+	p->velem.count = 2;
+	p->velem.velems[0].src_offset = 0;
+	p->velem.velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+	p->velem.velems[1].src_offset = 4 * sizeof(float);
+	p->velem.velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	{
+		const enum tgsi_semantic semantic_names[] =
+			{ TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	p->fs = util_make_fragment_tex_shader(p->pipe, TGSI_TEXTURE_2D,
+					      TGSI_INTERPOLATE_PERSPECTIVE,
+					      TGSI_RETURN_TYPE_FLOAT,
+					      TGSI_RETURN_TYPE_FLOAT, false,
+					      false);
+
+	return p;
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	pipe_sampler_view_reference(&p->view, NULL);
+	pipe_resource_reference(&p->tex, NULL);
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->vbuf, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+
+	FREE(p);
+}
+
+static void draw_frame(struct program *p, unsigned quad)
+{
+	const struct pipe_sampler_state *samplers[] = {&p->sampler};
+	struct pipe_fence_handle *fence = NULL;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, NULL, &p->clear_color, 0, 0);
+
+	cso_set_blend(p->cso, &p->blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_samplers(p->cso, PIPE_SHADER_FRAGMENT, 1, samplers);
+	p->pipe->set_sampler_views(p->pipe, PIPE_SHADER_FRAGMENT, 0, 1, 0, &p->view);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, &p->velem);
+
+	util_draw_vertex_buffer(p->pipe, p->cso,
+	                        p->vbuf, 0,
+	                        quad * 6 * sizeof(float[2][4]),
+	                        PIPE_PRIM_TRIANGLES,
+	                        6,
+	                        2);
+
+	p->pipe->flush(p->pipe, &fence, 0);
+	p->screen->fence_finish(p->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+	p->screen->fence_reference(p->screen, &fence, NULL);
+}
+
+/* Copy out the frame, or compare it with a previous copy */
+static unsigned read_frame(struct program *p, uint32_t *pixels, bool compare)
+{
+	struct pipe_transfer *t;
+	struct pipe_box box;
+	unsigned max_diff = 0;
+	uint8_t *map;
+	unsigned x, y, c;
+
+	u_box_origin_2d(WIDTH, HEIGHT, &box);
+	map = p->pipe->transfer_map(p->pipe, p->target, 0, PIPE_MAP_READ, &box, &t);
+	for (y = 0; y < HEIGHT; y++) {
+		const uint32_t *row = (const uint32_t *)(map + y * t->stride);
+		uint32_t *dst = pixels + y * WIDTH;
+
+		if (!compare) {
+			memcpy(dst, row, WIDTH * 4);
+			continue;
+		}
+
+		for (x = 0; x < WIDTH; x++) {
+			for (c = 0; c < 32; c += 8) {
+				int a = (row[x] >> c) & 0xff;
+				int b = (dst[x] >> c) & 0xff;
+				max_diff = MAX2(max_diff, (unsigned)abs(a - b));
+			}
+		}
+	}
+	p->pipe->transfer_unmap(p->pipe, t);
+
+	return max_diff;
+}
+
+int main(int argc, char** argv)
+{
+	static const char *names[] = { "linear", "tiled" };
+	unsigned frames = 20;
+	uint32_t *pixels[NUM_QUADS];
+	double base[NUM_QUADS];
+	unsigned n, q, i;
+
+	if (argc > 1)
+		frames = MAX2(1, atoi(argv[1]));
+
+	for (q = 0; q < NUM_QUADS; q++)
+		pixels[q] = MALLOC(WIDTH * HEIGHT * 4);
+
+	printf("layout  angle  scale   ms/frame   speedup  max diff\n");
+	for (n = 0; n < 2; n++) {
+		struct program *p = init_prog(n == 1);
+
+		for (q = 0; q < NUM_QUADS; q++) {
+			unsigned max_diff;
+			int64_t start;
+			double ms;
+
+			/* Warm up, compiles the shader variants */
+			draw_frame(p, q);
+
+			start = os_time_get_nano();
+			for (i = 0; i < frames; i++)
+				draw_frame(p, q);
+			ms = (os_time_get_nano() - start) / 1e6 / frames;
+
+			max_diff = read_frame(p, pixels[q], n != 0);
+
+			if (n == 0)
+				base[q] = ms;
+			printf("%-6s %6.0f %6.1f %10.3f %9.2f %9u\n", names[n],
+			       quads[q][0], quads[q][1], ms, base[q] / ms, max_diff);
+		}
+
+		close_prog(p);
+	}
+
+	for (q = 0; q < NUM_QUADS; q++)
+		FREE(pixels[q]);
+
+	return 0;
+}
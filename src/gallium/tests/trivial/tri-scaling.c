@@ -0,0 +1,309 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Rasterizer thread scaling benchmark for the software drivers.
+ *
+ * Renders the same frame with LP_NUM_THREADS going from 1 to the number
+ * of cpus (or the number given on the command line) and prints the frame
+ * time and speedup for each thread count.  Half of the triangles are
+ * packed in one corner of the framebuffer, so the bins are unevenly
+ * loaded.
+ *
+ * usage: tri-scaling [max_threads] [frames]
+ */
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define NUM_TRIS 20000
+#define TRI_SIZE 0.08f
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipe/p_state.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_inlines.h"
+#include "cso_cache/cso_context.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_draw_quad.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+#include "util/os_time.h"
+#include "pipe-loader/pipe_loader.h"
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend;
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct cso_velems_state velem;
+
+	void *vs;
+	void *fs;
+
+	union pipe_color_union clear_color;
+
+	struct pipe_resource *vbuf;
+	struct pipe_resource *target;
+};
+
+static float rand_float(unsigned *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (float)((*seed >> 8) & 0xffff) / 65535.0f;
+}
+
+static void fill_vertices(float (*vertices)[2][4])
+{
+	unsigned seed = 1;
+	unsigned i, j;
+
+	for (i = 0; i < NUM_TRIS; i++) {
+		/* Half of them in the top left corner */
+		float range = i & 1 ? 0.4f : 2.0f - TRI_SIZE;
+		float x = -1.0f + rand_float(&seed) * range;
+		float y = -1.0f + rand_float(&seed) * range;
+
+		for (j = 0; j < 3; j++) {
+			float *pos = vertices[i * 3 + j][0];
+			float *color = vertices[i * 3 + j][1];
+
+			pos[0] = x + (j == 1 ? TRI_SIZE : 0.0f);
+			pos[1] = y + (j == 2 ? TRI_SIZE : 0.0f);
+			pos[2] = rand_float(&seed);
+			pos[3] = 1.0f;
+			color[0] = rand_float(&seed);
+			color[1] = rand_float(&seed);
+			color[2] = rand_float(&seed);
+			color[3] = 0.5f;
+		}
+	}
+}
+
+static struct program *init_prog(unsigned num_threads)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	struct pipe_surface surf_tmpl;
+	char value[16];
+
+	/* Read by the driver at screen creation */
+	snprintf(value, sizeof(value), "%u", num_threads);
+	setenv("LP_NUM_THREADS", value, 1);
+
+	if (!pipe_loader_sw_probe_null(&p->dev)) {
+		fprintf(stderr, "no software device\n");
+		exit(1);
+	}
+	p->screen = pipe_loader_create_screen(p->dev);
+	if (!p->screen) {
+		fprintf(stderr, "failed to create the screen\n");
+		exit(1);
+	}
+
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	p->clear_color.f[0] = 0.3;
+	p->clear_color.f[1] = 0.1;
+	p->clear_color.f[2] = 0.3;
+	p->clear_color.f[3] = 1.0;
+
+	/* vertex buffer */
+	{
+		unsigned size = NUM_TRIS * 3 * sizeof(float[2][4]);
+		float (*vertices)[2][4] = MALLOC(size);
+
+		fill_vertices(vertices);
+		p->vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+					     PIPE_USAGE_DEFAULT, size);
+		pipe_buffer_write(p->pipe, p->vbuf, 0, size, vertices);
+		FREE(vertices);
+	}
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* alpha blending, so every triangle costs a read and a write */
+	memset(&p->blend, 0, sizeof(p->blend));
+	p->blend.rt[0].blend_enable = 1;
+	p->blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_SRC_ALPHA;
+	p->blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+	p->blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+	p->blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_ZERO;
+	p->blend.rt[0].colormask = PIPE_MASK_RGBA;
+
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+	p->viewport.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+	p->viewport.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+	p->viewport.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+	p->viewport.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+
+	memset(&p->velem, 0, sizeof(p->velem));
+	p->velem.count = 2;
+	p->velem.velems[0].src_offset = 0;
+	p->velem.velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+	p->velem.velems[1].src_offset = 4 * sizeof(float);
+	p->velem.velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	{
+		const enum tgsi_semantic semantic_names[] =
+			{ TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	p->fs = util_make_fragment_passthrough_shader(p->pipe,
+		    TGSI_SEMANTIC_COLOR, TGSI_INTERPOLATE_PERSPECTIVE, TRUE);
+
+	return p;
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->vbuf, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+
+	FREE(p);
+}
+
+static void draw_frame(struct program *p)
+{
+	struct pipe_fence_handle *fence = NULL;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, NULL, &p->clear_color, 0, 0);
+
+	cso_set_blend(p->cso, &p->blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, &p->velem);
+
+	util_draw_vertex_buffer(p->pipe, p->cso,
+	                        p->vbuf, 0, 0,
+	                        PIPE_PRIM_TRIANGLES,
+	                        NUM_TRIS * 3,
+	                        2);
+
+	p->pipe->flush(p->pipe, &fence, 0);
+	p->screen->fence_finish(p->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+	p->screen->fence_reference(p->screen, &fence, NULL);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned max_threads = util_get_cpu_caps()->nr_cpus;
+	unsigned frames = 20;
+	double base = 0.0;
+	unsigned n, i;
+
+	if (argc > 1)
+		max_threads = MAX2(1, atoi(argv[1]));
+	if (argc > 2)
+		frames = MAX2(1, atoi(argv[2]));
+
+	printf("threads   ms/frame   speedup\n");
+	for (n = 1; n <= max_threads; n++) {
+		struct program *p = init_prog(n);
+		int64_t start;
+		double ms;
+
+		/* Warm up, compiles the shader variants */
+		draw_frame(p);
+
+		start = os_time_get_nano();
+		for (i = 0; i < frames; i++)
+			draw_frame(p);
+		ms = (os_time_get_nano() - start) / 1e6 / frames;
+
+		if (n == 1)
+			base = ms;
+		printf("%7u %10.3f %9.2f\n", n, ms, base / ms);
+
+		close_prog(p);
+	}
+
+	return 0;
+}
@@ -397,6 +397,14 @@
    DRI_CONF_OPT_I(csmt_force, def, 0, 0, \
                   "If set to 1, force gallium nine CSMT. If set to 0, disable it. By default (-1) CSMT is enabled on known thread-safe drivers.")
 
+#define DRI_CONF_NINE_CSMT_QUEUE_DEPTH(def) \
+   DRI_CONF_OPT_I(csmt_queue_depth, def, 2, 256, \
+                  "Number of command buffers queued for the gallium nine CSMT thread before the application thread has to wait. Rounded up to a power of two.")
+
+#define DRI_CONF_NINE_CSMT_SHADOW_MEMORY(def) \
+   DRI_CONF_OPT_I(csmt_shadow_memory, def, 0, 4096, \
+                  "In MB the budget for the ram copies of resources gallium nine keeps to avoid waiting for the CSMT thread when they are locked. 0 disables them.")
+
 #define DRI_CONF_NINE_DYNAMICTEXTUREWORKAROUND(def) \
    DRI_CONF_OPT_B(dynamic_texture_workaround, def, \
                   "If set to true, use a ram intermediate buffer for dynamic textures. Increases ram usage, which can cause out of memory issues, but can fix glitches for some games.")
@@ -405,6 +413,18 @@
    DRI_CONF_OPT_B(shader_inline_constants, def, \
                   "If set to true, recompile shaders with integer or boolean constants when the values are known. Can cause stutter, but can increase slightly performance.")
 
+#define DRI_CONF_NINE_SHADERPRECOMPILE(def) \
+   DRI_CONF_OPT_B(shader_precompile, def, \
+                  "If set to true, gallium nine compiles in a background thread the shader variant matching the current state when a shader is created, to reduce the stutter at the first draw with a shader. Requires a driver with shareable shaders.")
+
+#define DRI_CONF_NINE_FFSHADERCACHESIZE(def) \
+   DRI_CONF_OPT_I(ff_shader_cache_size, def, 16, 65536, \
+                  "Maximum number of fixed function vertex shaders, and of pixel shaders, gallium nine keeps. The least recently used are destroyed above it.")
+
+#define DRI_CONF_NINE_TEXTUREUPLOADTHREAD(def) \
+   DRI_CONF_OPT_B(texture_upload_thread, def, \
+                  "If set to true, gallium nine copies the managed textures to staging textures in a dedicated thread, and the gpu copies them to the textures. Only used with csmt.")
+
 #define DRI_CONF_NINE_SHMEM_LIMIT() \
    DRI_CONF_OPT_I(texture_memory_limit, 128, 0, 0, \
                   "In MB the limit of virtual memory used for textures until shmem files are unmapped (default 128MB, 32bits only). If negative disables shmem. Set to a low amount to reduce virtual memory usage, but can incur a small perf hit if too low.")
@@ -413,6 +433,10 @@
    DRI_CONF_OPT_B(force_sw_rendering_on_cpu, def, \
                   "If set to false, emulates software rendering on the requested device, else uses a software renderer.")
 
+#define DRI_CONF_NINE_SWVPONCPU(def) \
+   DRI_CONF_OPT_B(swvp_on_cpu, def, \
+                  "If set to true with force_sw_rendering_on_cpu, the vertex shaders of the software vertex processing run on the software renderer, and the device only rasterizes the processed vertices.")
+
 /**
  * \brief radeonsi specific configuration options
  */